@@ -0,0 +1,146 @@
+#include "../include/inference.h"
+#include "../include/fer_loader.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Classifies 48x48 grayscale face crops with a model saved by train_fer.
+//
+//   fer_infer [--bench N] [--int8 data/fer2013.bin [--save PATH]] models/fer_model.bin face1.pgm [...]
+//
+// Images are binary PGM (P5) files; other sizes are resized bilinearly to
+// 48x48. All faces go through the network as one batch. --bench N repeats the
+// batch N times and reports the mean latency per face. --int8 quantizes the
+// model to 8 bits, calibrated on the first training faces of a converted
+// FER-2013 file, and --save writes the quantized model, which loads like any
+// other model file.
+
+const char* EMOTIONS[] = {"Angry", "Disgust", "Fear", "Happy", "Sad", "Surprise", "Neutral"};
+const size_t FACE_SIZE = 48;
+const int CALIBRATION_FACES = 512;
+
+// Reads a binary PGM into floats in [0, 1]
+std::vector<float> read_pgm(const std::string& path, size_t& width, size_t& height) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) throw std::runtime_error("Could not open " + path);
+
+    // header: magic, width, height, maxval, each possibly preceded by comments
+    auto next_token = [&]() {
+        std::string token;
+        while (file >> token) {
+            if (token[0] != '#') return token;
+            std::string rest;
+            std::getline(file, rest);
+        }
+        throw std::runtime_error(path + ": truncated PGM header");
+    };
+    if (next_token() != "P5") throw std::runtime_error(path + ": only binary PGM (P5) is supported");
+    width = std::stoul(next_token());
+    height = std::stoul(next_token());
+    size_t max_val = std::stoul(next_token());
+    if (max_val == 0 || max_val > 255) throw std::runtime_error(path + ": only 8-bit PGM is supported");
+    file.get(); // single whitespace before the pixel data
+
+    std::vector<unsigned char> pixels(width * height);
+    if (!file.read((char*)pixels.data(), pixels.size())) throw std::runtime_error(path + ": truncated pixel data");
+
+    std::vector<float> image(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) image[i] = pixels[i] / (float)max_val;
+    return image;
+}
+
+// Bilinear resize of a single channel image to size x size
+void resize_to(const std::vector<float>& src, size_t width, size_t height, size_t size, float* dst) {
+    for (size_t y = 0; y < size; y++) {
+        float sy = std::max(0.0f, (y + 0.5f) * height / size - 0.5f);
+        size_t y0 = std::min((size_t)sy, height - 1);
+        size_t y1 = std::min(y0 + 1, height - 1);
+        float fy = sy - y0;
+        for (size_t x = 0; x < size; x++) {
+            float sx = std::max(0.0f, (x + 0.5f) * width / size - 0.5f);
+            size_t x0 = std::min((size_t)sx, width - 1);
+            size_t x1 = std::min(x0 + 1, width - 1);
+            float fx = sx - x0;
+            float top = src[y0 * width + x0] * (1 - fx) + src[y0 * width + x1] * fx;
+            float bottom = src[y1 * width + x0] * (1 - fx) + src[y1 * width + x1] * fx;
+            dst[y * size + x] = top * (1 - fy) + bottom * fy;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int bench = 0;
+    std::string calibration_path, save_path;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench" && i + 1 < argc) bench = std::atoi(argv[++i]);
+        else if (arg == "--int8" && i + 1 < argc) calibration_path = argv[++i];
+        else if (arg == "--save" && i + 1 < argc) save_path = argv[++i];
+        else args.push_back(arg);
+    }
+    if (args.size() < 2) {
+        std::cerr << "Usage: " << argv[0] << " [--bench N] [--int8 fer2013.bin [--save PATH]] model.bin face.pgm [face.pgm ...]"
+                  << std::endl;
+        return 1;
+    }
+
+    try {
+        size_t n = args.size() - 1;
+        std::vector<float> batch(n * FACE_SIZE * FACE_SIZE);
+        for (size_t i = 0; i < n; i++) {
+            size_t width, height;
+            std::vector<float> image = read_pgm(args[i + 1], width, height);
+            resize_to(image, width, height, FACE_SIZE, batch.data() + i * FACE_SIZE * FACE_SIZE);
+        }
+
+        InferenceModel model = InferenceModel::fer();
+        model.load(args[0]);
+        model.plan(1, FACE_SIZE, FACE_SIZE, n);
+
+        if (!calibration_path.empty()) {
+            FERDataset faces(calibration_path, FERUsage::Training);
+            if (faces.get_length() == 0)
+                throw std::runtime_error(calibration_path + " has no training faces to calibrate on");
+            std::vector<int> indices(std::min(CALIBRATION_FACES, faces.get_length()));
+            for (size_t i = 0; i < indices.size(); i++) indices[i] = (int)i;
+            std::vector<size_t> labels;
+            std::shared_ptr<Tensor> calibration = faces.get_batch(indices, labels);
+            model.quantize(calibration->data().data(), indices.size());
+            if (!save_path.empty()) model.save_quantized(save_path);
+        }
+        if (model.quantized()) std::cout << "INT8 model" << std::endl;
+
+        std::vector<float> logits(n * model.output_size());
+        model.run(batch.data(), n, logits.data());
+
+        for (size_t i = 0; i < n; i++) {
+            const float* row = logits.data() + i * model.output_size();
+            float max_logit = *std::max_element(row, row + model.output_size());
+            float sum = 0.0f;
+            for (size_t c = 0; c < model.output_size(); c++) sum += std::exp(row[c] - max_logit);
+            size_t pred = std::max_element(row, row + model.output_size()) - row;
+            std::cout << args[i + 1] << ": " << EMOTIONS[pred] << " (" << std::fixed << std::setprecision(2)
+                      << 1.0f / sum << ")" << std::endl;
+        }
+
+        if (bench > 0) {
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < bench; r++) model.run(batch.data(), n, logits.data());
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Mean latency: " << std::setprecision(1) << us / bench << " us per batch of " << n << ", "
+                      << us / bench / n << " us per face" << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,161 +1,160 @@
 #include "../include/tensor.h"
 #include "../include/conv2d.h"
-#include "../include/relu.h"
-#include "../include/pooling.h"
 #include "../include/flatten.h"
 #include "../include/linear.h"
 #include "../include/loss.h"
 #include "../include/sgd.h"
 #include "../include/fer_loader.h"
 #include "../include/dropout.h" 
+#include "../include/data_parallel.h"
+#include "../include/grad_mode.h"
+#include "../include/checkpoint.h"
+#include "../include/dataloader.h"
 #include <iostream>
 #include <algorithm>
 #include <vector>
 #include <fstream>
 
-void save_model(const std::string& filename, const std::vector<std::pair<std::string, std::shared_ptr<Tensor>>>& params) {
-    
-    std::ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error opening file for saving" << std::endl;
-        return;
+// Counts rows of a [N, Classes] logits tensor whose argmax matches the target
+int count_correct(const std::shared_ptr<Tensor>& logits, const std::vector<size_t>& targets) {
+    const auto& data = logits->data();
+    size_t n_classes = logits->shape()[1];
+    int correct = 0;
+    for (size_t n = 0; n < targets.size(); n++) {
+        auto row = data.begin() + n * n_classes;
+        size_t pred = std::distance(row, std::max_element(row, row + n_classes));
+        if (pred == targets[n]) correct++;
     }
+    return correct;
+}
 
-    size_t num_tensors = params.size();
-    file.write((char*)&num_tensors, sizeof(size_t));
-
-    for (const auto& pair : params) {
-        const auto& tensor = pair.second; 
-        const auto& data = tensor->data();
-        
-        size_t data_size = data.size();
-        file.write((char*)&data_size, sizeof(size_t));
+// conv -> relu -> pool -> dropout, twice, then a linear classifier over 7 emotions.
+// Each conv -> relu -> pool block runs as one fused op.
+class FERNet : public Module {
+public:
+    FERNet()
+        : conv1(std::make_shared<Conv2D>(1, 12, 3, 1, 1)),
+          drop1(std::make_shared<Dropout>(0.25f)),
+          conv2(std::make_shared<Conv2D>(12, 24, 3, 1, 1)),
+          drop2(std::make_shared<Dropout>(0.25f)),
+          flatten(std::make_shared<Flatten>()), fc(std::make_shared<Linear>(24 * 12 * 12, 7)) {
+        register_module("conv1", conv1);
+        register_module("drop1", drop1);
+        register_module("conv2", conv2);
+        register_module("drop2", drop2);
+        register_module("flatten", flatten);
+        register_module("fc", fc);
+    }
 
-        file.write((char*)data.data(), data_size * sizeof(float));
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        x = drop1->forward(conv1->forward_relu_pool(x, 2, 2));
+        x = drop2->forward(conv2->forward_relu_pool(x, 2, 2));
+        return fc->forward(flatten->forward(x));
     }
 
-    std::cout << "Model saved to " << filename << " (" << num_tensors << " tensors)" << std::endl;
-    file.close();
-}
+private:
+    std::shared_ptr<Conv2D> conv1;
+    std::shared_ptr<Dropout> drop1;
+    std::shared_ptr<Conv2D> conv2;
+    std::shared_ptr<Dropout> drop2;
+    std::shared_ptr<Flatten> flatten;
+    std::shared_ptr<Linear> fc;
+};
 
 int main() {
     std::cout << "Loading Data" << std::endl;
-    std::vector<std::shared_ptr<Tensor>> all_x;
-    std::vector<int> all_y;
-    
-    int total_load = 10000; 
+    const std::string csv_path = "data/fer2013.csv";
+    const std::string bin_path = "data/fer2013.bin";
+    std::unique_ptr<FERDataset> dataset;
     try {
-        FERLoader::load("data/fer2013.csv", all_x, all_y, total_load); 
+        // the CSV is parsed once; later runs map the packed file directly
+        if (!std::ifstream(bin_path).good()) {
+            std::cout << "   Converting " << csv_path << " to " << bin_path << std::endl;
+            FERLoader::convert(csv_path, bin_path);
+        }
+        dataset = std::make_unique<FERDataset>(bin_path);
     } catch (const std::exception& e) {
         std::cerr << "Error loading data: " << e.what() << std::endl;
         return 1;
     }
 
-    size_t split_idx = (size_t)(total_load * 0.8);
-    std::vector<std::shared_ptr<Tensor>> train_x(all_x.begin(), all_x.begin() + split_idx);
-    std::vector<int> train_y(all_y.begin(), all_y.begin() + split_idx);
-    std::vector<std::shared_ptr<Tensor>> val_x(all_x.begin() + split_idx, all_x.end());
-    std::vector<int> val_y(all_y.begin() + split_idx, all_y.end());
+    int total_load = std::min(10000, dataset->get_length());
+    int split_idx = (int)(total_load * 0.8);
+    Subset train_set(dataset.get(), 0, split_idx);
+    Subset val_set(dataset.get(), split_idx, total_load);
 
-    std::cout << "   Training on " << train_x.size() << " samples." << std::endl;
-    std::cout << "   Validating on " << val_x.size() << " samples." << std::endl;
+    std::cout << "   Training on " << train_set.get_length() << " samples." << std::endl;
+    std::cout << "   Validating on " << val_set.get_length() << " samples." << std::endl;
 
     std::cout << "Building Model" << std::endl;
     
-    Conv2D conv1(1, 12, 3, 1, 1);
-    Relu relu1;
-    Pooling pool1(2, 2);
-    Dropout drop1(0.25f);
-
-    Conv2D conv2(12, 24, 3, 1, 1);
-    Relu relu2;
-    Pooling pool2(2, 2);
-    Dropout drop2(0.25f); 
-
-    Flatten flatten;
-    Linear fc(24 * 12 * 12, 7); 
-
-    auto p1 = conv1.parameters();
-    auto p2 = conv2.parameters();
-    auto p3 = fc.parameters();
-    
-    p1.insert(p1.end(), p2.begin(), p2.end());
-    p1.insert(p1.end(), p3.begin(), p3.end());
-
-    SGD optimizer(p1, 0.001f); 
+    // one replica per pool thread; each takes a shard of every mini-batch
+    DataParallel model([] { return std::make_shared<FERNet>(); });
+    // every step has the same shape, so each replica records it once and replays it
+    model.set_capture(true);
+    std::cout << "   " << model.replicas() << " data-parallel replicas." << std::endl;
+    auto params = model.module()->parameters();
+
+    // the loss is averaged over each mini-batch, so the step size is scaled up with the batch
+    const int batch_size = 32;
+    SGD optimizer(params, 0.01f, 0.9f);
+    CrossEntropyLoss criterion;
+
+    // activations and gradients of a step live in this arena; it rewinds once the
+    // step's graph is released, so steady-state steps make no tensor allocations
+    ArenaAllocator step_arena;
+
+    // batches are assembled on a background thread while the previous one trains
+    DataLoader train_loader(&train_set, batch_size, true, 1, 2, 42);
+    DataLoader val_loader(&val_set, batch_size, false);
 
     int epochs = 50; 
     std::cout << "3. Starting Training (" << epochs << " epochs)..." << std::endl;
 
     for (int epoch = 0; epoch < epochs; epoch++) {
       
-        drop1.train(); 
-        drop2.train();
+        model.train();
 
         float total_loss = 0.0f;
         int train_correct = 0;
 
-        for (size_t i = 0; i < train_x.size(); i++) {
-            
-            auto out = conv1.forward(train_x[i]);
-            out = relu1.forward(out);
-            out = pool1.forward(out);
-            out = drop1.forward(out);
-
-            out = conv2.forward(out);
-            out = relu2.forward(out);
-            out = pool2.forward(out);
-            out = drop2.forward(out); 
-
-            out = flatten.forward(out);
-            out = fc.forward(out);
-
-            CrossEntropyLoss criterion;
-            auto loss = criterion(out, train_y[i]);
-            total_loss += loss->item();
-
-            optimizer.zero_grad();
-            loss->backward(); 
-            optimizer.step();
-
-            const auto& logits = out->data();
-            int pred = std::distance(logits.begin(), std::max_element(logits.begin(), logits.end()));
-            if (pred == train_y[i]) train_correct++;
+        for (Batch& batch : train_loader) {
+            {
+                AllocatorGuard guard(step_arena);
+                optimizer.zero_grad();
+                auto step = model.forward_backward(batch.data, batch.labels, criterion);
+                optimizer.step();
+                total_loss += step.loss * batch.size();
+
+                train_correct += count_correct(step.output, batch.labels);
+            }
+            step_arena.reset();
         }
 
-        drop1.eval(); 
-        drop2.eval();
+        model.eval();
+        // validation records no graph: activations are freed layer by layer
+        NoGradGuard no_grad;
         
         int val_correct = 0;
-        for (size_t i = 0; i < val_x.size(); i++) {
-            auto out = conv1.forward(val_x[i]);
-            out = relu1.forward(out);
-            out = pool1.forward(out);
-            out = drop1.forward(out);
-
-            out = conv2.forward(out);
-            out = relu2.forward(out);
-            out = pool2.forward(out);
-            out = drop2.forward(out); 
-
-            out = flatten.forward(out);
-            out = fc.forward(out);
-
-            const auto& logits = out->data();
-            int pred = std::distance(logits.begin(), std::max_element(logits.begin(), logits.end()));
-            if (pred == val_y[i]) val_correct++;
+        for (Batch& batch : val_loader) {
+            {
+                AllocatorGuard guard(step_arena);
+                auto out = model.forward(batch.data);
+                val_correct += count_correct(out, batch.labels);
+            }
+            step_arena.reset();
         }
 
-        float train_acc = (float)train_correct / train_x.size() * 100.0f;
-        float val_acc = (float)val_correct / val_x.size() * 100.0f;
+        float train_acc = (float)train_correct / train_set.get_length() * 100.0f;
+        float val_acc = (float)val_correct / val_set.get_length() * 100.0f;
         
         std::cout << "Epoch " << epoch 
-                  << " Loss: " << (total_loss/train_x.size()) 
+                  << " Loss: " << (total_loss/train_set.get_length()) 
                   << " Train Acc: " << train_acc << "%" 
                   << " Val Acc: " << val_acc << "%" << std::endl;
     }
     std::cout << "Saving trained model" << std::endl;
     
-    save_model("fer_model.bin", p1);
+    save_checkpoint("fer_model.bin", *model.module());
     return 0;
 }
\ No newline at end of file
@@ -43,25 +43,40 @@ def load_and_run():
     
     tensors = []
     with open("fer_model.bin", "rb") as f:
-        
-        count_bytes = f.read(8)
-        if not count_bytes:
+        blob = f.read()
+
+    if blob[:8] == b"DLCKPT\0\0":
+        # checkpoint: header, then an index of name/dtype/shape/offset/bytes
+        version, count, _ = struct.unpack_from("<IIQ", blob, 8)
+        print(f"Found {count} tensors in checkpoint (version {version}).")
+        pos = 24
+        for i in range(count):
+            (name_len,) = struct.unpack_from("<I", blob, pos)
+            pos += 4
+            name = blob[pos:pos + name_len].decode()
+            pos += name_len
+            _, ndim = struct.unpack_from("<II", blob, pos)
+            pos += 8
+            shape = struct.unpack_from(f"<{ndim}Q", blob, pos)
+            pos += 8 * ndim
+            offset, nbytes = struct.unpack_from("<QQ", blob, pos)
+            pos += 16
+            arr = np.frombuffer(blob, dtype="<f4", count=nbytes // 4, offset=offset)
+            tensors.append(arr)
+            print(f"  Loaded tensor {name}: shape={list(shape)}")
+    else:
+        # older flat format: count, then size and floats of each tensor
+        if not blob:
             print("Error: Empty file.")
             return
-            
-        count = struct.unpack("Q", count_bytes)[0]
+        (count,) = struct.unpack_from("Q", blob, 0)
         print(f"Found {count} tensors in file.")
-        
+        pos = 8
         for i in range(count):
-            # 2. Read data size (size_t = 8 bytes)
-            size_bytes = f.read(8)
-            data_size = struct.unpack("Q", size_bytes)[0]
-            
-            # 3. Read float data
-            float_bytes = f.read(data_size * 4) # 4 bytes per float
-            data = struct.unpack(f"{data_size}f", float_bytes)
-            
-            arr = np.array(data, dtype=np.float32)
+            (data_size,) = struct.unpack_from("Q", blob, pos)
+            pos += 8
+            arr = np.frombuffer(blob, dtype=np.float32, count=data_size, offset=pos)
+            pos += data_size * 4
             tensors.append(arr)
             print(f"  Loaded tensor {i}: size={data_size}")
 
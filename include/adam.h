@@ -0,0 +1,43 @@
+#pragma once
+#include "optimizer.h"
+#include "storage.h"
+
+// Adam (Kingma & Ba). Running averages of the gradient and its square, in
+// flat buffers over all parameters, scale each element's step:
+//     m = beta1 * m + (1 - beta1) * g
+//     v = beta2 * v + (1 - beta2) * g^2
+//     p -= lr * (m / (1 - beta1^t)) / (sqrt(v / (1 - beta2^t)) + eps)
+// weight_decay is added to the gradient as an L2 penalty, g = grad + wd * p.
+class Adam : public Optimizer
+{
+public:
+    Adam(Params params, float lr = 0.001f, float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+         float weight_decay = 0.0f);
+
+protected:
+    void begin_step() override;
+    void update(float *values, const float *grad, std::size_t offset, std::size_t n) override;
+
+    float _beta1;
+    float _beta2;
+    float _eps;
+    float _weight_decay;
+    bool _decoupled = false; // AdamW: decay the weights, not the gradient
+
+private:
+    Storage _m;
+    Storage _v;
+    long _t = 0;
+    // per step: lr / (1 - beta1^t) and 1 / sqrt(1 - beta2^t)
+    float _step_size = 0.0f;
+    float _inv_bias2 = 0.0f;
+};
+
+// AdamW (Loshchilov & Hutter). Weight decay is decoupled from the adaptive
+// step: p -= lr * weight_decay * p, instead of being added to the gradient.
+class AdamW : public Adam
+{
+public:
+    AdamW(Params params, float lr = 0.001f, float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+          float weight_decay = 0.01f);
+};
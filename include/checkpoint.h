@@ -0,0 +1,49 @@
+#pragma once
+#include "module.h"
+#include "tensor.h"
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Checkpoint file layout, version 1. Integers are little-endian.
+//
+//   char    magic[8]       "DLCKPT\0\0"
+//   uint32  version
+//   uint32  tensor count
+//   uint64  data offset    where the first tensor starts
+//   index, one entry per tensor:
+//     uint32  name length, then the name bytes without a terminator
+//     uint32  dtype        0 = float32, 1 = bfloat16, 2 = float16
+//     uint32  rank, then uint64 dims[rank]
+//     uint64  offset       from the start of the file, a multiple of 64
+//     uint64  byte size
+//   tensor data at the recorded offsets, zero padded in between
+//
+// Entries keep the order they were saved in (Module::parameters() order for a
+// module), so readers that do not use names can go by position.
+
+constexpr std::size_t CHECKPOINT_ALIGNMENT = 64;
+
+using NamedTensors = std::vector<std::pair<std::string, std::shared_ptr<Tensor>>>;
+
+// Writes through a temporary file that is renamed over `path` once complete
+void save_checkpoint(const std::string &path, const NamedTensors &tensors);
+void save_checkpoint(const std::string &path, const Module &module);
+
+// Reads every tensor in file order. With use_mmap the file is mapped
+// copy-on-write and the tensors alias it: loading copies nothing and only
+// touches the pages that are used, and processes loading the same file share
+// one copy of it in the page cache. Writes to the tensors stay private.
+NamedTensors load_checkpoint(const std::string &path, bool use_mmap = true);
+
+// Loads a checkpoint into a module's parameters by name, with the checks of
+// Module::load_state_dict. A flattened module (Module::flatten_parameters,
+// e.g. a DataParallel master) gets the values copied into its arena. Only a
+// module that is not flat adopts the mapped memory with use_mmap instead of
+// copying it. Parameters keep their dtype: values saved in another one are
+// converted.
+void load_checkpoint(Module &module, const std::string &path, bool use_mmap = true);
+
+// Whether the file starts with the checkpoint magic
+bool is_checkpoint(const std::string &path);
@@ -1,8 +1,15 @@
 #pragma once
 #include "module.h"
 #include "tensor.h"
+#include <cstddef>
 #include <memory>
 
+class WinogradFilters;
+
+// 3x3, stride 1 layers with enough channels run on Winograd (see winograd.h)
+// in forward and for the input gradient, with the transformed filters cached
+// until the weights change; everything else, and the weight gradient, is an
+// im2col GEMM.
 class Conv2D : public Module
 {
 public:
@@ -15,6 +22,15 @@ public:
 
     std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
 
+    // relu(conv(input)) max pooled with the given window, as one op. Each
+    // sample's conv output is pooled while still in cache and never stored;
+    // backward keeps one byte per output for the position of its max. Same
+    // result and gradients as Conv2D, Relu and Pooling in sequence.
+    // pool_kernel = 1 is conv + ReLU alone.
+    std::shared_ptr<Tensor> forward_relu_pool(std::shared_ptr<Tensor> input,
+                                              std::size_t pool_kernel = 1,
+                                              std::size_t pool_stride = 1);
+
 private:
     std::size_t _in_channels;
     std::size_t _out_channels;
@@ -25,4 +41,5 @@ private:
 
     std::shared_ptr<Tensor> _weight;  // [C_out, C_in, K, K]
     std::shared_ptr<Tensor> _bias;    // [C_out]
+    std::shared_ptr<WinogradFilters> _winograd;
 };
@@ -0,0 +1,15 @@
+#pragma once
+
+// Instruction set extensions available on the running CPU, detected once via
+// CPUID. Everything is false on non-x86 builds so callers fall back to scalar code.
+struct CpuFeatures
+{
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vnni = false;
+};
+
+const CpuFeatures &cpu_features();
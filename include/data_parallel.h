@@ -0,0 +1,82 @@
+#pragma once
+#include "graph_capture.h"
+#include "loss.h"
+#include "module.h"
+#include "tensor.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Result of one data-parallel forward/backward over a mini-batch
+struct ParallelStep
+{
+    float loss;                     // loss of the whole batch, as the criterion computes it
+    std::shared_ptr<Tensor> output; // model output for the whole batch, no graph attached
+};
+
+// Data-parallel training over threads.
+//
+// The factory is called once for the master model, whose parameters are the
+// ones handed to the optimizer, and once per worker replica. Every step copies
+// the master weights into the replicas, splits the batch along its first
+// dimension into one contiguous shard per replica, runs forward/backward on
+// all shards concurrently, tree-reduces the replica gradients and accumulates
+// the result into the master gradients. Kernels inside a replica run on that
+// replica's thread only, so replicas do not compete for the pool. The master
+// and the replicas are flattened (Module::flatten_parameters), so the weight
+// copy is one memcpy per replica and the reduction adds whole gradient arenas.
+//
+// Typical step:
+//     optimizer.zero_grad();
+//     auto step = model.forward_backward(inputs, targets, criterion);
+//     optimizer.step();
+class DataParallel
+{
+public:
+    using ModelFactory = std::function<std::shared_ptr<Module>()>;
+
+    // n_replicas defaults to the thread pool size
+    explicit DataParallel(ModelFactory factory, std::size_t n_replicas = 0);
+
+    std::shared_ptr<Module> module() const;
+    std::size_t replicas() const;
+
+    // Loss and gradients for the batch are identical (up to float rounding)
+    // to running the master model on the whole batch.
+    ParallelStep forward_backward(std::shared_ptr<Tensor> inputs,
+                                  const std::vector<std::size_t> &targets,
+                                  Loss &criterion);
+
+    // Sharded forward only, e.g. for validation under a NoGradGuard. The
+    // caller's grad mode applies to every replica.
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> inputs);
+
+    // Runs forward_backward through one CapturedStep per replica: each replica
+    // records its step on the first batch and replays it afterwards, capturing
+    // again whenever the shard shape, the criterion or the mode changes.
+    // Every layer of the model must support capture. Off by default.
+    void set_capture(bool enabled);
+
+    // Sets training/evaluation mode on the master and every replica
+    void train(bool mode = true);
+    void eval();
+
+private:
+    struct Shard
+    {
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    std::vector<Shard> make_shards(std::size_t batch) const;
+    void sync_replicas();
+    void reduce_gradients(std::size_t n);
+
+    std::shared_ptr<Module> _master;
+    std::vector<std::shared_ptr<Module>> _replicas;
+    std::vector<std::shared_ptr<Tensor>> _master_params;
+    std::vector<std::vector<std::shared_ptr<Tensor>>> _replica_params;
+    bool _capture = false;
+    std::vector<std::unique_ptr<CapturedStep>> _steps; // per replica, when capturing
+};
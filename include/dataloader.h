@@ -1,30 +1,91 @@
 #pragma once
 #include "datasets.h"
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <map>
 #include <memory>
-#include <utility>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <vector>
 
+// One mini-batch: data is [N, ...] in one contiguous tensor, labels has N entries
+struct Batch
+{
+    std::shared_ptr<Tensor> data;
+    std::vector<std::size_t> labels;
+
+    std::size_t size() const { return labels.size(); }
+};
+
+// Iterates a dataset in mini-batches assembled ahead of time on background
+// threads.
+//
+// Each begin() starts an epoch, reshuffling the sample order with a generator
+// seeded once at construction, so a seed fixes the order of every epoch.
+// num_workers threads call Dataset::get_batch for upcoming batches while the
+// caller trains on the current one, staying at most `prefetch` batches ahead
+// of it; batches come out in order whichever worker built them. The dataset
+// must tolerate concurrent get_batch calls. Workers allocate from the heap,
+// never from an allocator made current by the training loop, so prefetched
+// batches do not pin a step arena. With num_workers = 0 batches are built on
+// the calling thread when requested.
 class DataLoader
 {
 private:
+    struct Slot
+    {
+        Batch batch;
+        std::exception_ptr error;
+    };
+
     Dataset *_dataset;
     int _batch_size;
     std::vector<int> _indices;
+    bool _shuffle;
+    std::size_t _prefetch;
+    std::mt19937 _gen;
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _work_cv;  // workers wait for batches to build
+    std::condition_variable _ready_cv; // the consumer waits for a built batch
+    std::map<std::size_t, Slot> _ready;
+    std::size_t _next = 0;     // next batch for a worker to claim
+    std::size_t _consumed = 0; // batches handed to or stepped over by the caller this epoch
+    std::size_t _in_flight = 0;
+    bool _started = false;
+    bool _stop = false;
+
+    void start_epoch();
+    void worker_loop();
+    std::vector<int> batch_indices(std::size_t batch) const;
+    Batch load(std::size_t batch);
+    Batch take(std::size_t batch);
 
 public:
-    DataLoader(Dataset *dataset, int batch_size, bool shuffle = true);
+    DataLoader(Dataset *dataset, int batch_size, bool shuffle = true, int num_workers = 1, int prefetch = 2,
+               unsigned seed = 0);
+    ~DataLoader();
+
+    DataLoader(const DataLoader &) = delete;
+    DataLoader &operator=(const DataLoader &) = delete;
 
     class Iterator
     {
     private:
         DataLoader *_dataloader;
-        int _index;
+        std::size_t _index;
+        Batch _current;
+        bool _loaded = false;
 
     public:
-        Iterator(DataLoader *dataloader, int index);
+        Iterator(DataLoader *dataloader, std::size_t index);
         void operator++();
-        std::vector<std::pair<int, std::shared_ptr<Tensor>>> operator*();
-        bool operator!=(const Iterator &other);
+        // Blocks until the batch is ready
+        Batch &operator*();
+        bool operator!=(const Iterator &other) const;
     };
 
     Iterator begin();
@@ -33,4 +94,4 @@ public:
     std::size_t batch_size() const;
     std::size_t n_samples() const;
     std::size_t n_batches() const;
-};
\ No newline at end of file
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include "mapped_file.h"
 #include "tensor.h"
 #include <memory>
 #include <string>
@@ -8,37 +9,83 @@
 class Dataset
 {
 public:
+    virtual ~Dataset() = default;
     virtual std::pair<int, std::shared_ptr<Tensor>> get_item(int index) = 0;
     virtual int get_length() = 0;
+
+    // Gathers the samples at `indices` into one [N, ...] batch and their labels.
+    // The default stacks get_item(); datasets that can fill a batch directly
+    // override it.
+    virtual std::shared_ptr<Tensor> get_batch(const std::vector<int> &indices, std::vector<std::size_t> &labels);
 };
 
-class MNIST : public Dataset
+// A view of some samples of another dataset, e.g. a train/validation split.
+// Sample i is sample indices[i] of the underlying dataset.
+class Subset : public Dataset
 {
 private:
-    std::vector<std::vector<std::vector<float>>> _images;
-    std::vector<int> _labels;
-    std::vector<std::string> classes = {"zero", "one", "two",   "three", "four", "five", "six", "seven", "eight", "nine"};
+    Dataset *_dataset;
+    std::vector<int> _indices;
 
 public:
-    MNIST(std::string data_path, std::string labels_path);
+    Subset(Dataset *dataset, std::vector<int> indices);
+    // Samples [begin, end) of the underlying dataset
+    Subset(Dataset *dataset, int begin, int end);
     std::pair<int, std::shared_ptr<Tensor>> get_item(int index) override;
     int get_length() override;
-    std::string label_to_class(int label);
+    std::shared_ptr<Tensor> get_batch(const std::vector<int> &indices, std::vector<std::size_t> &labels) override;
 };
 
-class FashionMNIST : public Dataset
+// Images and labels from a pair of IDX files, the format MNIST and
+// FashionMNIST are distributed in. Both files are memory-mapped: pixels stay
+// uint8 in the page cache and are scaled into [0, 1] only when a sample or a
+// batch is requested, so opening a dataset reads nothing but the headers.
+class IDXDataset : public Dataset
 {
 private:
-    std::vector<std::vector<std::vector<float>>> _images;
-    std::vector<int> _labels;
-    std::vector<std::string> _classes = { "T-shirt/top", "Trouser", "Pullover", "Dress", "Coat", "Sandal", "Shirt", "Sneaker",  "Bag",   "Ankle boot",
-    };
+    std::shared_ptr<MappedFile> _images_file;
+    std::shared_ptr<MappedFile> _labels_file;
+    const unsigned char *_pixels = nullptr;
+    const unsigned char *_labels = nullptr;
+    std::size_t _count = 0;
+    std::size_t _rows = 0;
+    std::size_t _cols = 0;
+
+    std::size_t check_index(int index) const;
 
 public:
-    FashionMNIST(std::string data_path, std::string labels_path);
+    IDXDataset(const std::string &data_path, const std::string &labels_path);
     std::pair<int, std::shared_ptr<Tensor>> get_item(int index) override;
     int get_length() override;
+    std::shared_ptr<Tensor> get_batch(const std::vector<int> &indices, std::vector<std::size_t> &labels) override;
+
+    std::size_t rows() const;
+    std::size_t cols() const;
+};
+
+class MNIST : public IDXDataset
+{
+private:
+    std::vector<std::string> _classes = {"zero", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine"};
+
+public:
+    MNIST(std::string data_path, std::string labels_path);
     std::string label_to_class(int label);
 };
 
+class FashionMNIST : public IDXDataset
+{
+private:
+    std::vector<std::string> _classes = {"T-shirt/top", "Trouser", "Pullover", "Dress", "Coat",
+                                         "Sandal",      "Shirt",   "Sneaker",  "Bag",   "Ankle boot"};
+
+public:
+    FashionMNIST(std::string data_path, std::string labels_path);
+    std::string label_to_class(int label);
+};
+
+// Scales n uint8 pixels into [0, 1] as v / 255
+void normalize_pixels(const unsigned char *src, float *dst, std::size_t n);
+
+// Prints the last two dimensions of an image with values in [0, 1] as ASCII art
 void visualize_image(std::shared_ptr<Tensor> image);
\ No newline at end of file
@@ -3,20 +3,19 @@
 
 #include "module.h"
 #include "../include/tensor.h"
+#include <random>
 #include <vector>
 
 class Dropout : public Module {
     float rate;
-    bool is_training;
     std::shared_ptr<Tensor> mask; 
+    // Each instance draws from its own stream so replicas can run concurrently
+    std::mt19937 gen;
 
 public:
    
     Dropout(float rate = 0.5f);
 
-    void train() { is_training = true; }
-    void eval() { is_training = false; }
-
     std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
     std::vector<std::shared_ptr<Tensor>> parameters() {
         return {}; 
@@ -1,18 +1,70 @@
 #ifndef FER_LOADER_H
 #define FER_LOADER_H
 
+#include "datasets.h"
+#include "mapped_file.h"
 #include "tensor.h"
 #include <string>
 #include <vector>
 #include <memory>
 
+// The "Usage" column of fer2013.csv
+enum class FERUsage : unsigned char {
+    Training = 0,
+    PublicTest = 1,
+    PrivateTest = 2
+};
+
 class FERLoader {
 public:
-    
-    static void load(const std::string& csv_path, 
-                     std::vector<std::shared_ptr<Tensor>>& images, 
+
+    static void load(const std::string& csv_path,
+                     std::vector<std::shared_ptr<Tensor>>& images,
                      std::vector<int>& labels,
                      int limit = -1);
+
+    // One-time conversion of fer2013.csv into the packed binary read by FERDataset.
+    // Returns the number of images written; malformed rows are skipped with a warning.
+    static std::size_t convert(const std::string& csv_path, const std::string& bin_path);
+};
+
+// FER-2013 served straight from a memory-mapped file written by FERLoader::convert:
+//
+//   char   magic[8]   "FERDAT\0\0"
+//   uint32 version, count, height, width
+//   uint8  labels[count], usage[count]
+//   uint8  pixels[count][height * width], starting at a 64-byte aligned offset
+//
+// Nothing is parsed or allocated per image; a batch is one buffer filled by
+// scaling the mapped bytes to [0, 1].
+class FERDataset : public Dataset {
+public:
+    explicit FERDataset(const std::string& bin_path);
+    // Only the images of one usage split, in file order; none if the file
+    // has no rows of that split
+    FERDataset(const std::string& bin_path, FERUsage usage);
+
+    std::pair<int, std::shared_ptr<Tensor>> get_item(int index) override;
+    int get_length() override;
+    std::shared_ptr<Tensor> get_batch(const std::vector<int>& indices, std::vector<std::size_t>& labels) override;
+
+    int label(int index) const;
+    FERUsage usage(int index) const;
+
+private:
+    std::size_t length() const;
+    std::size_t file_index(int index) const;
+    void fill(float* dst, std::size_t i) const;
+
+    std::shared_ptr<MappedFile> _file;
+    const unsigned char* _labels = nullptr;
+    const unsigned char* _usage = nullptr;
+    const unsigned char* _pixels = nullptr;
+    std::size_t _count = 0;
+    std::size_t _height = 0;
+    std::size_t _width = 0;
+    bool _filtered = false;           // restricted to one usage split, which may be empty
+    std::vector<std::size_t> _subset; // file indices of that split
 };
 
-#endif
\ No newline at end of file
+#endif
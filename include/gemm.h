@@ -0,0 +1,51 @@
+#pragma once
+#include "half.h"
+#include <cstddef>
+
+// Dense single precision kernels on row-major buffers. The implementation is
+// chosen at runtime from the CPU's features (AVX-512, AVX2+FMA or portable
+// scalar code); set DL_SIMD=scalar|avx2|avx512 to force a lower level.
+
+// C = alpha * op(A) * op(B) + beta * C
+// op(A) is M x K, op(B) is K x N and C is M x N. When trans_a is set A is
+// stored as K x M (likewise for B), lda/ldb/ldc are the row strides of the
+// stored matrices. beta == 0 overwrites C without reading it.
+//
+// The product is cache blocked (panels of A and B are packed into contiguous
+// buffers sized for L2/L1) and computed by a register-tiled micro-kernel.
+void sgemm(bool trans_a, bool trans_b,
+           std::size_t M, std::size_t N, std::size_t K,
+           float alpha,
+           const float *A, std::size_t lda,
+           const float *B, std::size_t ldb,
+           float beta,
+           float *C, std::size_t ldc);
+
+// y = alpha * op(A) * x + beta * y for A stored as M x N.
+// Without trans x has N entries and y has M, with trans it is the other way round.
+void sgemv(bool trans, std::size_t M, std::size_t N,
+           float alpha, const float *A, std::size_t lda,
+           const float *x, float beta, float *y);
+
+// sgemm and sgemv with A and/or B stored in any DType. 16-bit elements are
+// widened to float as they are loaded (while packing panels for the GEMM, in
+// registers for the GEMV), so products accumulate in float and only half the
+// bytes of a 16-bit operand cross the memory bus.
+void sgemm_mixed(bool trans_a, bool trans_b,
+                 std::size_t M, std::size_t N, std::size_t K,
+                 float alpha,
+                 const void *A, DType a_type, std::size_t lda,
+                 const void *B, DType b_type, std::size_t ldb,
+                 float beta,
+                 float *C, std::size_t ldc);
+
+void sgemv_mixed(bool trans, std::size_t M, std::size_t N,
+                 float alpha, const void *A, DType a_type, std::size_t lda,
+                 const float *x, float beta, float *y);
+
+// Rank-1 update A[M x N] += alpha * x[M] * y[N]^T
+void sger(std::size_t M, std::size_t N, float alpha,
+          const float *x, const float *y, float *A, std::size_t lda);
+
+// Name of the kernel set in use ("avx512", "avx2" or "scalar")
+const char *gemm_backend();
@@ -0,0 +1,120 @@
+#pragma once
+#include "half.h"
+#include <cstddef>
+#include <cstdint>
+
+// Per-ISA kernel table used internally by gemm.cpp. Each instruction set lives
+// in its own translation unit (gemm_avx2.cpp, gemm_avx512.cpp) compiled with
+// function-level target attributes, and the best table for the running CPU is
+// picked once at startup.
+struct GemmKernels
+{
+    const char *name;
+
+    // Register tile of the micro-kernel; panels of A and B are packed to match
+    std::size_t mr;
+    std::size_t nr;
+
+    // C[0:m, 0:n] = alpha * a_panel[kc x mr] * b_panel[kc x nr] + beta * C
+    void (*micro_kernel)(std::size_t kc, const float *a, const float *b,
+                         float *C, std::size_t ldc, std::size_t m, std::size_t n,
+                         float alpha, float beta);
+
+    // y[M] = alpha * A[M x N] * x[N] + beta * y
+    void (*gemv_n)(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                   const float *x, float beta, float *y);
+
+    // y[N] = alpha * A[M x N]^T * x[M] + beta * y
+    void (*gemv_t)(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                   const float *x, float beta, float *y);
+
+    // A[M x N] += alpha * x[M] * y[N]^T
+    void (*ger)(std::size_t M, std::size_t N, float alpha, const float *x, const float *y,
+                float *A, std::size_t lda);
+
+    // gemv_n and gemv_t with A stored in a 16-bit dtype, widened in registers
+    void (*gemv_n_half)(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                        std::size_t lda, const float *x, float beta, float *y);
+    void (*gemv_t_half)(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                        std::size_t lda, const float *x, float beta, float *y);
+};
+
+// Return nullptr when the ISA is not compiled in (non-x86 builds)
+const GemmKernels *gemm_kernels_avx2();
+const GemmKernels *gemm_kernels_avx512();
+
+// Per-ISA kernel table used internally by qgemm.cpp, selected the same way
+struct QGemmKernels
+{
+    const char *name;
+
+    // Register tile: rows of A and blocks of QGEMM_BLOCK packed channels
+    std::size_t mr;
+    std::size_t nb;
+
+    // C[0:m, 0:16*nb] = A[m x k4] * blocks^T for m <= mr rows and nb <= the
+    // tile's blocks, which start block_stride bytes apart in w
+    void (*micro_kernel)(std::size_t k4, const std::uint8_t *A, std::size_t lda,
+                         const std::int8_t *w, std::size_t block_stride,
+                         std::size_t m, std::size_t nb, std::int32_t *C, std::size_t ldc);
+};
+
+const QGemmKernels *qgemm_kernels_avx2();
+const QGemmKernels *qgemm_kernels_avx512vnni();
+
+// Per-ISA float <-> 16-bit conversions used internally by half.cpp. Each
+// converts all n elements and rounds exactly like the scalar functions in
+// half.h.
+struct HalfKernels
+{
+    const char *name;
+    void (*bf16_to_float)(const std::uint16_t *src, float *dst, std::size_t n);
+    void (*float_to_bf16)(const float *src, std::uint16_t *dst, std::size_t n);
+    void (*fp16_to_float)(const std::uint16_t *src, float *dst, std::size_t n);
+    void (*float_to_fp16)(const float *src, std::uint16_t *dst, std::size_t n);
+};
+
+// AVX2 + F16C, AVX-512F + BW
+const HalfKernels *half_kernels_avx2();
+const HalfKernels *half_kernels_avx512();
+
+// Per-step constants of the optimizer updates (sgd.h, adam.h)
+struct SGDStep
+{
+    float grad_scale; // applied to the gradient first, 1 / accumulation steps
+    float lr;
+    float weight_decay;
+    float momentum;
+    // the step is g_scale * g + buf_scale * buf: (0, 1), or (1, momentum) for Nesterov
+    float g_scale;
+    float buf_scale;
+};
+
+struct AdamStep
+{
+    float grad_scale;
+    float beta1;
+    float beta2;
+    float eps;
+    float step_size; // lr / (1 - beta1^t)
+    float inv_bias2; // 1 / sqrt(1 - beta2^t)
+    float l2;        // weight decay added to the gradient (Adam)
+    float shrink;    // factor on the weights before the step, 1 - lr * wd (AdamW)
+};
+
+// Per-ISA optimizer updates used internally by the optimizers, selected the
+// same way. Each updates p[0:n] in place from g[0:n] and its state buffers.
+struct OptimizerKernels
+{
+    const char *name;
+    // buf may be null when momentum is 0
+    void (*sgd)(float *p, const float *g, float *buf, std::size_t n, const SGDStep &step);
+    void (*adam)(float *p, const float *g, float *m, float *v, std::size_t n, const AdamStep &step);
+};
+
+// AVX2 + FMA, AVX-512F
+const OptimizerKernels *optimizer_kernels_avx2();
+const OptimizerKernels *optimizer_kernels_avx512();
+
+// Best table for the running CPU, capped by DL_SIMD like the others
+const OptimizerKernels &optimizer_kernels();
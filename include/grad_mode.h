@@ -0,0 +1,35 @@
+#pragma once
+
+// Whether operations on this thread record the autograd graph. When disabled,
+// layers skip building gradient functions and parent links, so their outputs
+// hold no references to their inputs and activations are freed as soon as the
+// caller drops them. Enabled by default on every thread.
+class GradMode
+{
+public:
+    static bool is_enabled();
+    static void set_enabled(bool enabled);
+};
+
+// Sets the grad mode of the current thread until it goes out of scope
+class GradModeGuard
+{
+public:
+    explicit GradModeGuard(bool enabled);
+    ~GradModeGuard();
+
+    GradModeGuard(const GradModeGuard &) = delete;
+    GradModeGuard &operator=(const GradModeGuard &) = delete;
+
+private:
+    bool _previous;
+};
+
+// Inference scope: no graph is recorded on this thread while it is alive
+//     NoGradGuard no_grad;
+//     auto logits = model.forward(images);
+class NoGradGuard : public GradModeGuard
+{
+public:
+    NoGradGuard() : GradModeGuard(false) {}
+};
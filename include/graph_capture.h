@@ -0,0 +1,69 @@
+#pragma once
+#include "loss.h"
+#include "module.h"
+#include "tensor.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Whether this thread is recording a CapturedStep. Ops that support capture
+// attach a ForwardFn to the nodes they create while it is active.
+class CaptureMode
+{
+public:
+    static bool is_active();
+};
+
+// One forward/backward of a static-shape model, recorded once and replayed.
+//
+// The first run() executes the step eagerly while every op attaches a forward
+// function that recomputes its output in place, and keeps the resulting
+// graph. Later runs copy the new input and targets into the captured step,
+// call those forward functions in topological order and then the gradfns in
+// reverse: no tensors, closures or parent lists are created, activations are
+// rewritten in the captured buffers, and gradients accumulate into the model
+// parameters as with loss->backward().
+//
+// A run whose input shape, target count or train/eval mode differs from the
+// captured one captures again. The step must not branch on data, and every op
+// in it must support capture (Conv2D, Relu, the pooling layers, Dropout,
+// Flatten, Linear, tensor views, elementwise math and batched
+// CrossEntropyLoss do); capturing throws otherwise. The captured buffers come
+// from the heap; temporaries made inside the gradfns still come from the
+// current allocator, so replay under a step arena. model and criterion must
+// outlive the capture.
+//
+//     CapturedStep step(model, criterion);
+//     optimizer.zero_grad();
+//     float loss = step.run(batch, targets);
+//     optimizer.step();
+class CapturedStep
+{
+public:
+    CapturedStep(Module &model, Loss &criterion);
+
+    CapturedStep(const CapturedStep &) = delete;
+    CapturedStep &operator=(const CapturedStep &) = delete;
+
+    // Forward and backward for one batch; returns the loss
+    float run(const std::shared_ptr<Tensor> &input, const std::vector<std::size_t> &targets);
+
+    // Output of the model for the last run. Rewritten by the next run.
+    std::shared_ptr<Tensor> output() const;
+    const Loss &criterion() const;
+
+    // Drops the captured graph; the next run captures again
+    void reset();
+
+private:
+    void capture(const std::shared_ptr<Tensor> &input, const std::vector<std::size_t> &targets);
+
+    Module &_model;
+    Loss &_criterion;
+    bool _training = false;
+    std::shared_ptr<Tensor> _input;
+    std::shared_ptr<Tensor> _output;
+    std::shared_ptr<Tensor> _loss;
+    std::vector<std::size_t> _targets; // read by the captured loss on every run
+    std::vector<Tensor *> _order;
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Element types of tensor storage. The 16-bit formats only store values:
+// kernels widen them to float as they load and accumulate in float.
+//
+// BFloat16 keeps float's 8-bit exponent with 7 mantissa bits, so it covers
+// the same range and converts by dropping the low half of the float.
+// Float16 (IEEE binary16) has 10 mantissa bits but overflows past 65504.
+enum class DType : unsigned char
+{
+    Float32,
+    BFloat16,
+    Float16
+};
+
+std::size_t dtype_size(DType dtype);
+const char *dtype_name(DType dtype);
+
+// ---- Scalar conversions, rounding to nearest even ----
+
+inline float bf16_to_float(std::uint16_t h)
+{
+    std::uint32_t bits = (std::uint32_t)h << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline std::uint16_t float_to_bf16(float f)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u)
+        return (std::uint16_t)((bits >> 16) | 0x40); // keep NaN a quiet NaN
+    bits += 0x7fffu + ((bits >> 16) & 1);
+    return (std::uint16_t)(bits >> 16);
+}
+
+inline float fp16_to_float(std::uint16_t h)
+{
+    // move exponent and mantissa into place, then let a float multiply
+    // rebias the exponent, which also normalizes subnormals
+    std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+    std::uint32_t rest = (std::uint32_t)(h & 0x7fff) << 13;
+    float f;
+    if ((h & 0x7c00) == 0x7c00)
+    {
+        // inf, or NaN made quiet
+        std::uint32_t bits = sign | 0x7f800000u | rest | ((h & 0x3ff) ? 0x400000u : 0u);
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+    std::memcpy(&f, &rest, sizeof(f));
+    f *= 0x1p112f;
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    bits |= sign;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+std::uint16_t float_to_fp16(float f);
+
+// ---- Bulk conversions, vectorized with F16C / AVX-512 where available ----
+
+// dst[0:n] = float values of the 16-bit elements in src
+void half_to_float(const std::uint16_t *src, float *dst, std::size_t n, DType dtype);
+// dst[0:n] = src rounded to the 16-bit dtype
+void float_to_half(const float *src, std::uint16_t *dst, std::size_t n, DType dtype);
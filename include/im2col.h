@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+
+// Geometry of a 2D convolution over one [C,H,W] image
+struct ConvGeometry
+{
+    std::size_t channels;
+    std::size_t height;
+    std::size_t width;
+    std::size_t kernel_size;
+    std::size_t stride;
+    std::size_t padding;
+    std::size_t out_height;
+    std::size_t out_width;
+};
+
+// Unfolds an image [C,H,W] into a column matrix [C*K*K, H_out*W_out] so the
+// convolution becomes weight[C_out, C*K*K] x columns. Padding is written as zeros.
+void im2col(const float *image, const ConvGeometry &g, float *columns);
+
+// Inverse of im2col: adds every column entry back onto the image position it
+// was read from. `image` is accumulated into, not overwritten.
+void col2im(const float *columns, const ConvGeometry &g, float *image);
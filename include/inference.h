@@ -0,0 +1,149 @@
+#pragma once
+#include "im2col.h"
+#include "storage.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Graph-free runtime for trained CNNs, built for low latency inference.
+//
+// The network is described layer by layer and its parameters are loaded from
+// a checkpoint (see checkpoint.h) or a file in the older flat format. plan()
+// then fixes the input shape and the largest batch, works out every activation
+// shape, fuses what it can and preallocates all buffers: two ping-pong
+// activation buffers and one im2col scratch buffer per worker. run() allocates
+// nothing and records no autograd graph. 3x3, stride 1 convolutions with
+// enough channels run on Winograd (see winograd.h), their filters transformed
+// once by plan().
+//
+// Fusions: convolution/linear bias is written into the output before the GEMM
+// accumulates onto it, a ReLU is applied as the epilogue of the layer before
+// it, and a ReLU followed by max pooling becomes a clamped pool (the two
+// commute, so the clamp runs on the smaller pooled output). Flatten is free.
+//
+// quantize() switches conv and linear layers to 8-bit integer arithmetic
+// (see qgemm.h): weights are stored as int8 with one scale per output
+// channel, each layer's input is coded to 7 bits with a scale and zero point
+// calibrated on sample images, and the 32-bit sums are scaled back to float
+// together with the bias, so ReLU, pooling and the next layer's coding run
+// on floats as before. Such a model can be saved and loaded on its own:
+//
+//   char    magic[8]       "DLQINT8\0"
+//   uint32  version        1
+//   uint32  layer count    conv and linear layers, in layer order
+//   per layer:
+//     uint32  outputs, uint32 inputs per output (C_in * K * K or in_features)
+//     float   input scale, uint32 input zero point
+//     float   weight scale[outputs], float bias[outputs]
+//     int8    weight[outputs * inputs], row-major
+class InferenceModel
+{
+public:
+    void add_conv(std::size_t in_channels, std::size_t out_channels, std::size_t kernel_size,
+                  std::size_t stride = 1, std::size_t padding = 0);
+    void add_relu();
+    void add_max_pool(std::size_t kernel_size, std::size_t stride);
+    void add_flatten();
+    void add_linear(std::size_t in_features, std::size_t out_features);
+
+    // Reads weight then bias of every conv/linear layer, in layer order. A
+    // checkpoint is memory-mapped and its weights are used in place, 16-bit
+    // ones included. A quantized model file makes the model quantized.
+    void load(const std::string &path);
+
+    // Post-training quantization. Runs the float model (planned beforehand)
+    // on n calibration images to find the input range of every conv and
+    // linear layer, then quantizes their weights; run() uses the integer
+    // kernels from then on. The float weights are dropped.
+    void quantize(const float *calibration_images, std::size_t n);
+    bool quantized() const;
+
+    // Writes a quantized model in the format above
+    void save_quantized(const std::string &path) const;
+
+    // Prepares for inputs of shape [n, channels, height, width] with n <= max_batch
+    void plan(std::size_t channels, std::size_t height, std::size_t width, std::size_t max_batch = 1);
+
+    // images holds n inputs back to back, logits receives n x output_size() values
+    void run(const float *images, std::size_t n, float *logits);
+
+    std::size_t input_size() const;
+    std::size_t output_size() const;
+    std::size_t max_batch() const;
+
+    // The network trained by examples/train_fer.cpp, for 1 x 48 x 48 faces
+    static InferenceModel fer();
+
+private:
+    enum class Kind
+    {
+        Conv,
+        Relu,
+        MaxPool,
+        Flatten,
+        Linear
+    };
+
+    struct Layer
+    {
+        Kind kind;
+        std::size_t in_channels = 0;  // conv channels or linear in_features
+        std::size_t out_channels = 0; // conv channels or linear out_features
+        std::size_t kernel_size = 0;
+        std::size_t stride = 1;
+        std::size_t padding = 0;
+        Storage weight;
+        Storage bias;
+
+        // INT8 form, filled by quantize() or a quantized model file
+        std::vector<std::int8_t> qweight; // packed for qgemm_u8s8
+        Storage qweight_scale;             // per output channel
+        std::vector<std::int32_t> qrowsum; // per output channel, sum of its int8 weights
+        float qinput_scale = 0.0f;
+        std::uint8_t qinput_zero_point = 0;
+    };
+
+    // Smallest and largest value of a layer input seen during calibration
+    struct Range
+    {
+        float min;
+        float max;
+    };
+
+    // A fused step of the execution plan
+    struct Step
+    {
+        std::size_t layer; // index into _layers
+        bool relu;
+        ConvGeometry geom;     // conv and pooling geometry for one sample
+        std::size_t in_numel;  // per sample
+        std::size_t out_numel; // per sample
+        // Float 3x3 convs that winograd_tile picks: the tile and the
+        // transformed filters, made by plan() from the loaded weights
+        std::size_t winograd = 0;
+        Storage winograd_filters;
+    };
+
+    void load_quantized(const std::string &path);
+
+    // run() with an optional per-step record of the input ranges
+    void execute(const float *images, std::size_t n, float *logits, std::vector<Range> *ranges);
+    void run_conv(const Step &step, const float *in, std::size_t n, float *out);
+    void run_qconv(const Step &step, const float *in, std::size_t n, float *out);
+    void run_qlinear(const Step &step, const float *in, std::size_t n, float *out);
+    void run_pool(const Step &step, const float *in, std::size_t n, float *out);
+    void run_linear(const Step &step, const float *in, std::size_t n, float *out);
+
+    std::vector<Layer> _layers;
+    std::vector<Step> _plan;
+    std::size_t _input_shape[3] = {0, 0, 0};
+    std::size_t _input_numel = 0;
+    std::size_t _max_batch = 0;
+    std::size_t _workers = 1;
+    Storage _activations[2];
+    Storage _scratch; // _workers im2col or Winograd buffers of _scratch_stride floats
+    std::size_t _scratch_stride = 0;
+    Storage _qscratch; // _workers buffers of codes and int32 sums for the quantized layers
+    std::size_t _qscratch_stride = 0;
+};
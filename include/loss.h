@@ -2,6 +2,7 @@
 #include "module.h"
 #include "tensor.h"
 #include <memory>
+#include <vector>
 
 class Loss : public Module
 {
@@ -9,17 +10,48 @@ public:
     std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
     virtual std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input, std::size_t target);
     std::shared_ptr<Tensor> operator()(std::shared_ptr<Tensor> input, std::size_t target);
+
+    // Batched variants: input is [N, Classes] with one target per row, the loss is the batch mean
+    virtual std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets);
+    std::shared_ptr<Tensor> operator()(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets);
+
+    // What the batched loss of these targets divides its sum by: the batch
+    // size for a plain mean. A batch split into shards gets its loss back as
+    // the sum of the shard losses weighted by shard normalizer / batch normalizer.
+    virtual float normalizer(const std::vector<std::size_t> &targets) const;
 };
 
 class NLLLoss : public Loss
 {
 public:
     std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input, std::size_t target) override;
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets) override;
 };
 
+// Cross-entropy of logits, with log-softmax and the negative log-likelihood
+// fused into one autograd node. The log-softmax is taken as
+// x - max - log(sum(exp(x - max))), and backward is
+// (softmax - target distribution) / N, linear in the number of classes.
+//
+// class_weights (one per class, optional) scale every sample's loss by the
+// weight of its target class, and the batch mean becomes a weighted mean:
+// the sum of losses over the sum of target weights. label_smoothing e trains
+// against (1 - e) * onehot + e / Classes instead of the one-hot target.
 class CrossEntropyLoss : public Loss
 {
 public:
+    explicit CrossEntropyLoss(std::vector<float> class_weights = {}, float label_smoothing = 0.0f);
+
     std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input, std::size_t target) override;
-    
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets) override;
+    // The sum of the target weights with class weights
+    float normalizer(const std::vector<std::size_t> &targets) const override;
+
+private:
+    // With capturable, a captured step rereads `targets` on every replay
+    std::shared_ptr<Tensor> fused(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets,
+                                  bool capturable);
+
+    std::vector<float> _class_weights;
+    float _label_smoothing;
 };
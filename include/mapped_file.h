@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// A whole file mapped into memory, private and copy-on-write: pages are
+// shared with the page cache (and so with every other process mapping the
+// same file) until this process writes to them, and writes never reach the
+// file. On platforms without mmap the file is read into memory instead.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    char *data() { return _data; }
+    const char *data() const { return _data; }
+    std::size_t size() const { return _size; }
+
+private:
+    char *_data = nullptr;
+    std::size_t _size = 0;
+    bool _mapped = false;
+};
@@ -1,6 +1,10 @@
 #pragma once
+#include "storage.h"
 #include "tensor.h"
+#include <atomic>
+#include <cstddef>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -11,14 +15,58 @@ class Module
 private:
     std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> _parameters;
     std::vector<std::pair<std::string, std::shared_ptr<Module>>> _modules;
+    bool _training = true;
+
+    // parameters() of the whole tree, rebuilt after any module registers
+    // something; the rebuild holds _cache_mutex and publishes _cache_epoch last
+    mutable std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> _parameter_cache;
+    mutable std::atomic<std::size_t> _cache_epoch{0};
+    mutable std::mutex _cache_mutex;
+
+    // arenas of flatten_parameters(); null until it is called
+    std::shared_ptr<Storage> _flat_data;
+    std::shared_ptr<Storage> _flat_grad;
 
 public:
     virtual std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input);
     std::shared_ptr<Tensor> operator()(std::shared_ptr<Tensor> input);
     void register_parameter(std::string name, std::shared_ptr<Tensor> param);
     void register_module(std::string name, std::shared_ptr<Module> module);
-    std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> parameters() const;
+    // Every parameter of the tree with its dotted name. Built once and cached
+    // until a module registers another parameter or submodule. Safe to call
+    // from several threads at once (e.g. DataParallel replicas); registering
+    // is not, and must not overlap a call or the use of a returned list,
+    // which the next call after a registration may rebuild.
+    const std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> &parameters() const;
     std::unordered_map<std::string, std::shared_ptr<Tensor>> state_dict() const;
     void load_state_dict(std::unordered_map<std::string, std::shared_ptr<Tensor>> &state_dict);
+
+    // Stores every weight matrix and conv kernel (parameters with two or more
+    // dimensions) as dtype, halving their memory and the bandwidth the GEMMs
+    // spend reading them; biases stay float. Optimizers built afterwards keep
+    // float master copies to apply their updates to (see optimizer.h).
+    void to(DType dtype);
+
+    // Packs the parameters of the tree into two contiguous arenas: their data
+    // into flat_data() and their gradients into flat_grad(), each parameter
+    // keeping its slice. The data arena has the checkpoint layout (every
+    // parameter at a 64-byte boundary, zero padded), so a checkpoint of the
+    // module goes out in one write; the gradient arena is packed floats, so
+    // zeroing, scaling or reducing all gradients is one pass. Call it on the
+    // root once the tree is built. to() repacks a flattened module; replacing
+    // a parameter's buffer by other means takes it out of the arena.
+    void flatten_parameters();
+    bool is_flat() const;
+    // The arenas; flat_data() is raw bytes unless every parameter is float
+    Storage &flat_data();
+    Storage &flat_grad();
+
+    // Zeroes every parameter gradient: one memset once flattened
+    void zero_grad();
+
+    // Training/evaluation mode, applied recursively to registered submodules
+    virtual void train(bool mode = true);
+    void eval();
+    bool is_training() const;
     virtual ~Module() = default;
 };
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+#include "storage.h"
+#include "tensor.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Base of the optimizers. The parameters are laid end to end in one flat index
+// space of numel() elements, and subclasses keep their per-element state
+// (momentum, Adam moments) as flat Storage buffers over that space. step()
+// splits the whole space into chunks across the thread pool, so every
+// parameter is updated in a single parallel pass, and hands each chunk's
+// contiguous runs to update().
+//
+// Parameters stored in a 16-bit dtype get an fp32 master copy: update() works
+// on the master and the parameter is re-rounded from it, so steps smaller
+// than the 16-bit spacing still accumulate. step() also keeps the 16-bit
+// values it last wrote; elements rewritten since (load_state_dict,
+// load_checkpoint) are taken into the master before the update. Parameters
+// without a gradient (none flowed into them since a lazy zero_grad) are left
+// untouched. The dtype and size of every parameter are fixed when the
+// optimizer is built: call Module::to() before, step() throws otherwise.
+//
+// With gradient accumulation over n micro-batches, a training loop runs
+// unchanged: zero_grad() only clears at the start of a group, and step() only
+// updates on its n-th call, from the gradient summed over the group and
+// scaled by 1 / n. With each micro-batch loss a mean over equally many
+// samples, that is the gradient of the mean over the whole group, as if it
+// were one batch n times larger.
+class Optimizer
+{
+public:
+    using Params = std::vector<std::pair<std::string, std::shared_ptr<Tensor>>>;
+
+    Optimizer(Params params, float lr);
+    virtual ~Optimizer() = default;
+
+    Optimizer(const Optimizer &) = delete;
+    Optimizer &operator=(const Optimizer &) = delete;
+
+    // Returns whether the parameters were updated, false between the
+    // micro-steps of an accumulation
+    bool step();
+    // In place, or lazily (see Tensor::zero_grad)
+    void zero_grad(bool lazy = false);
+
+    // 1, the default, updates on every step()
+    void set_accumulation_steps(std::size_t steps);
+    std::size_t accumulation_steps() const { return _accumulation_steps; }
+
+    float learning_rate() const { return _learning_rate; }
+    void set_learning_rate(float lr) { _learning_rate = lr; }
+
+protected:
+    // Total elements over all parameters
+    std::size_t numel() const { return _offsets.back(); }
+
+    // Called once per step before any update(), e.g. to advance a step count
+    virtual void begin_step() {}
+    // Updates values[0:n] from grad[0:n]; offset is the position of values[0]
+    // in the flat index space, so the state of values[i] is at offset + i.
+    // Called concurrently on disjoint ranges.
+    virtual void update(float *values, const float *grad, std::size_t offset, std::size_t n) = 0;
+
+    float _learning_rate;
+    // for update() to apply to the gradient: 1 / accumulation steps
+    float _grad_scale = 1.0f;
+
+private:
+    std::size_t _accumulation_steps = 1;
+    std::size_t _micro_step = 0; // step() calls since the last update
+    Params _params;
+    std::vector<DType> _dtypes;        // per param, at construction
+    std::vector<Storage> _master;      // per param; empty for float params
+    std::vector<Storage> _written;     // per 16-bit param, the values step() last rounded into it
+    std::vector<std::size_t> _offsets; // start of each param, then numel()
+};
@@ -1,13 +1,55 @@
 #pragma once
+#include "module.h"
 #include "tensor.h"
+#include <cstddef>
 #include <memory>
 
-class Pooling {
+// Window layout of a 2D pooling layer. Padding adds `padding` virtual
+// elements on every border (at most half the kernel); in ceil mode a
+// partial window at the bottom/right edge still produces an output, as
+// long as it starts inside the input or left padding.
+struct PoolGeometry
+{
+    std::size_t kernel_size;
+    std::size_t stride;
+    std::size_t padding = 0;
+    bool ceil_mode = false;
+
+    std::size_t out_size(std::size_t in_size) const;
+};
+
+// Max pooling over [C,H,W] or [N,C,H,W]. Forward records the position of
+// every window's max as a one-byte offset into the window, and backward
+// scatters the gradient through those offsets instead of searching the
+// input again. Padded positions never win. Kernels up to 16x16.
+class Pooling : public Module
+{
 public:
-    Pooling(std::size_t kernel_size, std::size_t stride);
-    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input);
+    Pooling(std::size_t kernel_size, std::size_t stride, std::size_t padding = 0, bool ceil_mode = false);
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
 
 private:
-    int _kernel_size;
-    int _stride;
+    PoolGeometry _geom;
+};
+
+// Average pooling over [C,H,W] or [N,C,H,W]. With count_include_pad the
+// divisor counts the padded positions a window covers (not the ones a ceil
+// mode window hangs past the padding), otherwise only real input elements.
+class AvgPooling : public Module
+{
+public:
+    AvgPooling(std::size_t kernel_size, std::size_t stride, std::size_t padding = 0, bool ceil_mode = false,
+               bool count_include_pad = true);
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
+
+private:
+    PoolGeometry _geom;
+    bool _count_include_pad;
+};
+
+// Mean of every channel plane: [C,H,W] -> [C,1,1], [N,C,H,W] -> [N,C,1,1]
+class GlobalAvgPooling : public Module
+{
+public:
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
 };
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// 8-bit integer matrix products for quantized inference, with the same
+// runtime kernel choice as gemm.h: AVX-512 VNNI (vpdpbusd), AVX2
+// (vpmaddubsw) or portable scalar code, capped by DL_SIMD.
+//
+// Activations are unsigned and limited to 7 bits (0..127) so that the
+// pairwise 16-bit sums of vpmaddubsw can never saturate: every kernel then
+// computes exactly the same integers. Weights are signed 8-bit.
+
+// Output channels per block of packed weights
+constexpr std::size_t QGEMM_BLOCK = 16;
+
+// Reduction length rounded up to whole groups of 4 bytes. Rows of A and the
+// packed weights are padded to it.
+std::size_t qgemm_k4(std::size_t K);
+
+// Channels rounded up to whole blocks; the row stride C needs
+std::size_t qgemm_n16(std::size_t N);
+
+// Bytes of the packed form of an N x K weight matrix
+std::size_t qgemm_packed_size(std::size_t N, std::size_t K);
+
+// Packs row-major W[N x K] into blocks of QGEMM_BLOCK channels. Inside a
+// block, the 4 weights of k group g for channel c are at (g * 16 + c) * 4,
+// so one 64-byte load covers a k group for the whole block. Channels past N
+// and k past K are zero.
+void qgemm_pack(const std::int8_t *W, std::size_t N, std::size_t K, std::int8_t *packed);
+
+// C[M x N] = A[M x K] * W^T as 32-bit sums. A is row-major with row stride
+// lda >= qgemm_k4(K) and zero padding past K; C has row stride
+// ldc >= qgemm_n16(N) and receives every padded channel too. Large products
+// are split across the thread pool.
+void qgemm_u8s8(std::size_t M, std::size_t N, std::size_t K,
+                const std::uint8_t *A, std::size_t lda,
+                const std::int8_t *packed,
+                std::int32_t *C, std::size_t ldc);
+
+// Name of the kernel set in use ("avx512vnni", "avx2" or "scalar")
+const char *qgemm_backend();
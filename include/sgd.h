@@ -1,17 +1,24 @@
 #pragma once
-#include "tensor.h"
-#include <memory>
-#include <string>
-#include <vector>
+#include "optimizer.h"
+#include "storage.h"
 
-class SGD
+// SGD with optional momentum, Nesterov momentum and L2 weight decay:
+//     g = grad + weight_decay * p
+//     buf = momentum * buf + g
+//     p -= lr * (nesterov ? g + momentum * buf : buf)
+// With momentum 0 it is plain SGD and keeps no state.
+class SGD : public Optimizer
 {
-private:
-    std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> _params;
-    float _learning_rate;
-
 public:
-    SGD(std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> params, float lr = 0.001);
-    void step();
-    void zero_grad();
-};
\ No newline at end of file
+    SGD(Params params, float lr = 0.001, float momentum = 0.0f, float weight_decay = 0.0f,
+        bool nesterov = false);
+
+protected:
+    void update(float *values, const float *grad, std::size_t offset, std::size_t n) override;
+
+private:
+    float _momentum;
+    float _weight_decay;
+    bool _nesterov;
+    Storage _velocity; // flat momentum buffer, empty without momentum
+};
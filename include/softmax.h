@@ -3,8 +3,28 @@
 #include "tensor.h"
 #include <memory>
 
+// Softmax along one dimension of an N-D input, e.g. dim -1 normalizes each
+// row of an [N, Classes] batch. Negative dims count from the end. Backward is
+// linear in the input size: grad_in = s * (grad - sum(grad * s)).
 class Softmax : public Module
 {
 public:
+    explicit Softmax(int dim = -1);
     std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
-};
\ No newline at end of file
+
+private:
+    int _dim;
+};
+
+// log(softmax(x)) along one dimension, computed as x - max - log(sum(exp(x - max)))
+// so that it never takes the log of an underflowed probability.
+// Backward: grad_in = grad - softmax * sum(grad).
+class LogSoftmax : public Module
+{
+public:
+    explicit LogSoftmax(int dim = -1);
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> input) override;
+
+private:
+    int _dim;
+};
@@ -0,0 +1,210 @@
+#pragma once
+#include "half.h"
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Alignment of every block handed out by an allocator (one cache line, and
+// enough for the widest SIMD loads)
+constexpr std::size_t STORAGE_ALIGNMENT = 64;
+
+// Source of raw memory for tensor data and gradients. deallocate() receives the
+// same byte count that was passed to allocate(). Implementations must be
+// thread-safe: pool workers allocate concurrently.
+class Allocator
+{
+public:
+    virtual ~Allocator() = default;
+    virtual void *allocate(std::size_t bytes) = 0;
+    virtual void deallocate(void *ptr, std::size_t bytes) = 0;
+};
+
+// Aligned operator new/delete, the process default
+class HeapAllocator : public Allocator
+{
+public:
+    void *allocate(std::size_t bytes) override;
+    void deallocate(void *ptr, std::size_t bytes) override;
+};
+
+// Keeps freed blocks in power-of-two size classes and hands them out again, so
+// a loop that allocates the same shapes every iteration stops hitting the heap
+// after its first pass.
+class PoolAllocator : public Allocator
+{
+public:
+    ~PoolAllocator() override;
+    void *allocate(std::size_t bytes) override;
+    void deallocate(void *ptr, std::size_t bytes) override;
+
+    // Returns every cached block to the heap
+    void release();
+    std::size_t cached_bytes() const;
+
+private:
+    static constexpr std::size_t N_CLASSES = 48;
+
+    mutable std::mutex _mutex;
+    std::vector<void *> _free[N_CLASSES];
+    std::size_t _cached_bytes = 0;
+};
+
+// Bump-pointer arena for memory that dies together, e.g. the activations and
+// gradients of one training step. Freeing a block only decrements a live
+// count; reset() rewinds the arena to empty as soon as that count reaches zero.
+// If one cycle spilled into extra chunks they are merged into a single chunk on
+// rewind, so from the second step on a step of the same shape allocates nothing.
+class ArenaAllocator : public Allocator
+{
+public:
+    explicit ArenaAllocator(std::size_t chunk_bytes = 1 << 24);
+    ~ArenaAllocator() override;
+
+    ArenaAllocator(const ArenaAllocator &) = delete;
+    ArenaAllocator &operator=(const ArenaAllocator &) = delete;
+
+    void *allocate(std::size_t bytes) override;
+    void deallocate(void *ptr, std::size_t bytes) override;
+
+    // Rewinds now if no block is live, otherwise when the last one is freed
+    void reset();
+    std::size_t live_blocks() const;
+    std::size_t capacity() const;
+
+private:
+    struct Chunk
+    {
+        char *base;
+        std::size_t size;
+    };
+
+    void add_chunk(std::size_t bytes);
+    void rewind();
+
+    mutable std::mutex _mutex;
+    std::vector<Chunk> _chunks;
+    std::size_t _chunk_bytes;
+    std::size_t _current = 0; // chunk being bumped
+    std::size_t _offset = 0;  // bytes used in the current chunk
+    std::size_t _live = 0;
+    bool _reset_pending = false;
+};
+
+// Allocator used for new storage. It is process-wide rather than per thread so
+// that pool workers allocate from the same place as the thread driving a step;
+// a ThreadAllocatorGuard takes precedence on its own thread.
+Allocator &current_allocator();
+Allocator &heap_allocator();
+
+// Makes `allocator` current until the guard goes out of scope. Set it from the
+// thread that drives the computation, outside of parallel regions.
+class AllocatorGuard
+{
+public:
+    explicit AllocatorGuard(Allocator &allocator);
+    ~AllocatorGuard();
+
+    AllocatorGuard(const AllocatorGuard &) = delete;
+    AllocatorGuard &operator=(const AllocatorGuard &) = delete;
+
+private:
+    Allocator *_previous;
+};
+
+// Makes `allocator` current for the calling thread only, overriding the
+// process-wide choice. For threads outside the compute path, such as data
+// loader workers, whose buffers must not land in a step arena.
+class ThreadAllocatorGuard
+{
+public:
+    explicit ThreadAllocatorGuard(Allocator &allocator);
+    ~ThreadAllocatorGuard();
+
+    ThreadAllocatorGuard(const ThreadAllocatorGuard &) = delete;
+    ThreadAllocatorGuard &operator=(const ThreadAllocatorGuard &) = delete;
+
+private:
+    Allocator *_previous;
+};
+
+// Contiguous float buffer for tensor data and gradients, a small subset of the
+// std::vector<float> interface. Memory comes from the allocator that was
+// current when the buffer was first allocated and goes back to that same
+// allocator; resizing or assigning a different size keeps it there, so long
+// lived buffers such as parameters never migrate into a step arena.
+//
+// A storage can also borrow memory it does not own (e.g. a memory-mapped
+// checkpoint); `owner` is kept alive for as long as the storage uses it.
+//
+// Elements are float unless the storage was created with a 16-bit dtype
+// (see half.h); such a buffer holds size() 2-byte values behind
+// half_data(), and the float accessors must not be used on it.
+class Storage
+{
+public:
+    static Storage borrow(float *data, std::size_t size, std::shared_ptr<void> owner,
+                          DType dtype = DType::Float32);
+
+    Storage() = default;
+    explicit Storage(std::size_t size, float value = 0.0f);
+    // size zeros of the given dtype
+    Storage(std::size_t size, DType dtype);
+    Storage(const std::vector<float> &values);
+    Storage(std::initializer_list<float> values);
+    Storage(const float *first, const float *last);
+
+    Storage(const Storage &other);
+    Storage(Storage &&other) noexcept;
+    Storage &operator=(const Storage &other);
+    Storage &operator=(Storage &&other) noexcept;
+    ~Storage();
+
+    std::size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    DType dtype() const { return _dtype; }
+    std::size_t bytes() const { return _size * dtype_size(_dtype); }
+    void *raw() { return _data; }
+    const void *raw() const { return _data; }
+    std::uint16_t *half_data() { return reinterpret_cast<std::uint16_t *>(_data); }
+    const std::uint16_t *half_data() const { return reinterpret_cast<const std::uint16_t *>(_data); }
+    float *data() { return _data; }
+    const float *data() const { return _data; }
+    float &operator[](std::size_t i) { return _data[i]; }
+    const float &operator[](std::size_t i) const { return _data[i]; }
+    float *begin() { return _data; }
+    float *end() { return _data + _size; }
+    const float *begin() const { return _data; }
+    const float *end() const { return _data + _size; }
+
+    // New elements are zero; shrinking keeps the buffer
+    void resize(std::size_t size);
+    void fill(float value);
+    std::vector<float> to_vector() const;
+
+    // Copy converted to dtype (a plain copy if it already has it), from
+    // the current allocator
+    Storage to(DType dtype) const;
+    // Overwrites the elements with float values rounded to this dtype
+    void assign_from(const float *values);
+
+    // Owner handle for borrowing a window of this buffer: it keeps the buffer
+    // itself alive, even after this storage is assigned a new one or
+    // destroyed. An owning storage hands its buffer over to the handle (it
+    // still goes back to its allocator once the last holder lets go); a
+    // borrowing one returns its own owner.
+    std::shared_ptr<void> share();
+
+private:
+    void allocate(std::size_t size);
+    void release();
+
+    float *_data = nullptr;
+    std::size_t _size = 0;
+    std::size_t _capacity = 0; // bytes
+    Allocator *_allocator = nullptr;
+    DType _dtype = DType::Float32;
+    std::shared_ptr<void> _owner; // set for borrowed memory
+};
@@ -1,52 +1,106 @@
 #pragma once
 #include <vector>
 #include <functional>
+#include <memory>
+#include <iosfwd>
+#include "storage.h"
 
+// Called with the gradient of a node's output during backward
+using GradFn = std::function<void(const Storage &)>;
+// Recomputes a node's output in place from its parents' current data; only
+// attached while a step is being captured (see graph_capture.h)
+using ForwardFn = std::function<void(Storage &)>;
 
+// Elementwise operations, see Tensor::apply
+enum class BinaryOp
+{
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Max,
+    Min,
+    Pow
+};
+
+enum class UnaryOp
+{
+    Neg,
+    Exp,
+    Log,
+    Sqrt,
+    Abs,
+    Tanh,
+    Sigmoid
+};
 
 class Tensor : public std::enable_shared_from_this<Tensor>
 {
     private:
-    std::vector<float> _data;
+    // Element buffer, shared by a tensor and all views of it
+    std::shared_ptr<Storage> _storage;
     std:: vector<std::size_t> _shape;
     std:: vector<std::size_t> _stride;
-    std::vector<float> _grad;
+    // Position of element 0 in *_storage. Only views that are not contiguous
+    // have an offset: a contiguous window of another tensor borrows its range
+    // as a Storage of its own, so data() can always hand out a flat buffer.
+    std::size_t _offset = 0;
+    bool _contiguous = true;
+    bool _is_view = false;
+    Storage _grad;
+    // zero_grad(true) was called: the buffer is kept, but the next gradient
+    // added overwrites it and grad() reads as empty until then
+    bool _grad_stale = false;
     bool _requires_grad = false;
-    std::function<void(const std::vector<float> &)> _gradfn;
+    GradFn _gradfn;
     std::vector<std::shared_ptr<Tensor>> _parents;
-    void _backward();
-    bool _visited = false;
-    void _reset_graph_visit();
+    ForwardFn _forwardfn;
+    bool _retains_grad = false;
+
+    // Post-order of the graph below root (parents before consumers); with
+    // grad_only, nodes that do not require grad are left out
+    static std::vector<Tensor *> topological_order(Tensor *root, bool grad_only);
+    // Runs the gradfns of a topological order ending at the root, in reverse
+    static void run_backward(const std::vector<Tensor *> &order);
+    friend class CapturedStep;
+
+    Tensor() = default;
+    // View of this tensor's storage with the given layout (in elements of
+    // *_storage); gradfn maps the view's gradient back to this tensor
+    std::shared_ptr<Tensor> make_view(std::vector<std::size_t> shape, std::vector<std::size_t> stride,
+                                      std::size_t offset, GradFn gradfn);
 
     public:
     Tensor(float data, bool requires_grad = false, 
-       std::function<void(const std::vector<float> &)> gradfn = {}, 
+       GradFn gradfn = {}, 
        std::vector<std::shared_ptr<Tensor>> parents = {});
        
 
-    Tensor(std::vector<float> data, bool requires_grad = false, 
-        std::function<void(const std::vector<float> &)> gradfn = {}, 
+    Tensor(Storage data, bool requires_grad = false, 
+        GradFn gradfn = {}, 
         std::vector<std::shared_ptr<Tensor>> parents = {});
 
     Tensor(std::vector<std::vector<float>> data, bool requires_grad = false, 
-        std::function<void(const std::vector<float> &)> gradfn = {}, 
+        GradFn gradfn = {}, 
         std::vector<std::shared_ptr<Tensor>> parents = {});
 
     Tensor(std::vector<std::vector<std::vector<float>>> data, bool requires_grad = false,
-        std::function<void(const std::vector<float> &)> gradfn = {},
+        GradFn gradfn = {},
         std::vector<std::shared_ptr<Tensor>> parents = {});
 
     Tensor(std::vector<std::vector<std::vector<std::vector<float>>>> data,
        bool requires_grad = false,
-       std::function<void(const std::vector<float>&)> gradfn = {},
+       GradFn gradfn = {},
        std::vector<std::shared_ptr<Tensor>> parents = {});
 
-    Tensor(std::vector<float> data, 
+    Tensor(Storage data, 
            std::vector<std::size_t> shape, 
            bool requires_grad = false, 
-           std::function<void(const std::vector<float> &)> gradfn = {}, 
+           GradFn gradfn = {}, 
            std::vector<std::shared_ptr<Tensor>> parents = {});
 
+    ~Tensor();
+
     const float &item() const;
     float &item();
     const float &operator()(std::size_t i) const;
@@ -56,42 +110,110 @@ class Tensor : public std::enable_shared_from_this<Tensor>
     const std::vector<std::size_t> &shape() const;
     const std::vector<std::size_t> &stride() const;
     const bool &requires_grad() const;
-    const std::vector<float> &grad() const;
-    void add_to_grad(const std::vector<float> &grad_update);
-    void zero_grad();
+    // Leaves (tensors without a gradfn) get a zeroed gradient on construction.
+    // Graph nodes get theirs from the first gradient that reaches them, and
+    // backward() frees it once it has been propagated unless retain_grad() was
+    // called; grad() is empty otherwise.
+    const Storage &grad() const;
+    void retain_grad();
+    void add_to_grad(const Storage &grad_update);
+    // Takes over the buffer when no gradient is held yet
+    void add_to_grad(Storage &&grad_update);
+    void set_forwardfn(ForwardFn forwardfn);
+    void scale_grad(float factor);
+    // Zeroes the gradient in place, allocating it the first time. With lazy,
+    // the memset is skipped: the buffer is only marked, and the next gradient
+    // added is written into it instead of accumulated. Until then grad() is
+    // empty, so an optimizer leaves a parameter nothing flowed into alone.
+    void zero_grad(bool lazy = false);
     std::size_t numel() const;
-    std::vector<float> &data();
+    // The elements, flat and row-major. Only contiguous tensors have one;
+    // call contiguous() first on a transposed or strided view.
+    Storage &data();
+    const Storage &data() const;
+    // Element type of data(); gradients are always float. Only the weights
+    // of Linear and Conv2D may be 16-bit (see Module::to), every other op
+    // expects float data.
+    DType dtype() const;
+    // Converts the data in place, rounding to nearest even
+    void set_dtype(DType dtype);
+    // Moves the data and gradient of a leaf into the given buffers, e.g.
+    // slices of the arenas of Module::flatten_parameters(). data must have
+    // the tensor's size and dtype and grad its size; the current values are
+    // copied over (a missing gradient becomes zeros).
+    void rebind(Storage data, Storage grad);
     void backward();
-    std::shared_ptr<Tensor> operator+(std::shared_ptr<Tensor> other);
+    // Matrix product of 1D/2D tensors
     std::shared_ptr<Tensor> operator*(std::shared_ptr<Tensor> other);
     std::size_t argmax() const;
+
+    // ---- Elementwise math (elementwise.cpp) ----
+    // Binary ops broadcast like NumPy: shapes are aligned at their last
+    // dimension, and sizes must match or be 1 (missing leading dimensions
+    // count as 1), so a [C] bias adds to an [N, C] batch. Inputs may be any
+    // float32 view; the result is a new contiguous tensor. Gradients are summed
+    // back over the broadcast dimensions.
+    std::shared_ptr<Tensor> apply(BinaryOp op, std::shared_ptr<Tensor> other);
+    std::shared_ptr<Tensor> apply(UnaryOp op);
+    std::shared_ptr<Tensor> operator+(std::shared_ptr<Tensor> other);
+    std::shared_ptr<Tensor> operator-(std::shared_ptr<Tensor> other);
+    // Elementwise product and quotient (operator* is the matrix product)
+    std::shared_ptr<Tensor> mul(std::shared_ptr<Tensor> other);
+    std::shared_ptr<Tensor> div(std::shared_ptr<Tensor> other);
+    std::shared_ptr<Tensor> maximum(std::shared_ptr<Tensor> other);
+    std::shared_ptr<Tensor> minimum(std::shared_ptr<Tensor> other);
+    std::shared_ptr<Tensor> pow(std::shared_ptr<Tensor> exponent);
+    std::shared_ptr<Tensor> neg();
+    std::shared_ptr<Tensor> exp();
+    std::shared_ptr<Tensor> log();
+    std::shared_ptr<Tensor> sqrt();
+    std::shared_ptr<Tensor> abs();
+    std::shared_ptr<Tensor> tanh();
+    std::shared_ptr<Tensor> sigmoid();
+
+    // ---- Views ----
+    // A view shares this tensor's storage instead of copying it: writes through
+    // either are seen by both, and gradients flow back to this tensor. Assigning
+    // data() a different size detaches the views. Bad sizes or dims throw
+    // std::invalid_argument.
+
+    // Same elements in another shape; copies first if this is not contiguous
+    std::shared_ptr<Tensor> reshape(std::vector<std::size_t> shape);
+    // reshape that never copies; throws on a tensor that is not contiguous
+    std::shared_ptr<Tensor> view(std::vector<std::size_t> shape);
+    std::shared_ptr<Tensor> transpose(std::size_t dim0, std::size_t dim1);
+    // Indices start, start + step, ... below end along dim
+    std::shared_ptr<Tensor> slice(std::size_t dim, std::size_t start, std::size_t end, std::size_t step = 1);
+    // Removes dim, which must have size 1
+    std::shared_ptr<Tensor> squeeze(std::size_t dim);
+    // Inserts a dimension of size 1 at dim
+    std::shared_ptr<Tensor> unsqueeze(std::size_t dim);
+    // This tensor if its elements are row-major without gaps, else a copy that is
+    std::shared_ptr<Tensor> contiguous();
+    bool is_contiguous() const;
+    // Whether another tensor may see these elements: this is a view or has views
+    bool shares_storage() const;
+
+    // Stacks equally shaped tensors along a new leading batch dimension,
+    // e.g. N images [C,H,W] -> [N,C,H,W].
+    static std::shared_ptr<Tensor> stack(const std::vector<std::shared_ptr<Tensor>> &tensors);
     
     // 3D access
 float& operator()(size_t i, size_t j, size_t k) {
-    size_t H = _shape[1];
-    size_t W = _shape[2];
-    return _data[i*H*W + j*W + k];
+    return (*_storage)[_offset + i * _stride[0] + j * _stride[1] + k * _stride[2]];
 }
 
 const float& operator()(size_t i, size_t j, size_t k) const {
-    size_t H = _shape[1];
-    size_t W = _shape[2];
-    return _data[i*H*W + j*W + k];
+    return (*_storage)[_offset + i * _stride[0] + j * _stride[1] + k * _stride[2]];
 }
 
 // 4D access
 float& operator()(size_t i, size_t j, size_t k, size_t l) {
-    size_t C = _shape[1];
-    size_t H = _shape[2];
-    size_t W = _shape[3];
-    return _data[i*C*H*W + j*H*W + k*W + l];
+    return (*_storage)[_offset + i * _stride[0] + j * _stride[1] + k * _stride[2] + l * _stride[3]];
 }
 
 const float& operator()(size_t i, size_t j, size_t k, size_t l) const {
-    size_t C = _shape[1];
-    size_t H = _shape[2];
-    size_t W = _shape[3];
-    return _data[i*C*H*W + j*H*W + k*W + l];
+    return (*_storage)[_offset + i * _stride[0] + j * _stride[1] + k * _stride[2] + l * _stride[3]];
 }
 
     friend std::ostream &operator<<(std::ostream &os, const Tensor &obj);
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Elements per task for cheap elementwise loops (relu, gradient accumulation, ...)
+constexpr std::size_t ELEMENTWISE_GRAIN = 1 << 14;
+
+// Persistent pool of worker threads used for intra-op parallelism.
+//
+// parallel_for splits a range into chunks and deals them round-robin onto
+// per-worker deques; idle workers steal from the back of other deques. The
+// calling thread works on chunks too until the whole range is done, so a pool
+// of size n runs n - 1 background threads. Calls made from inside a pool task
+// run inline, which keeps nested kernels (e.g. a GEMM inside a per-sample
+// task) from oversubscribing the machine.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Total threads taking part in a parallel_for, including the caller
+    std::size_t size() const;
+
+    // Calls fn(chunk_begin, chunk_end) over disjoint chunks covering [begin, end).
+    // Chunks hold at least `grain` iterations. The first exception thrown by a
+    // chunk is rethrown here once every chunk has finished.
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+                      const std::function<void(std::size_t, std::size_t)> &fn);
+
+private:
+    struct Job;
+    struct Task
+    {
+        Job *job;
+        std::size_t begin;
+        std::size_t end;
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop(std::size_t queue, Task &task);
+    bool steal(std::size_t thief, Task &task);
+    static void run(const Task &task);
+    void worker_loop(std::size_t index);
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _workers;
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    std::atomic<std::size_t> _pending{0};
+    std::atomic<std::size_t> _next_queue{0};
+    bool _stop = false;
+};
+
+// Process-wide pool shared by all kernels. Its size defaults to the
+// DL_NUM_THREADS environment variable, or the hardware concurrency.
+ThreadPool &thread_pool();
+
+// Resizes the shared pool. Must not be called while kernels are running.
+void set_num_threads(std::size_t num_threads);
+std::size_t get_num_threads();
+
+// parallel_for on the shared pool
+void parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+                  const std::function<void(std::size_t, std::size_t)> &fn);
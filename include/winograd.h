@@ -0,0 +1,73 @@
+#pragma once
+#include "im2col.h"
+#include "storage.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Winograd minimal filtering for 3x3, stride 1 convolutions (Lavin & Gray,
+// "Fast Algorithms for Convolutional Neural Networks").
+//
+// F(m x m, 3 x 3) computes an m x m output tile from an (m + 2) x (m + 2)
+// input tile with (m + 2)^2 multiplies per channel pair instead of 9 m^2:
+// 2.25x fewer for F(2x2, 3x3), 4x fewer for F(4x4, 3x3). Filters and input
+// tiles are moved into the transform domain, where the convolution is an
+// elementwise product summed over input channels; done for all tiles at
+// once, that is one GEMM per transform-domain position xi:
+//   M[xi][C_out, tiles] = U[xi][C_out, C_in] x V[xi][C_in, tiles]
+// and the output transform folds every M tile back to m x m outputs.
+// F(4x4, 3x3) saves more multiplies but its transforms round more; both stay
+// within float accuracy for 3x3 filters.
+
+// Output tile size for a 3x3, stride 1 convolution of this geometry with
+// c_out output channels: 4 or 2 where Winograd beats the im2col GEMM, 0 where
+// the layer should stay on the GEMM (other kernels and strides, few channels,
+// or padding beyond 2).
+std::size_t winograd_tile(const ConvGeometry &g, std::size_t c_out);
+
+// Floats of the transformed filters U of a c_out x c_in layer
+std::size_t winograd_filter_size(std::size_t c_out, std::size_t c_in, std::size_t m);
+
+// U[(m + 2)^2][c_out][c_in] from a float weight [c_out, c_in, 3, 3]. With
+// flip the filters are rotated by 180 degrees and the channels swapped, so U
+// is that of the [c_in, c_out, 3, 3] layer whose convolution is the gradient
+// of this one's input (see conv2D.cpp).
+void winograd_filter_transform(const float *weight, std::size_t c_out, std::size_t c_in, std::size_t m,
+                               bool flip, float *U);
+
+// Floats of scratch one winograd_conv call needs
+std::size_t winograd_scratch_size(const ConvGeometry &g, std::size_t c_out, std::size_t m);
+
+// out[c_out, out_height, out_width] = conv(image) + bias for one image,
+// overwriting out. bias may be null. g must be a 3x3, stride 1 geometry.
+void winograd_conv(const float *image, const ConvGeometry &g, const float *U, std::size_t c_out,
+                   std::size_t m, const float *bias, float *out, float *scratch);
+
+// Transformed filters of one layer, kept until its weights change. Every get()
+// compares the weights with the bytes the cached filters came from, a pass
+// over the weights where a convolution makes one per output pixel, so
+// optimizer steps, load_state_dict and dtype changes are all picked up.
+class WinogradFilters
+{
+public:
+    // U for tile m of weight [c_out, c_in, 3, 3] in any dtype; flip as in
+    // winograd_filter_transform. Thread safe.
+    std::shared_ptr<const std::vector<float>> get(const Storage &weight, std::size_t c_out, std::size_t c_in,
+                                                  std::size_t m, bool flip);
+
+private:
+    // Buffers are reused while the weights change every step: U is
+    // rewritten in place unless a caller still holds it
+    struct Entry
+    {
+        std::vector<unsigned char> source; // weight bytes U was transformed from
+        DType dtype = DType::Float32;
+        std::size_t m = 0;
+        std::shared_ptr<std::vector<float>> U;
+        std::vector<float> widened; // 16-bit weights as float, for the transform
+    };
+
+    std::mutex _mutex;
+    Entry _entries[2]; // plain, flipped
+};
@@ -0,0 +1,38 @@
+#include "../include/adam.h"
+#include "../include/gemm_kernels.h"
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+Adam::Adam(Params params, float lr, float beta1, float beta2, float eps, float weight_decay)
+    : Optimizer(std::move(params), lr), _beta1(beta1), _beta2(beta2), _eps(eps), _weight_decay(weight_decay)
+{
+    if (!(beta1 >= 0.0f && beta1 < 1.0f) || !(beta2 >= 0.0f && beta2 < 1.0f))
+    {
+        throw std::invalid_argument("Adam: betas must be in [0, 1).");
+    }
+    _m = Storage(numel());
+    _v = Storage(numel());
+}
+
+void Adam::begin_step()
+{
+    _t++;
+    _step_size = _learning_rate / (1.0f - (float)std::pow((double)_beta1, (double)_t));
+    _inv_bias2 = 1.0f / (float)std::sqrt(1.0 - std::pow((double)_beta2, (double)_t));
+}
+
+void Adam::update(float *values, const float *grad, std::size_t offset, std::size_t n)
+{
+    // L2 folds the decay into the gradient; AdamW shrinks the weights directly
+    AdamStep step{_grad_scale, _beta1, _beta2, _eps, _step_size, _inv_bias2,
+                  _decoupled ? 0.0f : _weight_decay,
+                  _decoupled ? 1.0f - _learning_rate * _weight_decay : 1.0f};
+    optimizer_kernels().adam(values, grad, _m.data() + offset, _v.data() + offset, n, step);
+}
+
+AdamW::AdamW(Params params, float lr, float beta1, float beta2, float eps, float weight_decay)
+    : Adam(std::move(params), lr, beta1, beta2, eps, weight_decay)
+{
+    _decoupled = true;
+}
@@ -0,0 +1,285 @@
+#include "../include/data_parallel.h"
+#include "../include/grad_mode.h"
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+std::vector<std::shared_ptr<Tensor>> parameter_list(const Module &module)
+{
+    std::vector<std::shared_ptr<Tensor>> params;
+    for (const auto &p : module.parameters())
+    {
+        params.push_back(p.second);
+    }
+    return params;
+}
+
+// dst += src over whole gradient arenas
+void add_into(Storage &dst, const Storage &src)
+{
+    parallel_for(0, dst.size(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            dst[i] += src[i];
+        }
+    });
+}
+
+bool same_dtypes(const std::vector<std::shared_ptr<Tensor>> &a, const std::vector<std::shared_ptr<Tensor>> &b)
+{
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i]->dtype() != b[i]->dtype())
+            return false;
+    }
+    return true;
+}
+
+// Rows [begin, end) of a batched tensor, as a view without a graph
+std::shared_ptr<Tensor> slice_rows(const std::shared_ptr<Tensor> &batch, std::size_t begin, std::size_t end)
+{
+    NoGradGuard no_grad;
+    return batch->slice(0, begin, end);
+}
+
+// Shard outputs joined back into one batch, without a graph
+std::shared_ptr<Tensor> concat_rows(const std::vector<std::shared_ptr<Tensor>> &parts, std::size_t batch)
+{
+    std::vector<std::size_t> shape = parts[0]->shape();
+    std::size_t row = parts[0]->numel() / shape[0];
+    Storage rows(batch * row);
+    float *dst = rows.data();
+    for (const auto &part : parts)
+    {
+        dst = std::copy(part->data().begin(), part->data().end(), dst);
+    }
+    shape[0] = batch;
+    return std::make_shared<Tensor>(std::move(rows), shape);
+}
+} // namespace
+
+DataParallel::DataParallel(ModelFactory factory, std::size_t n_replicas)
+{
+    if (n_replicas == 0)
+    {
+        n_replicas = get_num_threads();
+    }
+    _master = factory();
+    _master->flatten_parameters();
+    _master_params = parameter_list(*_master);
+    for (std::size_t r = 0; r < n_replicas; r++)
+    {
+        _replicas.push_back(factory());
+        _replicas.back()->flatten_parameters();
+        _replica_params.push_back(parameter_list(*_replicas.back()));
+
+        const auto &params = _replica_params.back();
+        if (params.size() != _master_params.size())
+        {
+            throw std::runtime_error("DataParallel factory built models with different parameter lists");
+        }
+        for (std::size_t i = 0; i < params.size(); i++)
+        {
+            if (params[i]->shape() != _master_params[i]->shape())
+            {
+                throw std::runtime_error("DataParallel replica parameter " + std::to_string(i) +
+                                         " does not match the master's shape");
+            }
+        }
+    }
+    sync_replicas();
+}
+
+std::shared_ptr<Module> DataParallel::module() const { return _master; }
+
+std::size_t DataParallel::replicas() const { return _replicas.size(); }
+
+void DataParallel::train(bool mode)
+{
+    _master->train(mode);
+    for (auto &replica : _replicas)
+    {
+        replica->train(mode);
+    }
+}
+
+void DataParallel::eval() { train(false); }
+
+void DataParallel::set_capture(bool enabled)
+{
+    _capture = enabled;
+    _steps.clear();
+    if (enabled)
+    {
+        _steps.resize(_replicas.size());
+    }
+}
+
+std::vector<DataParallel::Shard> DataParallel::make_shards(std::size_t batch) const
+{
+    std::size_t n = std::min(batch, _replicas.size());
+    std::vector<Shard> shards;
+    std::size_t start = 0;
+    for (std::size_t r = 0; r < n; r++)
+    {
+        std::size_t size = batch / n + (r < batch % n ? 1 : 0);
+        shards.push_back({start, start + size});
+        start += size;
+    }
+    return shards;
+}
+
+void DataParallel::sync_replicas()
+{
+    parallel_for(0, _replicas.size(), 1, [&](std::size_t r_begin, std::size_t r_end)
+    {
+        for (std::size_t r = r_begin; r < r_end; r++)
+        {
+            // one copy of the whole arena while the layouts agree, i.e. until
+            // the master's dtype is changed on its own
+            if (_master->flat_data().size() == _replicas[r]->flat_data().size() &&
+                same_dtypes(_master_params, _replica_params[r]))
+            {
+                _replicas[r]->flat_data() = _master->flat_data();
+                continue;
+            }
+            for (std::size_t i = 0; i < _master_params.size(); i++)
+            {
+                _replica_params[r][i]->data() = _master_params[i]->data();
+            }
+        }
+    });
+}
+
+void DataParallel::reduce_gradients(std::size_t n)
+{
+    // Pairwise tree: at each level replica r absorbs replica r + stride, with
+    // all pairs of a level reduced concurrently. log2(n) levels in total.
+    for (std::size_t stride = 1; stride < n; stride *= 2)
+    {
+        std::size_t n_pairs = (n + 2 * stride - 1) / (2 * stride);
+        parallel_for(0, n_pairs, 1, [&](std::size_t p_begin, std::size_t p_end)
+        {
+            for (std::size_t p = p_begin; p < p_end; p++)
+            {
+                std::size_t dst = p * 2 * stride;
+                std::size_t src = dst + stride;
+                if (src >= n)
+                {
+                    continue;
+                }
+                add_into(_replicas[dst]->flat_grad(), _replicas[src]->flat_grad());
+            }
+        });
+    }
+
+    // per parameter, which honours a lazy zero_grad on the master
+    for (std::size_t i = 0; i < _master_params.size(); i++)
+    {
+        _master_params[i]->add_to_grad(_replica_params[0][i]->grad());
+    }
+}
+
+ParallelStep DataParallel::forward_backward(std::shared_ptr<Tensor> inputs,
+                                            const std::vector<std::size_t> &targets,
+                                            Loss &criterion)
+{
+    if (inputs->shape().empty() || inputs->shape()[0] != targets.size())
+    {
+        throw std::runtime_error("DataParallel expects one target per row of the input batch");
+    }
+    if (!GradMode::is_enabled())
+    {
+        throw std::runtime_error("DataParallel::forward_backward called with grad mode disabled");
+    }
+    std::size_t batch = targets.size();
+    std::vector<Shard> shards = make_shards(batch);
+    std::vector<float> losses(shards.size());
+    std::vector<std::shared_ptr<Tensor>> outputs(shards.size());
+
+    // Each shard loss divides by its own normalizer (row count, or sum of
+    // target weights for a weighted loss); scaling it by its share of the
+    // batch normalizer turns the sum of shard losses into the batch loss
+    std::vector<float> shares(shards.size());
+    float total = criterion.normalizer(targets);
+    for (std::size_t r = 0; r < shards.size(); r++)
+    {
+        std::vector<std::size_t> shard_targets(targets.begin() + shards[r].begin, targets.begin() + shards[r].end);
+        shares[r] = criterion.normalizer(shard_targets) / total;
+    }
+
+    sync_replicas();
+
+    parallel_for(0, shards.size(), 1, [&](std::size_t r_begin, std::size_t r_end)
+    {
+        for (std::size_t r = r_begin; r < r_end; r++)
+        {
+            const Shard &shard = shards[r];
+            _replicas[r]->zero_grad();
+
+            auto x = slice_rows(inputs, shard.begin, shard.end);
+            std::vector<std::size_t> shard_targets(targets.begin() + shard.begin, targets.begin() + shard.end);
+            if (_capture)
+            {
+                if (!_steps[r] || &_steps[r]->criterion() != &criterion)
+                {
+                    _steps[r] = std::make_unique<CapturedStep>(*_replicas[r], criterion);
+                }
+                losses[r] = _steps[r]->run(x, shard_targets);
+                outputs[r] = _steps[r]->output();
+            }
+            else
+            {
+                outputs[r] = _replicas[r]->forward(x);
+                auto loss = criterion(outputs[r], shard_targets);
+                loss->backward();
+                losses[r] = loss->item();
+            }
+
+            for (float &g : _replicas[r]->flat_grad())
+            {
+                g *= shares[r];
+            }
+        }
+    });
+
+    reduce_gradients(shards.size());
+
+    ParallelStep step{0.0f, nullptr};
+    for (std::size_t r = 0; r < shards.size(); r++)
+    {
+        step.loss += losses[r] * shares[r];
+    }
+    step.output = concat_rows(outputs, batch);
+    return step;
+}
+
+std::shared_ptr<Tensor> DataParallel::forward(std::shared_ptr<Tensor> inputs)
+{
+    if (inputs->shape().empty())
+    {
+        throw std::runtime_error("DataParallel expects a batched input");
+    }
+    std::size_t batch = inputs->shape()[0];
+    std::vector<Shard> shards = make_shards(batch);
+    std::vector<std::shared_ptr<Tensor>> outputs(shards.size());
+    // grad mode is per thread; carry the caller's into the replica tasks
+    bool grad_enabled = GradMode::is_enabled();
+
+    sync_replicas();
+
+    parallel_for(0, shards.size(), 1, [&](std::size_t r_begin, std::size_t r_end)
+    {
+        GradModeGuard mode(grad_enabled);
+        for (std::size_t r = r_begin; r < r_end; r++)
+        {
+            outputs[r] = _replicas[r]->forward(slice_rows(inputs, shards[r].begin, shards[r].end));
+        }
+    });
+
+    return concat_rows(outputs, batch);
+}
@@ -1,14 +1,18 @@
 #include "../include/linear.h"
+#include "../include/grad_mode.h"
+#include "../include/gemm.h"
+#include "../include/graph_capture.h"
 #include <vector>
 #include <cmath>
 #include <random>
 #include <functional>
 #include <stdexcept>
+#include <algorithm>
 
 Linear::Linear(std::size_t in_features, std::size_t out_features, std::size_t seed)
     : _in_features(in_features), _out_features(out_features)
 {
-    std::vector<float> w(_in_features * _out_features);
+    Storage w(_in_features * _out_features);
     
     float limit = sqrt(6.0f / (_in_features + _out_features));
     std::mt19937 generator(seed);
@@ -18,10 +22,10 @@ Linear::Linear(std::size_t in_features, std::size_t out_features, std::size_t se
         w[i] = distribution(generator);
     }
     
-    std::vector<float> b(_out_features, 0.0f);
+    Storage b(_out_features, 0.0f);
 
-    _weight = std::make_shared<Tensor>(w, std::vector<std::size_t>{_out_features, _in_features}, true);
-    _bias = std::make_shared<Tensor>(b, std::vector<std::size_t>{_out_features}, true);
+    _weight = std::make_shared<Tensor>(std::move(w), std::vector<std::size_t>{_out_features, _in_features}, true);
+    _bias = std::make_shared<Tensor>(std::move(b), std::vector<std::size_t>{_out_features}, true);
 
     register_parameter("weight", _weight);
     register_parameter("bias", _bias);
@@ -31,65 +35,97 @@ void Linear::reset_parameters() {}
 
 std::shared_ptr<Tensor> Linear::forward(std::shared_ptr<Tensor> input)
 {
-    // Input is flattened 
-    if (input->numel() != _in_features) {
+    // Input is either one flattened sample [In] or a batch of them [N, In]
+    const auto& in_shape = input->shape();
+    bool batched = in_shape.size() == 2 && in_shape[1] == _in_features;
+    std::size_t N = batched ? in_shape[0] : 1;
+
+    if (!batched && input->numel() != _in_features) {
          throw std::runtime_error("Linear input size mismatch. Expected " + 
              std::to_string(_in_features) + " but got " + std::to_string(input->numel()));
     }
 
-    // Prepare Output
-    std::vector<float> out(_out_features);
-    const auto& in_data = input->data();
-    const auto& w_data = _weight->data();
-    const auto& b_data = _bias->data();
+    // Forward Pass: Y = X * W^T + B. W as [Out, In] so every output is a dot product with a row
+    auto compute = [input, weight=_weight, bias=_bias, N, in_f=_in_features, out_f=_out_features](Storage &out)
+    {
+        const auto& in_data = input->data();
+        const auto& w_data = weight->data();
+        const auto& b_data = bias->data();
 
-    // Forward Pass: Y = W * X + B. W as [Out, In] to dot-product the rows
-    for (size_t i = 0; i < _out_features; i++) {
-        float sum = b_data[i];
-        for (size_t j = 0; j < _in_features; j++) {
-            
-            sum += w_data[i * _in_features + j] * in_data[j];
+        // the weight may be 16-bit (Module::to); the kernels widen it as they load
+        if (N == 1) {
+            sgemv_mixed(false, out_f, in_f, 1.0f, w_data.raw(), w_data.dtype(), in_f,
+                        in_data.data(), 0.0f, out.data());
+            for (size_t i = 0; i < out_f; i++)
+                out[i] += b_data[i];
+        } else {
+            for (size_t n = 0; n < N; n++)
+                std::copy(b_data.begin(), b_data.end(), out.begin() + n * out_f);
+            sgemm_mixed(false, true, N, out_f, in_f,
+                        1.0f, in_data.data(), DType::Float32, in_f, w_data.raw(), w_data.dtype(), in_f,
+                        1.0f, out.data(), out_f);
         }
-        out[i] = sum;
-    }
+    };
+
+    // Prepare Output
+    Storage out(N * _out_features);
+    compute(out);
+
+    std::vector<std::size_t> out_shape{_out_features};
+    if (batched)
+        out_shape = {N, _out_features};
 
     // Backward Pass
-    if (input->requires_grad()) {
+    if (GradMode::is_enabled() &&
+        (input->requires_grad() || _weight->requires_grad() || _bias->requires_grad())) {
 
         std::vector<std::shared_ptr<Tensor>> parents = {input, _weight, _bias};
         
         // gradients by value/shared_ptr
-        std::function<void(const std::vector<float>&)> gradfn = [input, weight=_weight, bias=_bias, in_f=_in_features, out_f=_out_features]
-            (const std::vector<float>& grad_output) 
+        GradFn gradfn = [input, weight=_weight, bias=_bias, N, in_f=_in_features, out_f=_out_features]
+            (const Storage &grad_output) 
         {
-            std::vector<float> grad_input(in_f, 0.0f);
-            std::vector<float> grad_weight(weight->numel(), 0.0f);
-          
-            std::vector<float> grad_bias = grad_output; 
+            Storage grad_input(input->requires_grad() ? N * in_f : 0, 0.0f);
+            Storage grad_weight(weight->numel(), 0.0f);
+            Storage grad_bias(out_f, 0.0f);
             
             const auto& in_vals = input->data();
             const auto& w_vals = weight->data();
 
-            for (size_t i = 0; i < out_f; i++) {
-                float g = grad_output[i];
-                
-                for (size_t j = 0; j < in_f; j++) {
-                    // dL/dW_ij = input_j * grad_output_i
-                    grad_weight[i * in_f + j] = in_vals[j] * g;
+            for (size_t n = 0; n < N; n++)
+                for (size_t i = 0; i < out_f; i++)
+                    grad_bias[i] += grad_output[n * out_f + i];
 
-                    // dL/dX_j += W_ij * grad_output_i
-                    // This sends the gradient back to the CNN!
-                    grad_input[j] += w_vals[i * in_f + j] * g;
-                }
+            if (N == 1) {
+                // dL/dW = grad_output (outer) input
+                sger(out_f, in_f, 1.0f, grad_output.data(), in_vals.data(), grad_weight.data(), in_f);
+                // dL/dX = W^T * grad_output. This sends the gradient back to the CNN!
+                if (!grad_input.empty())
+                    sgemv_mixed(true, out_f, in_f, 1.0f, w_vals.raw(), w_vals.dtype(), in_f,
+                                grad_output.data(), 0.0f, grad_input.data());
+            } else {
+                // dL/dW = grad_output^T[Out, N] * X[N, In], summed over the batch by the GEMM
+                sgemm(true, false, out_f, in_f, N,
+                      1.0f, grad_output.data(), out_f, in_vals.data(), in_f,
+                      0.0f, grad_weight.data(), in_f);
+                // dL/dX = grad_output[N, Out] * W[Out, In]
+                if (!grad_input.empty())
+                    sgemm_mixed(false, false, N, in_f, out_f,
+                                1.0f, grad_output.data(), DType::Float32, out_f, w_vals.raw(), w_vals.dtype(), in_f,
+                                0.0f, grad_input.data(), in_f);
             }
             
             // Push gradients to parents
-            input->add_to_grad(grad_input);
-            weight->add_to_grad(grad_weight);
-            bias->add_to_grad(grad_bias);
+            input->add_to_grad(std::move(grad_input));
+            weight->add_to_grad(std::move(grad_weight));
+            bias->add_to_grad(std::move(grad_bias));
         };
 
-        return std::make_shared<Tensor>(out, std::vector<std::size_t>{_out_features}, true, gradfn, parents);
+        auto result = std::make_shared<Tensor>(std::move(out), out_shape, true, gradfn, parents);
+        if (CaptureMode::is_active()) {
+            result->set_forwardfn(compute);
+        }
+        return result;
     }
-    return std::make_shared<Tensor>(out, std::vector<std::size_t>{_out_features});
-}
\ No newline at end of file
+    return std::make_shared<Tensor>(std::move(out), out_shape);
+}
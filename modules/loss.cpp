@@ -1,10 +1,14 @@
 #include "../include/loss.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
 #include "../include/module.h"
-#include "../include/softmax.h"
 #include "../include/tensor.h"
 #include <algorithm>
 #include <cmath>
 #include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
 std::shared_ptr<Tensor> Loss::forward(std::shared_ptr<Tensor> input)
 {
@@ -21,6 +25,42 @@ std::shared_ptr<Tensor> Loss::operator()(std::shared_ptr<Tensor> input, std::siz
     return forward(input, target);
 }
 
+std::shared_ptr<Tensor> Loss::forward(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets)
+{
+    throw std::runtime_error("Batched forward not implemented.");
+}
+
+std::shared_ptr<Tensor> Loss::operator()(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets)
+{
+    return forward(input, targets);
+}
+
+float Loss::normalizer(const std::vector<std::size_t> &targets) const
+{
+    return (float)targets.size();
+}
+
+// Checks a batched [N, Classes] input against its targets
+static void check_batch(const std::shared_ptr<Tensor> &input, const std::vector<std::size_t> &targets, const std::string &name)
+{
+    if (input->shape().size() != 2)
+    {
+        throw std::runtime_error(name + " expects a 2d [batch, classes] input tensor.");
+    }
+    if (input->shape()[0] != targets.size())
+    {
+        throw std::runtime_error(name + " got " + std::to_string(targets.size()) + " targets for a batch of " +
+                                 std::to_string(input->shape()[0]));
+    }
+    for (std::size_t target : targets)
+    {
+        if (target >= input->shape()[1])
+        {
+            throw std::runtime_error(name + " target out of bounds.");
+        }
+    }
+}
+
 std::shared_ptr<Tensor> NLLLoss::forward(std::shared_ptr<Tensor> input, std::size_t target)
 {
     if (input->shape().size() != 1)
@@ -35,19 +75,19 @@ std::shared_ptr<Tensor> NLLLoss::forward(std::shared_ptr<Tensor> input, std::siz
     float prob = std::max((*input)(target), 1e-12f);
     float loss = -std::log(prob);
 
-    if (input->requires_grad())
+    if (GradMode::is_enabled() && input->requires_grad())
 {
     std::vector<std::shared_ptr<Tensor>> parents{input};
 
-    std::function<void(const std::vector<float>&)> gradfn = [input, target](const std::vector<float>& grad_output)
+    GradFn gradfn = [input, target](const Storage &grad_output)
     {
-        std::vector<float> grad_input(input->numel(), 0.0f);
+        Storage grad_input(input->numel(), 0.0f);
 
         float eps = 1e-9f;
         grad_input[target] =
             grad_output[0] * (-1.0f / std::max((*input)(target), eps));
 
-        input->add_to_grad(grad_input);
+        input->add_to_grad(std::move(grad_input));
     };
 
     return std::make_shared<Tensor>(loss, true, gradfn, parents);
@@ -57,6 +97,51 @@ return std::make_shared<Tensor>(loss);
 
     }
 
+std::shared_ptr<Tensor> NLLLoss::forward(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets)
+{
+    check_batch(input, targets, "NLLLoss");
+    std::size_t N = input->shape()[0];
+    std::size_t C = input->shape()[1];
+    const Storage &probs = input->data();
+
+    float loss = 0.0f;
+    for (std::size_t n = 0; n < N; n++)
+    {
+        loss -= std::log(std::max(probs[n * C + targets[n]], 1e-12f));
+    }
+    loss /= N;
+
+    if (GradMode::is_enabled() && input->requires_grad())
+    {
+        std::vector<std::shared_ptr<Tensor>> parents{input};
+
+        GradFn gradfn = [input, targets, N, C](const Storage &grad_output)
+        {
+            Storage grad_input(input->numel(), 0.0f);
+            const Storage &probs = input->data();
+
+            float eps = 1e-9f;
+            for (std::size_t n = 0; n < N; n++)
+            {
+                std::size_t idx = n * C + targets[n];
+                grad_input[idx] = grad_output[0] * (-1.0f / std::max(probs[idx], eps)) / N;
+            }
+            input->add_to_grad(std::move(grad_input));
+        };
+        return std::make_shared<Tensor>(loss, true, std::move(gradfn), parents);
+    }
+    return std::make_shared<Tensor>(loss);
+}
+
+CrossEntropyLoss::CrossEntropyLoss(std::vector<float> class_weights, float label_smoothing)
+    : _class_weights(std::move(class_weights)), _label_smoothing(label_smoothing)
+{
+    if (!(label_smoothing >= 0.0f && label_smoothing <= 1.0f))
+    {
+        throw std::invalid_argument("CrossEntropyLoss label_smoothing must be in [0, 1].");
+    }
+}
+
 std::shared_ptr<Tensor> CrossEntropyLoss::forward(std::shared_ptr<Tensor> input, std::size_t target)
 {
     if (input->shape().size() != 1)
@@ -67,9 +152,159 @@ std::shared_ptr<Tensor> CrossEntropyLoss::forward(std::shared_ptr<Tensor> input,
     {
         throw std::runtime_error("CrossEntropyLoss target out of bounds.");
     }
-    Softmax softmax;
-    NLLLoss nll_loss;
-    std::shared_ptr<Tensor> softmax_output = softmax(input);
-    return nll_loss(softmax_output, target);
+    // a batch of one, through a view of the logits
+    return fused(input->reshape({1, input->numel()}), {target}, false);
 }
 
+std::shared_ptr<Tensor> CrossEntropyLoss::forward(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets)
+{
+    check_batch(input, targets, "CrossEntropyLoss");
+    return fused(input, targets, true);
+}
+
+float CrossEntropyLoss::normalizer(const std::vector<std::size_t> &targets) const
+{
+    if (_class_weights.empty())
+    {
+        return Loss::normalizer(targets);
+    }
+    float norm = 0.0f;
+    for (std::size_t target : targets)
+    {
+        if (target >= _class_weights.size())
+        {
+            throw std::runtime_error("CrossEntropyLoss target out of bounds.");
+        }
+        norm += _class_weights[target];
+    }
+    return norm;
+}
+
+std::shared_ptr<Tensor> CrossEntropyLoss::fused(std::shared_ptr<Tensor> input, const std::vector<std::size_t> &targets,
+                                                bool capturable)
+{
+    std::size_t N = input->shape()[0];
+    std::size_t C = input->shape()[1];
+    if (!_class_weights.empty() && _class_weights.size() != C)
+    {
+        throw std::runtime_error("CrossEntropyLoss has " + std::to_string(_class_weights.size()) +
+                                 " class weights for " + std::to_string(C) + " classes.");
+    }
+    input = input->contiguous();
+
+    // Softmax probabilities, targets and the weight normalizer are shared with
+    // the gradfn, so a captured step can refresh them on every replay
+    struct State
+    {
+        Storage probs;
+        std::vector<std::size_t> targets;
+        float norm = 0.0f; // sum of the target weights, N without weights
+    };
+    auto state = std::make_shared<State>();
+    state->probs = Storage(N * C);
+    state->targets = targets;
+
+    // Sample n contributes -sum_c a_c * log_softmax_c with a_c = w_c * q_c,
+    // q = (1 - e) * onehot + e / C the smoothed target distribution
+    std::vector<float> weights = _class_weights.empty() ? std::vector<float>(C, 1.0f) : _class_weights;
+    float smoothing = _label_smoothing;
+    float weight_sum = 0.0f;
+    for (float w : weights)
+        weight_sum += w;
+
+    // Row-wise softmax and the weighted negative log-likelihood in one pass,
+    // so the whole batch is a single autograd node
+    auto compute = [input, state, weights, smoothing, weight_sum, N, C]()
+    {
+        const Storage &logits = input->data();
+        float loss = 0.0f;
+        float norm = 0.0f;
+        for (std::size_t n = 0; n < N; n++)
+        {
+            const float *row = logits.data() + n * C;
+            float *p = state->probs.data() + n * C;
+            std::size_t t = state->targets[n];
+
+            float max_val = row[0];
+            for (std::size_t c = 1; c < C; c++)
+            {
+                if (row[c] > max_val) max_val = row[c];
+            }
+            float sum_exp = 0.0f;
+            for (std::size_t c = 0; c < C; c++)
+            {
+                p[c] = std::exp(row[c] - max_val);
+                sum_exp += p[c];
+            }
+            float inv = 1.0f / sum_exp;
+            for (std::size_t c = 0; c < C; c++)
+            {
+                p[c] *= inv;
+            }
+            // log softmax from the logits rather than from p, for stability
+            float shift = max_val + std::log(sum_exp);
+            loss -= (1.0f - smoothing) * weights[t] * (row[t] - shift);
+            if (smoothing > 0.0f)
+            {
+                float weighted = 0.0f;
+                for (std::size_t c = 0; c < C; c++)
+                {
+                    weighted += weights[c] * (row[c] - shift);
+                }
+                loss -= smoothing / C * weighted;
+            }
+            norm += weights[t];
+        }
+        state->norm = norm;
+        return loss / norm;
+    };
+    float loss = compute();
+
+    if (GradMode::is_enabled() && input->requires_grad())
+    {
+        std::vector<std::shared_ptr<Tensor>> parents{input};
+
+        GradFn gradfn = [input, state, weights, smoothing, weight_sum, N, C](const Storage &grad_output)
+        {
+            // d(loss)/d(logits) = (sum(a) * softmax - a) / norm, which is
+            // (softmax - onehot) / N without weights or smoothing
+            const Storage &probs = state->probs;
+            const std::vector<std::size_t> &targets = state->targets;
+            Storage grad_input(N * C);
+            float scale = grad_output[0] / state->norm;
+            float spread = smoothing / C;
+            for (std::size_t n = 0; n < N; n++)
+            {
+                std::size_t t = targets[n];
+                float total = (1.0f - smoothing) * weights[t] + spread * weight_sum;
+                const float *p = probs.data() + n * C;
+                float *g = grad_input.data() + n * C;
+                for (std::size_t c = 0; c < C; c++)
+                {
+                    g[c] = (total * p[c] - spread * weights[c]) * scale;
+                }
+                g[t] -= (1.0f - smoothing) * weights[t] * scale;
+            }
+            input->add_to_grad(std::move(grad_input));
+        };
+        auto result = std::make_shared<Tensor>(loss, true, std::move(gradfn), parents);
+        if (capturable && CaptureMode::is_active())
+        {
+            // targets is the capturing step's own buffer, rewritten before every replay
+            result->set_forwardfn([state, compute, &targets, N, C](Storage &out)
+            {
+                for (std::size_t n = 0; n < N; n++)
+                {
+                    if (targets[n] >= C)
+                    {
+                        throw std::runtime_error("CrossEntropyLoss target out of bounds.");
+                    }
+                    state->targets[n] = targets[n];
+                }
+                out[0] = compute();
+            });
+        }
+        return result;
+    }
+    return std::make_shared<Tensor>(loss);
+}
@@ -1,10 +1,26 @@
 #include "../include/module.h"
 #include "../include/tensor.h"
+#include <atomic>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+namespace
+{
+// Bumped by every registration anywhere, so a cached parameter list also
+// notices changes to submodules; starts above the caches' initial 0
+std::atomic<std::size_t> registration_epoch{1};
+
+std::size_t align_up(std::size_t bytes)
+{
+    return (bytes + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+}
+} // namespace
+
 std::shared_ptr<Tensor> Module::forward(std::shared_ptr<Tensor> input)
 {
     throw std::runtime_error("Forward not implemented");
@@ -22,6 +38,7 @@ void Module::register_parameter(std::string name, std::shared_ptr<Tensor> param)
         }
     }
     _parameters.push_back({name, param});
+    registration_epoch++;
 }
 
 void Module::register_module(std::string name, std::shared_ptr<Module> module)
@@ -34,15 +51,22 @@ void Module::register_module(std::string name, std::shared_ptr<Module> module)
         }
     }
     _modules.push_back({name, module});
+    registration_epoch++;
 }
 
-std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> Module::parameters() const
+const std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> &Module::parameters() const
 {
-    std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> params;
-    for (const auto &p : _parameters)
+    std::size_t epoch = registration_epoch;
+    if (_cache_epoch.load(std::memory_order_acquire) == epoch)
     {
-        params.push_back(p);
+        return _parameter_cache;
     }
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    if (_cache_epoch.load(std::memory_order_relaxed) == epoch)
+    {
+        return _parameter_cache;
+    }
+    std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> params(_parameters);
     for (const auto &m : _modules)
     {
         for (const auto &p : m.second->parameters())
@@ -51,7 +75,9 @@ std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> Module::parameters(
             params.push_back({full_name, p.second});
         }
     }
-    return params;
+    _parameter_cache = std::move(params);
+    _cache_epoch.store(epoch, std::memory_order_release);
+    return _parameter_cache;
 }
 
 std::unordered_map<std::string, std::shared_ptr<Tensor>> Module::state_dict() const
@@ -79,6 +105,104 @@ void Module::load_state_dict(std::unordered_map<std::string, std::shared_ptr<Ten
         {
             throw std::runtime_error("Parameter '" + p.first + "' has different shape in state_dict");
         }
-        p.second->data() = stored_param->data();
+        // copied into place, so a flattened parameter stays in its arena
+        Storage &data = p.second->data();
+        const Storage &values = stored_param->data();
+        if (values.dtype() == data.dtype())
+            data = values;
+        else
+            data.assign_from(values.to(DType::Float32).data());
+    }
+}
+
+void Module::to(DType dtype)
+{
+    for (const auto &p : parameters())
+    {
+        if (p.second->shape().size() >= 2)
+            p.second->set_dtype(dtype);
+    }
+    // the converted weights have left the arena and their slices changed size
+    if (is_flat())
+        flatten_parameters();
+}
+
+void Module::flatten_parameters()
+{
+    // a tensor registered under several names gets one slice
+    std::vector<Tensor *> params;
+    std::unordered_set<Tensor *> seen;
+    for (const auto &p : parameters())
+    {
+        if (seen.insert(p.second.get()).second)
+            params.push_back(p.second.get());
+    }
+
+    std::vector<std::size_t> data_offsets;
+    std::size_t data_bytes = 0;
+    std::size_t grad_size = 0;
+    for (Tensor *param : params)
+    {
+        data_offsets.push_back(data_bytes);
+        data_bytes = align_up(data_bytes + param->data().bytes());
+        grad_size += param->numel();
+    }
+
+    // zeroed, so the padding between parameters is too
+    auto flat_data = std::make_shared<Storage>(data_bytes / sizeof(float));
+    auto flat_grad = std::make_shared<Storage>(grad_size);
+    char *data_base = static_cast<char *>(flat_data->raw());
+    std::size_t grad_offset = 0;
+    for (std::size_t i = 0; i < params.size(); i++)
+    {
+        Tensor &param = *params[i];
+        std::size_t n = param.numel();
+        param.rebind(Storage::borrow(reinterpret_cast<float *>(data_base + data_offsets[i]), n, flat_data, param.dtype()),
+                     Storage::borrow(flat_grad->data() + grad_offset, n, flat_grad));
+        grad_offset += n;
+    }
+    _flat_data = std::move(flat_data);
+    _flat_grad = std::move(flat_grad);
+}
+
+bool Module::is_flat() const { return _flat_data != nullptr; }
+
+Storage &Module::flat_data()
+{
+    if (!_flat_data)
+        throw std::runtime_error("flat_data() needs flatten_parameters() first");
+    return *_flat_data;
+}
+
+Storage &Module::flat_grad()
+{
+    if (!_flat_grad)
+        throw std::runtime_error("flat_grad() needs flatten_parameters() first");
+    return *_flat_grad;
+}
+
+void Module::zero_grad()
+{
+    if (_flat_grad)
+    {
+        _flat_grad->fill(0.0f);
+        return;
     }
-}
\ No newline at end of file
+    for (const auto &p : parameters())
+    {
+        p.second->zero_grad();
+    }
+}
+
+void Module::train(bool mode)
+{
+    _training = mode;
+    for (const auto &m : _modules)
+    {
+        m.second->train(mode);
+    }
+}
+
+void Module::eval() { train(false); }
+
+bool Module::is_training() const { return _training; }
@@ -0,0 +1,209 @@
+#include "../include/optimizer.h"
+#include "../include/cpu_features.h"
+#include "../include/gemm_kernels.h"
+#include "../include/half.h"
+#include "../include/tensor.h"
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// ---- Portable scalar kernels ----
+
+void scalar_sgd(float *p, const float *g, float *buf, std::size_t n, const SGDStep &step)
+{
+    if (!buf)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            p[i] -= step.lr * (step.grad_scale * g[i] + step.weight_decay * p[i]);
+        return;
+    }
+    for (std::size_t i = 0; i < n; i++)
+    {
+        float gi = step.grad_scale * g[i] + step.weight_decay * p[i];
+        float b = step.momentum * buf[i] + gi;
+        buf[i] = b;
+        p[i] -= step.lr * (step.g_scale * gi + step.buf_scale * b);
+    }
+}
+
+void scalar_adam(float *p, const float *g, float *m, float *v, std::size_t n, const AdamStep &step)
+{
+    for (std::size_t i = 0; i < n; i++)
+    {
+        float gi = step.grad_scale * g[i] + step.l2 * p[i];
+        float mi = step.beta1 * m[i] + (1.0f - step.beta1) * gi;
+        float vi = step.beta2 * v[i] + (1.0f - step.beta2) * gi * gi;
+        m[i] = mi;
+        v[i] = vi;
+        p[i] = step.shrink * p[i] - step.step_size * mi / (std::sqrt(vi) * step.inv_bias2 + step.eps);
+    }
+}
+
+const OptimizerKernels scalar_kernels{"scalar", scalar_sgd, scalar_adam};
+
+const OptimizerKernels &select_kernels()
+{
+    const char *env = std::getenv("DL_SIMD");
+    std::string cap = env ? env : "";
+    const CpuFeatures &cpu = cpu_features();
+
+    if (cap.empty() || cap == "avx512")
+    {
+        const OptimizerKernels *k = optimizer_kernels_avx512();
+        if (k && cpu.avx512f)
+            return *k;
+    }
+    if (cap.empty() || cap == "avx512" || cap == "avx2")
+    {
+        const OptimizerKernels *k = optimizer_kernels_avx2();
+        if (k && cpu.avx2 && cpu.fma)
+            return *k;
+    }
+    return scalar_kernels;
+}
+
+// Takes 16-bit elements rewritten since the last step into the master
+void adopt_rewritten(const std::uint16_t *half, const std::uint16_t *written, float *master, std::size_t n,
+                     DType dtype)
+{
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (half[i] != written[i])
+            master[i] = dtype == DType::BFloat16 ? bf16_to_float(half[i]) : fp16_to_float(half[i]);
+    }
+}
+} // namespace
+
+const OptimizerKernels &optimizer_kernels()
+{
+    static const OptimizerKernels &k = select_kernels();
+    return k;
+}
+
+Optimizer::Optimizer(Params params, float lr)
+    : _learning_rate(lr), _params(std::move(params))
+{
+    _master.resize(_params.size());
+    _written.resize(_params.size());
+    _offsets.reserve(_params.size() + 1);
+    _offsets.push_back(0);
+    for (std::size_t p = 0; p < _params.size(); p++)
+    {
+        const Storage &data = _params[p].second->data();
+        _dtypes.push_back(data.dtype());
+        if (data.dtype() != DType::Float32)
+        {
+            _master[p] = data.to(DType::Float32);
+            _written[p] = data.to(data.dtype());
+        }
+        _offsets.push_back(_offsets.back() + data.size());
+    }
+}
+
+void Optimizer::set_accumulation_steps(std::size_t steps)
+{
+    if (steps == 0)
+    {
+        throw std::invalid_argument("Optimizer: accumulation steps must be at least 1.");
+    }
+    _accumulation_steps = steps;
+    _micro_step = 0;
+}
+
+bool Optimizer::step()
+{
+    if (++_micro_step < _accumulation_steps)
+    {
+        return false;
+    }
+    _micro_step = 0;
+    _grad_scale = 1.0f / _accumulation_steps;
+    begin_step();
+
+    // resolve every parameter's buffers once; the chunks only index them
+    struct Segment
+    {
+        float *values;
+        const float *grad;
+        std::uint16_t *half;    // the 16-bit parameter behind a master, or null
+        std::uint16_t *written; // what the last step rounded into half
+        DType dtype;
+    };
+    std::vector<Segment> segments(_params.size());
+    for (std::size_t p = 0; p < _params.size(); p++)
+    {
+        Tensor &param = *_params[p].second;
+        // update() would run over a buffer of the wrong element size
+        if (param.data().dtype() != _dtypes[p] || param.numel() != _offsets[p + 1] - _offsets[p])
+        {
+            throw std::runtime_error("Optimizer: parameter " + _params[p].first + " is now " +
+                                     std::to_string(param.numel()) + " " + dtype_name(param.data().dtype()) +
+                                     " values, it was " + std::to_string(_offsets[p + 1] - _offsets[p]) + " " +
+                                     dtype_name(_dtypes[p]) + " when the optimizer was built.");
+        }
+        const Storage &grad = param.grad();
+        if (grad.size() != param.numel())
+        {
+            segments[p].grad = nullptr;
+            continue;
+        }
+        Storage &master = _master[p];
+        Storage &data = param.data();
+        segments[p].values = master.empty() ? data.data() : master.data();
+        segments[p].grad = grad.data();
+        segments[p].half = master.empty() ? nullptr : static_cast<std::uint16_t *>(data.raw());
+        segments[p].written = master.empty() ? nullptr : _written[p].half_data();
+        segments[p].dtype = data.dtype();
+    }
+
+    // One pass over the flat index space; a chunk may span several parameters
+    parallel_for(0, numel(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+    {
+        std::size_t p = std::upper_bound(_offsets.begin(), _offsets.end(), begin) - _offsets.begin() - 1;
+        for (; begin < end; p++)
+        {
+            std::size_t stop = std::min(end, _offsets[p + 1]);
+            const Segment &segment = segments[p];
+            if (segment.grad)
+            {
+                std::size_t local = begin - _offsets[p];
+                std::size_t n = stop - begin;
+                std::uint16_t *half = segment.half ? segment.half + local : nullptr;
+                std::uint16_t *written = segment.half ? segment.written + local : nullptr;
+                if (half && std::memcmp(half, written, n * sizeof(std::uint16_t)) != 0)
+                    adopt_rewritten(half, written, segment.values + local, n, segment.dtype);
+                update(segment.values + local, segment.grad + local, begin, n);
+                if (half)
+                {
+                    float_to_half(segment.values + local, half, n, segment.dtype);
+                    std::memcpy(written, half, n * sizeof(std::uint16_t));
+                }
+            }
+            begin = stop;
+        }
+    });
+    return true;
+}
+
+void Optimizer::zero_grad(bool lazy)
+{
+    // mid-accumulation the gradients keep adding up
+    if (_micro_step != 0)
+    {
+        return;
+    }
+    for (auto &param : _params)
+    {
+        param.second->zero_grad(lazy);
+    }
+}
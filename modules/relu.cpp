@@ -1,51 +1,75 @@
 #include "../include/relu.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
 #include "../include/tensor.h"
+#include "../include/thread_pool.h"
 #include <functional>
 #include <memory>
 #include <vector>
 
 std::shared_ptr<Tensor> Relu::forward(std::shared_ptr<Tensor> input)
 {
-    // Access raw flat data (works for 1D, 2D, 3D, 4D)
-    const std::vector<float>& in_data = input->data();
-    std::vector<float> out_data;
-    out_data.reserve(in_data.size());
-
-    // ReLU element-wise
-    for (const float& val : in_data)
+    // No graph will reference an input that needs no grad, so if nobody else
+    // holds it either (e.g. the temporary output of the previous layer under a
+    // NoGradGuard) and no view shares its storage, it is rectified in place
+    // instead of copied
+    if (!input->requires_grad() && input.use_count() == 1 && !input->shares_storage())
     {
-        out_data.push_back(val > 0.0f ? val : 0.0f);
+        Storage &data = input->data();
+        parallel_for(0, data.size(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; i++)
+            {
+                data[i] = data[i] > 0.0f ? data[i] : 0.0f;
+            }
+        });
+        return input;
     }
 
+    // ReLU element-wise on the raw flat data (works for 1D, 2D, 3D, 4D), in chunks across threads
+    auto compute = [input](Storage &out_data)
+    {
+        const Storage &in_data = input->data();
+        parallel_for(0, in_data.size(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; i++)
+            {
+                out_data[i] = in_data[i] > 0.0f ? in_data[i] : 0.0f;
+            }
+        });
+    };
+    Storage out_data(input->numel());
+    compute(out_data);
+
     // Gradient
-    if (input->requires_grad())
+    if (GradMode::is_enabled() && input->requires_grad())
     {
         std::vector<std::shared_ptr<Tensor>> parents{input};
 
-        std::function<void(const std::vector<float> &)> gradfn =
-            [input](const std::vector<float> &grad_output)
+        GradFn gradfn =
+            [input](const Storage &grad_output)
         {
-            const std::vector<float>& input_vals = input->data();
-            std::vector<float> grad_input;
-            grad_input.reserve(grad_output.size());
+            const Storage &input_vals = input->data();
+            Storage grad_input(input_vals.size());
 
             // Gradient is 1 if input > 0, else 0
-            for (std::size_t i = 0; i < input_vals.size(); i++)
+            parallel_for(0, input_vals.size(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
             {
-                if (input_vals[i] > 0.0f)
-                {
-                    grad_input.push_back(grad_output[i]);
-                }
-                else
+                for (std::size_t i = begin; i < end; i++)
                 {
-                    grad_input.push_back(0.0f);
+                    grad_input[i] = input_vals[i] > 0.0f ? grad_output[i] : 0.0f;
                 }
-            }
-            input->add_to_grad(grad_input);
+            });
+            input->add_to_grad(std::move(grad_input));
         };
         
-        return std::make_shared<Tensor>(out_data, input->shape(), true, gradfn, parents);
+        auto result = std::make_shared<Tensor>(std::move(out_data), input->shape(), true, gradfn, parents);
+        if (CaptureMode::is_active())
+        {
+            result->set_forwardfn(compute);
+        }
+        return result;
     }
 
-    return std::make_shared<Tensor>(out_data, input->shape());
+    return std::make_shared<Tensor>(std::move(out_data), input->shape());
 }
\ No newline at end of file
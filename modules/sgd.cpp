@@ -1,29 +1,23 @@
 #include "../include/sgd.h"
-#include "../include/tensor.h"
-#include <memory>
-#include <string>
-#include <vector>
+#include "../include/gemm_kernels.h"
+#include <stdexcept>
+#include <utility>
 
-SGD::SGD(std::vector<std::pair<std::string, std::shared_ptr<Tensor>>> params, float lr)
-    : _params(params), _learning_rate(lr)
+SGD::SGD(Params params, float lr, float momentum, float weight_decay, bool nesterov)
+    : Optimizer(std::move(params), lr), _momentum(momentum), _weight_decay(weight_decay), _nesterov(nesterov)
 {
-}
-
-void SGD::step()
-{
-    for (auto &param : _params)
+    if (nesterov && momentum <= 0.0f)
     {
-        for (std::size_t i = 0; i < param.second->numel(); i++)
-        {
-            param.second->data()[i] -= _learning_rate * param.second->grad()[i];
-        }
+        throw std::invalid_argument("SGD: Nesterov momentum requires a positive momentum.");
     }
+    if (momentum != 0.0f)
+        _velocity = Storage(numel());
 }
 
-void SGD::zero_grad()
+void SGD::update(float *values, const float *grad, std::size_t offset, std::size_t n)
 {
-    for (auto &param : _params)
-    {
-        param.second->zero_grad();
-    }
-}
\ No newline at end of file
+    // the buffer starts at zero, so the first step's buf is the gradient itself
+    SGDStep step{_grad_scale, _learning_rate, _weight_decay, _momentum, _nesterov ? 1.0f : 0.0f, _nesterov ? _momentum : 1.0f};
+    float *buf = _velocity.empty() ? nullptr : _velocity.data() + offset;
+    optimizer_kernels().sgd(values, grad, buf, n, step);
+}
@@ -1,87 +1,177 @@
 #include "../include/softmax.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
 #include "../include/tensor.h"
-#include <memory>
+#include "../include/thread_pool.h"
+#include <algorithm>
 #include <cmath>
-#include <vector>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
-std::shared_ptr<Tensor> Softmax::forward(std::shared_ptr<Tensor> input)
+namespace
 {
-    const std::vector<float>& in_data = input->data();
-    std::size_t numel = input->numel();
+// The input seen as [outer, C, inner] around the softmax dimension: lane
+// (o, i) holds the C values at o * C * inner + c * inner + i
+struct Lanes
+{
+    std::size_t outer = 1;
+    std::size_t C = 1;
+    std::size_t inner = 1;
+};
 
-    if (input->shape().empty() || (input->shape().size() == 1 && numel == 1))
+Lanes lanes_of(const std::vector<std::size_t> &shape, int dim, const char *name)
+{
+    Lanes lanes;
+    if (shape.empty())
     {
-        float result = 1.0f;
-        
-        if (input->requires_grad())
-        {
-            std::vector<std::shared_ptr<Tensor>> parents{input};
-
-            std::function<void(const std::vector<float> &)> gradfn =
-                [input](const std::vector<float> &grad_output)
-            {
-               
-                std::vector<float> grad_input(input->numel(), 0.0f);
-                input->add_to_grad(grad_input);
-            };
-           
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
-        }
-        return std::make_shared<Tensor>(result);
+        // a scalar is a single class
+        return lanes;
+    }
+    int rank = (int)shape.size();
+    int d = dim < 0 ? dim + rank : dim;
+    if (d < 0 || d >= rank)
+    {
+        throw std::invalid_argument(std::string(name) + ": dim " + std::to_string(dim) + " is out of range for a " +
+                                    std::to_string(rank) + "D input");
     }
+    for (int k = 0; k < d; k++)
+        lanes.outer *= shape[k];
+    lanes.C = shape[d];
+    for (int k = d + 1; k < rank; k++)
+        lanes.inner *= shape[k];
+    return lanes;
+}
 
-    if (input->shape().size() == 1)
+// Splits the outer * inner lanes across the pool; fn(first, stride, ...) gets
+// the offset of a lane's first value and the distance between its values
+template <typename Fn>
+void for_each_lane(const Lanes &lanes, Fn fn)
+{
+    std::size_t n_lanes = lanes.outer * lanes.inner;
+    std::size_t grain = std::max<std::size_t>(1, ELEMENTWISE_GRAIN / std::max<std::size_t>(1, lanes.C));
+    parallel_for(0, n_lanes, grain, [&](std::size_t begin, std::size_t end)
     {
-        float max_val = in_data[0];
-        for (std::size_t i = 1; i < numel; i++)
+        for (std::size_t lane = begin; lane < end; lane++)
         {
-            if (in_data[i] > max_val) max_val = in_data[i];
+            std::size_t o = lane / lanes.inner;
+            std::size_t i = lane % lanes.inner;
+            fn(o * lanes.C * lanes.inner + i, lanes.inner);
         }
+    });
+}
 
-        std::vector<float> s(numel);
+// out = softmax or log-softmax of in along the lanes
+void softmax_lanes(const float *in, float *out, const Lanes &lanes, bool log)
+{
+    std::size_t C = lanes.C;
+    for_each_lane(lanes, [&](std::size_t first, std::size_t stride)
+    {
+        const float *x = in + first;
+        float *y = out + first;
+        float max_val = x[0];
+        for (std::size_t c = 1; c < C; c++)
+            max_val = std::max(max_val, x[c * stride]);
         float sum_exp = 0.0f;
-        for (std::size_t i = 0; i < numel; i++)
+        for (std::size_t c = 0; c < C; c++)
         {
-            float val = std::exp(in_data[i] - max_val);
-            s[i] = val;
-            sum_exp += val;
+            float e = std::exp(x[c * stride] - max_val);
+            sum_exp += e;
+            if (!log)
+                y[c * stride] = e;
         }
-
-        for (std::size_t i = 0; i < numel; i++)
+        if (log)
+        {
+            float shift = max_val + std::log(sum_exp);
+            for (std::size_t c = 0; c < C; c++)
+                y[c * stride] = x[c * stride] - shift;
+        }
+        else
         {
-            s[i] /= sum_exp;
+            float inv = 1.0f / sum_exp;
+            for (std::size_t c = 0; c < C; c++)
+                y[c * stride] *= inv;
         }
+    });
+}
 
-        if (input->requires_grad())
+std::shared_ptr<Tensor> softmax_forward(std::shared_ptr<Tensor> input, int dim, bool log)
+{
+    const char *name = log ? "LogSoftmax" : "Softmax";
+    input = input->contiguous();
+    Lanes lanes = lanes_of(input->shape(), dim, name);
+    auto compute = [input, lanes, log](Storage &out)
+    {
+        softmax_lanes(input->data().data(), out.data(), lanes, log);
+    };
+    Storage out(input->numel());
+    compute(out);
+
+    if (!GradMode::is_enabled() || !input->requires_grad())
+    {
+        return std::make_shared<Tensor>(std::move(out), input->shape());
+    }
+    // The gradfn reads the output: it keeps the buffer in a Storage of its
+    // own that the result borrows, since capturing the result itself would
+    // make it own its gradfn
+    auto output = std::make_shared<Storage>(std::move(out));
+    GradFn gradfn = [input, lanes, log, output](const Storage &grad_output)
+    {
+        const float *y = output->data();
+        const float *g = grad_output.data();
+        Storage grad_input(input->numel());
+        float *dx = grad_input.data();
+        std::size_t C = lanes.C;
+        for_each_lane(lanes, [&](std::size_t first, std::size_t stride)
         {
-            std::vector<std::shared_ptr<Tensor>> parents{input};
-            
-            std::function<void(const std::vector<float> &)> gradfn =
-                [input, s, numel](const std::vector<float> &grad_output)
+            float sum = 0.0f;
+            if (log)
             {
-                std::vector<float> grad_input(numel, 0.0f);
-                
-                for (std::size_t j = 0; j < numel; j++)
+                // dx = g - softmax * sum(g), softmax = exp(log-softmax)
+                for (std::size_t c = 0; c < C; c++)
+                    sum += g[first + c * stride];
+                for (std::size_t c = 0; c < C; c++)
                 {
-                    float grad_j = 0.0f;
-                    float s_j = s[j];
-                    
-                    for (std::size_t i = 0; i < numel; i++)
-                    {
-                        if (i == j)
-                            grad_j += grad_output[i] * s[i] * (1.0f - s_j); 
-                        else
-                            grad_j += grad_output[i] * (-s[i] * s_j);
-                    }
-                    grad_input[j] = grad_j;
+                    std::size_t k = first + c * stride;
+                    dx[k] = g[k] - std::exp(y[k]) * sum;
                 }
-                
-                input->add_to_grad(grad_input);
-            };
-            return std::make_shared<Tensor>(s, true, gradfn, parents);
-        }
-        return std::make_shared<Tensor>(s);
+            }
+            else
+            {
+                // dx = s * (g - sum(g * s))
+                for (std::size_t c = 0; c < C; c++)
+                    sum += g[first + c * stride] * y[first + c * stride];
+                for (std::size_t c = 0; c < C; c++)
+                {
+                    std::size_t k = first + c * stride;
+                    dx[k] = y[k] * (g[k] - sum);
+                }
+            }
+        });
+        input->add_to_grad(std::move(grad_input));
+    };
+    std::vector<std::shared_ptr<Tensor>> parents{input};
+    Storage view = Storage::borrow(output->data(), output->size(), output->share(), output->dtype());
+    auto result = std::make_shared<Tensor>(std::move(view), input->shape(), true, std::move(gradfn), parents);
+    if (CaptureMode::is_active())
+    {
+        result->set_forwardfn(compute);
     }
-    throw std::runtime_error("Softmax is currently only allowed for scalars or 1D vectors.");
-}
\ No newline at end of file
+    return result;
+}
+} // namespace
+
+Softmax::Softmax(int dim) : _dim(dim) {}
+
+std::shared_ptr<Tensor> Softmax::forward(std::shared_ptr<Tensor> input)
+{
+    return softmax_forward(input, _dim, false);
+}
+
+LogSoftmax::LogSoftmax(int dim) : _dim(dim) {}
+
+std::shared_ptr<Tensor> LogSoftmax::forward(std::shared_ptr<Tensor> input)
+{
+    return softmax_forward(input, _dim, true);
+}
@@ -0,0 +1,311 @@
+#include "../include/checkpoint.h"
+#include "../include/mapped_file.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+const char MAGIC[8] = {'D', 'L', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr std::uint32_t VERSION = 1;
+
+// dtype codes of the index
+std::uint32_t dtype_code(DType dtype)
+{
+    switch (dtype)
+    {
+    case DType::Float32:
+        return 0;
+    case DType::BFloat16:
+        return 1;
+    case DType::Float16:
+        return 2;
+    }
+    return 0;
+}
+constexpr std::size_t HEADER_BYTES = sizeof(MAGIC) + 2 * sizeof(std::uint32_t) + sizeof(std::uint64_t);
+
+std::uint64_t align_up(std::uint64_t offset)
+{
+    return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+template <typename T>
+void write_value(std::ofstream &file, T value)
+{
+    file.write((const char *)&value, sizeof(T));
+}
+
+// Bounds-checked cursor over the bytes of a checkpoint
+class Reader
+{
+public:
+    Reader(const char *data, std::size_t size, const std::string &path) : _data(data), _size(size), _path(path) {}
+
+    template <typename T>
+    T read()
+    {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    std::string read_string(std::size_t length)
+    {
+        return std::string(take(length), length);
+    }
+
+    void fail(const std::string &what) const
+    {
+        throw std::runtime_error("Corrupt checkpoint " + _path + ": " + what);
+    }
+
+private:
+    const char *take(std::size_t bytes)
+    {
+        if (bytes > _size - _pos)
+        {
+            fail("index runs past the end of the file");
+        }
+        const char *p = _data + _pos;
+        _pos += bytes;
+        return p;
+    }
+
+    const char *_data;
+    std::size_t _size;
+    std::size_t _pos = 0;
+    const std::string &_path;
+};
+
+struct Entry
+{
+    std::string name;
+    std::vector<std::size_t> shape;
+    std::uint64_t offset;
+    std::uint64_t numel;
+    DType dtype;
+};
+
+std::vector<Entry> read_index(const char *data, std::size_t size, const std::string &path)
+{
+    Reader reader(data, size, path);
+    if (size < sizeof(MAGIC) || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    reader.read_string(sizeof(MAGIC));
+    std::uint32_t version = reader.read<std::uint32_t>();
+    if (version != VERSION)
+    {
+        throw std::runtime_error(path + " is checkpoint version " + std::to_string(version) +
+                                 ", this build reads version " + std::to_string(VERSION));
+    }
+    std::uint32_t count = reader.read<std::uint32_t>();
+    reader.read<std::uint64_t>(); // data offset, implied by the entries
+
+    std::vector<Entry> entries;
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        Entry entry;
+        entry.name = reader.read_string(reader.read<std::uint32_t>());
+        std::uint32_t dtype = reader.read<std::uint32_t>();
+        if (dtype > 2)
+        {
+            reader.fail("tensor '" + entry.name + "' has unknown dtype " + std::to_string(dtype));
+        }
+        entry.dtype = dtype == 0 ? DType::Float32 : dtype == 1 ? DType::BFloat16 : DType::Float16;
+        std::uint32_t rank = reader.read<std::uint32_t>();
+        entry.numel = 1;
+        for (std::uint32_t d = 0; d < rank; d++)
+        {
+            entry.shape.push_back(reader.read<std::uint64_t>());
+            entry.numel *= entry.shape.back();
+        }
+        entry.offset = reader.read<std::uint64_t>();
+        std::uint64_t bytes = reader.read<std::uint64_t>();
+        if (bytes != entry.numel * dtype_size(entry.dtype))
+        {
+            reader.fail("tensor '" + entry.name + "' size does not match its shape");
+        }
+        if (entry.offset % CHECKPOINT_ALIGNMENT != 0 || entry.offset > size || bytes > size - entry.offset)
+        {
+            reader.fail("tensor '" + entry.name + "' lies outside the file or is misaligned");
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+} // namespace
+
+void save_checkpoint(const std::string &path, const NamedTensors &tensors)
+{
+    // lay out the index first so every tensor offset is known up front
+    std::uint64_t index_bytes = 0;
+    for (const auto &t : tensors)
+    {
+        index_bytes += 3 * sizeof(std::uint32_t) + t.first.size() +
+                       (t.second->shape().size() + 2) * sizeof(std::uint64_t);
+    }
+    std::uint64_t data_offset = align_up(HEADER_BYTES + index_bytes);
+
+    std::vector<std::uint64_t> offsets;
+    std::uint64_t offset = data_offset;
+    for (const auto &t : tensors)
+    {
+        offsets.push_back(offset);
+        offset = align_up(offset + t.second->data().bytes());
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open " + tmp_path + " for writing");
+    }
+
+    file.write(MAGIC, sizeof(MAGIC));
+    write_value<std::uint32_t>(file, VERSION);
+    write_value<std::uint32_t>(file, (std::uint32_t)tensors.size());
+    write_value<std::uint64_t>(file, data_offset);
+    for (std::size_t i = 0; i < tensors.size(); i++)
+    {
+        const std::string &name = tensors[i].first;
+        const Tensor &tensor = *tensors[i].second;
+        write_value<std::uint32_t>(file, (std::uint32_t)name.size());
+        file.write(name.data(), name.size());
+        write_value<std::uint32_t>(file, dtype_code(tensor.dtype()));
+        write_value<std::uint32_t>(file, (std::uint32_t)tensor.shape().size());
+        for (std::size_t dim : tensor.shape())
+        {
+            write_value<std::uint64_t>(file, dim);
+        }
+        write_value<std::uint64_t>(file, offsets[i]);
+        write_value<std::uint64_t>(file, tensor.data().bytes());
+    }
+
+    // Tensors that already sit in memory with the file's layout, as in the
+    // data arena of a flattened module, go out in one write, padding included
+    bool one_block = !tensors.empty();
+    const char *first = tensors.empty() ? nullptr : (const char *)tensors[0].second->data().raw();
+    for (std::size_t i = 0; i < tensors.size() && one_block; i++)
+    {
+        one_block = (const char *)tensors[i].second->data().raw() == first + (offsets[i] - data_offset);
+    }
+
+    const char zeros[CHECKPOINT_ALIGNMENT] = {};
+    std::uint64_t written = HEADER_BYTES + index_bytes;
+    if (one_block)
+    {
+        file.write(zeros, data_offset - written);
+        const Storage &last = tensors.back().second->data();
+        file.write(first, offsets.back() + last.bytes() - data_offset);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < tensors.size(); i++)
+        {
+            file.write(zeros, offsets[i] - written);
+            const Storage &data = tensors[i].second->data();
+            file.write((const char *)data.raw(), data.bytes());
+            written = offsets[i] + data.bytes();
+        }
+    }
+
+    file.close();
+    if (!file)
+    {
+        throw std::runtime_error("Failed writing checkpoint " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("Could not move " + tmp_path + " to " + path);
+    }
+}
+
+void save_checkpoint(const std::string &path, const Module &module)
+{
+    save_checkpoint(path, module.parameters());
+}
+
+NamedTensors load_checkpoint(const std::string &path, bool use_mmap)
+{
+    NamedTensors tensors;
+    if (use_mmap)
+    {
+        auto file = std::make_shared<MappedFile>(path);
+        for (const Entry &entry : read_index(file->data(), file->size(), path))
+        {
+            float *data = reinterpret_cast<float *>(file->data() + entry.offset);
+            tensors.push_back({entry.name, std::make_shared<Tensor>(
+                                               Storage::borrow(data, entry.numel, file, entry.dtype), entry.shape)});
+        }
+        return tensors;
+    }
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    std::vector<char> bytes((std::size_t)file.tellg());
+    file.seekg(0);
+    file.read(bytes.data(), bytes.size());
+    for (const Entry &entry : read_index(bytes.data(), bytes.size(), path))
+    {
+        Storage data(entry.numel, entry.dtype);
+        std::memcpy(data.raw(), bytes.data() + entry.offset, data.bytes());
+        tensors.push_back({entry.name, std::make_shared<Tensor>(std::move(data), entry.shape)});
+    }
+    return tensors;
+}
+
+void load_checkpoint(Module &module, const std::string &path, bool use_mmap)
+{
+    std::unordered_map<std::string, std::shared_ptr<Tensor>> stored;
+    for (auto &t : load_checkpoint(path, use_mmap))
+    {
+        stored[t.first] = t.second;
+    }
+
+    for (const auto &p : module.parameters())
+    {
+        auto it = stored.find(p.first);
+        if (it == stored.end())
+        {
+            std::cerr << "Warning: Parameters '" << p.first << "' not found in checkpoint" << std::endl;
+            continue;
+        }
+        if (p.second->shape() != it->second->shape())
+        {
+            throw std::runtime_error("Parameter '" + p.first + "' has different shape in checkpoint");
+        }
+        // takes over the loaded buffer, which for a mapping is the file itself;
+        // a parameter stored in another dtype gets a converted copy. A
+        // flattened module's parameters are copied into their arena instead.
+        Storage &loaded = it->second->data();
+        Storage &data = p.second->data();
+        if (module.is_flat())
+        {
+            if (loaded.dtype() == data.dtype())
+                data = loaded;
+            else
+                data.assign_from(loaded.to(DType::Float32).data());
+        }
+        else if (loaded.dtype() == data.dtype())
+            data = std::move(loaded);
+        else
+            data = loaded.to(data.dtype());
+    }
+}
+
+bool is_checkpoint(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(MAGIC)] = {};
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
@@ -1,9 +1,221 @@
 #include "../include/conv2d.h"
+#include "../include/grad_mode.h"
+#include "../include/gemm.h"
+#include "../include/graph_capture.h"
+#include "../include/im2col.h"
+#include "../include/thread_pool.h"
+#include "../include/winograd.h"
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include <functional>
 #include <stdexcept>
 #include <cmath>
 #include <cstdlib>
+#include <mutex>
+
+namespace
+{
+// The convolution is lowered to a GEMM per sample:
+//   out[C_out, H_out*W_out] = weight[C_out, C_in*K*K] x columns[C_in*K*K, H_out*W_out]
+// where columns is the im2col unfolding of the input. A 1x1/stride 1/no padding
+// conv needs no unfolding, the input already is the column matrix.
+// Layers winograd_tile picks run on Winograd instead, with no columns at all.
+struct ConvGemm
+{
+    ConvGeometry geom;
+    std::size_t N;
+    std::size_t C_out;
+    std::size_t col_rows;
+    std::size_t col_cols;
+    bool direct;
+    std::size_t input_stride_n;
+    std::size_t winograd; // forward tile, 0 for the GEMM
+    // The input gradient of a 3x3, stride 1 conv is the conv of the output
+    // gradient, padded by 2 - padding, with the filters flipped
+    ConvGeometry grad_geom;
+    std::size_t grad_winograd; // its tile, 0 for the GEMM and col2im
+};
+
+// Conv plus bias for every sample. target(n, scratch) says where sample n's
+// [C_out, H_out*W_out] result goes and epilogue(n, result) runs on it while it
+// is still in cache; scratch is a per-task buffer of one sample's output, only
+// allocated when with_scratch is set. Samples are spread across the thread
+// pool; a lone image instead gets its GEMM split into spatial tiles inside sgemm.
+// winograd_U holds the layer's transformed filters when g.winograd is set.
+template <typename Target, typename Epilogue>
+void conv_forward(const ConvGemm &g, const Storage &input_data, const Storage &weight_data,
+                  const Storage &bias_data, const float *winograd_U, bool with_scratch,
+                  Target target, Epilogue epilogue)
+{
+    parallel_for(0, g.N, 1, [&](std::size_t n_begin, std::size_t n_end) {
+        Storage columns(g.direct || winograd_U ? 0 : g.col_rows * g.col_cols);
+        Storage transformed(winograd_U ? winograd_scratch_size(g.geom, g.C_out, g.winograd) : 0);
+        Storage scratch(with_scratch ? g.C_out * g.col_cols : 0);
+        for (std::size_t n = n_begin; n < n_end; n++) {
+            const float* in_n = input_data.data() + n * g.input_stride_n;
+            float* out_n = target(n, scratch.data());
+
+            if (winograd_U) {
+                winograd_conv(in_n, g.geom, winograd_U, g.C_out, g.winograd, bias_data.data(),
+                              out_n, transformed.data());
+                epilogue(n, out_n);
+                continue;
+            }
+
+            const float* cols = in_n;
+            if (!g.direct) {
+                im2col(in_n, g.geom, columns.data());
+                cols = columns.data();
+            }
+
+            for (std::size_t co = 0; co < g.C_out; co++)
+                std::fill(out_n + co * g.col_cols, out_n + (co + 1) * g.col_cols, bias_data[co]);
+
+            // the weight may be 16-bit (Module::to); packing widens it
+            sgemm_mixed(false, false, g.C_out, g.col_cols, g.col_rows,
+                        1.0f, weight_data.raw(), weight_data.dtype(), g.col_rows, cols, DType::Float32, g.col_cols,
+                        1.0f, out_n, g.col_cols);
+            epilogue(n, out_n);
+        }
+    });
+}
+
+// Backward of conv plus bias. grad_of(n, scratch) returns the gradient with
+// respect to sample n's conv output, building it in scratch if it has to
+// (scratch is allocated as in conv_forward). The input gradient runs on
+// Winograd when g.grad_winograd is set, with the flipped filters from cache.
+template <typename GradOf>
+void conv_backward(const ConvGemm &g, const std::shared_ptr<Tensor> &input, const std::shared_ptr<Tensor> &weight,
+                   const std::shared_ptr<Tensor> &bias, WinogradFilters &cache, bool with_scratch, GradOf grad_of)
+{
+    Storage grad_input(input->requires_grad() ? input->numel() : 0, 0.0f);
+    Storage grad_weight(weight->numel(), 0.0f);
+    Storage grad_bias(bias->numel(), 0.0f);
+
+    const Storage &w_data = weight->data();
+    const Storage &in_data = input->data();
+
+    bool input_grad = !grad_input.empty();
+    std::shared_ptr<const std::vector<float>> flipped;
+    if (input_grad && g.grad_winograd)
+        flipped = cache.get(w_data, g.C_out, g.geom.channels, g.grad_winograd, true);
+    std::mutex accumulate_mutex;
+
+    // Each task handles a run of samples with its own weight/bias partials,
+    // merged once at the end; input gradients of different samples are disjoint.
+    parallel_for(0, g.N, 1, [&](std::size_t n_begin, std::size_t n_end) {
+        Storage columns(g.direct ? 0 : g.col_rows * g.col_cols);
+        Storage grad_columns(g.direct || !input_grad || flipped ? 0 : g.col_rows * g.col_cols);
+        Storage transformed(flipped ? winograd_scratch_size(g.grad_geom, g.geom.channels, g.grad_winograd) : 0);
+        Storage scratch(with_scratch ? g.C_out * g.col_cols : 0);
+        Storage local_weight(grad_weight.size(), 0.0f);
+        Storage local_bias(g.C_out, 0.0f);
+
+        for (std::size_t n = n_begin; n < n_end; n++) {
+            const float* grad_out_n = grad_of(n, scratch.data());
+            const float* in_n = in_data.data() + n * g.input_stride_n;
+
+            // 1. Grad Bias (summed over the batch)
+            for (std::size_t co = 0; co < g.C_out; co++) {
+                float sum = 0.0f;
+                for (std::size_t i = 0; i < g.col_cols; i++)
+                    sum += grad_out_n[co * g.col_cols + i];
+                local_bias[co] += sum;
+            }
+
+            // 2. Grad Weights: grad_out[C_out, HW] x columns^T[HW, C_in*K*K]
+            const float* cols = in_n;
+            if (!g.direct) {
+                im2col(in_n, g.geom, columns.data());
+                cols = columns.data();
+            }
+            sgemm(false, true, g.C_out, g.col_rows, g.col_cols,
+                  1.0f, grad_out_n, g.col_cols, cols, g.col_cols,
+                  1.0f, local_weight.data(), g.col_rows);
+
+            // 3. Grad Input: weight^T[C_in*K*K, C_out] x grad_out[C_out, HW], folded back with col2im
+            if (flipped) {
+                float* grad_in_n = grad_input.data() + n * g.input_stride_n;
+                winograd_conv(grad_out_n, g.grad_geom, flipped->data(), g.geom.channels, g.grad_winograd,
+                              nullptr, grad_in_n, transformed.data());
+            } else if (input_grad) {
+                float* grad_in_n = grad_input.data() + n * g.input_stride_n;
+                float* target = g.direct ? grad_in_n : grad_columns.data();
+                sgemm_mixed(true, false, g.col_rows, g.col_cols, g.C_out,
+                            1.0f, w_data.raw(), w_data.dtype(), g.col_rows, grad_out_n, DType::Float32, g.col_cols,
+                            0.0f, target, g.col_cols);
+                if (!g.direct)
+                    col2im(grad_columns.data(), g.geom, grad_in_n);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(accumulate_mutex);
+        for (std::size_t i = 0; i < grad_weight.size(); i++)
+            grad_weight[i] += local_weight[i];
+        for (std::size_t co = 0; co < g.C_out; co++)
+            grad_bias[co] += local_bias[co];
+    });
+
+    // Safe update for input
+    if (input->requires_grad()) {
+        input->add_to_grad(std::move(grad_input));
+    }
+    weight->add_to_grad(std::move(grad_weight));
+    bias->add_to_grad(std::move(grad_bias));
+}
+
+// Checks the input against the layer and works out the GEMM sizes and output shape
+ConvGemm plan_conv(const std::shared_ptr<Tensor> &input, std::size_t in_channels, std::size_t out_channels,
+                   std::size_t kernel_size, std::size_t stride, std::size_t padding,
+                   std::vector<std::size_t> &out_shape)
+{
+    // Accepts a single image [C,H,W] or a batch [N,C,H,W]
+    const auto& in_shape = input->shape(); 
+    bool batched = in_shape.size() == 4;
+    if (in_shape.size() != 3 && !batched)
+        throw std::runtime_error("Conv2D expects 3D input [C,H,W] or 4D input [N,C,H,W]");
+
+    std::size_t N = batched ? in_shape[0] : 1;
+    std::size_t C_in = in_shape[batched ? 1 : 0];
+    std::size_t H_in = in_shape[batched ? 2 : 1];
+    std::size_t W_in = in_shape[batched ? 3 : 2];
+
+    if (C_in != in_channels)
+         throw std::runtime_error("Input channels do not match Conv2D in_channels");
+
+    std::size_t H_out = (H_in - kernel_size + 2 * padding) / stride + 1;
+    std::size_t W_out = (W_in - kernel_size + 2 * padding) / stride + 1;
+
+    out_shape = {out_channels, H_out, W_out};
+    if (batched)
+        out_shape.insert(out_shape.begin(), N);
+
+    ConvGeometry geom{C_in, H_in, W_in, kernel_size, stride, padding, H_out, W_out};
+    ConvGeometry grad_geom{};
+    std::size_t grad_winograd = 0;
+    if (kernel_size == 3 && stride == 1 && padding <= 2) {
+        grad_geom = ConvGeometry{out_channels, H_out, W_out, 3, 1, 2 - padding, H_in, W_in};
+        grad_winograd = winograd_tile(grad_geom, C_in);
+    }
+    return ConvGemm{geom, N, out_channels, C_in * kernel_size * kernel_size, H_out * W_out,
+                    kernel_size == 1 && stride == 1 && padding == 0, C_in * H_in * W_in,
+                    winograd_tile(geom, out_channels), grad_geom, grad_winograd};
+}
+
+// The layer's Winograd filters for its forward conv, null when it runs on the GEMM
+std::shared_ptr<const std::vector<float>> forward_filters(const ConvGemm &g, const Storage &weight,
+                                                          WinogradFilters &cache)
+{
+    if (!g.winograd)
+        return nullptr;
+    return cache.get(weight, g.C_out, g.geom.channels, g.winograd, false);
+}
+
+// Window position of the max of a fused pooling window, or POOL_CLAMPED when
+// the ReLU zeroed the whole window
+constexpr unsigned char POOL_CLAMPED = 0xff;
+} // namespace
 
 Conv2D::Conv2D(std::size_t in_channels, std::size_t out_channels, std::size_t kernel_size, std::size_t stride, std::size_t padding, std::size_t seed)
     : _in_channels(in_channels), _out_channels(out_channels),
@@ -11,156 +223,169 @@ Conv2D::Conv2D(std::size_t in_channels, std::size_t out_channels, std::size_t ke
       _seed(seed)
 {
     std::size_t weight_numel = out_channels * in_channels * kernel_size * kernel_size;
-    std::vector<float> w(weight_numel);
+    Storage w(weight_numel);
 
     for (std::size_t i = 0; i < weight_numel; i++) {
         w[i] = ((float)rand() / RAND_MAX - 0.5f) * 0.1f;
     }
 
-    std::vector<float> b(out_channels, 0.1f);
+    Storage b(out_channels, 0.1f);
 
-    _weight = std::make_shared<Tensor>(w, true);
-    _bias = std::make_shared<Tensor>(b, true);
+    _weight = std::make_shared<Tensor>(std::move(w), std::vector<std::size_t>{out_channels, in_channels, kernel_size, kernel_size}, true);
+    _bias = std::make_shared<Tensor>(std::move(b), true);
 
     register_parameter("weight", _weight);
     register_parameter("bias", _bias);
+    _winograd = std::make_shared<WinogradFilters>();
 }
 
 std::shared_ptr<Tensor> Conv2D::forward(std::shared_ptr<Tensor> input)
 {
-    bool should_create_graph = input->requires_grad() || _weight->requires_grad() || _bias->requires_grad();
+    bool should_create_graph = GradMode::is_enabled() &&
+        (input->requires_grad() || _weight->requires_grad() || _bias->requires_grad());
 
-    const auto& in_shape = input->shape(); 
-    if (in_shape.size() != 3)
-        throw std::runtime_error("Conv2D expects 3D input [C,H,W]");
+    std::vector<std::size_t> out_shape;
+    ConvGemm g = plan_conv(input, _in_channels, _out_channels, _kernel_size, _stride, _padding, out_shape);
+    std::size_t out_stride_n = g.C_out * g.col_cols;
 
-    std::size_t C_in = in_shape[0];
-    std::size_t H_in = in_shape[1];
-    std::size_t W_in = in_shape[2];
+    // --- Forward Pass ---
+    auto compute = [input, weight=_weight, bias=_bias, winograd=_winograd, g, out_stride_n](Storage &out)
+    {
+        auto U = forward_filters(g, weight->data(), *winograd);
+        conv_forward(g, input->data(), weight->data(), bias->data(), U ? U->data() : nullptr, false,
+                     [&](std::size_t n, float *) { return out.data() + n * out_stride_n; },
+                     [](std::size_t, float *) {});
+    };
+    Storage out(g.N * out_stride_n);
+    compute(out);
 
-    if (C_in != _in_channels)
-         throw std::runtime_error("Input channels do not match Conv2D in_channels");
+    if (should_create_graph)
+    {
+        std::vector<std::shared_ptr<Tensor>> parents{input, _weight, _bias};
+
+        GradFn gradfn = [input, weight=_weight, bias=_bias, winograd=_winograd, g, out_stride_n](const Storage &grad_output_flat)
+        {
+            conv_backward(g, input, weight, bias, *winograd, false,
+                          [&](std::size_t n, float *) { return grad_output_flat.data() + n * out_stride_n; });
+        };
 
-    std::size_t H_out = (H_in - _kernel_size + 2 * _padding) / _stride + 1;
-    std::size_t W_out = (W_in - _kernel_size + 2 * _padding) / _stride + 1;
-    std::size_t out_numel = _out_channels * H_out * W_out;
+        auto result = std::make_shared<Tensor>(std::move(out), out_shape, true, gradfn, parents);
+        if (CaptureMode::is_active())
+        {
+            result->set_forwardfn(compute);
+        }
+        return result;
+    }
+    return std::make_shared<Tensor>(std::move(out), out_shape);
+}
 
-    std::vector<float> out(out_numel, 0.0f);
+std::shared_ptr<Tensor> Conv2D::forward_relu_pool(std::shared_ptr<Tensor> input, std::size_t pool_kernel, std::size_t pool_stride)
+{
+    if (pool_kernel == 0 || pool_stride == 0 || pool_kernel * pool_kernel >= POOL_CLAMPED)
+        throw std::runtime_error("Conv2D::forward_relu_pool: pool kernel must be between 1 and 15, stride at least 1");
 
-    const std::vector<float>& input_data = input->data();
-    const std::vector<float>& weight_data = _weight->data();
-    const std::vector<float>& bias_data = _bias->data();
+    bool should_create_graph = GradMode::is_enabled() &&
+        (input->requires_grad() || _weight->requires_grad() || _bias->requires_grad());
 
-    // Strides
-    std::size_t input_stride_c = H_in * W_in;
-    std::size_t input_stride_h = W_in;
-    
-    std::size_t weight_stride_co = _in_channels * _kernel_size * _kernel_size;
-    std::size_t weight_stride_ci = _kernel_size * _kernel_size;
-    std::size_t weight_stride_kh = _kernel_size;
+    std::vector<std::size_t> out_shape;
+    ConvGemm g = plan_conv(input, _in_channels, _out_channels, _kernel_size, _stride, _padding, out_shape);
+    std::size_t H_conv = g.geom.out_height;
+    std::size_t W_conv = g.geom.out_width;
+    if (H_conv < pool_kernel || W_conv < pool_kernel)
+        throw std::runtime_error("Conv2D::forward_relu_pool: pool kernel larger than the conv output");
 
-    std::size_t out_stride_co = H_out * W_out;
-    std::size_t out_stride_h = W_out;
+    std::size_t H_out = (H_conv - pool_kernel) / pool_stride + 1;
+    std::size_t W_out = (W_conv - pool_kernel) / pool_stride + 1;
+    out_shape[out_shape.size() - 2] = H_out;
+    out_shape[out_shape.size() - 1] = W_out;
+    std::size_t out_stride_n = g.C_out * H_out * W_out;
+    std::size_t out_numel = g.N * out_stride_n;
 
-    // --- Forward Pass ---
-    for (std::size_t co = 0; co < _out_channels; co++) {
-        float b_val = bias_data[co];
-        for (std::size_t h = 0; h < H_out; h++) {
-            for (std::size_t w = 0; w < W_out; w++) {
-                float sum = b_val;
-                for (std::size_t ci = 0; ci < C_in; ci++) {
-                    for (std::size_t kh = 0; kh < _kernel_size; kh++) {
-                        for (std::size_t kw = 0; kw < _kernel_size; kw++) {
-                            int ih = h * _stride + kh - _padding;
-                            int iw = w * _stride + kw - _padding;
-                            
-                            if (ih >= 0 && ih < (int)H_in && iw >= 0 && iw < (int)W_in) {
-                                std::size_t in_idx = ci * input_stride_c + ih * input_stride_h + iw;
-                                std::size_t w_idx = co * weight_stride_co + ci * weight_stride_ci + kh * weight_stride_kh + kw;
-                                sum += input_data[in_idx] * weight_data[w_idx];
+    // The pre-activation of a sample only lives in a per-task scratch buffer:
+    // it is pooled and clamped right after its GEMM. Backward needs just the
+    // position of every window's max, one byte per output, kept in a Storage
+    // so it comes from the step's allocator.
+    std::shared_ptr<Storage> argmax;
+    if (should_create_graph)
+        argmax = std::make_shared<Storage>((out_numel + sizeof(float) - 1) / sizeof(float));
+
+    // relu(max(window)) == max(relu(window)), and the first max of the raw
+    // values is the element the unfused pool would route its gradient to
+    auto compute = [input, weight=_weight, bias=_bias, winograd=_winograd, g, argmax, pool_kernel, pool_stride,
+                    H_out, W_out, out_stride_n](Storage &out)
+    {
+        unsigned char *arg = argmax ? reinterpret_cast<unsigned char *>(argmax->data()) : nullptr;
+        std::size_t W_conv = g.geom.out_width;
+        auto U = forward_filters(g, weight->data(), *winograd);
+        conv_forward(g, input->data(), weight->data(), bias->data(), U ? U->data() : nullptr, true,
+                     [](std::size_t, float *scratch) { return scratch; },
+                     [&](std::size_t n, const float *conv) {
+            float *out_n = out.data() + n * out_stride_n;
+            unsigned char *arg_n = arg ? arg + n * out_stride_n : nullptr;
+            for (std::size_t c = 0; c < g.C_out; c++) {
+                const float *plane = conv + c * g.col_cols;
+                for (std::size_t h = 0; h < H_out; h++) {
+                    for (std::size_t w = 0; w < W_out; w++) {
+                        const float *window = plane + h * pool_stride * W_conv + w * pool_stride;
+                        float max_val = -std::numeric_limits<float>::infinity();
+                        unsigned char max_pos = 0;
+                        for (std::size_t kh = 0; kh < pool_kernel; kh++) {
+                            for (std::size_t kw = 0; kw < pool_kernel; kw++) {
+                                if (window[kh * W_conv + kw] > max_val) {
+                                    max_val = window[kh * W_conv + kw];
+                                    max_pos = (unsigned char)(kh * pool_kernel + kw);
+                                }
                             }
                         }
+                        std::size_t o = (c * H_out + h) * W_out + w;
+                        out_n[o] = max_val > 0.0f ? max_val : 0.0f;
+                        if (arg_n)
+                            arg_n[o] = max_val > 0.0f ? max_pos : POOL_CLAMPED;
                     }
                 }
-                out[co * out_stride_co + h * out_stride_h + w] = sum;
             }
-        }
-    }
-
-    std::vector<std::size_t> out_shape = {_out_channels, H_out, W_out};
+        });
+    };
+    Storage out(out_numel);
+    compute(out);
 
     if (should_create_graph)
     {
         std::vector<std::shared_ptr<Tensor>> parents{input, _weight, _bias};
 
-        std::function<void(const std::vector<float>&)> gradfn =
-            [input, weight=_weight, bias=_bias,
-             C_in, H_in, W_in, 
-             stride=_stride, padding=_padding, kernel_size=_kernel_size, C_out=_out_channels,
-             H_out, W_out,
-             input_stride_c, input_stride_h,
-             weight_stride_co, weight_stride_ci, weight_stride_kh,
-             out_stride_co, out_stride_h]
-            (const std::vector<float>& grad_output_flat)
+        GradFn gradfn = [input, weight=_weight, bias=_bias, winograd=_winograd, g, argmax, pool_kernel, pool_stride,
+                         H_out, W_out, out_stride_n](const Storage &grad_output_flat)
         {
-            std::vector<float> grad_input(input->numel(), 0.0f);
-            std::vector<float> grad_weight(weight->numel(), 0.0f);
-            std::vector<float> grad_bias(bias->numel(), 0.0f);
-            
-            const std::vector<float>& w_data = weight->data();
-            const std::vector<float>& in_data = input->data();
-
-            // 1. Grad Bias
-            for (std::size_t co = 0; co < C_out; co++) {
-                float sum = 0.0f;
-                for (std::size_t h = 0; h < H_out; h++) {
-                    for (std::size_t w = 0; w < W_out; w++) {
-                         sum += grad_output_flat[co * out_stride_co + h * out_stride_h + w];
-                    }
-                }
-                grad_bias[co] = sum;
-            }
-
-            // 2. Grad Weights & Input
-            for (std::size_t co = 0; co < C_out; co++) {
-                for (std::size_t ci = 0; ci < C_in; ci++) {
-                    for (std::size_t kh = 0; kh < kernel_size; kh++) {
-                        for (std::size_t kw = 0; kw < kernel_size; kw++) {
-                            float grad_w = 0.0f;
-                            std::size_t w_idx = co * weight_stride_co + ci * weight_stride_ci + kh * weight_stride_kh + kw;
-                            float w_val = w_data[w_idx];
-
-                            for (std::size_t h = 0; h < H_out; h++) {
-                                for (std::size_t w = 0; w < W_out; w++) {
-                                    int ih = h * stride + kh - padding;
-                                    int iw = w * stride + kw - padding;
-                                    
-                                    if (ih >= 0 && ih < (int)H_in && iw >= 0 && iw < (int)W_in) {
-                                        std::size_t out_idx = co * out_stride_co + h * out_stride_h + w;
-                                        std::size_t in_idx = ci * input_stride_c + ih * input_stride_h + iw;
-                                        
-                                        float g = grad_output_flat[out_idx];
-                                        
-                                        grad_w += in_data[in_idx] * g;
-                                        grad_input[in_idx] += w_val * g;
-                                    }
-                                }
-                            }
-                            grad_weight[w_idx] = grad_w;
+            const unsigned char *arg = reinterpret_cast<const unsigned char *>(argmax->data());
+            std::size_t W_conv = g.geom.out_width;
+            // scatter each output's gradient onto the conv output it came from
+            conv_backward(g, input, weight, bias, *winograd, true, [&](std::size_t n, float *grad_conv) {
+                const float *grad_n = grad_output_flat.data() + n * out_stride_n;
+                const unsigned char *arg_n = arg + n * out_stride_n;
+                std::fill(grad_conv, grad_conv + g.C_out * g.col_cols, 0.0f);
+                for (std::size_t c = 0; c < g.C_out; c++) {
+                    float *plane = grad_conv + c * g.col_cols;
+                    for (std::size_t h = 0; h < H_out; h++) {
+                        for (std::size_t w = 0; w < W_out; w++) {
+                            std::size_t o = (c * H_out + h) * W_out + w;
+                            if (arg_n[o] == POOL_CLAMPED)
+                                continue;
+                            std::size_t kh = arg_n[o] / pool_kernel;
+                            std::size_t kw = arg_n[o] % pool_kernel;
+                            plane[(h * pool_stride + kh) * W_conv + w * pool_stride + kw] += grad_n[o];
                         }
                     }
                 }
-            }
-
-            // Safe update for input
-            if (input->requires_grad()) {
-                input->add_to_grad(grad_input);
-            }
-            weight->add_to_grad(grad_weight);
-            bias->add_to_grad(grad_bias);
+                return (const float *)grad_conv;
+            });
         };
 
-        return std::make_shared<Tensor>(out, out_shape, true, gradfn, parents);
+        auto result = std::make_shared<Tensor>(std::move(out), out_shape, true, gradfn, parents);
+        if (CaptureMode::is_active())
+        {
+            result->set_forwardfn(compute);
+        }
+        return result;
     }
-    return std::make_shared<Tensor>(out, out_shape);
-}
\ No newline at end of file
+    return std::make_shared<Tensor>(std::move(out), out_shape);
+}
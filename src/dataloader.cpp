@@ -0,0 +1,191 @@
+#include "../include/dataloader.h"
+#include "../include/storage.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+DataLoader::DataLoader(Dataset *dataset, int batch_size, bool shuffle, int num_workers, int prefetch, unsigned seed)
+    : _dataset(dataset), _batch_size(batch_size), _indices(dataset->get_length()), _shuffle(shuffle),
+      _prefetch(std::max(prefetch, 1)), _gen(seed)
+{
+    if (batch_size <= 0)
+    {
+        throw std::invalid_argument("DataLoader batch_size must be positive");
+    }
+    std::iota(_indices.begin(), _indices.end(), 0);
+    for (int i = 0; i < num_workers; i++)
+    {
+        _workers.emplace_back(&DataLoader::worker_loop, this);
+    }
+}
+
+DataLoader::~DataLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _work_cv.notify_all();
+    for (std::thread &worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+void DataLoader::start_epoch()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    // batches of an abandoned epoch may still be building from the old order
+    _started = false;
+    _ready_cv.wait(lock, [this] { return _in_flight == 0; });
+    _ready.clear();
+    if (_shuffle)
+    {
+        std::shuffle(_indices.begin(), _indices.end(), _gen);
+    }
+    _next = 0;
+    _consumed = 0;
+    _started = true;
+    lock.unlock();
+    _work_cv.notify_all();
+}
+
+std::vector<int> DataLoader::batch_indices(std::size_t batch) const
+{
+    std::size_t begin = batch * _batch_size;
+    std::size_t end = std::min(begin + _batch_size, _indices.size());
+    return std::vector<int>(_indices.begin() + begin, _indices.begin() + end);
+}
+
+Batch DataLoader::load(std::size_t batch)
+{
+    Batch result;
+    result.data = _dataset->get_batch(batch_indices(batch), result.labels);
+    return result;
+}
+
+void DataLoader::worker_loop()
+{
+    ThreadAllocatorGuard heap(heap_allocator());
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _work_cv.wait(lock, [this]
+                      { return _stop || (_started && _next < n_batches() && _next < _consumed + _prefetch); });
+        if (_stop)
+        {
+            return;
+        }
+        std::size_t batch = _next++;
+        _in_flight++;
+        lock.unlock();
+
+        Slot slot;
+        try
+        {
+            slot.batch = load(batch);
+        }
+        catch (...)
+        {
+            slot.error = std::current_exception();
+        }
+
+        lock.lock();
+        _in_flight--;
+        if (batch >= _consumed)
+        {
+            _ready[batch] = std::move(slot);
+        }
+        _ready_cv.notify_all();
+    }
+}
+
+Batch DataLoader::take(std::size_t batch)
+{
+    if (batch >= n_batches())
+    {
+        throw std::out_of_range("DataLoader batch " + std::to_string(batch) + " out of range");
+    }
+    if (_workers.empty())
+    {
+        return load(batch);
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (batch < _consumed)
+    {
+        throw std::logic_error("DataLoader batch " + std::to_string(batch) + " was already passed this epoch");
+    }
+    // batches the iterator stepped over are never asked for: drop the built
+    // ones and let the workers move on past them
+    _ready.erase(_ready.begin(), _ready.lower_bound(batch));
+    _consumed = batch;
+    _next = std::max(_next, batch);
+    _work_cv.notify_all();
+    _ready_cv.wait(lock, [this, batch] { return _ready.count(batch) > 0; });
+    Slot slot = std::move(_ready[batch]);
+    _ready.erase(batch);
+    _consumed = batch + 1;
+    lock.unlock();
+    _work_cv.notify_all();
+
+    if (slot.error)
+    {
+        std::rethrow_exception(slot.error);
+    }
+    return std::move(slot.batch);
+}
+
+// ---- Iterator ----
+
+DataLoader::Iterator::Iterator(DataLoader *dataloader, std::size_t index) : _dataloader(dataloader), _index(index)
+{
+}
+
+void DataLoader::Iterator::operator++()
+{
+    _index++;
+    _loaded = false;
+    _current = Batch();
+}
+
+Batch &DataLoader::Iterator::operator*()
+{
+    if (!_loaded)
+    {
+        _current = _dataloader->take(_index);
+        _loaded = true;
+    }
+    return _current;
+}
+
+bool DataLoader::Iterator::operator!=(const Iterator &other) const
+{
+    return _index != other._index;
+}
+
+DataLoader::Iterator DataLoader::begin()
+{
+    start_epoch();
+    return Iterator(this, 0);
+}
+
+DataLoader::Iterator DataLoader::end()
+{
+    return Iterator(this, n_batches());
+}
+
+std::size_t DataLoader::batch_size() const
+{
+    return _batch_size;
+}
+
+std::size_t DataLoader::n_samples() const
+{
+    return _indices.size();
+}
+
+std::size_t DataLoader::n_batches() const
+{
+    return (_indices.size() + _batch_size - 1) / _batch_size;
+}
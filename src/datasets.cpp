@@ -0,0 +1,228 @@
+#include "../include/datasets.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+// pixel byte -> v / 255, exactly as computed per pixel
+struct PixelTable
+{
+    float values[256];
+    PixelTable()
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            values[v] = v / 255.0f;
+        }
+    }
+};
+const PixelTable pixel_table;
+
+std::uint32_t read_big_endian(const char *p)
+{
+    const unsigned char *b = (const unsigned char *)p;
+    return (std::uint32_t(b[0]) << 24) | (std::uint32_t(b[1]) << 16) | (std::uint32_t(b[2]) << 8) | b[3];
+}
+
+// Checks an IDX header of unsigned bytes with `rank` dimensions and returns the dimensions
+std::vector<std::size_t> read_idx_header(const MappedFile &file, std::uint32_t rank, const std::string &path)
+{
+    std::size_t header = 4 * (rank + 1);
+    if (file.size() < header)
+    {
+        throw std::runtime_error(path + " is too short to be an IDX file");
+    }
+    std::uint32_t magic = read_big_endian(file.data());
+    // two zero bytes, type 0x08 (unsigned byte), then the rank
+    if (magic != (0x0800u | rank))
+    {
+        throw std::runtime_error(path + " is not an IDX file of " + std::to_string(rank) + "-d unsigned bytes");
+    }
+    std::vector<std::size_t> dims;
+    std::size_t numel = 1;
+    for (std::uint32_t d = 0; d < rank; d++)
+    {
+        dims.push_back(read_big_endian(file.data() + 4 * (d + 1)));
+        numel *= dims.back();
+    }
+    if (file.size() - header < numel)
+    {
+        throw std::runtime_error(path + " is truncated");
+    }
+    return dims;
+}
+} // namespace
+
+void normalize_pixels(const unsigned char *src, float *dst, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+    {
+        dst[i] = pixel_table.values[src[i]];
+    }
+}
+
+std::shared_ptr<Tensor> Dataset::get_batch(const std::vector<int> &indices, std::vector<std::size_t> &labels)
+{
+    std::vector<std::shared_ptr<Tensor>> items;
+    items.reserve(indices.size());
+    labels.clear();
+    for (int index : indices)
+    {
+        auto item = get_item(index);
+        labels.push_back(item.first);
+        items.push_back(item.second);
+    }
+    return Tensor::stack(items);
+}
+
+// ---- Subset ----
+
+Subset::Subset(Dataset *dataset, std::vector<int> indices) : _dataset(dataset), _indices(std::move(indices))
+{
+}
+
+Subset::Subset(Dataset *dataset, int begin, int end) : _dataset(dataset)
+{
+    if (begin < 0 || end < begin || end > dataset->get_length())
+    {
+        throw std::out_of_range("Subset range is outside the dataset");
+    }
+    for (int i = begin; i < end; i++)
+    {
+        _indices.push_back(i);
+    }
+}
+
+std::pair<int, std::shared_ptr<Tensor>> Subset::get_item(int index)
+{
+    return _dataset->get_item(_indices.at(index));
+}
+
+int Subset::get_length()
+{
+    return (int)_indices.size();
+}
+
+std::shared_ptr<Tensor> Subset::get_batch(const std::vector<int> &indices, std::vector<std::size_t> &labels)
+{
+    std::vector<int> mapped;
+    mapped.reserve(indices.size());
+    for (int index : indices)
+    {
+        mapped.push_back(_indices.at(index));
+    }
+    return _dataset->get_batch(mapped, labels);
+}
+
+// ---- IDXDataset ----
+
+IDXDataset::IDXDataset(const std::string &data_path, const std::string &labels_path)
+    : _images_file(std::make_shared<MappedFile>(data_path)), _labels_file(std::make_shared<MappedFile>(labels_path))
+{
+    std::vector<std::size_t> image_dims = read_idx_header(*_images_file, 3, data_path);
+    std::vector<std::size_t> label_dims = read_idx_header(*_labels_file, 1, labels_path);
+    if (image_dims[0] != label_dims[0])
+    {
+        throw std::runtime_error(data_path + " holds " + std::to_string(image_dims[0]) + " images but " + labels_path +
+                                 " holds " + std::to_string(label_dims[0]) + " labels");
+    }
+    _count = image_dims[0];
+    _rows = image_dims[1];
+    _cols = image_dims[2];
+    _pixels = (const unsigned char *)_images_file->data() + 16;
+    _labels = (const unsigned char *)_labels_file->data() + 8;
+}
+
+std::size_t IDXDataset::check_index(int index) const
+{
+    if (index < 0 || (std::size_t)index >= _count)
+    {
+        throw std::out_of_range("Dataset index " + std::to_string(index) + " out of range");
+    }
+    return index;
+}
+
+std::pair<int, std::shared_ptr<Tensor>> IDXDataset::get_item(int index)
+{
+    std::size_t i = check_index(index);
+    std::size_t numel = _rows * _cols;
+    Storage image(numel);
+    normalize_pixels(_pixels + i * numel, image.data(), numel);
+    return {_labels[i], std::make_shared<Tensor>(std::move(image), std::vector<std::size_t>{1, _rows, _cols})};
+}
+
+int IDXDataset::get_length()
+{
+    return (int)_count;
+}
+
+std::shared_ptr<Tensor> IDXDataset::get_batch(const std::vector<int> &indices, std::vector<std::size_t> &labels)
+{
+    std::size_t numel = _rows * _cols;
+    Storage batch(indices.size() * numel);
+    labels.clear();
+    for (std::size_t n = 0; n < indices.size(); n++)
+    {
+        std::size_t i = check_index(indices[n]);
+        normalize_pixels(_pixels + i * numel, batch.data() + n * numel, numel);
+        labels.push_back(_labels[i]);
+    }
+    return std::make_shared<Tensor>(std::move(batch), std::vector<std::size_t>{indices.size(), 1, _rows, _cols});
+}
+
+std::size_t IDXDataset::rows() const
+{
+    return _rows;
+}
+
+std::size_t IDXDataset::cols() const
+{
+    return _cols;
+}
+
+// ---- MNIST / FashionMNIST ----
+
+MNIST::MNIST(std::string data_path, std::string labels_path) : IDXDataset(data_path, labels_path)
+{
+}
+
+std::string MNIST::label_to_class(int label)
+{
+    return _classes.at(label);
+}
+
+FashionMNIST::FashionMNIST(std::string data_path, std::string labels_path) : IDXDataset(data_path, labels_path)
+{
+}
+
+std::string FashionMNIST::label_to_class(int label)
+{
+    return _classes.at(label);
+}
+
+void visualize_image(std::shared_ptr<Tensor> image)
+{
+    const std::vector<std::size_t> &shape = image->shape();
+    if (shape.size() < 2)
+    {
+        throw std::invalid_argument("visualize_image expects at least 2 dimensions");
+    }
+    std::size_t height = shape[shape.size() - 2];
+    std::size_t width = shape[shape.size() - 1];
+    const char *ramp = " .:-=+*#%@";
+    const std::size_t levels = 10;
+    const Storage &data = image->data();
+    for (std::size_t y = 0; y < height; y++)
+    {
+        std::string row;
+        for (std::size_t x = 0; x < width; x++)
+        {
+            float v = std::min(std::max(data[y * width + x], 0.0f), 1.0f);
+            row += ramp[std::min(levels - 1, (std::size_t)(v * levels))];
+        }
+        std::cout << row << '\n';
+    }
+    std::cout << std::flush;
+}
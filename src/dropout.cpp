@@ -1,63 +1,78 @@
 #include "../include/dropout.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
 #include "../include/tensor.h"
 #include <random>
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
-Dropout::Dropout(float rate) : rate(rate), is_training(true) {}
+// Instances are seeded in construction order: deterministic, but not all alike
+static std::atomic<unsigned> next_seed{1234};
+
+Dropout::Dropout(float rate) : rate(rate), gen(next_seed++) {}
 
 std::shared_ptr<Tensor> Dropout::forward(std::shared_ptr<Tensor> input) {
     // Pass through directly
-    if (!is_training) {
+    if (!is_training()) {
         return input;
     }
 
     //Generate Mask
     float scale = 1.0f / (1.0f - rate);
-    
-    static std::mt19937 gen(1234); 
-    std::bernoulli_distribution d(1.0f - rate);
 
-    const auto& in_data = input->data(); 
-    std::vector<float> out_data;
-    out_data.reserve(in_data.size());
-    
-    std::vector<float> mask_vec; 
-    mask_vec.reserve(in_data.size());
+    bool build_graph = GradMode::is_enabled() && input->requires_grad();
+
+    // the mask is only kept when backward will need it; it is shared with the
+    // gradfn so a captured step can redraw it on every replay
+    std::shared_ptr<Storage> mask_vec;
+    if (build_graph) mask_vec = std::make_shared<Storage>(input->numel());
 
     //  Forward Pass
-    for (float val : in_data) {
-        if (d(gen)) {
-            out_data.push_back(val * scale);
-            mask_vec.push_back(scale);
-        } else {
-            out_data.push_back(0.0f);
-            mask_vec.push_back(0.0f);
+    auto compute = [this, input, mask_vec, scale](Storage &out_data) {
+        std::bernoulli_distribution d(1.0f - rate);
+        const Storage& in_data = input->data();
+        float *mask = mask_vec ? mask_vec->data() : nullptr;
+        for (std::size_t i = 0; i < in_data.size(); i++) {
+            bool keep = d(gen);
+            out_data[i] = keep ? in_data[i] * scale : 0.0f;
+            if (mask) mask[i] = keep ? scale : 0.0f;
         }
+    };
+    Storage out_data(input->numel());
+    compute(out_data);
+
+    if (!build_graph) {
+        return std::make_shared<Tensor>(std::move(out_data), input->shape());
     }
 
     // Gradient Function
-    auto grad_fn = [input, mask_vec](const std::vector<float>& grad_output) {
+    GradFn grad_fn = [input, mask_vec](const Storage& grad_output) {
         
-        std::vector<float> grad_input;
-        grad_input.reserve(grad_output.size());
+        Storage grad_input(grad_output.size());
+        const Storage &mask = *mask_vec;
 
         // Chain Rule: d(Input) = d(Output) * Mask
         for (size_t i = 0; i < grad_output.size(); ++i) {
-            grad_input.push_back(grad_output[i] * mask_vec[i]);
+            grad_input[i] = grad_output[i] * mask[i];
         }
 
       
-        input->add_to_grad(grad_input);
+        input->add_to_grad(std::move(grad_input));
     };
     
     auto result = std::make_shared<Tensor>(
-        out_data,             
+        std::move(out_data),             
         input->shape(),        
-        input->requires_grad(),
-        grad_fn,             
+        true,
+        std::move(grad_fn),
         std::vector<std::shared_ptr<Tensor>>{input} 
     );
+    // the replayed forward draws from this module's generator, so the module
+    // must outlive the capture like every other layer
+    if (CaptureMode::is_active()) {
+        result->set_forwardfn(compute);
+    }
 
     return result;
 }
\ No newline at end of file
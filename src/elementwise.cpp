@@ -0,0 +1,520 @@
+#include "../include/tensor.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace
+{
+// One input of an elementwise loop: element i of the output (row-major
+// multi-index idx) reads data[sum(idx[d] * stride[d])]. Broadcast
+// dimensions have stride 0.
+struct Operand
+{
+    const float *data;
+    std::vector<std::size_t> stride;
+};
+
+// ---- Element functions ----
+
+struct AddFn { float operator()(float x, float y) const { return x + y; } };
+struct SubFn { float operator()(float x, float y) const { return x - y; } };
+struct MulFn { float operator()(float x, float y) const { return x * y; } };
+struct DivFn { float operator()(float x, float y) const { return x / y; } };
+struct MaxFn { float operator()(float x, float y) const { return x >= y ? x : y; } };
+struct MinFn { float operator()(float x, float y) const { return x <= y ? x : y; } };
+struct PowFn { float operator()(float x, float y) const { return std::pow(x, y); } };
+
+struct NegFn { float operator()(float x) const { return -x; } };
+struct ExpFn { float operator()(float x) const { return std::exp(x); } };
+struct LogFn { float operator()(float x) const { return std::log(x); } };
+struct SqrtFn { float operator()(float x) const { return std::sqrt(x); } };
+struct AbsFn { float operator()(float x) const { return std::fabs(x); } };
+struct TanhFn { float operator()(float x) const { return std::tanh(x); } };
+struct SigmoidFn { float operator()(float x) const { return 1.0f / (1.0f + std::exp(-x)); } };
+
+// ---- Strided loops ----
+
+// Stride-0 inputs of a run are read from a block filled with their value, so
+// that runs mixing broadcast and unit-stride inputs take the vectorized loop
+constexpr std::size_t BLOCK = 256;
+
+template <std::size_t K, typename Fn, std::size_t... I>
+void unit_loop(Fn fn, float *out, const float *const *in, std::size_t n, std::index_sequence<I...>)
+{
+    for (std::size_t i = 0; i < n; i++)
+    {
+        out[i] = fn(in[I][i]...);
+    }
+}
+
+template <std::size_t K, typename Fn, std::size_t... I>
+void strided_loop(Fn fn, float *out, const float *const *in, const std::size_t *stride, std::size_t n,
+                  std::index_sequence<I...>)
+{
+    for (std::size_t i = 0; i < n; i++)
+    {
+        out[i] = fn(in[I][i * stride[I]]...);
+    }
+}
+
+// out[0:n] = fn(inputs) along one run of the innermost dimension
+template <std::size_t K, typename Fn>
+void run(Fn fn, float *out, const float *const *in, const std::size_t *stride, std::size_t n)
+{
+    bool unit_or_broadcast = true;
+    for (std::size_t k = 0; k < K; k++)
+    {
+        unit_or_broadcast = unit_or_broadcast && stride[k] <= 1;
+    }
+    if (!unit_or_broadcast)
+    {
+        strided_loop<K>(fn, out, in, stride, n, std::make_index_sequence<K>());
+        return;
+    }
+    float filled[K][BLOCK];
+    const float *ptr[K];
+    for (std::size_t k = 0; k < K; k++)
+    {
+        if (stride[k] == 0 && n > 1)
+        {
+            std::fill(filled[k], filled[k] + std::min(n, BLOCK), *in[k]);
+        }
+    }
+    for (std::size_t i = 0; i < n; i += BLOCK)
+    {
+        std::size_t len = std::min(BLOCK, n - i);
+        for (std::size_t k = 0; k < K; k++)
+        {
+            ptr[k] = stride[k] == 0 && n > 1 ? filled[k] : in[k] + i;
+        }
+        unit_loop<K>(fn, out + i, ptr, len, std::make_index_sequence<K>());
+    }
+}
+
+// Drops size-1 dimensions and merges neighbours that every input walks
+// contiguously, so that e.g. a bias add over [N, C, H*W] is two loops, not four
+void collapse(std::vector<std::size_t> &shape, std::vector<std::vector<std::size_t> *> strides)
+{
+    std::vector<std::size_t> merged_shape;
+    std::vector<std::vector<std::size_t>> merged(strides.size());
+    for (std::size_t d = 0; d < shape.size(); d++)
+    {
+        if (shape[d] == 1)
+        {
+            continue;
+        }
+        bool mergeable = !merged_shape.empty();
+        for (std::size_t k = 0; k < strides.size() && mergeable; k++)
+        {
+            mergeable = merged[k].back() == (*strides[k])[d] * shape[d];
+        }
+        if (mergeable)
+        {
+            merged_shape.back() *= shape[d];
+            for (std::size_t k = 0; k < strides.size(); k++)
+            {
+                merged[k].back() = (*strides[k])[d];
+            }
+            continue;
+        }
+        merged_shape.push_back(shape[d]);
+        for (std::size_t k = 0; k < strides.size(); k++)
+        {
+            merged[k].push_back((*strides[k])[d]);
+        }
+    }
+    if (merged_shape.empty())
+    {
+        merged_shape.push_back(1);
+        for (auto &m : merged)
+        {
+            m.push_back(0);
+        }
+    }
+    shape = std::move(merged_shape);
+    for (std::size_t k = 0; k < strides.size(); k++)
+    {
+        *strides[k] = std::move(merged[k]);
+    }
+}
+
+// out (contiguous, of the given shape) = fn applied to the K inputs
+template <std::size_t K, typename Fn>
+void run_elementwise(Fn fn, std::vector<std::size_t> shape, std::array<Operand, K> in, float *out)
+{
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+    {
+        n *= d;
+    }
+    if (n == 0)
+    {
+        return;
+    }
+    std::vector<std::vector<std::size_t> *> strides;
+    for (auto &op : in)
+    {
+        strides.push_back(&op.stride);
+    }
+    collapse(shape, strides);
+    std::size_t rank = shape.size();
+    std::size_t inner = shape[rank - 1];
+
+    parallel_for(0, n, ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+    {
+        // multi-index of the first element, then runs along the last dimension
+        std::vector<std::size_t> index(rank);
+        std::size_t rest = begin;
+        for (std::size_t d = rank; d-- > 0;)
+        {
+            index[d] = rest % shape[d];
+            rest /= shape[d];
+        }
+        std::size_t inner_stride[K];
+        for (std::size_t k = 0; k < K; k++)
+        {
+            inner_stride[k] = in[k].stride[rank - 1];
+        }
+        std::size_t i = begin;
+        while (i < end)
+        {
+            const float *ptr[K];
+            for (std::size_t k = 0; k < K; k++)
+            {
+                std::size_t position = 0;
+                for (std::size_t d = 0; d < rank; d++)
+                {
+                    position += index[d] * in[k].stride[d];
+                }
+                ptr[k] = in[k].data + position;
+            }
+            std::size_t len = std::min(inner - index[rank - 1], end - i);
+            run<K>(fn, out + i, ptr, inner_stride, len);
+            i += len;
+            index[rank - 1] = 0;
+            for (std::size_t d = rank - 1; d-- > 0;)
+            {
+                if (++index[d] < shape[d])
+                {
+                    break;
+                }
+                index[d] = 0;
+            }
+        }
+    });
+}
+
+std::vector<std::size_t> row_major_strides(const std::vector<std::size_t> &shape)
+{
+    std::vector<std::size_t> stride(shape.size());
+    std::size_t s = 1;
+    for (std::size_t d = shape.size(); d-- > 0;)
+    {
+        stride[d] = s;
+        s *= shape[d];
+    }
+    return stride;
+}
+
+std::string shape_string(const std::vector<std::size_t> &shape)
+{
+    std::string text = "[";
+    for (std::size_t d = 0; d < shape.size(); d++)
+    {
+        text += (d ? ", " : "") + std::to_string(shape[d]);
+    }
+    return text + "]";
+}
+
+// NumPy broadcasting: align at the last dimension, sizes must match or be 1
+std::vector<std::size_t> broadcast_shape(const std::vector<std::size_t> &a, const std::vector<std::size_t> &b)
+{
+    std::size_t rank = std::max(a.size(), b.size());
+    std::vector<std::size_t> shape(rank);
+    for (std::size_t d = 0; d < rank; d++)
+    {
+        std::size_t da = d + a.size() >= rank ? a[d + a.size() - rank] : 1;
+        std::size_t db = d + b.size() >= rank ? b[d + b.size() - rank] : 1;
+        if (da != db && da != 1 && db != 1)
+        {
+            throw std::invalid_argument("Cannot broadcast shapes " + shape_string(a) + " and " + shape_string(b));
+        }
+        shape[d] = da == 1 ? db : da;
+    }
+    return shape;
+}
+
+// Strides that read a row-major buffer of `shape` broadcast to `out_shape`
+std::vector<std::size_t> broadcast_strides(const std::vector<std::size_t> &shape,
+                                           const std::vector<std::size_t> &stride,
+                                           const std::vector<std::size_t> &out_shape)
+{
+    std::vector<std::size_t> out(out_shape.size(), 0);
+    std::size_t lead = out_shape.size() - shape.size();
+    for (std::size_t d = 0; d < shape.size(); d++)
+    {
+        if (shape[d] != 1)
+        {
+            out[lead + d] = stride[d];
+        }
+    }
+    return out;
+}
+
+// Sums a gradient over the dimensions an input was broadcast along
+Storage reduce_to(Storage grad, const std::vector<std::size_t> &out_shape, const std::vector<std::size_t> &shape)
+{
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+    {
+        n *= d;
+    }
+    if (n == grad.size())
+    {
+        return grad;
+    }
+    Storage reduced(n);
+    std::vector<std::size_t> stride = broadcast_strides(shape, row_major_strides(shape), out_shape);
+    std::vector<std::size_t> index(out_shape.size(), 0);
+    for (std::size_t i = 0; i < grad.size(); i++)
+    {
+        std::size_t position = 0;
+        for (std::size_t d = 0; d < out_shape.size(); d++)
+        {
+            position += index[d] * stride[d];
+        }
+        reduced[position] += grad[i];
+        for (std::size_t d = out_shape.size(); d-- > 0;)
+        {
+            if (++index[d] < out_shape[d])
+            {
+                break;
+            }
+            index[d] = 0;
+        }
+    }
+    return reduced;
+}
+
+template <std::size_t K, typename Fn>
+Storage compute(Fn fn, const std::vector<std::size_t> &shape, std::array<Operand, K> in)
+{
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+    {
+        n *= d;
+    }
+    Storage out(n);
+    run_elementwise<K>(fn, shape, std::move(in), out.data());
+    return out;
+}
+
+// Input over a tensor's storage, broadcast to out_shape
+Operand make_operand(const Storage &storage, std::size_t offset, const std::vector<std::size_t> &shape,
+                     const std::vector<std::size_t> &stride, const std::vector<std::size_t> &out_shape)
+{
+    if (storage.dtype() != DType::Float32)
+    {
+        throw std::invalid_argument(std::string("Elementwise ops need float32 tensors, got ") +
+                                    dtype_name(storage.dtype()));
+    }
+    return {storage.data() + offset, broadcast_strides(shape, stride, out_shape)};
+}
+
+template <typename Fn>
+void binary_forward(BinaryOp op, Fn dispatch)
+{
+    switch (op)
+    {
+    case BinaryOp::Add: dispatch(AddFn{}); break;
+    case BinaryOp::Sub: dispatch(SubFn{}); break;
+    case BinaryOp::Mul: dispatch(MulFn{}); break;
+    case BinaryOp::Div: dispatch(DivFn{}); break;
+    case BinaryOp::Max: dispatch(MaxFn{}); break;
+    case BinaryOp::Min: dispatch(MinFn{}); break;
+    case BinaryOp::Pow: dispatch(PowFn{}); break;
+    }
+}
+
+template <typename Fn>
+void unary_forward(UnaryOp op, Fn dispatch)
+{
+    switch (op)
+    {
+    case UnaryOp::Neg: dispatch(NegFn{}); break;
+    case UnaryOp::Exp: dispatch(ExpFn{}); break;
+    case UnaryOp::Log: dispatch(LogFn{}); break;
+    case UnaryOp::Sqrt: dispatch(SqrtFn{}); break;
+    case UnaryOp::Abs: dispatch(AbsFn{}); break;
+    case UnaryOp::Tanh: dispatch(TanhFn{}); break;
+    case UnaryOp::Sigmoid: dispatch(SigmoidFn{}); break;
+    }
+}
+} // namespace
+
+std::shared_ptr<Tensor> Tensor::apply(BinaryOp op, std::shared_ptr<Tensor> other)
+{
+    std::shared_ptr<Tensor> self = shared_from_this();
+    std::vector<std::size_t> shape = broadcast_shape(_shape, other->_shape);
+    auto input = [shape](const Tensor &t) { return make_operand(*t._storage, t._offset, t._shape, t._stride, shape); };
+    auto forward = [self, other, op, shape, input](Storage &out)
+    {
+        std::array<Operand, 2> in{input(*self), input(*other)};
+        binary_forward(op, [&](auto fn) { run_elementwise<2>(fn, shape, in, out.data()); });
+    };
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+    {
+        n *= d;
+    }
+    Storage out(n);
+    forward(out);
+
+    if (!GradMode::is_enabled() || (!_requires_grad && !other->_requires_grad))
+    {
+        return std::make_shared<Tensor>(std::move(out), shape);
+    }
+    auto result = std::make_shared<Tensor>(std::move(out), shape, true, GradFn{},
+                                           std::vector<std::shared_ptr<Tensor>>{self, other});
+    // the output's own buffer, for the ops whose derivative uses it; holding
+    // the tensor itself would make it own its gradfn
+    std::shared_ptr<Storage> values = result->_storage;
+    result->_gradfn = [self, other, op, shape, values, input](const Storage &grad_output)
+    {
+        Operand g{grad_output.data(), row_major_strides(shape)};
+        Operand y{values->data(), row_major_strides(shape)};
+        Operand a = input(*self);
+        Operand b = input(*other);
+        Storage grad_a;
+        Storage grad_b;
+        switch (op)
+        {
+        case BinaryOp::Add:
+            grad_a = grad_output;
+            grad_b = grad_output;
+            break;
+        case BinaryOp::Sub:
+            grad_a = grad_output;
+            grad_b = compute<1>(NegFn{}, shape, {g});
+            break;
+        case BinaryOp::Mul:
+            grad_a = compute<2>(MulFn{}, shape, {g, b});
+            grad_b = compute<2>(MulFn{}, shape, {g, a});
+            break;
+        case BinaryOp::Div:
+            grad_a = compute<2>(DivFn{}, shape, {g, b});
+            grad_b = compute<3>([](float dy, float q, float y_) { return -dy * q / y_; }, shape, {g, y, b});
+            break;
+        case BinaryOp::Max:
+            grad_a = compute<3>([](float dy, float x, float y_) { return x >= y_ ? dy : 0.0f; }, shape, {g, a, b});
+            grad_b = compute<3>([](float dy, float x, float y_) { return x >= y_ ? 0.0f : dy; }, shape, {g, a, b});
+            break;
+        case BinaryOp::Min:
+            grad_a = compute<3>([](float dy, float x, float y_) { return x <= y_ ? dy : 0.0f; }, shape, {g, a, b});
+            grad_b = compute<3>([](float dy, float x, float y_) { return x <= y_ ? 0.0f : dy; }, shape, {g, a, b});
+            break;
+        case BinaryOp::Pow:
+            grad_a = compute<3>([](float dy, float x, float e) { return dy * e * std::pow(x, e - 1.0f); }, shape,
+                                {g, a, b});
+            // d(x^e)/de = x^e ln x, taken as 0 where x <= 0
+            grad_b = compute<3>([](float dy, float p, float x) { return x > 0.0f ? dy * p * std::log(x) : 0.0f; },
+                                shape, {g, y, a});
+            break;
+        }
+        if (self->_requires_grad)
+        {
+            self->add_to_grad(reduce_to(std::move(grad_a), shape, self->_shape));
+        }
+        if (other->_requires_grad)
+        {
+            other->add_to_grad(reduce_to(std::move(grad_b), shape, other->_shape));
+        }
+    };
+    if (CaptureMode::is_active())
+    {
+        result->set_forwardfn(forward);
+    }
+    return result;
+}
+
+std::shared_ptr<Tensor> Tensor::apply(UnaryOp op)
+{
+    std::shared_ptr<Tensor> self = shared_from_this();
+    std::vector<std::size_t> shape = _shape;
+    auto input = [shape](const Tensor &t) { return make_operand(*t._storage, t._offset, t._shape, t._stride, shape); };
+    auto forward = [self, op, shape, input](Storage &out)
+    {
+        std::array<Operand, 1> in{input(*self)};
+        unary_forward(op, [&](auto fn) { run_elementwise<1>(fn, shape, in, out.data()); });
+    };
+    Storage out(numel());
+    forward(out);
+
+    if (!GradMode::is_enabled() || !_requires_grad)
+    {
+        return std::make_shared<Tensor>(std::move(out), shape);
+    }
+    auto result = std::make_shared<Tensor>(std::move(out), shape, true, GradFn{},
+                                           std::vector<std::shared_ptr<Tensor>>{self});
+    std::shared_ptr<Storage> values = result->_storage;
+    result->_gradfn = [self, op, shape, values, input](const Storage &grad_output)
+    {
+        Operand g{grad_output.data(), row_major_strides(shape)};
+        Operand y{values->data(), row_major_strides(shape)};
+        Operand x = input(*self);
+        Storage grad;
+        switch (op)
+        {
+        case UnaryOp::Neg:
+            grad = compute<1>(NegFn{}, shape, {g});
+            break;
+        case UnaryOp::Exp:
+            grad = compute<2>(MulFn{}, shape, {g, y});
+            break;
+        case UnaryOp::Log:
+            grad = compute<2>(DivFn{}, shape, {g, x});
+            break;
+        case UnaryOp::Sqrt:
+            grad = compute<2>([](float dy, float r) { return 0.5f * dy / r; }, shape, {g, y});
+            break;
+        case UnaryOp::Abs:
+            grad = compute<2>([](float dy, float v) { return v > 0.0f ? dy : v < 0.0f ? -dy : 0.0f; }, shape,
+                              {g, x});
+            break;
+        case UnaryOp::Tanh:
+            grad = compute<2>([](float dy, float t) { return dy * (1.0f - t * t); }, shape, {g, y});
+            break;
+        case UnaryOp::Sigmoid:
+            grad = compute<2>([](float dy, float s) { return dy * s * (1.0f - s); }, shape, {g, y});
+            break;
+        }
+        self->add_to_grad(std::move(grad));
+    };
+    if (CaptureMode::is_active())
+    {
+        result->set_forwardfn(forward);
+    }
+    return result;
+}
+
+std::shared_ptr<Tensor> Tensor::operator+(std::shared_ptr<Tensor> other) { return apply(BinaryOp::Add, other); }
+std::shared_ptr<Tensor> Tensor::operator-(std::shared_ptr<Tensor> other) { return apply(BinaryOp::Sub, other); }
+std::shared_ptr<Tensor> Tensor::mul(std::shared_ptr<Tensor> other) { return apply(BinaryOp::Mul, other); }
+std::shared_ptr<Tensor> Tensor::div(std::shared_ptr<Tensor> other) { return apply(BinaryOp::Div, other); }
+std::shared_ptr<Tensor> Tensor::maximum(std::shared_ptr<Tensor> other) { return apply(BinaryOp::Max, other); }
+std::shared_ptr<Tensor> Tensor::minimum(std::shared_ptr<Tensor> other) { return apply(BinaryOp::Min, other); }
+std::shared_ptr<Tensor> Tensor::pow(std::shared_ptr<Tensor> exponent) { return apply(BinaryOp::Pow, exponent); }
+
+std::shared_ptr<Tensor> Tensor::neg() { return apply(UnaryOp::Neg); }
+std::shared_ptr<Tensor> Tensor::exp() { return apply(UnaryOp::Exp); }
+std::shared_ptr<Tensor> Tensor::log() { return apply(UnaryOp::Log); }
+std::shared_ptr<Tensor> Tensor::sqrt() { return apply(UnaryOp::Sqrt); }
+std::shared_ptr<Tensor> Tensor::abs() { return apply(UnaryOp::Abs); }
+std::shared_ptr<Tensor> Tensor::tanh() { return apply(UnaryOp::Tanh); }
+std::shared_ptr<Tensor> Tensor::sigmoid() { return apply(UnaryOp::Sigmoid); }
@@ -1,52 +1,234 @@
 #include "../include/fer_loader.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <sstream>
 #include <iostream>
 #include <stdexcept>
 
-void FERLoader::load(const std::string& csv_path, std::vector<std::shared_ptr<Tensor>>& images, std::vector<int>& labels, int limit) 
+namespace {
+const char FER_MAGIC[8] = {'F', 'E', 'R', 'D', 'A', 'T', '\0', '\0'};
+constexpr std::uint32_t FER_VERSION = 1;
+constexpr std::size_t FER_SIDE = 48;
+constexpr std::size_t FER_PIXELS = FER_SIDE * FER_SIDE;
+constexpr std::size_t FER_HEADER = sizeof(FER_MAGIC) + 4 * sizeof(std::uint32_t);
+constexpr std::size_t FER_ALIGNMENT = 64;
+
+// Parses "emotion,p0 p1 ... p2303[,Usage]" in place, with no stringstreams or
+// per-pixel allocations. Returns false for a malformed row.
+bool parse_row(const std::string& line, int& label, unsigned char* pixels, FERUsage& usage) {
+    const char* p = line.c_str();
+    const char* end = p + line.size();
+
+    if (p == end || *p < '0' || *p > '9') return false;
+    label = 0;
+    while (p < end && *p >= '0' && *p <= '9') label = label * 10 + (*p++ - '0');
+    if (p == end || *p++ != ',') return false;
+    if (p < end && *p == '"') p++;
+
+    for (std::size_t i = 0; i < FER_PIXELS; i++) {
+        while (p < end && *p == ' ') p++;
+        if (p == end || *p < '0' || *p > '9') return false;
+        int value = 0;
+        while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+        if (value > 255) return false;
+        pixels[i] = (unsigned char)value;
+    }
+    while (p < end && (*p == ' ' || *p == '"')) p++;
+
+    usage = FERUsage::Training;
+    if (p < end && *p == ',') {
+        std::string name(p + 1, end);
+        while (!name.empty() && (name.back() == '\r' || name.back() == ' ')) name.pop_back();
+        if (name == "PublicTest") usage = FERUsage::PublicTest;
+        else if (name == "PrivateTest") usage = FERUsage::PrivateTest;
+        else if (name != "Training") return false;
+        return true;
+    }
+    return p == end || *p == '\r';
+}
+
+template <typename T>
+void write_value(std::ofstream& file, T value) {
+    file.write((const char*)&value, sizeof(T));
+}
+
+std::size_t pixels_offset(std::size_t count) {
+    std::size_t offset = FER_HEADER + 2 * count;
+    return (offset + FER_ALIGNMENT - 1) / FER_ALIGNMENT * FER_ALIGNMENT;
+}
+} // namespace
+
+void FERLoader::load(const std::string& csv_path, std::vector<std::shared_ptr<Tensor>>& images, std::vector<int>& labels, int limit)
 {
     std::ifstream file(csv_path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open " + csv_path);
+    }
 
     std::string line;
-    
+
     std::getline(file, line);
 
     std::cout << "Loading FER-2013 Data" << std::endl;
     int count = 0;
+    int line_no = 1;
+    unsigned char pixels[FER_PIXELS];
 
     while (std::getline(file, line)) {
         if (limit != -1 && count >= limit) break;
+        line_no++;
 
-        std::stringstream ss(line);
-        std::string val_str;
+        int label;
+        FERUsage usage;
+        if (!parse_row(line, label, pixels, usage)) {
+            std::cerr << "Warning: wrong image found at line " << line_no << std::endl;
+            continue;
+        }
 
-        std::getline(ss, val_str, ','); 
-        int label = std::stoi(val_str);
+        Storage img_data(FER_PIXELS);
+        for (std::size_t i = 0; i < FER_PIXELS; i++) {
+            img_data[i] = pixels[i] / 255.0f;
+        }
         labels.push_back(label);
+        images.push_back(std::make_shared<Tensor>(std::move(img_data), std::vector<std::size_t>{1, 48, 48}));
 
-        std::getline(ss, val_str, ',');
-        std::stringstream pixel_ss(val_str);
-        std::string pixel_val;
-        std::vector<float> img_data;
-        img_data.reserve(48 * 48);
+        count++;
+        if (count % 1000 == 0) std::cout << "Loaded " << count << " images \r" << std::flush;
+    }
+    std::cout << "\nLoaded " << count << " images successfully." << std::endl;
+}
 
-        while (std::getline(pixel_ss, pixel_val, ' ')) {
-            if (!pixel_val.empty()) {
-                img_data.push_back(std::stof(pixel_val) / 255.0f);
-            }
-        }
+std::size_t FERLoader::convert(const std::string& csv_path, const std::string& bin_path)
+{
+    std::ifstream csv(csv_path);
+    if (!csv.is_open()) {
+        throw std::runtime_error("Could not open " + csv_path);
+    }
 
-        if (img_data.size() != 48 * 48) {
-            std::cerr << "Warning: wrong image found at line " << count + 2 << std::endl;
-            labels.pop_back(); 
+    std::vector<unsigned char> labels;
+    std::vector<unsigned char> usage;
+    std::vector<unsigned char> pixels;
+    std::string line;
+    std::getline(csv, line);
+    int line_no = 1;
+    while (std::getline(csv, line)) {
+        line_no++;
+        if (line.empty() || line == "\r") continue;
+        int label;
+        FERUsage row_usage;
+        pixels.resize((labels.size() + 1) * FER_PIXELS);
+        if (!parse_row(line, label, pixels.data() + labels.size() * FER_PIXELS, row_usage) || label > 255) {
+            std::cerr << "Warning: skipping malformed row at line " << line_no << std::endl;
+            pixels.resize(labels.size() * FER_PIXELS);
             continue;
         }
+        labels.push_back((unsigned char)label);
+        usage.push_back((unsigned char)row_usage);
+    }
 
-        images.push_back(std::make_shared<Tensor>(img_data, std::vector<std::size_t>{1, 48, 48}));
-        
-        count++;
-        if (count % 1000 == 0) std::cout << "Loaded " << count << " images \r" << std::flush;
+    std::size_t count = labels.size();
+    std::string tmp_path = bin_path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not open " + tmp_path + " for writing");
     }
-    std::cout << "\nLoaded " << count << " images successfully." << std::endl;
-}
\ No newline at end of file
+    out.write(FER_MAGIC, sizeof(FER_MAGIC));
+    write_value<std::uint32_t>(out, FER_VERSION);
+    write_value<std::uint32_t>(out, (std::uint32_t)count);
+    write_value<std::uint32_t>(out, (std::uint32_t)FER_SIDE);
+    write_value<std::uint32_t>(out, (std::uint32_t)FER_SIDE);
+    out.write((const char*)labels.data(), count);
+    out.write((const char*)usage.data(), count);
+    const char zeros[FER_ALIGNMENT] = {};
+    out.write(zeros, pixels_offset(count) - (FER_HEADER + 2 * count));
+    out.write((const char*)pixels.data(), pixels.size());
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Failed writing " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), bin_path.c_str()) != 0) {
+        throw std::runtime_error("Could not move " + tmp_path + " to " + bin_path);
+    }
+    return count;
+}
+
+// ---- FERDataset ----
+
+FERDataset::FERDataset(const std::string& bin_path) : _file(std::make_shared<MappedFile>(bin_path)) {
+    const char* data = _file->data();
+    std::size_t size = _file->size();
+    if (size < FER_HEADER || std::memcmp(data, FER_MAGIC, sizeof(FER_MAGIC)) != 0) {
+        throw std::runtime_error(bin_path + " is not a FER dataset; create it with FERLoader::convert");
+    }
+    std::uint32_t header[4];
+    std::memcpy(header, data + sizeof(FER_MAGIC), sizeof(header));
+    if (header[0] != FER_VERSION) {
+        throw std::runtime_error(bin_path + " is FER dataset version " + std::to_string(header[0]) +
+                                 ", this build reads version " + std::to_string(FER_VERSION));
+    }
+    _count = header[1];
+    _height = header[2];
+    _width = header[3];
+    std::size_t offset = pixels_offset(_count);
+    if (offset > size || (size - offset) / (_height * _width) < _count) {
+        throw std::runtime_error(bin_path + " is truncated");
+    }
+    const unsigned char* bytes = (const unsigned char*)data;
+    _labels = bytes + FER_HEADER;
+    _usage = _labels + _count;
+    _pixels = bytes + offset;
+}
+
+FERDataset::FERDataset(const std::string& bin_path, FERUsage usage) : FERDataset(bin_path) {
+    _filtered = true;
+    for (std::size_t i = 0; i < _count; i++) {
+        if (_usage[i] == (unsigned char)usage) _subset.push_back(i);
+    }
+}
+
+std::size_t FERDataset::length() const {
+    return _filtered ? _subset.size() : _count;
+}
+
+std::size_t FERDataset::file_index(int index) const {
+    if (index < 0 || (std::size_t)index >= length()) {
+        throw std::out_of_range("FERDataset index " + std::to_string(index) + " out of range");
+    }
+    return _filtered ? _subset[index] : (std::size_t)index;
+}
+
+void FERDataset::fill(float* dst, std::size_t i) const {
+    normalize_pixels(_pixels + i * _height * _width, dst, _height * _width);
+}
+
+std::pair<int, std::shared_ptr<Tensor>> FERDataset::get_item(int index) {
+    std::size_t i = file_index(index);
+    Storage image(_height * _width);
+    fill(image.data(), i);
+    return {_labels[i], std::make_shared<Tensor>(std::move(image), std::vector<std::size_t>{1, _height, _width})};
+}
+
+int FERDataset::get_length() {
+    return (int)length();
+}
+
+std::shared_ptr<Tensor> FERDataset::get_batch(const std::vector<int>& indices, std::vector<std::size_t>& labels) {
+    std::size_t numel = _height * _width;
+    Storage batch(indices.size() * numel);
+    labels.clear();
+    for (std::size_t n = 0; n < indices.size(); n++) {
+        std::size_t i = file_index(indices[n]);
+        fill(batch.data() + n * numel, i);
+        labels.push_back(_labels[i]);
+    }
+    return std::make_shared<Tensor>(std::move(batch), std::vector<std::size_t>{indices.size(), 1, _height, _width});
+}
+
+int FERDataset::label(int index) const {
+    return _labels[file_index(index)];
+}
+
+FERUsage FERDataset::usage(int index) const {
+    return (FERUsage)_usage[file_index(index)];
+}
@@ -0,0 +1,495 @@
+#include "../include/gemm.h"
+#include "../include/gemm_kernels.h"
+#include "../include/cpu_features.h"
+#include "../include/half.h"
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Cache blocks: a KC x NR sliver of B stays in L1, an MC x KC block of A in L2.
+// MC and NC are multiples of every kernel's MR and NR.
+constexpr std::size_t MC = 120;
+constexpr std::size_t KC = 256;
+constexpr std::size_t NC = 2048;
+
+// Multiply-adds below which a call is not worth splitting across threads
+constexpr double PARALLEL_MIN_WORK = 1 << 18;
+
+// ---- Portable scalar kernels ----
+
+constexpr std::size_t SCALAR_MR = 4;
+constexpr std::size_t SCALAR_NR = 16;
+
+void scalar_micro_kernel(std::size_t kc, const float *a, const float *b,
+                         float *C, std::size_t ldc, std::size_t m, std::size_t n,
+                         float alpha, float beta)
+{
+    float acc[SCALAR_MR][SCALAR_NR] = {};
+    for (std::size_t k = 0; k < kc; k++)
+    {
+        const float *b_k = b + k * SCALAR_NR;
+        for (std::size_t r = 0; r < SCALAR_MR; r++)
+        {
+            float a_r = a[k * SCALAR_MR + r];
+            for (std::size_t c = 0; c < SCALAR_NR; c++)
+            {
+                acc[r][c] += a_r * b_k[c];
+            }
+        }
+    }
+
+    for (std::size_t r = 0; r < m; r++)
+    {
+        float *c_row = C + r * ldc;
+        if (beta == 0.0f)
+        {
+            for (std::size_t c = 0; c < n; c++)
+                c_row[c] = alpha * acc[r][c];
+        }
+        else
+        {
+            for (std::size_t c = 0; c < n; c++)
+                c_row[c] = alpha * acc[r][c] + beta * c_row[c];
+        }
+    }
+}
+
+void scalar_gemv_n(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                   const float *x, float beta, float *y)
+{
+    for (std::size_t i = 0; i < M; i++)
+    {
+        const float *row = A + i * lda;
+        float sum = 0.0f;
+        for (std::size_t j = 0; j < N; j++)
+            sum += row[j] * x[j];
+        y[i] = alpha * sum + (beta == 0.0f ? 0.0f : beta * y[i]);
+    }
+}
+
+void scalar_gemv_t(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                   const float *x, float beta, float *y)
+{
+    for (std::size_t j = 0; j < N; j++)
+        y[j] = beta == 0.0f ? 0.0f : beta * y[j];
+    for (std::size_t i = 0; i < M; i++)
+    {
+        const float *row = A + i * lda;
+        float s = alpha * x[i];
+        for (std::size_t j = 0; j < N; j++)
+            y[j] += s * row[j];
+    }
+}
+
+void scalar_ger(std::size_t M, std::size_t N, float alpha, const float *x, const float *y,
+                float *A, std::size_t lda)
+{
+    for (std::size_t i = 0; i < M; i++)
+    {
+        float *row = A + i * lda;
+        float s = alpha * x[i];
+        for (std::size_t j = 0; j < N; j++)
+            row[j] += s * y[j];
+    }
+}
+
+inline float load_half(DType dtype, const std::uint16_t *p)
+{
+    return dtype == DType::BFloat16 ? bf16_to_float(*p) : fp16_to_float(*p);
+}
+
+void scalar_gemv_n_half(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                        std::size_t lda, const float *x, float beta, float *y)
+{
+    for (std::size_t i = 0; i < M; i++)
+    {
+        const std::uint16_t *row = A + i * lda;
+        float sum = 0.0f;
+        for (std::size_t j = 0; j < N; j++)
+            sum += load_half(dtype, row + j) * x[j];
+        y[i] = alpha * sum + (beta == 0.0f ? 0.0f : beta * y[i]);
+    }
+}
+
+void scalar_gemv_t_half(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                        std::size_t lda, const float *x, float beta, float *y)
+{
+    for (std::size_t j = 0; j < N; j++)
+        y[j] = beta == 0.0f ? 0.0f : beta * y[j];
+    for (std::size_t i = 0; i < M; i++)
+    {
+        const std::uint16_t *row = A + i * lda;
+        float s = alpha * x[i];
+        for (std::size_t j = 0; j < N; j++)
+            y[j] += s * load_half(dtype, row + j);
+    }
+}
+
+const GemmKernels scalar_kernels{
+    "scalar", SCALAR_MR, SCALAR_NR,
+    scalar_micro_kernel, scalar_gemv_n, scalar_gemv_t, scalar_ger,
+    scalar_gemv_n_half, scalar_gemv_t_half};
+
+// Best kernel set for this CPU, capped by DL_SIMD if set
+const GemmKernels &select_kernels()
+{
+    const char *env = std::getenv("DL_SIMD");
+    std::string cap = env ? env : "";
+    const CpuFeatures &cpu = cpu_features();
+
+    if (cap.empty() || cap == "avx512")
+    {
+        const GemmKernels *k = gemm_kernels_avx512();
+        if (k && cpu.avx512f)
+            return *k;
+    }
+    if (cap.empty() || cap == "avx512" || cap == "avx2")
+    {
+        // F16C ships with every AVX2 CPU; the 16-bit GEMVs use it
+        const GemmKernels *k = gemm_kernels_avx2();
+        if (k && cpu.avx2 && cpu.fma && cpu.f16c)
+            return *k;
+    }
+    return scalar_kernels;
+}
+
+const GemmKernels &kernels()
+{
+    static const GemmKernels &k = select_kernels();
+    return k;
+}
+
+// Storage types of a GEMM operand. Packing widens every element to float,
+// so the micro-kernels only ever see float panels.
+struct F32
+{
+    using type = float;
+    static float load(const float *p) { return *p; }
+    static void copy(const float *src, std::size_t n, float *dst) { std::copy(src, src + n, dst); }
+};
+
+struct BF16
+{
+    using type = std::uint16_t;
+    static float load(const std::uint16_t *p) { return bf16_to_float(*p); }
+    static void copy(const std::uint16_t *src, std::size_t n, float *dst) { half_to_float(src, dst, n, DType::BFloat16); }
+};
+
+struct F16
+{
+    using type = std::uint16_t;
+    static float load(const std::uint16_t *p) { return fp16_to_float(*p); }
+    static void copy(const std::uint16_t *src, std::size_t n, float *dst) { half_to_float(src, dst, n, DType::Float16); }
+};
+
+// Packs rows [0, mc) x cols [0, kc) of op(A) into mr-row panels, each stored
+// k-major so the micro-kernel reads mr consecutive values per k. Rows past mc
+// are zero padded.
+template <typename TA>
+void pack_a(bool trans, const typename TA::type *A, std::size_t lda, std::size_t mc, std::size_t kc,
+            std::size_t mr, float *buf)
+{
+    for (std::size_t p = 0; p < mc; p += mr)
+    {
+        std::size_t rows = std::min(mr, mc - p);
+        for (std::size_t k = 0; k < kc; k++)
+        {
+            for (std::size_t r = 0; r < mr; r++)
+            {
+                if (r < rows)
+                    *buf++ = TA::load(trans ? A + k * lda + p + r : A + (p + r) * lda + k);
+                else
+                    *buf++ = 0.0f;
+            }
+        }
+    }
+}
+
+// Packs rows [0, kc) x cols [0, nc) of op(B) into nr-column panels, k-major
+template <typename TB>
+void pack_b(bool trans, const typename TB::type *B, std::size_t ldb, std::size_t kc, std::size_t nc,
+            std::size_t nr, float *buf)
+{
+    for (std::size_t p = 0; p < nc; p += nr)
+    {
+        std::size_t cols = std::min(nr, nc - p);
+        for (std::size_t k = 0; k < kc; k++)
+        {
+            if (!trans && cols == nr)
+            {
+                TB::copy(B + k * ldb + p, nr, buf);
+                buf += nr;
+                continue;
+            }
+            for (std::size_t c = 0; c < nr; c++)
+            {
+                if (c < cols)
+                    *buf++ = TB::load(trans ? B + (p + c) * ldb + k : B + k * ldb + p + c);
+                else
+                    *buf++ = 0.0f;
+            }
+        }
+    }
+}
+
+template <typename TA, typename TB>
+void sgemm_serial(bool trans_a, bool trans_b,
+                  std::size_t M, std::size_t N, std::size_t K,
+                  float alpha,
+                  const typename TA::type *A, std::size_t lda,
+                  const typename TB::type *B, std::size_t ldb,
+                  float beta,
+                  float *C, std::size_t ldc)
+{
+    if (K == 0)
+    {
+        for (std::size_t i = 0; i < M; i++)
+            for (std::size_t j = 0; j < N; j++)
+                C[i * ldc + j] = beta == 0.0f ? 0.0f : beta * C[i * ldc + j];
+        return;
+    }
+
+    const GemmKernels &kern = kernels();
+    std::size_t mr = kern.mr;
+    std::size_t nr = kern.nr;
+
+    // Packing buffers are reused across calls on the same thread
+    thread_local std::vector<float> a_buf;
+    thread_local std::vector<float> b_buf;
+    a_buf.resize(MC * KC);
+    b_buf.resize(KC * NC);
+
+    for (std::size_t jc = 0; jc < N; jc += NC)
+    {
+        std::size_t nc = std::min(NC, N - jc);
+        for (std::size_t pc = 0; pc < K; pc += KC)
+        {
+            std::size_t kc = std::min(KC, K - pc);
+            // only the first K block applies the caller's beta, later blocks accumulate
+            float beta_block = pc == 0 ? beta : 1.0f;
+
+            const auto *B_block = trans_b ? B + jc * ldb + pc : B + pc * ldb + jc;
+            pack_b<TB>(trans_b, B_block, ldb, kc, nc, nr, b_buf.data());
+
+            for (std::size_t ic = 0; ic < M; ic += MC)
+            {
+                std::size_t mc = std::min(MC, M - ic);
+                const auto *A_block = trans_a ? A + pc * lda + ic : A + ic * lda + pc;
+                pack_a<TA>(trans_a, A_block, lda, mc, kc, mr, a_buf.data());
+
+                for (std::size_t jr = 0; jr < nc; jr += nr)
+                {
+                    std::size_t n = std::min(nr, nc - jr);
+                    for (std::size_t ir = 0; ir < mc; ir += mr)
+                    {
+                        std::size_t m = std::min(mr, mc - ir);
+                        kern.micro_kernel(kc, a_buf.data() + ir * kc, b_buf.data() + jr * kc,
+                                          C + (ic + ir) * ldc + jc + jr, ldc, m, n,
+                                          alpha, beta_block);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Number of `unit`-sized tiles each task should get so it does at least
+// PARALLEL_MIN_WORK multiply-adds
+std::size_t tile_grain(double work_per_tile)
+{
+    return std::max<std::size_t>(1, (std::size_t)(PARALLEL_MIN_WORK / std::max(work_per_tile, 1.0)));
+}
+
+template <typename TA, typename TB>
+void gemm(bool trans_a, bool trans_b,
+          std::size_t M, std::size_t N, std::size_t K,
+          float alpha,
+          const typename TA::type *A, std::size_t lda,
+          const typename TB::type *B, std::size_t ldb,
+          float beta,
+          float *C, std::size_t ldc)
+{
+    if (M == 0 || N == 0)
+        return;
+
+    // Large products are split into independent stripes of C along its longer
+    // side, aligned to the register tile. Inside a pool task this runs inline.
+    if ((double)M * N * K < 2 * PARALLEL_MIN_WORK)
+    {
+        sgemm_serial<TA, TB>(trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+        return;
+    }
+
+    const GemmKernels &kern = kernels();
+    if (N >= M)
+    {
+        std::size_t nr = kern.nr;
+        std::size_t tiles = (N + nr - 1) / nr;
+        parallel_for(0, tiles, tile_grain((double)M * nr * K), [&](std::size_t t0, std::size_t t1)
+        {
+            std::size_t j0 = t0 * nr;
+            std::size_t j1 = std::min(N, t1 * nr);
+            const auto *B_j = trans_b ? B + j0 * ldb : B + j0;
+            sgemm_serial<TA, TB>(trans_a, trans_b, M, j1 - j0, K, alpha, A, lda, B_j, ldb, beta, C + j0, ldc);
+        });
+    }
+    else
+    {
+        std::size_t mr = kern.mr;
+        std::size_t tiles = (M + mr - 1) / mr;
+        parallel_for(0, tiles, tile_grain((double)mr * N * K), [&](std::size_t t0, std::size_t t1)
+        {
+            std::size_t i0 = t0 * mr;
+            std::size_t i1 = std::min(M, t1 * mr);
+            const auto *A_i = trans_a ? A + i0 : A + i0 * lda;
+            sgemm_serial<TA, TB>(trans_a, trans_b, i1 - i0, N, K, alpha, A_i, lda, B, ldb, beta, C + i0 * ldc, ldc);
+        });
+    }
+}
+
+// Calls f with the storage type tag of dtype
+template <typename F>
+void with_type(DType dtype, F &&f)
+{
+    switch (dtype)
+    {
+    case DType::Float32:
+        f(F32{});
+        return;
+    case DType::BFloat16:
+        f(BF16{});
+        return;
+    case DType::Float16:
+        f(F16{});
+        return;
+    }
+}
+
+} // namespace
+
+void sgemm(bool trans_a, bool trans_b,
+           std::size_t M, std::size_t N, std::size_t K,
+           float alpha,
+           const float *A, std::size_t lda,
+           const float *B, std::size_t ldb,
+           float beta,
+           float *C, std::size_t ldc)
+{
+    gemm<F32, F32>(trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void sgemm_mixed(bool trans_a, bool trans_b,
+                 std::size_t M, std::size_t N, std::size_t K,
+                 float alpha,
+                 const void *A, DType a_type, std::size_t lda,
+                 const void *B, DType b_type, std::size_t ldb,
+                 float beta,
+                 float *C, std::size_t ldc)
+{
+    with_type(a_type, [&](auto ta)
+    {
+        using TA = decltype(ta);
+        with_type(b_type, [&](auto tb)
+        {
+            using TB = decltype(tb);
+            gemm<TA, TB>(trans_a, trans_b, M, N, K, alpha,
+                         static_cast<const typename TA::type *>(A), lda,
+                         static_cast<const typename TB::type *>(B), ldb,
+                         beta, C, ldc);
+        });
+    });
+}
+
+void sgemv(bool trans, std::size_t M, std::size_t N,
+           float alpha, const float *A, std::size_t lda,
+           const float *x, float beta, float *y)
+{
+    const GemmKernels &kern = kernels();
+    if ((double)M * N < 2 * PARALLEL_MIN_WORK)
+    {
+        if (trans)
+            kern.gemv_t(M, N, alpha, A, lda, x, beta, y);
+        else
+            kern.gemv_n(M, N, alpha, A, lda, x, beta, y);
+        return;
+    }
+
+    // Split along the output: rows of A without trans, columns with trans
+    if (trans)
+    {
+        parallel_for(0, N, tile_grain((double)M), [&](std::size_t j0, std::size_t j1)
+        {
+            kern.gemv_t(M, j1 - j0, alpha, A + j0, lda, x, beta, y + j0);
+        });
+    }
+    else
+    {
+        parallel_for(0, M, tile_grain((double)N), [&](std::size_t i0, std::size_t i1)
+        {
+            kern.gemv_n(i1 - i0, N, alpha, A + i0 * lda, lda, x, beta, y + i0);
+        });
+    }
+}
+
+void sgemv_mixed(bool trans, std::size_t M, std::size_t N,
+                 float alpha, const void *A, DType a_type, std::size_t lda,
+                 const float *x, float beta, float *y)
+{
+    if (a_type == DType::Float32)
+    {
+        sgemv(trans, M, N, alpha, static_cast<const float *>(A), lda, x, beta, y);
+        return;
+    }
+    const GemmKernels &kern = kernels();
+    const auto *A16 = static_cast<const std::uint16_t *>(A);
+    if ((double)M * N < 2 * PARALLEL_MIN_WORK)
+    {
+        if (trans)
+            kern.gemv_t_half(a_type, M, N, alpha, A16, lda, x, beta, y);
+        else
+            kern.gemv_n_half(a_type, M, N, alpha, A16, lda, x, beta, y);
+        return;
+    }
+
+    // Same splits as sgemv
+    if (trans)
+    {
+        parallel_for(0, N, tile_grain((double)M), [&](std::size_t j0, std::size_t j1)
+        {
+            kern.gemv_t_half(a_type, M, j1 - j0, alpha, A16 + j0, lda, x, beta, y + j0);
+        });
+    }
+    else
+    {
+        parallel_for(0, M, tile_grain((double)N), [&](std::size_t i0, std::size_t i1)
+        {
+            kern.gemv_n_half(a_type, i1 - i0, N, alpha, A16 + i0 * lda, lda, x, beta, y + i0);
+        });
+    }
+}
+
+void sger(std::size_t M, std::size_t N, float alpha,
+          const float *x, const float *y, float *A, std::size_t lda)
+{
+    const GemmKernels &kern = kernels();
+    if ((double)M * N < 2 * PARALLEL_MIN_WORK)
+    {
+        kern.ger(M, N, alpha, x, y, A, lda);
+        return;
+    }
+
+    // Column stripes keep every task busy even when M is tiny (e.g. 7 classes)
+    parallel_for(0, N, tile_grain((double)M), [&](std::size_t j0, std::size_t j1)
+    {
+        kern.ger(M, j1 - j0, alpha, x, y + j0, A + j0, lda);
+    });
+}
+
+const char *gemm_backend()
+{
+    return kernels().name;
+}
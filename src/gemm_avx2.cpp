@@ -0,0 +1,255 @@
+#include "../include/gemm_kernels.h"
+#include "../include/half.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+
+namespace
+{
+constexpr std::size_t MR = 6;
+constexpr std::size_t NR = 16;
+
+AVX2_TARGET inline float hsum(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+    return _mm_cvtss_f32(lo);
+}
+
+// 6x16 tile: 12 ymm accumulators, two B vectors and one broadcast A value per k
+AVX2_TARGET void micro_kernel(std::size_t kc, const float *a, const float *b,
+                              float *C, std::size_t ldc, std::size_t m, std::size_t n,
+                              float alpha, float beta)
+{
+    __m256 acc[MR][2];
+    for (std::size_t r = 0; r < MR; r++)
+    {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+
+    for (std::size_t k = 0; k < kc; k++)
+    {
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+        for (std::size_t r = 0; r < MR; r++)
+        {
+            __m256 a_r = _mm256_broadcast_ss(a + r);
+            acc[r][0] = _mm256_fmadd_ps(a_r, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(a_r, b1, acc[r][1]);
+        }
+        a += MR;
+        b += NR;
+    }
+
+    __m256 va = _mm256_set1_ps(alpha);
+    if (m == MR && n == NR)
+    {
+        __m256 vb = _mm256_set1_ps(beta);
+        for (std::size_t r = 0; r < MR; r++)
+        {
+            float *c_row = C + r * ldc;
+            for (std::size_t h = 0; h < 2; h++)
+            {
+                __m256 v = _mm256_mul_ps(va, acc[r][h]);
+                if (beta != 0.0f)
+                    v = _mm256_fmadd_ps(vb, _mm256_loadu_ps(c_row + 8 * h), v);
+                _mm256_storeu_ps(c_row + 8 * h, v);
+            }
+        }
+        return;
+    }
+
+    // Edge tile: spill and write only the valid part
+    float tile[MR][NR];
+    for (std::size_t r = 0; r < MR; r++)
+    {
+        _mm256_storeu_ps(tile[r], _mm256_mul_ps(va, acc[r][0]));
+        _mm256_storeu_ps(tile[r] + 8, _mm256_mul_ps(va, acc[r][1]));
+    }
+    for (std::size_t r = 0; r < m; r++)
+    {
+        float *c_row = C + r * ldc;
+        for (std::size_t c = 0; c < n; c++)
+            c_row[c] = tile[r][c] + (beta == 0.0f ? 0.0f : beta * c_row[c]);
+    }
+}
+
+// Row element loads for the GEMV kernels: 8 values widened to float, or one
+template <typename T, DType D = DType::Float32>
+struct Load;
+
+template <>
+struct Load<float>
+{
+    using type = float;
+    AVX2_TARGET static __m256 load(const float *p) { return _mm256_loadu_ps(p); }
+    static float scalar(const float *p) { return *p; }
+};
+
+template <DType D>
+struct Load<std::uint16_t, D>
+{
+    using type = std::uint16_t;
+    AVX2_TARGET static __m256 load(const std::uint16_t *p)
+    {
+        __m128i h = _mm_loadu_si128((const __m128i *)p);
+        if (D == DType::BFloat16)
+            return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+        return _mm256_cvtph_ps(h);
+    }
+    static float scalar(const std::uint16_t *p) { return D == DType::BFloat16 ? bf16_to_float(*p) : fp16_to_float(*p); }
+};
+
+using LoadF32 = Load<float>;
+
+template <typename L>
+AVX2_TARGET void gemv_n_rows(std::size_t M, std::size_t N, float alpha, const typename L::type *A, std::size_t lda,
+                             const float *x, float beta, float *y)
+{
+    std::size_t i = 0;
+    // four rows at a time so every load of x is reused four times
+    for (; i + 4 <= M; i += 4)
+    {
+        const auto *r0 = A + i * lda;
+        const auto *r1 = r0 + lda;
+        const auto *r2 = r1 + lda;
+        const auto *r3 = r2 + lda;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 8 <= N; j += 8)
+        {
+            __m256 xv = _mm256_loadu_ps(x + j);
+            s0 = _mm256_fmadd_ps(L::load(r0 + j), xv, s0);
+            s1 = _mm256_fmadd_ps(L::load(r1 + j), xv, s1);
+            s2 = _mm256_fmadd_ps(L::load(r2 + j), xv, s2);
+            s3 = _mm256_fmadd_ps(L::load(r3 + j), xv, s3);
+        }
+        float t0 = hsum(s0), t1 = hsum(s1), t2 = hsum(s2), t3 = hsum(s3);
+        for (; j < N; j++)
+        {
+            t0 += L::scalar(r0 + j) * x[j];
+            t1 += L::scalar(r1 + j) * x[j];
+            t2 += L::scalar(r2 + j) * x[j];
+            t3 += L::scalar(r3 + j) * x[j];
+        }
+        float t[4] = {t0, t1, t2, t3};
+        for (std::size_t r = 0; r < 4; r++)
+            y[i + r] = alpha * t[r] + (beta == 0.0f ? 0.0f : beta * y[i + r]);
+    }
+    for (; i < M; i++)
+    {
+        const auto *row = A + i * lda;
+        __m256 s = _mm256_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 8 <= N; j += 8)
+            s = _mm256_fmadd_ps(L::load(row + j), _mm256_loadu_ps(x + j), s);
+        float t = hsum(s);
+        for (; j < N; j++)
+            t += L::scalar(row + j) * x[j];
+        y[i] = alpha * t + (beta == 0.0f ? 0.0f : beta * y[i]);
+    }
+}
+
+AVX2_TARGET void gemv_n(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                        const float *x, float beta, float *y)
+{
+    gemv_n_rows<LoadF32>(M, N, alpha, A, lda, x, beta, y);
+}
+
+// y += s * row over N entries
+template <typename L>
+AVX2_TARGET inline void axpy(std::size_t N, float s, const typename L::type *row, float *y)
+{
+    __m256 sv = _mm256_set1_ps(s);
+    std::size_t j = 0;
+    for (; j + 8 <= N; j += 8)
+        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(sv, L::load(row + j), _mm256_loadu_ps(y + j)));
+    for (; j < N; j++)
+        y[j] += s * L::scalar(row + j);
+}
+
+template <typename L>
+AVX2_TARGET void gemv_t_rows(std::size_t M, std::size_t N, float alpha, const typename L::type *A, std::size_t lda,
+                             const float *x, float beta, float *y)
+{
+    for (std::size_t j = 0; j < N; j++)
+        y[j] = beta == 0.0f ? 0.0f : beta * y[j];
+
+    std::size_t i = 0;
+    // four rows per pass over y halves the load/store traffic on y
+    for (; i + 4 <= M; i += 4)
+    {
+        const auto *r0 = A + i * lda;
+        const auto *r1 = r0 + lda;
+        const auto *r2 = r1 + lda;
+        const auto *r3 = r2 + lda;
+        __m256 x0 = _mm256_set1_ps(alpha * x[i]);
+        __m256 x1 = _mm256_set1_ps(alpha * x[i + 1]);
+        __m256 x2 = _mm256_set1_ps(alpha * x[i + 2]);
+        __m256 x3 = _mm256_set1_ps(alpha * x[i + 3]);
+        std::size_t j = 0;
+        for (; j + 8 <= N; j += 8)
+        {
+            __m256 acc = _mm256_loadu_ps(y + j);
+            acc = _mm256_fmadd_ps(x0, L::load(r0 + j), acc);
+            acc = _mm256_fmadd_ps(x1, L::load(r1 + j), acc);
+            acc = _mm256_fmadd_ps(x2, L::load(r2 + j), acc);
+            acc = _mm256_fmadd_ps(x3, L::load(r3 + j), acc);
+            _mm256_storeu_ps(y + j, acc);
+        }
+        for (; j < N; j++)
+            y[j] += alpha * (x[i] * L::scalar(r0 + j) + x[i + 1] * L::scalar(r1 + j) +
+                             x[i + 2] * L::scalar(r2 + j) + x[i + 3] * L::scalar(r3 + j));
+    }
+    for (; i < M; i++)
+        axpy<L>(N, alpha * x[i], A + i * lda, y);
+}
+
+AVX2_TARGET void gemv_t(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                        const float *x, float beta, float *y)
+{
+    gemv_t_rows<LoadF32>(M, N, alpha, A, lda, x, beta, y);
+}
+
+AVX2_TARGET void gemv_n_half(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                             std::size_t lda, const float *x, float beta, float *y)
+{
+    if (dtype == DType::BFloat16)
+        gemv_n_rows<Load<std::uint16_t, DType::BFloat16>>(M, N, alpha, A, lda, x, beta, y);
+    else
+        gemv_n_rows<Load<std::uint16_t, DType::Float16>>(M, N, alpha, A, lda, x, beta, y);
+}
+
+AVX2_TARGET void gemv_t_half(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                             std::size_t lda, const float *x, float beta, float *y)
+{
+    if (dtype == DType::BFloat16)
+        gemv_t_rows<Load<std::uint16_t, DType::BFloat16>>(M, N, alpha, A, lda, x, beta, y);
+    else
+        gemv_t_rows<Load<std::uint16_t, DType::Float16>>(M, N, alpha, A, lda, x, beta, y);
+}
+
+AVX2_TARGET void ger(std::size_t M, std::size_t N, float alpha, const float *x, const float *y,
+                     float *A, std::size_t lda)
+{
+    for (std::size_t i = 0; i < M; i++)
+        axpy<LoadF32>(N, alpha * x[i], y, A + i * lda);
+}
+
+const GemmKernels kernels{"avx2", MR, NR, micro_kernel, gemv_n, gemv_t, ger, gemv_n_half, gemv_t_half};
+} // namespace
+
+const GemmKernels *gemm_kernels_avx2() { return &kernels; }
+
+#else
+
+const GemmKernels *gemm_kernels_avx2() { return nullptr; }
+
+#endif
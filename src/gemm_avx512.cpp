@@ -0,0 +1,256 @@
+#include "../include/gemm_kernels.h"
+#include "../include/half.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#include <cstring>
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+namespace
+{
+constexpr std::size_t MR = 12;
+constexpr std::size_t NR = 32;
+
+// Mask selecting the first `n` (< 16) lanes
+AVX512_TARGET inline __mmask16 tail_mask(std::size_t n)
+{
+    return (__mmask16)((1u << n) - 1u);
+}
+
+// 12x32 tile: 24 zmm accumulators, two B vectors and one broadcast A value per k
+AVX512_TARGET void micro_kernel(std::size_t kc, const float *a, const float *b,
+                                float *C, std::size_t ldc, std::size_t m, std::size_t n,
+                                float alpha, float beta)
+{
+    __m512 acc[MR][2];
+    for (std::size_t r = 0; r < MR; r++)
+    {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+
+    for (std::size_t k = 0; k < kc; k++)
+    {
+        __m512 b0 = _mm512_loadu_ps(b);
+        __m512 b1 = _mm512_loadu_ps(b + 16);
+        for (std::size_t r = 0; r < MR; r++)
+        {
+            __m512 a_r = _mm512_set1_ps(a[r]);
+            acc[r][0] = _mm512_fmadd_ps(a_r, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(a_r, b1, acc[r][1]);
+        }
+        a += MR;
+        b += NR;
+    }
+
+    // Column masks for the two 16-wide halves of the tile
+    __mmask16 mask[2];
+    mask[0] = n >= 16 ? (__mmask16)0xFFFF : tail_mask(n);
+    mask[1] = n >= 32 ? (__mmask16)0xFFFF : (n > 16 ? tail_mask(n - 16) : (__mmask16)0);
+
+    __m512 va = _mm512_set1_ps(alpha);
+    __m512 vb = _mm512_set1_ps(beta);
+    for (std::size_t r = 0; r < m; r++)
+    {
+        float *c_row = C + r * ldc;
+        for (std::size_t h = 0; h < 2; h++)
+        {
+            if (!mask[h])
+                continue;
+            __m512 v = _mm512_mul_ps(va, acc[r][h]);
+            if (beta != 0.0f)
+                v = _mm512_fmadd_ps(vb, _mm512_maskz_loadu_ps(mask[h], c_row + 16 * h), v);
+            _mm512_mask_storeu_ps(c_row + 16 * h, mask[h], v);
+        }
+    }
+}
+
+// Row element loads for the GEMV kernels: 16 values widened to float, or the
+// first n < 16 of them with the rest zero
+struct LoadF32
+{
+    using type = float;
+    AVX512_TARGET static __m512 load(const float *p) { return _mm512_loadu_ps(p); }
+    AVX512_TARGET static __m512 load_tail(const float *p, std::size_t n)
+    {
+        return _mm512_maskz_loadu_ps(tail_mask(n), p);
+    }
+};
+
+template <DType D>
+struct LoadHalf
+{
+    using type = std::uint16_t;
+    AVX512_TARGET static __m512 widen(__m256i h)
+    {
+        if (D == DType::BFloat16)
+            return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+        return _mm512_cvtph_ps(h);
+    }
+    AVX512_TARGET static __m512 load(const std::uint16_t *p) { return widen(_mm256_loadu_si256((const __m256i *)p)); }
+    AVX512_TARGET static __m512 load_tail(const std::uint16_t *p, std::size_t n)
+    {
+        std::uint16_t tmp[16] = {};
+        std::memcpy(tmp, p, n * sizeof(std::uint16_t));
+        return load(tmp);
+    }
+};
+
+template <typename L>
+AVX512_TARGET void gemv_n_rows(std::size_t M, std::size_t N, float alpha, const typename L::type *A, std::size_t lda,
+                               const float *x, float beta, float *y)
+{
+    std::size_t tail = N % 16;
+    __mmask16 tm = tail_mask(tail);
+    std::size_t i = 0;
+    for (; i + 4 <= M; i += 4)
+    {
+        const auto *r0 = A + i * lda;
+        const auto *r1 = r0 + lda;
+        const auto *r2 = r1 + lda;
+        const auto *r3 = r2 + lda;
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 16 <= N; j += 16)
+        {
+            __m512 xv = _mm512_loadu_ps(x + j);
+            s0 = _mm512_fmadd_ps(L::load(r0 + j), xv, s0);
+            s1 = _mm512_fmadd_ps(L::load(r1 + j), xv, s1);
+            s2 = _mm512_fmadd_ps(L::load(r2 + j), xv, s2);
+            s3 = _mm512_fmadd_ps(L::load(r3 + j), xv, s3);
+        }
+        if (tail)
+        {
+            __m512 xv = _mm512_maskz_loadu_ps(tm, x + j);
+            s0 = _mm512_fmadd_ps(L::load_tail(r0 + j, tail), xv, s0);
+            s1 = _mm512_fmadd_ps(L::load_tail(r1 + j, tail), xv, s1);
+            s2 = _mm512_fmadd_ps(L::load_tail(r2 + j, tail), xv, s2);
+            s3 = _mm512_fmadd_ps(L::load_tail(r3 + j, tail), xv, s3);
+        }
+        float t[4] = {_mm512_reduce_add_ps(s0), _mm512_reduce_add_ps(s1),
+                      _mm512_reduce_add_ps(s2), _mm512_reduce_add_ps(s3)};
+        for (std::size_t r = 0; r < 4; r++)
+            y[i + r] = alpha * t[r] + (beta == 0.0f ? 0.0f : beta * y[i + r]);
+    }
+    for (; i < M; i++)
+    {
+        const auto *row = A + i * lda;
+        __m512 s = _mm512_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 16 <= N; j += 16)
+            s = _mm512_fmadd_ps(L::load(row + j), _mm512_loadu_ps(x + j), s);
+        if (tail)
+            s = _mm512_fmadd_ps(L::load_tail(row + j, tail), _mm512_maskz_loadu_ps(tm, x + j), s);
+        y[i] = alpha * _mm512_reduce_add_ps(s) + (beta == 0.0f ? 0.0f : beta * y[i]);
+    }
+}
+
+AVX512_TARGET void gemv_n(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                          const float *x, float beta, float *y)
+{
+    gemv_n_rows<LoadF32>(M, N, alpha, A, lda, x, beta, y);
+}
+
+// y += s * row over N entries
+template <typename L>
+AVX512_TARGET inline void axpy(std::size_t N, float s, const typename L::type *row, float *y)
+{
+    __m512 sv = _mm512_set1_ps(s);
+    std::size_t j = 0;
+    for (; j + 16 <= N; j += 16)
+        _mm512_storeu_ps(y + j, _mm512_fmadd_ps(sv, L::load(row + j), _mm512_loadu_ps(y + j)));
+    if (j < N)
+    {
+        __mmask16 tm = tail_mask(N - j);
+        __m512 v = _mm512_fmadd_ps(sv, L::load_tail(row + j, N - j), _mm512_maskz_loadu_ps(tm, y + j));
+        _mm512_mask_storeu_ps(y + j, tm, v);
+    }
+}
+
+template <typename L>
+AVX512_TARGET void gemv_t_rows(std::size_t M, std::size_t N, float alpha, const typename L::type *A, std::size_t lda,
+                               const float *x, float beta, float *y)
+{
+    for (std::size_t j = 0; j < N; j++)
+        y[j] = beta == 0.0f ? 0.0f : beta * y[j];
+
+    std::size_t tail = N % 16;
+    __mmask16 tm = tail_mask(tail);
+    std::size_t i = 0;
+    for (; i + 4 <= M; i += 4)
+    {
+        const auto *r0 = A + i * lda;
+        const auto *r1 = r0 + lda;
+        const auto *r2 = r1 + lda;
+        const auto *r3 = r2 + lda;
+        __m512 x0 = _mm512_set1_ps(alpha * x[i]);
+        __m512 x1 = _mm512_set1_ps(alpha * x[i + 1]);
+        __m512 x2 = _mm512_set1_ps(alpha * x[i + 2]);
+        __m512 x3 = _mm512_set1_ps(alpha * x[i + 3]);
+        std::size_t j = 0;
+        for (; j + 16 <= N; j += 16)
+        {
+            __m512 acc = _mm512_loadu_ps(y + j);
+            acc = _mm512_fmadd_ps(x0, L::load(r0 + j), acc);
+            acc = _mm512_fmadd_ps(x1, L::load(r1 + j), acc);
+            acc = _mm512_fmadd_ps(x2, L::load(r2 + j), acc);
+            acc = _mm512_fmadd_ps(x3, L::load(r3 + j), acc);
+            _mm512_storeu_ps(y + j, acc);
+        }
+        if (tail)
+        {
+            __m512 acc = _mm512_maskz_loadu_ps(tm, y + j);
+            acc = _mm512_fmadd_ps(x0, L::load_tail(r0 + j, tail), acc);
+            acc = _mm512_fmadd_ps(x1, L::load_tail(r1 + j, tail), acc);
+            acc = _mm512_fmadd_ps(x2, L::load_tail(r2 + j, tail), acc);
+            acc = _mm512_fmadd_ps(x3, L::load_tail(r3 + j, tail), acc);
+            _mm512_mask_storeu_ps(y + j, tm, acc);
+        }
+    }
+    for (; i < M; i++)
+        axpy<L>(N, alpha * x[i], A + i * lda, y);
+}
+
+AVX512_TARGET void gemv_t(std::size_t M, std::size_t N, float alpha, const float *A, std::size_t lda,
+                          const float *x, float beta, float *y)
+{
+    gemv_t_rows<LoadF32>(M, N, alpha, A, lda, x, beta, y);
+}
+
+AVX512_TARGET void gemv_n_half(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                               std::size_t lda, const float *x, float beta, float *y)
+{
+    if (dtype == DType::BFloat16)
+        gemv_n_rows<LoadHalf<DType::BFloat16>>(M, N, alpha, A, lda, x, beta, y);
+    else
+        gemv_n_rows<LoadHalf<DType::Float16>>(M, N, alpha, A, lda, x, beta, y);
+}
+
+AVX512_TARGET void gemv_t_half(DType dtype, std::size_t M, std::size_t N, float alpha, const std::uint16_t *A,
+                               std::size_t lda, const float *x, float beta, float *y)
+{
+    if (dtype == DType::BFloat16)
+        gemv_t_rows<LoadHalf<DType::BFloat16>>(M, N, alpha, A, lda, x, beta, y);
+    else
+        gemv_t_rows<LoadHalf<DType::Float16>>(M, N, alpha, A, lda, x, beta, y);
+}
+
+AVX512_TARGET void ger(std::size_t M, std::size_t N, float alpha, const float *x, const float *y,
+                       float *A, std::size_t lda)
+{
+    for (std::size_t i = 0; i < M; i++)
+        axpy<LoadF32>(N, alpha * x[i], y, A + i * lda);
+}
+
+const GemmKernels kernels{"avx512", MR, NR, micro_kernel, gemv_n, gemv_t, ger, gemv_n_half, gemv_t_half};
+} // namespace
+
+const GemmKernels *gemm_kernels_avx512() { return &kernels; }
+
+#else
+
+const GemmKernels *gemm_kernels_avx512() { return nullptr; }
+
+#endif
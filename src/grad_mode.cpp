@@ -0,0 +1,26 @@
+#include "../include/grad_mode.h"
+
+namespace
+{
+thread_local bool grad_enabled = true;
+} // namespace
+
+bool GradMode::is_enabled()
+{
+    return grad_enabled;
+}
+
+void GradMode::set_enabled(bool enabled)
+{
+    grad_enabled = enabled;
+}
+
+GradModeGuard::GradModeGuard(bool enabled) : _previous(grad_enabled)
+{
+    grad_enabled = enabled;
+}
+
+GradModeGuard::~GradModeGuard()
+{
+    grad_enabled = _previous;
+}
@@ -0,0 +1,107 @@
+#include "../include/graph_capture.h"
+#include "../include/grad_mode.h"
+#include "../include/storage.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+thread_local bool capturing = false;
+
+class CaptureScope
+{
+public:
+    CaptureScope() : _previous(capturing) { capturing = true; }
+    ~CaptureScope() { capturing = _previous; }
+
+private:
+    bool _previous;
+};
+} // namespace
+
+bool CaptureMode::is_active()
+{
+    return capturing;
+}
+
+CapturedStep::CapturedStep(Module &model, Loss &criterion) : _model(model), _criterion(criterion)
+{
+}
+
+void CapturedStep::reset()
+{
+    _order.clear();
+    _loss.reset();
+    _output.reset();
+    _input.reset();
+}
+
+void CapturedStep::capture(const std::shared_ptr<Tensor> &input, const std::vector<std::size_t> &targets)
+{
+    reset();
+    // The captured buffers outlive the step, so they must not come from a
+    // step arena, which could then never rewind
+    ThreadAllocatorGuard heap(heap_allocator());
+    _training = _model.is_training();
+    _targets = targets;
+    // The input requires grad while recording so that every op on the way
+    // builds a node, even one that only depends on the input; its own
+    // gradient is never computed.
+    _input = std::make_shared<Tensor>(input->contiguous()->data(), input->shape(), true);
+    {
+        CaptureScope scope;
+        GradModeGuard grad_mode(true);
+        _output = _model.forward(_input);
+        _loss = _criterion(_output, _targets);
+    }
+    _input->_requires_grad = false;
+    _input->_grad = Storage();
+
+    if (!_loss->requires_grad())
+    {
+        reset();
+        throw std::runtime_error("CapturedStep: the loss does not depend on any parameter");
+    }
+    _order = Tensor::topological_order(_loss.get(), false);
+    for (Tensor *node : _order)
+    {
+        if (!node->_parents.empty() && !node->_forwardfn)
+        {
+            reset();
+            throw std::runtime_error("CapturedStep: the step uses an op that does not support graph capture");
+        }
+    }
+    Tensor::run_backward(_order);
+}
+
+float CapturedStep::run(const std::shared_ptr<Tensor> &input, const std::vector<std::size_t> &targets)
+{
+    if (!_loss || input->shape() != _input->shape() || targets.size() != _targets.size() ||
+        _model.is_training() != _training)
+    {
+        capture(input, targets);
+        return _loss->item();
+    }
+
+    _input->data() = input->contiguous()->data();
+    std::copy(targets.begin(), targets.end(), _targets.begin());
+    for (Tensor *node : _order)
+    {
+        if (node->_forwardfn)
+        {
+            node->_forwardfn(*node->_storage);
+        }
+    }
+    Tensor::run_backward(_order);
+    return _loss->item();
+}
+
+std::shared_ptr<Tensor> CapturedStep::output() const
+{
+    return _output;
+}
+
+const Loss &CapturedStep::criterion() const
+{
+    return _criterion;
+}
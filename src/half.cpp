@@ -0,0 +1,141 @@
+#include "../include/half.h"
+#include "../include/gemm_kernels.h"
+#include "../include/cpu_features.h"
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+std::size_t dtype_size(DType dtype)
+{
+    return dtype == DType::Float32 ? sizeof(float) : sizeof(std::uint16_t);
+}
+
+const char *dtype_name(DType dtype)
+{
+    switch (dtype)
+    {
+    case DType::Float32:
+        return "float32";
+    case DType::BFloat16:
+        return "bfloat16";
+    case DType::Float16:
+        return "float16";
+    }
+    return "unknown";
+}
+
+std::uint16_t float_to_fp16(float f)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    std::uint16_t sign = (std::uint16_t)((bits >> 16) & 0x8000);
+    bits &= 0x7fffffffu;
+
+    if (bits > 0x7f800000u)
+        return sign | 0x7e00 | (std::uint16_t)((bits >> 13) & 0x3ff); // quiet NaN, as vcvtps2ph
+    if (bits >= 0x477ff000u)
+        return sign | 0x7c00; // 65520 and up round to infinity
+    if (bits < 0x38800000u)
+    {
+        // below the smallest normal: adding 0.5 lines the binary16 subnormal
+        // step up with float's last mantissa bit, and the FPU rounds
+        float a;
+        std::memcpy(&a, &bits, sizeof(a));
+        a += 0.5f;
+        std::memcpy(&bits, &a, sizeof(bits));
+        return sign | (std::uint16_t)(bits - 0x3f000000u);
+    }
+    // rebias the exponent, round the 13 dropped bits to nearest even
+    bits += ((std::uint32_t)(15 - 127) << 23) + 0xfffu + ((bits >> 13) & 1);
+    return sign | (std::uint16_t)(bits >> 13);
+}
+
+namespace
+{
+// ---- Portable scalar kernels ----
+
+void scalar_bf16_to_float(const std::uint16_t *src, float *dst, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        dst[i] = bf16_to_float(src[i]);
+}
+
+void scalar_float_to_bf16(const float *src, std::uint16_t *dst, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        dst[i] = float_to_bf16(src[i]);
+}
+
+void scalar_fp16_to_float(const std::uint16_t *src, float *dst, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        dst[i] = fp16_to_float(src[i]);
+}
+
+void scalar_float_to_fp16(const float *src, std::uint16_t *dst, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        dst[i] = float_to_fp16(src[i]);
+}
+
+const HalfKernels scalar_kernels{"scalar", scalar_bf16_to_float, scalar_float_to_bf16,
+                                 scalar_fp16_to_float, scalar_float_to_fp16};
+
+// Best kernel set for this CPU, capped by DL_SIMD if set
+const HalfKernels &select_kernels()
+{
+    const char *env = std::getenv("DL_SIMD");
+    std::string cap = env ? env : "";
+    const CpuFeatures &cpu = cpu_features();
+
+    if (cap.empty() || cap == "avx512")
+    {
+        const HalfKernels *k = half_kernels_avx512();
+        if (k && cpu.avx512f && cpu.avx512bw)
+            return *k;
+    }
+    if (cap.empty() || cap == "avx512" || cap == "avx2")
+    {
+        const HalfKernels *k = half_kernels_avx2();
+        if (k && cpu.avx2 && cpu.f16c)
+            return *k;
+    }
+    return scalar_kernels;
+}
+
+const HalfKernels &kernels()
+{
+    static const HalfKernels &k = select_kernels();
+    return k;
+}
+} // namespace
+
+void half_to_float(const std::uint16_t *src, float *dst, std::size_t n, DType dtype)
+{
+    switch (dtype)
+    {
+    case DType::BFloat16:
+        kernels().bf16_to_float(src, dst, n);
+        return;
+    case DType::Float16:
+        kernels().fp16_to_float(src, dst, n);
+        return;
+    default:
+        throw std::invalid_argument(std::string("half_to_float: ") + dtype_name(dtype) + " is not a 16-bit type");
+    }
+}
+
+void float_to_half(const float *src, std::uint16_t *dst, std::size_t n, DType dtype)
+{
+    switch (dtype)
+    {
+    case DType::BFloat16:
+        kernels().float_to_bf16(src, dst, n);
+        return;
+    case DType::Float16:
+        kernels().float_to_fp16(src, dst, n);
+        return;
+    default:
+        throw std::invalid_argument(std::string("float_to_half: ") + dtype_name(dtype) + " is not a 16-bit type");
+    }
+}
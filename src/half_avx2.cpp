@@ -0,0 +1,84 @@
+#include "../include/gemm_kernels.h"
+#include "../include/half.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2,f16c")))
+
+namespace
+{
+// 8 (16 for float -> bf16) elements per step; the tails use the scalar
+// conversions of half.h
+
+AVX2_TARGET void bf16_to_float_avx2(const std::uint16_t *src, float *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_slli_epi32(h, 16));
+    }
+    for (; i < n; i++)
+        dst[i] = bf16_to_float(src[i]);
+}
+
+// Eight floats rounded to bf16, still in the low half of 32-bit lanes
+AVX2_TARGET inline __m256i round_bf16(__m256i x)
+{
+    const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i inf = _mm256_set1_epi32(0x7f800000);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(_mm256_set1_epi32(0x7fff), lsb)), 16);
+    // signed compare is fine: both sides are below 2^31
+    __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(x, abs_mask), inf);
+    __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(0x40));
+    return _mm256_blendv_epi8(rounded, quiet, nan);
+}
+
+AVX2_TARGET void float_to_bf16_avx2(const float *src, std::uint16_t *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = round_bf16(_mm256_loadu_si256((const __m256i *)(src + i)));
+        __m256i hi = round_bf16(_mm256_loadu_si256((const __m256i *)(src + i + 8)));
+        // packus works per 128-bit lane; the permute puts the quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    for (; i < n; i++)
+        dst[i] = float_to_bf16(src[i]);
+}
+
+AVX2_TARGET void fp16_to_float_avx2(const std::uint16_t *src, float *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    for (; i < n; i++)
+        dst[i] = fp16_to_float(src[i]);
+}
+
+AVX2_TARGET void float_to_fp16_avx2(const float *src, std::uint16_t *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i *)(dst + i), h);
+    }
+    for (; i < n; i++)
+        dst[i] = float_to_fp16(src[i]);
+}
+
+const HalfKernels kernels{"avx2", bf16_to_float_avx2, float_to_bf16_avx2, fp16_to_float_avx2, float_to_fp16_avx2};
+} // namespace
+
+const HalfKernels *half_kernels_avx2() { return &kernels; }
+
+#else
+
+const HalfKernels *half_kernels_avx2() { return nullptr; }
+
+#endif
@@ -0,0 +1,77 @@
+#include "../include/gemm_kernels.h"
+#include "../include/half.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+namespace
+{
+// 16 elements per step; the tails use the scalar conversions of half.h
+
+AVX512_TARGET void bf16_to_float_avx512(const std::uint16_t *src, float *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(src + i)));
+        _mm512_storeu_si512(dst + i, _mm512_slli_epi32(h, 16));
+    }
+    for (; i < n; i++)
+        dst[i] = bf16_to_float(src[i]);
+}
+
+AVX512_TARGET void float_to_bf16_avx512(const float *src, std::uint16_t *dst, std::size_t n)
+{
+    const __m512i abs_mask = _mm512_set1_epi32(0x7fffffff);
+    const __m512i inf = _mm512_set1_epi32(0x7f800000);
+    const __m512i bias = _mm512_set1_epi32(0x7fff);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i quiet = _mm512_set1_epi32(0x40);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i x = _mm512_loadu_si512(src + i);
+        __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(x, 16), one);
+        __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(x, _mm512_add_epi32(bias, lsb)), 16);
+        __mmask16 nan = _mm512_cmpgt_epu32_mask(_mm512_and_si512(x, abs_mask), inf);
+        __m512i r = _mm512_mask_or_epi32(rounded, nan, _mm512_srli_epi32(x, 16), quiet);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm512_cvtepi32_epi16(r));
+    }
+    for (; i < n; i++)
+        dst[i] = float_to_bf16(src[i]);
+}
+
+AVX512_TARGET void fp16_to_float_avx512(const std::uint16_t *src, float *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(src + i))));
+    for (; i < n; i++)
+        dst[i] = fp16_to_float(src[i]);
+}
+
+AVX512_TARGET void float_to_fp16_avx512(const float *src, std::uint16_t *dst, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256((__m256i *)(dst + i), h);
+    }
+    for (; i < n; i++)
+        dst[i] = float_to_fp16(src[i]);
+}
+
+const HalfKernels kernels{"avx512", bf16_to_float_avx512, float_to_bf16_avx512,
+                          fp16_to_float_avx512, float_to_fp16_avx512};
+} // namespace
+
+const HalfKernels *half_kernels_avx512() { return &kernels; }
+
+#else
+
+const HalfKernels *half_kernels_avx512() { return nullptr; }
+
+#endif
@@ -0,0 +1,95 @@
+#include "../include/im2col.h"
+#include <algorithm>
+
+namespace
+{
+// Range [lo, hi) of output columns whose input column ow * stride + kw - padding
+// lands inside the image; everything outside reads padding.
+void valid_range(const ConvGeometry &g, std::size_t kw, std::size_t &lo, std::size_t &hi)
+{
+    long s = (long)g.stride;
+    long offset = (long)kw - (long)g.padding;
+    long first = offset >= 0 ? 0 : (-offset + s - 1) / s;
+    long last = ((long)g.width - offset + s - 1) / s;
+    lo = (std::size_t)std::min<long>(std::max<long>(first, 0), (long)g.out_width);
+    hi = (std::size_t)std::min<long>(std::max<long>(last, (long)lo), (long)g.out_width);
+}
+} // namespace
+
+void im2col(const float *image, const ConvGeometry &g, float *columns)
+{
+    std::size_t K = g.kernel_size;
+    std::size_t out_plane = g.out_height * g.out_width;
+
+    for (std::size_t c = 0; c < g.channels; c++)
+    {
+        const float *plane = image + c * g.height * g.width;
+        for (std::size_t kh = 0; kh < K; kh++)
+        {
+            for (std::size_t kw = 0; kw < K; kw++)
+            {
+                float *row = columns + ((c * K + kh) * K + kw) * out_plane;
+                std::size_t lo, hi;
+                valid_range(g, kw, lo, hi);
+
+                for (std::size_t oh = 0; oh < g.out_height; oh++)
+                {
+                    float *dst = row + oh * g.out_width;
+                    long ih = (long)(oh * g.stride + kh) - (long)g.padding;
+                    if (ih < 0 || ih >= (long)g.height)
+                    {
+                        std::fill(dst, dst + g.out_width, 0.0f);
+                        continue;
+                    }
+
+                    const float *src = plane + ih * g.width;
+                    std::fill(dst, dst + lo, 0.0f);
+                    long iw = (long)(lo * g.stride + kw) - (long)g.padding;
+                    if (g.stride == 1)
+                    {
+                        std::copy(src + iw, src + iw + (hi - lo), dst + lo);
+                    }
+                    else
+                    {
+                        for (std::size_t ow = lo; ow < hi; ow++, iw += g.stride)
+                            dst[ow] = src[iw];
+                    }
+                    std::fill(dst + hi, dst + g.out_width, 0.0f);
+                }
+            }
+        }
+    }
+}
+
+void col2im(const float *columns, const ConvGeometry &g, float *image)
+{
+    std::size_t K = g.kernel_size;
+    std::size_t out_plane = g.out_height * g.out_width;
+
+    for (std::size_t c = 0; c < g.channels; c++)
+    {
+        float *plane = image + c * g.height * g.width;
+        for (std::size_t kh = 0; kh < K; kh++)
+        {
+            for (std::size_t kw = 0; kw < K; kw++)
+            {
+                const float *row = columns + ((c * K + kh) * K + kw) * out_plane;
+                std::size_t lo, hi;
+                valid_range(g, kw, lo, hi);
+
+                for (std::size_t oh = 0; oh < g.out_height; oh++)
+                {
+                    long ih = (long)(oh * g.stride + kh) - (long)g.padding;
+                    if (ih < 0 || ih >= (long)g.height)
+                        continue;
+
+                    const float *src = row + oh * g.out_width;
+                    float *dst = plane + ih * g.width;
+                    long iw = (long)(lo * g.stride + kw) - (long)g.padding;
+                    for (std::size_t ow = lo; ow < hi; ow++, iw += g.stride)
+                        dst[iw] += src[ow];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,892 @@
+#include "../include/inference.h"
+#include "../include/checkpoint.h"
+#include "../include/gemm.h"
+#include "../include/qgemm.h"
+#include "../include/thread_pool.h"
+#include "../include/winograd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+// ---- Network description ----
+
+void InferenceModel::add_conv(std::size_t in_channels, std::size_t out_channels, std::size_t kernel_size,
+                              std::size_t stride, std::size_t padding)
+{
+    Layer layer{Kind::Conv};
+    layer.in_channels = in_channels;
+    layer.out_channels = out_channels;
+    layer.kernel_size = kernel_size;
+    layer.stride = stride;
+    layer.padding = padding;
+    _layers.push_back(std::move(layer));
+}
+
+void InferenceModel::add_relu()
+{
+    _layers.push_back(Layer{Kind::Relu});
+}
+
+void InferenceModel::add_max_pool(std::size_t kernel_size, std::size_t stride)
+{
+    Layer layer{Kind::MaxPool};
+    layer.kernel_size = kernel_size;
+    layer.stride = stride;
+    _layers.push_back(std::move(layer));
+}
+
+void InferenceModel::add_flatten()
+{
+    _layers.push_back(Layer{Kind::Flatten});
+}
+
+void InferenceModel::add_linear(std::size_t in_features, std::size_t out_features)
+{
+    Layer layer{Kind::Linear};
+    layer.in_channels = in_features;
+    layer.out_channels = out_features;
+    _layers.push_back(std::move(layer));
+}
+
+InferenceModel InferenceModel::fer()
+{
+    InferenceModel model;
+    model.add_conv(1, 12, 3, 1, 1);
+    model.add_relu();
+    model.add_max_pool(2, 2);
+    model.add_conv(12, 24, 3, 1, 1);
+    model.add_relu();
+    model.add_max_pool(2, 2);
+    model.add_flatten();
+    model.add_linear(24 * 12 * 12, 7);
+    return model;
+}
+
+// ---- Parameters ----
+
+namespace
+{
+std::size_t weight_numel(std::size_t in, std::size_t out, std::size_t kernel_size)
+{
+    return out * in * kernel_size * kernel_size;
+}
+
+void read_tensor(std::ifstream &file, Storage &dst, std::size_t expected, const std::string &what)
+{
+    std::size_t size = 0;
+    if (!file.read((char *)&size, sizeof(size)))
+    {
+        throw std::runtime_error("Model file ended before " + what);
+    }
+    if (size != expected)
+    {
+        throw std::runtime_error(what + " expects " + std::to_string(expected) + " values, model file has " +
+                                 std::to_string(size));
+    }
+    dst = Storage(size);
+    if (!file.read((char *)dst.data(), size * sizeof(float)))
+    {
+        throw std::runtime_error("Model file ended inside " + what);
+    }
+}
+
+const char QUANTIZED_MAGIC[8] = {'D', 'L', 'Q', 'I', 'N', 'T', '8', '\0'};
+constexpr std::uint32_t QUANTIZED_VERSION = 1;
+
+bool is_quantized_model(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[8] = {};
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, QUANTIZED_MAGIC, sizeof(magic)) == 0;
+}
+
+// 7-bit codes of x, see qgemm.h. Clamping before rounding keeps the loop
+// branch free so it vectorizes.
+void quantize_values(const float *x, std::size_t count, float inv_scale, std::uint8_t zero_point, std::uint8_t *q)
+{
+    float zp = zero_point;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        float v = std::min(std::max(x[i] * inv_scale + zp, 0.0f), 127.0f);
+        q[i] = (std::uint8_t)(v + 0.5f);
+    }
+}
+
+// Codes of an image [C,H,W] surrounded by a border of g.padding codes of 0.0
+void quantize_padded(const float *image, const ConvGeometry &g, float inv_scale, std::uint8_t zero_point,
+                     std::uint8_t *codes)
+{
+    std::size_t pad = g.padding;
+    std::size_t W_pad = g.width + 2 * pad;
+    std::size_t plane = (g.height + 2 * pad) * W_pad;
+    if (pad > 0)
+        std::fill(codes, codes + g.channels * plane, zero_point);
+    for (std::size_t c = 0; c < g.channels; c++)
+    {
+        for (std::size_t h = 0; h < g.height; h++)
+            quantize_values(image + (c * g.height + h) * g.width, g.width, inv_scale, zero_point,
+                            codes + c * plane + (h + pad) * W_pad + pad);
+    }
+}
+
+// Unfolds padded codes into one row of k4 codes per output pixel, in the
+// weights' (channel, kh, kw) order, with a zero tail past C*K*K
+void im2row(const std::uint8_t *codes, const ConvGeometry &g, std::size_t k4, std::uint8_t *rows)
+{
+    std::size_t K = g.kernel_size;
+    std::size_t W_pad = g.width + 2 * g.padding;
+    std::size_t plane = (g.height + 2 * g.padding) * W_pad;
+    std::size_t row_len = g.channels * K * K;
+    for (std::size_t oh = 0; oh < g.out_height; oh++)
+    {
+        for (std::size_t ow = 0; ow < g.out_width; ow++)
+        {
+            std::uint8_t *row = rows + (oh * g.out_width + ow) * k4;
+            const std::uint8_t *corner = codes + oh * g.stride * W_pad + ow * g.stride;
+            for (std::size_t c = 0; c < g.channels; c++)
+            {
+                for (std::size_t kh = 0; kh < K; kh++)
+                {
+                    const std::uint8_t *src = corner + c * plane + kh * W_pad;
+                    if (K == 3)
+                    {
+                        row[0] = src[0];
+                        row[1] = src[1];
+                        row[2] = src[2];
+                    }
+                    else
+                        std::memcpy(row, src, K);
+                    row += K;
+                }
+            }
+            std::fill(row, row + (k4 - row_len), 0);
+        }
+    }
+}
+
+// Packs int8 weights [N x K] for qgemm_u8s8 and sums every channel's
+// weights, which removes the input zero point from the products
+void pack_qweights(const std::vector<std::int8_t> &q, std::size_t N, std::size_t K,
+                   std::vector<std::int8_t> &packed, std::vector<std::int32_t> &rowsum)
+{
+    packed.assign(qgemm_packed_size(N, K), 0);
+    qgemm_pack(q.data(), N, K, packed.data());
+    rowsum.assign(N, 0);
+    for (std::size_t n = 0; n < N; n++)
+    {
+        for (std::size_t k = 0; k < K; k++)
+            rowsum[n] += q[n * K + k];
+    }
+}
+
+// Inverse of qgemm_pack
+std::vector<std::int8_t> unpack_qweights(const std::vector<std::int8_t> &packed, std::size_t N, std::size_t K)
+{
+    std::size_t k4 = qgemm_k4(K);
+    std::vector<std::int8_t> q(N * K);
+    for (std::size_t n = 0; n < N; n++)
+    {
+        for (std::size_t k = 0; k < K; k++)
+            q[n * K + k] = packed[(n / QGEMM_BLOCK) * k4 * QGEMM_BLOCK + (k / 4) * QGEMM_BLOCK * 4 +
+                                  (n % QGEMM_BLOCK) * 4 + k % 4];
+    }
+    return q;
+}
+
+template <typename T>
+void write_value(std::ofstream &file, T value)
+{
+    file.write((const char *)&value, sizeof(value));
+}
+
+template <typename T>
+T read_value(std::ifstream &file)
+{
+    T value{};
+    file.read((char *)&value, sizeof(value));
+    return value;
+}
+} // namespace
+
+void InferenceModel::load(const std::string &path)
+{
+    if (is_quantized_model(path))
+    {
+        load_quantized(path);
+        return;
+    }
+
+    // destination, expected size and name of every parameter, in file order
+    struct Slot
+    {
+        Storage *dst;
+        std::size_t expected;
+        std::string what;
+    };
+    std::vector<Slot> slots;
+    for (std::size_t i = 0; i < _layers.size(); i++)
+    {
+        Layer &layer = _layers[i];
+        std::string name = "layer " + std::to_string(i);
+        layer.qweight.clear();
+        if (layer.kind == Kind::Conv)
+        {
+            slots.push_back({&layer.weight, weight_numel(layer.in_channels, layer.out_channels, layer.kernel_size),
+                             name + " weight"});
+            slots.push_back({&layer.bias, layer.out_channels, name + " bias"});
+        }
+        else if (layer.kind == Kind::Linear)
+        {
+            slots.push_back({&layer.weight, weight_numel(layer.in_channels, layer.out_channels, 1), name + " weight"});
+            slots.push_back({&layer.bias, layer.out_channels, name + " bias"});
+        }
+    }
+    auto check_count = [&](std::size_t n_tensors)
+    {
+        if (n_tensors != slots.size())
+        {
+            throw std::runtime_error("Model file holds " + std::to_string(n_tensors) + " tensors, the network has " +
+                                     std::to_string(slots.size()));
+        }
+    };
+
+    if (is_checkpoint(path))
+    {
+        // mapped, so the weights are used straight from the page cache
+        NamedTensors tensors = load_checkpoint(path);
+        check_count(tensors.size());
+        for (std::size_t i = 0; i < slots.size(); i++)
+        {
+            Storage &data = tensors[i].second->data();
+            if (data.size() != slots[i].expected)
+            {
+                throw std::runtime_error(slots[i].what + " expects " + std::to_string(slots[i].expected) +
+                                         " values, checkpoint tensor '" + tensors[i].first + "' has " +
+                                         std::to_string(data.size()));
+            }
+            *slots[i].dst = std::move(data);
+        }
+        // 16-bit weights (Module::to) run through the mixed-precision GEMM;
+        // biases are added as floats
+        for (Layer &layer : _layers)
+        {
+            if (layer.bias.dtype() != DType::Float32)
+                layer.bias = layer.bias.to(DType::Float32);
+        }
+        _plan.clear();
+        return;
+    }
+
+    // legacy format: tensor count, then size and values of each tensor
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open model file: " + path);
+    }
+    std::size_t n_tensors = 0;
+    file.read((char *)&n_tensors, sizeof(n_tensors));
+    check_count(n_tensors);
+    for (const Slot &slot : slots)
+    {
+        read_tensor(file, *slot.dst, slot.expected, slot.what);
+    }
+    _plan.clear();
+}
+
+void InferenceModel::load_quantized(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open model file: " + path);
+    }
+    file.seekg(sizeof(QUANTIZED_MAGIC));
+    std::uint32_t version = read_value<std::uint32_t>(file);
+    if (version != QUANTIZED_VERSION)
+    {
+        throw std::runtime_error("Unsupported quantized model version " + std::to_string(version) + " in " + path);
+    }
+
+    std::vector<Layer *> layers;
+    for (Layer &layer : _layers)
+    {
+        if (layer.kind == Kind::Conv || layer.kind == Kind::Linear)
+            layers.push_back(&layer);
+    }
+    std::uint32_t count = read_value<std::uint32_t>(file);
+    if (count != layers.size())
+    {
+        throw std::runtime_error("Quantized model file holds " + std::to_string(count) + " layers, the network has " +
+                                 std::to_string(layers.size()));
+    }
+
+    for (std::size_t i = 0; i < layers.size(); i++)
+    {
+        Layer &layer = *layers[i];
+        std::string name = "quantized layer " + std::to_string(i);
+        std::size_t N = layer.out_channels;
+        std::size_t K = weight_numel(layer.in_channels, 1, layer.kernel_size ? layer.kernel_size : 1);
+        std::uint32_t outputs = read_value<std::uint32_t>(file);
+        std::uint32_t inputs = read_value<std::uint32_t>(file);
+        if (file && (outputs != N || inputs != K))
+        {
+            throw std::runtime_error(name + " expects " + std::to_string(N) + " x " + std::to_string(K) +
+                                     " weights, model file has " + std::to_string(outputs) + " x " +
+                                     std::to_string(inputs));
+        }
+        float input_scale = read_value<float>(file);
+        std::uint32_t zero_point = read_value<std::uint32_t>(file);
+        Storage weight_scale(N);
+        Storage bias(N);
+        std::vector<std::int8_t> q(N * K);
+        file.read((char *)weight_scale.data(), N * sizeof(float));
+        file.read((char *)bias.data(), N * sizeof(float));
+        file.read((char *)q.data(), q.size());
+        if (!file)
+        {
+            throw std::runtime_error("Model file ended inside " + name);
+        }
+        if (zero_point > 127 || !(input_scale > 0.0f))
+        {
+            throw std::runtime_error(name + " has an invalid input scale or zero point");
+        }
+
+        pack_qweights(q, N, K, layer.qweight, layer.qrowsum);
+        layer.qweight_scale = std::move(weight_scale);
+        layer.bias = std::move(bias);
+        layer.qinput_scale = input_scale;
+        layer.qinput_zero_point = (std::uint8_t)zero_point;
+        layer.weight = Storage();
+    }
+    _plan.clear();
+}
+
+void InferenceModel::save_quantized(const std::string &path) const
+{
+    std::vector<const Layer *> layers;
+    for (const Layer &layer : _layers)
+    {
+        if (layer.kind != Kind::Conv && layer.kind != Kind::Linear)
+            continue;
+        if (layer.qweight.empty())
+            throw std::runtime_error("InferenceModel::save_quantized needs a quantized model");
+        layers.push_back(&layer);
+    }
+
+    // written next to the target and renamed, so a failure never leaves half a file
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("Could not open model file for writing: " + tmp);
+        }
+        file.write(QUANTIZED_MAGIC, sizeof(QUANTIZED_MAGIC));
+        write_value<std::uint32_t>(file, QUANTIZED_VERSION);
+        write_value<std::uint32_t>(file, (std::uint32_t)layers.size());
+        for (const Layer *layer : layers)
+        {
+            std::size_t N = layer->out_channels;
+            std::size_t K = weight_numel(layer->in_channels, 1, layer->kernel_size ? layer->kernel_size : 1);
+            write_value<std::uint32_t>(file, (std::uint32_t)N);
+            write_value<std::uint32_t>(file, (std::uint32_t)K);
+            write_value<float>(file, layer->qinput_scale);
+            write_value<std::uint32_t>(file, layer->qinput_zero_point);
+            file.write((const char *)layer->qweight_scale.data(), N * sizeof(float));
+            file.write((const char *)layer->bias.data(), N * sizeof(float));
+            std::vector<std::int8_t> q = unpack_qweights(layer->qweight, N, K);
+            file.write((const char *)q.data(), q.size());
+        }
+        if (!file)
+        {
+            throw std::runtime_error("Failed writing model file: " + tmp);
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Could not replace model file: " + path);
+    }
+}
+
+// ---- Planning ----
+
+void InferenceModel::plan(std::size_t channels, std::size_t height, std::size_t width, std::size_t max_batch)
+{
+    if (max_batch == 0)
+    {
+        throw std::invalid_argument("InferenceModel::plan needs max_batch >= 1");
+    }
+    _plan.clear();
+    _input_shape[0] = channels;
+    _input_shape[1] = height;
+    _input_shape[2] = width;
+    _input_numel = channels * height * width;
+
+    std::size_t numel = _input_numel;
+    std::size_t largest = numel;
+    std::size_t largest_columns = 0;
+    std::size_t largest_qscratch = 0; // bytes
+    bool spatial = true;
+
+    for (std::size_t i = 0; i < _layers.size(); i++)
+    {
+        const Layer &layer = _layers[i];
+        std::string name = "layer " + std::to_string(i);
+        switch (layer.kind)
+        {
+        case Kind::Conv:
+        case Kind::MaxPool:
+        {
+            if (!spatial)
+                throw std::runtime_error(name + " needs a [C,H,W] input but follows a flatten/linear layer");
+            bool conv = layer.kind == Kind::Conv;
+            if (conv && channels != layer.in_channels)
+                throw std::runtime_error(name + " expects " + std::to_string(layer.in_channels) +
+                                         " input channels, gets " + std::to_string(channels));
+            bool quantized = !layer.qweight.empty();
+            if (conv && !quantized &&
+                layer.weight.size() != weight_numel(layer.in_channels, layer.out_channels, layer.kernel_size))
+                throw std::runtime_error(name + " has no parameters; call load() before plan()");
+            std::size_t k = layer.kernel_size;
+            if (height + 2 * layer.padding < k || width + 2 * layer.padding < k)
+                throw std::runtime_error(name + " kernel is larger than its input");
+
+            ConvGeometry geom{channels, height, width, k, layer.stride, layer.padding,
+                              (height + 2 * layer.padding - k) / layer.stride + 1,
+                              (width + 2 * layer.padding - k) / layer.stride + 1};
+            std::size_t out_channels = conv ? layer.out_channels : channels;
+            Step step{i, false, geom, numel, out_channels * geom.out_height * geom.out_width};
+
+            // relu(conv) then pool == pool then relu: clamp the smaller output
+            if (!conv && !_plan.empty() && _plan.back().relu &&
+                _layers[_plan.back().layer].kind == Kind::Conv)
+            {
+                _plan.back().relu = false;
+                step.relu = true;
+            }
+            bool direct = conv && k == 1 && layer.stride == 1 && layer.padding == 0;
+            std::size_t pixels = geom.out_height * geom.out_width;
+            if (conv && quantized)
+            {
+                // padded input codes, im2row rows and int32 sums of one sample
+                std::size_t padded = channels * (height + 2 * layer.padding) * (width + 2 * layer.padding);
+                std::size_t bytes = padded + pixels * qgemm_k4(channels * k * k) +
+                                    pixels * qgemm_n16(layer.out_channels) * sizeof(std::int32_t);
+                largest_qscratch = std::max(largest_qscratch, bytes);
+            }
+            else if (conv && winograd_tile(geom, layer.out_channels) != 0)
+            {
+                step.winograd = winograd_tile(geom, layer.out_channels);
+                // 16-bit weights are widened for the transform
+                Storage weight = layer.weight.to(DType::Float32);
+                step.winograd_filters = Storage(winograd_filter_size(layer.out_channels, channels, step.winograd));
+                winograd_filter_transform(weight.data(), layer.out_channels, channels, step.winograd, false,
+                                          step.winograd_filters.data());
+                largest_columns = std::max(largest_columns, winograd_scratch_size(geom, layer.out_channels, step.winograd));
+            }
+            else if (conv && !direct)
+                largest_columns = std::max(largest_columns, channels * k * k * pixels);
+
+            numel = step.out_numel;
+            _plan.push_back(std::move(step));
+            channels = out_channels;
+            height = geom.out_height;
+            width = geom.out_width;
+            break;
+        }
+        case Kind::Relu:
+            if (_plan.empty())
+                throw std::runtime_error(name + ": a ReLU must follow a conv, pool or linear layer");
+            _plan.back().relu = true;
+            break;
+        case Kind::Flatten:
+            spatial = false;
+            break;
+        case Kind::Linear:
+            if (numel != layer.in_channels)
+                throw std::runtime_error(name + " expects " + std::to_string(layer.in_channels) +
+                                         " features, gets " + std::to_string(numel));
+            if (!layer.qweight.empty())
+            {
+                // codes and int32 sums of the whole batch
+                std::size_t bytes = max_batch * (qgemm_k4(numel) + qgemm_n16(layer.out_channels) * sizeof(std::int32_t));
+                largest_qscratch = std::max(largest_qscratch, bytes);
+            }
+            else if (layer.weight.size() != weight_numel(layer.in_channels, layer.out_channels, 1))
+                throw std::runtime_error(name + " has no parameters; call load() before plan()");
+            _plan.push_back(Step{i, false, ConvGeometry{}, numel, layer.out_channels});
+            numel = layer.out_channels;
+            spatial = false;
+            break;
+        }
+        largest = std::max(largest, numel);
+    }
+    if (_plan.empty())
+    {
+        throw std::runtime_error("InferenceModel has no layers to run");
+    }
+
+    _max_batch = max_batch;
+    _workers = std::min(max_batch, get_num_threads());
+    _activations[0] = Storage(largest * max_batch);
+    _activations[1] = Storage(largest * max_batch);
+    _scratch_stride = largest_columns;
+    _scratch = Storage(_workers * largest_columns);
+    _qscratch_stride = (largest_qscratch + sizeof(float) - 1) / sizeof(float);
+    _qscratch = Storage(_workers * _qscratch_stride);
+}
+
+std::size_t InferenceModel::input_size() const { return _input_numel; }
+
+std::size_t InferenceModel::output_size() const { return _plan.empty() ? 0 : _plan.back().out_numel; }
+
+std::size_t InferenceModel::max_batch() const { return _max_batch; }
+
+// ---- Execution ----
+
+void InferenceModel::run(const float *images, std::size_t n, float *logits)
+{
+    execute(images, n, logits, nullptr);
+}
+
+void InferenceModel::execute(const float *images, std::size_t n, float *logits, std::vector<Range> *ranges)
+{
+    if (_plan.empty())
+    {
+        throw std::runtime_error("InferenceModel::run called before plan()");
+    }
+    if (n > _max_batch)
+    {
+        throw std::invalid_argument("Batch of " + std::to_string(n) + " exceeds the planned maximum of " +
+                                    std::to_string(_max_batch));
+    }
+
+    const float *in = images;
+    for (std::size_t s = 0; s < _plan.size(); s++)
+    {
+        const Step &step = _plan[s];
+        const Layer &layer = _layers[step.layer];
+        float *out = s + 1 == _plan.size() ? logits : _activations[s % 2].data();
+        if (ranges)
+        {
+            auto [lo, hi] = std::minmax_element(in, in + n * step.in_numel);
+            (*ranges)[s].min = std::min((*ranges)[s].min, *lo);
+            (*ranges)[s].max = std::max((*ranges)[s].max, *hi);
+        }
+        switch (layer.kind)
+        {
+        case Kind::Conv:
+            if (layer.qweight.empty())
+                run_conv(step, in, n, out);
+            else
+                run_qconv(step, in, n, out);
+            break;
+        case Kind::MaxPool:
+            run_pool(step, in, n, out);
+            break;
+        case Kind::Linear:
+            if (layer.qweight.empty())
+                run_linear(step, in, n, out);
+            else
+                run_qlinear(step, in, n, out);
+            break;
+        default:
+            break;
+        }
+        in = out;
+    }
+}
+
+namespace
+{
+void relu_inplace(float *data, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+        data[i] = data[i] > 0.0f ? data[i] : 0.0f;
+}
+} // namespace
+
+void InferenceModel::run_conv(const Step &step, const float *in, std::size_t n, float *out)
+{
+    const Layer &layer = _layers[step.layer];
+    const ConvGeometry &geom = step.geom;
+    std::size_t C_out = layer.out_channels;
+    std::size_t col_rows = geom.channels * geom.kernel_size * geom.kernel_size;
+    std::size_t col_cols = geom.out_height * geom.out_width;
+    bool direct = geom.kernel_size == 1 && geom.stride == 1 && geom.padding == 0;
+
+    // Samples are dealt to at most _workers parts; a part owns one scratch
+    // buffer. A single sample instead gets its GEMM split inside sgemm.
+    std::size_t parts = std::min(n, _workers);
+    parallel_for(0, parts, 1, [&](std::size_t p_begin, std::size_t p_end)
+    {
+        float *columns = _scratch.data() + p_begin * _scratch_stride;
+        for (std::size_t i = p_begin * n / parts; i < p_end * n / parts; i++)
+        {
+            const float *in_i = in + i * step.in_numel;
+            float *out_i = out + i * step.out_numel;
+
+            if (step.winograd)
+            {
+                winograd_conv(in_i, geom, step.winograd_filters.data(), C_out, step.winograd, layer.bias.data(),
+                              out_i, columns);
+                if (step.relu)
+                    relu_inplace(out_i, step.out_numel);
+                continue;
+            }
+
+            const float *cols = in_i;
+            if (!direct)
+            {
+                im2col(in_i, geom, columns);
+                cols = columns;
+            }
+            for (std::size_t co = 0; co < C_out; co++)
+                std::fill(out_i + co * col_cols, out_i + (co + 1) * col_cols, layer.bias[co]);
+
+            sgemm_mixed(false, false, C_out, col_cols, col_rows,
+                        1.0f, layer.weight.raw(), layer.weight.dtype(), col_rows, cols, DType::Float32, col_cols,
+                        1.0f, out_i, col_cols);
+            if (step.relu)
+                relu_inplace(out_i, step.out_numel);
+        }
+    });
+}
+
+void InferenceModel::run_pool(const Step &step, const float *in, std::size_t n, float *out)
+{
+    const ConvGeometry &geom = step.geom;
+    std::size_t H = geom.height;
+    std::size_t W = geom.width;
+    std::size_t H_out = geom.out_height;
+    std::size_t W_out = geom.out_width;
+    std::size_t k = geom.kernel_size;
+    std::size_t stride = geom.stride;
+    // a clamped pool starts from 0 instead of -inf, which applies the ReLU
+    float floor = step.relu ? 0.0f : -std::numeric_limits<float>::infinity();
+
+    std::size_t planes = n * geom.channels;
+    std::size_t plane_grain = std::max<std::size_t>(1, 4096 / std::max<std::size_t>(1, H_out * W_out));
+    parallel_for(0, planes, plane_grain, [&](std::size_t p_begin, std::size_t p_end)
+    {
+        for (std::size_t p = p_begin; p < p_end; p++)
+        {
+            const float *plane = in + p * H * W;
+            float *out_plane = out + p * H_out * W_out;
+            if (k == 2 && stride == 2)
+            {
+                // the common 2x2 pool: two input rows per output row, no inner loops
+                for (std::size_t h = 0; h < H_out; h++)
+                {
+                    const float *r0 = plane + 2 * h * W;
+                    const float *r1 = r0 + W;
+                    float *o = out_plane + h * W_out;
+                    for (std::size_t w = 0; w < W_out; w++)
+                    {
+                        float top = std::max(r0[2 * w], r0[2 * w + 1]);
+                        float bottom = std::max(r1[2 * w], r1[2 * w + 1]);
+                        o[w] = std::max(std::max(top, bottom), floor);
+                    }
+                }
+                continue;
+            }
+            for (std::size_t h = 0; h < H_out; h++)
+            {
+                for (std::size_t w = 0; w < W_out; w++)
+                {
+                    float max_val = floor;
+                    for (std::size_t kh = 0; kh < k; kh++)
+                    {
+                        const float *row = plane + (h * stride + kh) * W + w * stride;
+                        for (std::size_t kw = 0; kw < k; kw++)
+                            max_val = row[kw] > max_val ? row[kw] : max_val;
+                    }
+                    out_plane[h * W_out + w] = max_val;
+                }
+            }
+        }
+    });
+}
+
+void InferenceModel::run_linear(const Step &step, const float *in, std::size_t n, float *out)
+{
+    const Layer &layer = _layers[step.layer];
+    std::size_t in_f = layer.in_channels;
+    std::size_t out_f = layer.out_channels;
+
+    for (std::size_t i = 0; i < n; i++)
+        std::memcpy(out + i * out_f, layer.bias.data(), out_f * sizeof(float));
+
+    // out[n, out_f] += in[n, in_f] x weight^T
+    if (n == 1)
+        sgemv_mixed(false, out_f, in_f, 1.0f, layer.weight.raw(), layer.weight.dtype(), in_f, in, 1.0f, out);
+    else
+        sgemm_mixed(false, true, n, out_f, in_f, 1.0f, in, DType::Float32, in_f,
+                    layer.weight.raw(), layer.weight.dtype(), in_f, 1.0f, out, out_f);
+
+    if (step.relu)
+        relu_inplace(out, n * out_f);
+}
+
+// ---- Quantization ----
+
+bool InferenceModel::quantized() const
+{
+    for (const Layer &layer : _layers)
+    {
+        if (!layer.qweight.empty())
+            return true;
+    }
+    return false;
+}
+
+void InferenceModel::quantize(const float *calibration_images, std::size_t n)
+{
+    if (_plan.empty())
+    {
+        throw std::runtime_error("InferenceModel::quantize called before plan()");
+    }
+    if (quantized())
+    {
+        throw std::runtime_error("InferenceModel is already quantized");
+    }
+    if (n == 0)
+    {
+        throw std::invalid_argument("InferenceModel::quantize needs calibration images");
+    }
+
+    float inf = std::numeric_limits<float>::infinity();
+    std::vector<Range> ranges(_plan.size(), Range{inf, -inf});
+    std::vector<float> logits(_max_batch * output_size());
+    for (std::size_t i = 0; i < n; i += _max_batch)
+    {
+        std::size_t count = std::min(_max_batch, n - i);
+        execute(calibration_images + i * _input_numel, count, logits.data(), &ranges);
+    }
+
+    for (std::size_t s = 0; s < _plan.size(); s++)
+    {
+        Layer &layer = _layers[_plan[s].layer];
+        if (layer.kind != Kind::Conv && layer.kind != Kind::Linear)
+            continue;
+
+        // 0.0 must have an exact code: it is the padding and the ReLU floor
+        float lo = std::min(ranges[s].min, 0.0f);
+        float hi = std::max(ranges[s].max, 0.0f);
+        float input_scale = hi > lo ? (hi - lo) / 127.0f : 1.0f;
+        layer.qinput_scale = input_scale;
+        layer.qinput_zero_point = (std::uint8_t)std::lrint(-lo / input_scale);
+
+        // symmetric per output channel, [-127, 127]
+        std::size_t N = layer.out_channels;
+        std::size_t K = layer.weight.size() / N;
+        if (layer.weight.dtype() != DType::Float32)
+            layer.weight = layer.weight.to(DType::Float32);
+        std::vector<std::int8_t> q(N * K);
+        layer.qweight_scale = Storage(N);
+        for (std::size_t co = 0; co < N; co++)
+        {
+            const float *w = layer.weight.data() + co * K;
+            float max_abs = 0.0f;
+            for (std::size_t k = 0; k < K; k++)
+                max_abs = std::max(max_abs, std::fabs(w[k]));
+            float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+            layer.qweight_scale[co] = scale;
+            for (std::size_t k = 0; k < K; k++)
+                q[co * K + k] = (std::int8_t)std::max(-127L, std::min(127L, std::lrint(w[k] / scale)));
+        }
+        pack_qweights(q, N, K, layer.qweight, layer.qrowsum);
+        layer.weight = Storage();
+    }
+
+    plan(_input_shape[0], _input_shape[1], _input_shape[2], _max_batch);
+}
+
+namespace
+{
+// Scales the int32 sums of `pixels` rows back to float planes [N, pixels],
+// adding the bias: (sum - zp * rowsum) * input_scale * weight_scale + bias.
+// Pixels go in tiles so the rows being transposed stay in L1.
+void dequantize(const std::int32_t *sums, std::size_t ldc, std::size_t pixels, std::size_t N,
+                const float *weight_scale, const std::int32_t *rowsum, const float *bias,
+                float input_scale, std::uint8_t zero_point, bool relu, float *out)
+{
+    constexpr std::size_t TILE = 32;
+    float floor = relu ? 0.0f : -std::numeric_limits<float>::infinity();
+    for (std::size_t p0 = 0; p0 < pixels; p0 += TILE)
+    {
+        std::size_t p1 = std::min(pixels, p0 + TILE);
+        for (std::size_t co = 0; co < N; co++)
+        {
+            float scale = input_scale * weight_scale[co];
+            float shift = bias[co] - (float)(zero_point * rowsum[co]) * scale;
+            float *plane = out + co * pixels;
+            for (std::size_t p = p0; p < p1; p++)
+                plane[p] = std::max((float)sums[p * ldc + co] * scale + shift, floor);
+        }
+    }
+}
+} // namespace
+
+void InferenceModel::run_qconv(const Step &step, const float *in, std::size_t n, float *out)
+{
+    const Layer &layer = _layers[step.layer];
+    const ConvGeometry &geom = step.geom;
+    std::size_t N = layer.out_channels;
+    std::size_t K = geom.channels * geom.kernel_size * geom.kernel_size;
+    std::size_t k4 = qgemm_k4(K);
+    std::size_t n16 = qgemm_n16(N);
+    std::size_t pixels = geom.out_height * geom.out_width;
+    float inv_scale = 1.0f / layer.qinput_scale;
+
+    // as in run_conv: one scratch buffer per part of the batch
+    std::size_t parts = std::min(n, _workers);
+    parallel_for(0, parts, 1, [&](std::size_t p_begin, std::size_t p_end)
+    {
+        auto *base = (std::uint8_t *)(_qscratch.data() + p_begin * _qscratch_stride);
+        auto *sums = (std::int32_t *)base;
+        std::uint8_t *rows = base + pixels * n16 * sizeof(std::int32_t);
+        std::uint8_t *codes = rows + pixels * k4;
+        for (std::size_t i = p_begin * n / parts; i < p_end * n / parts; i++)
+        {
+            quantize_padded(in + i * step.in_numel, geom, inv_scale, layer.qinput_zero_point, codes);
+            im2row(codes, geom, k4, rows);
+            qgemm_u8s8(pixels, N, K, rows, k4, layer.qweight.data(), sums, n16);
+            dequantize(sums, n16, pixels, N, layer.qweight_scale.data(), layer.qrowsum.data(), layer.bias.data(),
+                       layer.qinput_scale, layer.qinput_zero_point, step.relu, out + i * step.out_numel);
+        }
+    });
+}
+
+void InferenceModel::run_qlinear(const Step &step, const float *in, std::size_t n, float *out)
+{
+    const Layer &layer = _layers[step.layer];
+    std::size_t K = layer.in_channels;
+    std::size_t N = layer.out_channels;
+    std::size_t k4 = qgemm_k4(K);
+    std::size_t n16 = qgemm_n16(N);
+    float inv_scale = 1.0f / layer.qinput_scale;
+
+    // one row of codes per sample, padded to k4
+    auto *sums = (std::int32_t *)_qscratch.data();
+    auto *rows = (std::uint8_t *)(sums + n * n16);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        quantize_values(in + i * K, K, inv_scale, layer.qinput_zero_point, rows + i * k4);
+        std::fill(rows + i * k4 + K, rows + (i + 1) * k4, 0);
+    }
+    qgemm_u8s8(n, N, K, rows, k4, layer.qweight.data(), sums, n16);
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        // a [N, 1] plane per sample
+        dequantize(sums + i * n16, 1, 1, N, layer.qweight_scale.data(), layer.qrowsum.data(), layer.bias.data(),
+                   layer.qinput_scale, layer.qinput_zero_point, step.relu, out + i * N);
+    }
+}
@@ -0,0 +1,70 @@
+#include "../include/mapped_file.h"
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DL_HAVE_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string &path)
+{
+#ifdef DL_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not stat " + path);
+    }
+    _size = (std::size_t)info.st_size;
+    if (_size > 0)
+    {
+        void *addr = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not map " + path);
+        }
+        _data = static_cast<char *>(addr);
+        _mapped = true;
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    _size = (std::size_t)file.tellg();
+    // same alignment as a mapping, so aligned offsets stay aligned
+    _data = static_cast<char *>(::operator new(_size, std::align_val_t(64)));
+    file.seekg(0);
+    if (!file.read(_data, _size))
+    {
+        ::operator delete(_data, std::align_val_t(64));
+        throw std::runtime_error("Could not read " + path);
+    }
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef DL_HAVE_MMAP
+    if (_mapped)
+    {
+        ::munmap(_data, _size);
+    }
+#else
+    ::operator delete(_data, std::align_val_t(64));
+#endif
+}
@@ -0,0 +1,98 @@
+#include "../include/gemm_kernels.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#include <cmath>
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+namespace
+{
+// 8 elements per step, then a scalar tail with the same arithmetic
+
+AVX2_TARGET void sgd_avx2(float *p, const float *g, float *buf, std::size_t n, const SGDStep &step)
+{
+    const __m256 scale = _mm256_set1_ps(step.grad_scale);
+    const __m256 lr = _mm256_set1_ps(step.lr);
+    const __m256 wd = _mm256_set1_ps(step.weight_decay);
+    std::size_t i = 0;
+    if (!buf)
+    {
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 pi = _mm256_loadu_ps(p + i);
+            __m256 gi = _mm256_fmadd_ps(wd, pi, _mm256_mul_ps(scale, _mm256_loadu_ps(g + i)));
+            _mm256_storeu_ps(p + i, _mm256_fnmadd_ps(lr, gi, pi));
+        }
+        for (; i < n; i++)
+            p[i] -= step.lr * (step.grad_scale * g[i] + step.weight_decay * p[i]);
+        return;
+    }
+
+    const __m256 mu = _mm256_set1_ps(step.momentum);
+    const __m256 g_scale = _mm256_set1_ps(step.g_scale);
+    const __m256 buf_scale = _mm256_set1_ps(step.buf_scale);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 pi = _mm256_loadu_ps(p + i);
+        __m256 gi = _mm256_fmadd_ps(wd, pi, _mm256_mul_ps(scale, _mm256_loadu_ps(g + i)));
+        __m256 b = _mm256_fmadd_ps(mu, _mm256_loadu_ps(buf + i), gi);
+        _mm256_storeu_ps(buf + i, b);
+        __m256 d = _mm256_fmadd_ps(g_scale, gi, _mm256_mul_ps(buf_scale, b));
+        _mm256_storeu_ps(p + i, _mm256_fnmadd_ps(lr, d, pi));
+    }
+    for (; i < n; i++)
+    {
+        float gi = step.grad_scale * g[i] + step.weight_decay * p[i];
+        float b = step.momentum * buf[i] + gi;
+        buf[i] = b;
+        p[i] -= step.lr * (step.g_scale * gi + step.buf_scale * b);
+    }
+}
+
+AVX2_TARGET void adam_avx2(float *p, const float *g, float *m, float *v, std::size_t n, const AdamStep &step)
+{
+    const __m256 scale = _mm256_set1_ps(step.grad_scale);
+    const __m256 b1 = _mm256_set1_ps(step.beta1);
+    const __m256 b2 = _mm256_set1_ps(step.beta2);
+    const __m256 c1 = _mm256_set1_ps(1.0f - step.beta1);
+    const __m256 c2 = _mm256_set1_ps(1.0f - step.beta2);
+    const __m256 eps = _mm256_set1_ps(step.eps);
+    const __m256 step_size = _mm256_set1_ps(step.step_size);
+    const __m256 inv_bias2 = _mm256_set1_ps(step.inv_bias2);
+    const __m256 l2 = _mm256_set1_ps(step.l2);
+    const __m256 shrink = _mm256_set1_ps(step.shrink);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 pi = _mm256_loadu_ps(p + i);
+        __m256 gi = _mm256_fmadd_ps(l2, pi, _mm256_mul_ps(scale, _mm256_loadu_ps(g + i)));
+        __m256 mi = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i), _mm256_mul_ps(c1, gi));
+        __m256 vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i), _mm256_mul_ps(c2, _mm256_mul_ps(gi, gi)));
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+        __m256 denom = _mm256_fmadd_ps(_mm256_sqrt_ps(vi), inv_bias2, eps);
+        __m256 update = _mm256_div_ps(_mm256_mul_ps(step_size, mi), denom);
+        _mm256_storeu_ps(p + i, _mm256_fmsub_ps(shrink, pi, update));
+    }
+    for (; i < n; i++)
+    {
+        float gi = step.grad_scale * g[i] + step.l2 * p[i];
+        float mi = step.beta1 * m[i] + (1.0f - step.beta1) * gi;
+        float vi = step.beta2 * v[i] + (1.0f - step.beta2) * gi * gi;
+        m[i] = mi;
+        v[i] = vi;
+        p[i] = step.shrink * p[i] - step.step_size * mi / (std::sqrt(vi) * step.inv_bias2 + step.eps);
+    }
+}
+
+const OptimizerKernels kernels{"avx2", sgd_avx2, adam_avx2};
+} // namespace
+
+const OptimizerKernels *optimizer_kernels_avx2() { return &kernels; }
+
+#else
+
+const OptimizerKernels *optimizer_kernels_avx2() { return nullptr; }
+
+#endif
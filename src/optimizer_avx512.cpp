@@ -0,0 +1,73 @@
+#include "../include/gemm_kernels.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+namespace
+{
+// 16 elements per step; the tail runs the same code under a load/store mask
+
+AVX512_TARGET void sgd_avx512(float *p, const float *g, float *buf, std::size_t n, const SGDStep &step)
+{
+    const __m512 scale = _mm512_set1_ps(step.grad_scale);
+    const __m512 lr = _mm512_set1_ps(step.lr);
+    const __m512 wd = _mm512_set1_ps(step.weight_decay);
+    const __m512 mu = _mm512_set1_ps(step.momentum);
+    const __m512 g_scale = _mm512_set1_ps(step.g_scale);
+    const __m512 buf_scale = _mm512_set1_ps(step.buf_scale);
+    for (std::size_t i = 0; i < n; i += 16)
+    {
+        __mmask16 k = n - i >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (n - i)) - 1);
+        __m512 pi = _mm512_maskz_loadu_ps(k, p + i);
+        __m512 gi = _mm512_fmadd_ps(wd, pi, _mm512_mul_ps(scale, _mm512_maskz_loadu_ps(k, g + i)));
+        __m512 d = gi;
+        if (buf)
+        {
+            __m512 b = _mm512_fmadd_ps(mu, _mm512_maskz_loadu_ps(k, buf + i), gi);
+            _mm512_mask_storeu_ps(buf + i, k, b);
+            d = _mm512_fmadd_ps(g_scale, gi, _mm512_mul_ps(buf_scale, b));
+        }
+        _mm512_mask_storeu_ps(p + i, k, _mm512_fnmadd_ps(lr, d, pi));
+    }
+}
+
+AVX512_TARGET void adam_avx512(float *p, const float *g, float *m, float *v, std::size_t n, const AdamStep &step)
+{
+    const __m512 scale = _mm512_set1_ps(step.grad_scale);
+    const __m512 b1 = _mm512_set1_ps(step.beta1);
+    const __m512 b2 = _mm512_set1_ps(step.beta2);
+    const __m512 c1 = _mm512_set1_ps(1.0f - step.beta1);
+    const __m512 c2 = _mm512_set1_ps(1.0f - step.beta2);
+    const __m512 eps = _mm512_set1_ps(step.eps);
+    const __m512 step_size = _mm512_set1_ps(step.step_size);
+    const __m512 inv_bias2 = _mm512_set1_ps(step.inv_bias2);
+    const __m512 l2 = _mm512_set1_ps(step.l2);
+    const __m512 shrink = _mm512_set1_ps(step.shrink);
+    for (std::size_t i = 0; i < n; i += 16)
+    {
+        __mmask16 k = n - i >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (n - i)) - 1);
+        __m512 pi = _mm512_maskz_loadu_ps(k, p + i);
+        __m512 gi = _mm512_fmadd_ps(l2, pi, _mm512_mul_ps(scale, _mm512_maskz_loadu_ps(k, g + i)));
+        __m512 mi = _mm512_fmadd_ps(b1, _mm512_maskz_loadu_ps(k, m + i), _mm512_mul_ps(c1, gi));
+        __m512 vi = _mm512_fmadd_ps(b2, _mm512_maskz_loadu_ps(k, v + i), _mm512_mul_ps(c2, _mm512_mul_ps(gi, gi)));
+        _mm512_mask_storeu_ps(m + i, k, mi);
+        _mm512_mask_storeu_ps(v + i, k, vi);
+        // masked-off lanes are 0 / eps, never stored
+        __m512 denom = _mm512_fmadd_ps(_mm512_sqrt_ps(vi), inv_bias2, eps);
+        __m512 update = _mm512_div_ps(_mm512_mul_ps(step_size, mi), denom);
+        _mm512_mask_storeu_ps(p + i, k, _mm512_fmsub_ps(shrink, pi, update));
+    }
+}
+
+const OptimizerKernels kernels{"avx512", sgd_avx512, adam_avx512};
+} // namespace
+
+const OptimizerKernels *optimizer_kernels_avx512() { return &kernels; }
+
+#else
+
+const OptimizerKernels *optimizer_kernels_avx512() { return nullptr; }
+
+#endif
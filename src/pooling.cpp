@@ -1,129 +1,330 @@
 #include "../include/pooling.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
+#include "../include/thread_pool.h"
 #include <limits>
 #include <stdexcept>
-#include <cmath>
+#include <string>
 #include <vector>
+#include <algorithm>
 
-Pooling::Pooling(std::size_t kernel_size, std::size_t stride)
-    : _kernel_size(kernel_size), _stride(stride)
-{}
+namespace
+{
+// Largest window whose offsets fit the one-byte argmax
+constexpr std::size_t MAX_POOL_WINDOW = 256;
 
-std::shared_ptr<Tensor> Pooling::forward(std::shared_ptr<Tensor> input)
+// A pooling layer applied to one input: every (sample, channel) plane is
+// pooled independently with a kernel_h x kernel_w window
+struct PoolPlan
 {
-    // Input Shape
-    std::vector<std::size_t> in_shape = input->shape();
-    if (in_shape.size() != 3)
-        throw std::runtime_error("Pooling expects 3D input [Channels, Height, Width]");
-
-    std::size_t C = in_shape[0];
-    std::size_t H = in_shape[1];
-    std::size_t W = in_shape[2];
-
-    // Output Dimensions
-    std::size_t H_out = (H - _kernel_size) / _stride + 1;
-    std::size_t W_out = (W - _kernel_size) / _stride + 1;
-
-    // Initialize Output as Flat Vector
-    std::size_t out_numel = C * H_out * W_out;
-    std::vector<float> out_data(out_numel, 0.0f);
-    
-    const std::vector<float>& in_data = input->data();
-    
-    // Strides for flat indexing
-    std::size_t in_stride_c = H * W;
-    std::size_t in_stride_h = W;
-    std::size_t out_stride_c = H_out * W_out;
-    std::size_t out_stride_h = W_out;
+    std::size_t C; // planes
+    std::size_t H;
+    std::size_t W;
+    std::size_t H_out;
+    std::size_t W_out;
+    std::size_t kernel_h;
+    std::size_t kernel_w;
+    std::size_t stride;
+    std::size_t padding;
+    std::vector<std::size_t> out_shape;
+};
 
-    // Max Pooling
-    for (std::size_t c = 0; c < C; c++)
-    {
-        for (std::size_t h = 0; h < H_out; h++)
+// Input rows [h0, h1) and columns [w0, w1) under one window; (hs, ws) is
+// the window origin, negative inside the top/left padding
+struct Window
+{
+    std::ptrdiff_t hs;
+    std::ptrdiff_t ws;
+    std::size_t h0;
+    std::size_t h1;
+    std::size_t w0;
+    std::size_t w1;
+};
+
+void check_geometry(const PoolGeometry &g, const std::string &name)
+{
+    if (g.kernel_size == 0 || g.stride == 0)
+        throw std::invalid_argument(name + " kernel size and stride must be at least 1");
+    if (2 * g.padding > g.kernel_size)
+        throw std::invalid_argument(name + " padding must be at most half the kernel size");
+}
+
+// Input Shape: a single image [C,H,W] or a batch [N,C,H,W]
+PoolPlan plan_pool(const std::shared_ptr<Tensor> &input, std::size_t kernel_h, std::size_t kernel_w,
+                   const PoolGeometry &g, const std::string &name)
+{
+    const std::vector<std::size_t> &in_shape = input->shape();
+    bool batched = in_shape.size() == 4;
+    if (in_shape.size() != 3 && !batched)
+        throw std::runtime_error(name + " expects 3D input [Channels, Height, Width] or 4D input [Batch, Channels, Height, Width]");
+
+    PoolPlan p;
+    p.C = batched ? in_shape[0] * in_shape[1] : in_shape[0];
+    p.H = in_shape[batched ? 2 : 1];
+    p.W = in_shape[batched ? 3 : 2];
+    if (p.H + 2 * g.padding < kernel_h || p.W + 2 * g.padding < kernel_w)
+        throw std::runtime_error(name + " kernel is larger than the padded input");
+
+    p.kernel_h = kernel_h;
+    p.kernel_w = kernel_w;
+    p.stride = g.stride;
+    p.padding = g.padding;
+    PoolGeometry rows = g, cols = g;
+    rows.kernel_size = kernel_h;
+    cols.kernel_size = kernel_w;
+    p.H_out = rows.out_size(p.H);
+    p.W_out = cols.out_size(p.W);
+
+    p.out_shape = in_shape;
+    p.out_shape[in_shape.size() - 2] = p.H_out;
+    p.out_shape[in_shape.size() - 1] = p.W_out;
+    return p;
+}
+
+// Calls body(c, o, window) for output o of every plane c. Planes are
+// independent, so they are split across threads.
+template <typename Body>
+void for_each_window(const PoolPlan &p, Body body)
+{
+    std::size_t out_plane = p.H_out * p.W_out;
+    std::size_t plane_grain = std::max<std::size_t>(1, 4096 / std::max<std::size_t>(1, out_plane));
+    parallel_for(0, p.C, plane_grain, [&](std::size_t c_begin, std::size_t c_end) {
+        for (std::size_t c = c_begin; c < c_end; c++)
         {
-            for (std::size_t w = 0; w < W_out; w++)
+            for (std::size_t h = 0; h < p.H_out; h++)
             {
-                float max_val = -std::numeric_limits<float>::infinity();
-                
-                size_t start_h = h * _stride;
-                size_t start_w = w * _stride;
+                Window win;
+                win.hs = (std::ptrdiff_t)(h * p.stride) - (std::ptrdiff_t)p.padding;
+                win.h0 = (std::size_t)std::max<std::ptrdiff_t>(win.hs, 0);
+                win.h1 = (std::size_t)std::min<std::ptrdiff_t>(win.hs + (std::ptrdiff_t)p.kernel_h, p.H);
+                for (std::size_t w = 0; w < p.W_out; w++)
+                {
+                    win.ws = (std::ptrdiff_t)(w * p.stride) - (std::ptrdiff_t)p.padding;
+                    win.w0 = (std::size_t)std::max<std::ptrdiff_t>(win.ws, 0);
+                    win.w1 = (std::size_t)std::min<std::ptrdiff_t>(win.ws + (std::ptrdiff_t)p.kernel_w, p.W);
+                    body(c, h * p.W_out + w, win);
+                }
+            }
+        }
+    });
+}
 
-                for (std::size_t kh = 0; kh < _kernel_size; kh++)
+// The common 2x2/stride 2 pool without partial windows: two input rows per
+// output row and no window bookkeeping. Same scan order as the general case.
+void max_pool_2x2(const PoolPlan &p, const float *in, float *out, unsigned char *arg)
+{
+    std::size_t out_plane = p.H_out * p.W_out;
+    std::size_t plane_grain = std::max<std::size_t>(1, 4096 / std::max<std::size_t>(1, out_plane));
+    parallel_for(0, p.C, plane_grain, [&](std::size_t c_begin, std::size_t c_end) {
+        for (std::size_t c = c_begin; c < c_end; c++)
+        {
+            for (std::size_t h = 0; h < p.H_out; h++)
+            {
+                const float *r0 = in + c * p.H * p.W + 2 * h * p.W;
+                const float *r1 = r0 + p.W;
+                std::size_t o = c * out_plane + h * p.W_out;
+                for (std::size_t w = 0; w < p.W_out; w++)
                 {
-                    for (std::size_t kw = 0; kw < _kernel_size; kw++)
+                    const float v[4] = {r0[2 * w], r0[2 * w + 1], r1[2 * w], r1[2 * w + 1]};
+                    float max_val = -std::numeric_limits<float>::infinity();
+                    unsigned char max_pos = 0;
+                    for (unsigned char k = 0; k < 4; k++)
                     {
-                        size_t cur_h = start_h + kh;
-                        size_t cur_w = start_w + kw;
-                        
-                        // Flat index calculation
-                        size_t in_idx = c * in_stride_c + cur_h * in_stride_h + cur_w;
-                        
-                        if (in_data[in_idx] > max_val) {
-                            max_val = in_data[in_idx];
+                        if (v[k] > max_val)
+                        {
+                            max_val = v[k];
+                            max_pos = k;
                         }
                     }
+                    out[o + w] = max_val;
+                    if (arg)
+                        arg[o + w] = max_pos;
                 }
-                
-                size_t out_idx = c * out_stride_c + h * out_stride_h + w;
-                out_data[out_idx] = max_val;
             }
         }
-    }
+    });
+}
+
+// Average pooling forward and backward, shared by AvgPooling and GlobalAvgPooling
+std::shared_ptr<Tensor> avg_pool(const std::shared_ptr<Tensor> &input, const PoolPlan &p, bool count_include_pad)
+{
+    // Number of elements a window averages over
+    auto divisor = [p_h = p.H, p_w = p.W, kernel_h = p.kernel_h, kernel_w = p.kernel_w, padding = p.padding,
+                    count_include_pad](const Window &win) {
+        if (!count_include_pad)
+            return (float)((win.h1 - win.h0) * (win.w1 - win.w0));
+        // padded positions count, but not the part of a ceil mode window past the padding
+        std::ptrdiff_t h_end = std::min<std::ptrdiff_t>(win.hs + (std::ptrdiff_t)kernel_h, p_h + padding);
+        std::ptrdiff_t w_end = std::min<std::ptrdiff_t>(win.ws + (std::ptrdiff_t)kernel_w, p_w + padding);
+        return (float)((h_end - win.hs) * (w_end - win.ws));
+    };
 
-    std::vector<std::size_t> out_shape = {C, H_out, W_out};
+    std::size_t in_plane = p.H * p.W;
+    std::size_t out_plane = p.H_out * p.W_out;
+    auto compute = [input, p, divisor, in_plane, out_plane](Storage &out_data)
+    {
+        const Storage &in_data = input->data();
+        for_each_window(p, [&](std::size_t c, std::size_t o, const Window &win) {
+            const float *plane = in_data.data() + c * in_plane;
+            float sum = 0.0f;
+            for (std::size_t h = win.h0; h < win.h1; h++)
+                for (std::size_t w = win.w0; w < win.w1; w++)
+                    sum += plane[h * p.W + w];
+            out_data[c * out_plane + o] = sum / divisor(win);
+        });
+    };
+    Storage out_data(p.C * out_plane);
+    compute(out_data);
 
-    //  Backward Pass
-    if (input->requires_grad())
+    if (GradMode::is_enabled() && input->requires_grad())
     {
         std::vector<std::shared_ptr<Tensor>> parents{input};
-        
-        std::function<void(const std::vector<float>&)> gradfn = 
-            [input, 
-             C, H, H_out, W_out, 
-             ks=_kernel_size, stride=_stride,
-             in_stride_c, in_stride_h, out_stride_c, out_stride_h]
-            (const std::vector<float>& grad_output)
+
+        // every input element gets an equal share of each window it is in;
+        // the input values themselves are not needed
+        GradFn gradfn = [input, p, divisor, in_plane, out_plane](const Storage &grad_output)
         {
-            std::vector<float> grad_input(input->numel(), 0.0f);
-            const std::vector<float>& in_vals = input->data();
+            Storage grad_input(input->numel(), 0.0f);
+            for_each_window(p, [&](std::size_t c, std::size_t o, const Window &win) {
+                float *plane = grad_input.data() + c * in_plane;
+                float share = grad_output[c * out_plane + o] / divisor(win);
+                for (std::size_t h = win.h0; h < win.h1; h++)
+                    for (std::size_t w = win.w0; w < win.w1; w++)
+                        plane[h * p.W + w] += share;
+            });
+            input->add_to_grad(std::move(grad_input));
+        };
+
+        auto result = std::make_shared<Tensor>(std::move(out_data), p.out_shape, true, gradfn, parents);
+        if (CaptureMode::is_active())
+        {
+            result->set_forwardfn(compute);
+        }
+        return result;
+    }
+    return std::make_shared<Tensor>(std::move(out_data), p.out_shape);
+}
+} // namespace
+
+std::size_t PoolGeometry::out_size(std::size_t in_size) const
+{
+    std::size_t span = in_size + 2 * padding - kernel_size;
+    std::size_t out = (ceil_mode ? (span + stride - 1) / stride : span / stride) + 1;
+    // the last window must start inside the input or the left padding
+    if (ceil_mode && (out - 1) * stride >= in_size + padding)
+        out--;
+    return out;
+}
+
+Pooling::Pooling(std::size_t kernel_size, std::size_t stride, std::size_t padding, bool ceil_mode)
+    : _geom{kernel_size, stride, padding, ceil_mode}
+{
+    check_geometry(_geom, "Pooling");
+    if (kernel_size * kernel_size > MAX_POOL_WINDOW)
+        throw std::invalid_argument("Pooling supports kernels up to 16x16");
+}
+
+std::shared_ptr<Tensor> Pooling::forward(std::shared_ptr<Tensor> input)
+{
+    PoolPlan p = plan_pool(input, _geom.kernel_size, _geom.kernel_size, _geom, "Pooling");
+    std::size_t in_plane = p.H * p.W;
+    std::size_t out_plane = p.H_out * p.W_out;
+    std::size_t out_numel = p.C * out_plane;
+    bool build_graph = GradMode::is_enabled() && input->requires_grad();
 
-            for (std::size_t c = 0; c < C; c++)
+    // Offset of every window's max inside its window, one byte per output,
+    // kept in a Storage so it comes from the step's allocator
+    std::shared_ptr<Storage> argmax;
+    if (build_graph)
+        argmax = std::make_shared<Storage>((out_numel + sizeof(float) - 1) / sizeof(float));
+
+    // Max Pooling
+    auto compute = [input, p, argmax, in_plane, out_plane](Storage &out_data)
+    {
+        const Storage &in_data = input->data();
+        unsigned char *arg = argmax ? reinterpret_cast<unsigned char *>(argmax->data()) : nullptr;
+        if (p.kernel_h == 2 && p.kernel_w == 2 && p.stride == 2 && p.padding == 0 &&
+            2 * p.H_out <= p.H && 2 * p.W_out <= p.W)
+        {
+            max_pool_2x2(p, in_data.data(), out_data.data(), arg);
+            return;
+        }
+        for_each_window(p, [&](std::size_t c, std::size_t o, const Window &win) {
+            const float *plane = in_data.data() + c * in_plane;
+            float max_val = -std::numeric_limits<float>::infinity();
+            // starts on a real element, so backward never routes into padding
+            std::size_t max_pos = (win.h0 - win.hs) * p.kernel_w + (win.w0 - win.ws);
+            for (std::size_t h = win.h0; h < win.h1; h++)
             {
-                for (std::size_t h = 0; h < H_out; h++)
+                for (std::size_t w = win.w0; w < win.w1; w++)
                 {
-                    for (std::size_t w = 0; w < W_out; w++)
+                    if (plane[h * p.W + w] > max_val)
                     {
-                        // max index to route gradient
-                        float max_val = -std::numeric_limits<float>::infinity();
-                        size_t max_idx = 0;
-
-                        size_t start_h = h * stride;
-                        size_t start_w = w * stride;
-
-                        for (std::size_t kh = 0; kh < ks; kh++)
-                        {
-                            for (std::size_t kw = 0; kw < ks; kw++)
-                            {
-                                size_t cur_h = start_h + kh;
-                                size_t cur_w = start_w + kw;
-                                size_t idx = c * in_stride_c + cur_h * in_stride_h + cur_w;
-                                
-                                if (in_vals[idx] > max_val) {
-                                    max_val = in_vals[idx];
-                                    max_idx = idx;
-                                }
-                            }
-                        }
-                        
-                        size_t out_idx = c * out_stride_c + h * out_stride_h + w;
-                        grad_input[max_idx] += grad_output[out_idx];
+                        max_val = plane[h * p.W + w];
+                        max_pos = (h - win.hs) * p.kernel_w + (w - win.ws);
                     }
                 }
             }
-            input->add_to_grad(grad_input);
+            out_data[c * out_plane + o] = max_val;
+            if (arg)
+                arg[c * out_plane + o] = (unsigned char)max_pos;
+        });
+    };
+    Storage out_data(out_numel);
+    compute(out_data);
+
+    //  Backward Pass
+    if (build_graph)
+    {
+        std::vector<std::shared_ptr<Tensor>> parents{input};
+
+        GradFn gradfn = [input, p, argmax, in_plane, out_plane](const Storage &grad_output)
+        {
+            Storage grad_input(input->numel(), 0.0f);
+            const unsigned char *arg = reinterpret_cast<const unsigned char *>(argmax->data());
+
+            // every plane only routes into its own input plane
+            for_each_window(p, [&](std::size_t c, std::size_t o, const Window &win) {
+                std::size_t i = c * out_plane + o;
+                std::size_t h = win.hs + arg[i] / p.kernel_w;
+                std::size_t w = win.ws + arg[i] % p.kernel_w;
+                grad_input[c * in_plane + h * p.W + w] += grad_output[i];
+            });
+            input->add_to_grad(std::move(grad_input));
         };
 
-        return std::make_shared<Tensor>(out_data, out_shape, true, gradfn, parents);
+        auto result = std::make_shared<Tensor>(std::move(out_data), p.out_shape, true, gradfn, parents);
+        if (CaptureMode::is_active())
+        {
+            result->set_forwardfn(compute);
+        }
+        return result;
     }
 
-    return std::make_shared<Tensor>(out_data, out_shape);
-}
\ No newline at end of file
+    return std::make_shared<Tensor>(std::move(out_data), p.out_shape);
+}
+
+AvgPooling::AvgPooling(std::size_t kernel_size, std::size_t stride, std::size_t padding, bool ceil_mode,
+                       bool count_include_pad)
+    : _geom{kernel_size, stride, padding, ceil_mode}, _count_include_pad(count_include_pad)
+{
+    check_geometry(_geom, "AvgPooling");
+}
+
+std::shared_ptr<Tensor> AvgPooling::forward(std::shared_ptr<Tensor> input)
+{
+    PoolPlan p = plan_pool(input, _geom.kernel_size, _geom.kernel_size, _geom, "AvgPooling");
+    return avg_pool(input, p, _count_include_pad);
+}
+
+std::shared_ptr<Tensor> GlobalAvgPooling::forward(std::shared_ptr<Tensor> input)
+{
+    // one window covering the whole plane
+    const std::vector<std::size_t> &in_shape = input->shape();
+    if (in_shape.size() != 3 && in_shape.size() != 4)
+        throw std::runtime_error("GlobalAvgPooling expects 3D input [Channels, Height, Width] or 4D input [Batch, Channels, Height, Width]");
+    std::size_t H = in_shape[in_shape.size() - 2];
+    std::size_t W = in_shape[in_shape.size() - 1];
+    PoolPlan p = plan_pool(input, H, W, PoolGeometry{1, 1}, "GlobalAvgPooling");
+    return avg_pool(input, p, false);
+}
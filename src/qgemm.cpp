@@ -0,0 +1,147 @@
+#include "../include/qgemm.h"
+#include "../include/gemm_kernels.h"
+#include "../include/cpu_features.h"
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+// Multiply-adds below which a call is not worth splitting across threads
+constexpr double PARALLEL_MIN_WORK = 1 << 19;
+
+// ---- Portable scalar kernel ----
+
+constexpr std::size_t SCALAR_MR = 4;
+
+void scalar_micro_kernel(std::size_t k4, const std::uint8_t *A, std::size_t lda,
+                         const std::int8_t *w, std::size_t,
+                         std::size_t m, std::size_t, std::int32_t *C, std::size_t ldc)
+{
+    for (std::size_t r = 0; r < m; r++)
+    {
+        const std::uint8_t *a = A + r * lda;
+        std::int32_t acc[QGEMM_BLOCK] = {};
+        for (std::size_t g = 0; g < k4; g += 4)
+        {
+            const std::int8_t *w_g = w + g * QGEMM_BLOCK;
+            for (std::size_t c = 0; c < QGEMM_BLOCK; c++)
+            {
+                for (std::size_t j = 0; j < 4; j++)
+                    acc[c] += (std::int32_t)a[g + j] * w_g[c * 4 + j];
+            }
+        }
+        std::copy(acc, acc + QGEMM_BLOCK, C + r * ldc);
+    }
+}
+
+const QGemmKernels scalar_kernels{"scalar", SCALAR_MR, 1, scalar_micro_kernel};
+
+// Best kernel set for this CPU, capped by DL_SIMD if set
+const QGemmKernels &select_kernels()
+{
+    const char *env = std::getenv("DL_SIMD");
+    std::string cap = env ? env : "";
+    const CpuFeatures &cpu = cpu_features();
+
+    if (cap.empty() || cap == "avx512")
+    {
+        const QGemmKernels *k = qgemm_kernels_avx512vnni();
+        if (k && cpu.avx512f && cpu.avx512bw && cpu.avx512vnni)
+            return *k;
+    }
+    if (cap.empty() || cap == "avx512" || cap == "avx2")
+    {
+        const QGemmKernels *k = qgemm_kernels_avx2();
+        if (k && cpu.avx2)
+            return *k;
+    }
+    return scalar_kernels;
+}
+
+const QGemmKernels &kernels()
+{
+    static const QGemmKernels &k = select_kernels();
+    return k;
+}
+
+// Rows [0, M) of the product, one register tile at a time
+void qgemm_serial(const QGemmKernels &kern, std::size_t M, std::size_t N, std::size_t k4,
+                  const std::uint8_t *A, std::size_t lda, const std::int8_t *packed,
+                  std::int32_t *C, std::size_t ldc)
+{
+    std::size_t blocks = qgemm_n16(N) / QGEMM_BLOCK;
+    std::size_t block_stride = k4 * QGEMM_BLOCK;
+    for (std::size_t i = 0; i < M; i += kern.mr)
+    {
+        std::size_t m = std::min(kern.mr, M - i);
+        for (std::size_t b = 0; b < blocks; b += kern.nb)
+        {
+            std::size_t nb = std::min(kern.nb, blocks - b);
+            kern.micro_kernel(k4, A + i * lda, lda, packed + b * block_stride, block_stride,
+                              m, nb, C + i * ldc + b * QGEMM_BLOCK, ldc);
+        }
+    }
+}
+} // namespace
+
+std::size_t qgemm_k4(std::size_t K) { return (K + 3) / 4 * 4; }
+
+std::size_t qgemm_n16(std::size_t N) { return (N + QGEMM_BLOCK - 1) / QGEMM_BLOCK * QGEMM_BLOCK; }
+
+std::size_t qgemm_packed_size(std::size_t N, std::size_t K) { return qgemm_n16(N) * qgemm_k4(K); }
+
+void qgemm_pack(const std::int8_t *W, std::size_t N, std::size_t K, std::int8_t *packed)
+{
+    std::size_t k4 = qgemm_k4(K);
+    std::size_t n16 = qgemm_n16(N);
+    for (std::size_t b = 0; b < n16; b += QGEMM_BLOCK)
+    {
+        for (std::size_t g = 0; g < k4; g += 4)
+        {
+            for (std::size_t c = 0; c < QGEMM_BLOCK; c++)
+            {
+                for (std::size_t j = 0; j < 4; j++)
+                {
+                    std::size_t n = b + c;
+                    std::size_t k = g + j;
+                    *packed++ = n < N && k < K ? W[n * K + k] : 0;
+                }
+            }
+        }
+    }
+}
+
+void qgemm_u8s8(std::size_t M, std::size_t N, std::size_t K,
+                const std::uint8_t *A, std::size_t lda,
+                const std::int8_t *packed,
+                std::int32_t *C, std::size_t ldc)
+{
+    if (M == 0 || N == 0)
+        return;
+    const QGemmKernels &kern = kernels();
+    std::size_t k4 = qgemm_k4(K);
+
+    // Large products are split into stripes of rows aligned to the register
+    // tile. Inside a pool task this runs inline.
+    double work = (double)M * qgemm_n16(N) * k4;
+    if (work < 2 * PARALLEL_MIN_WORK)
+    {
+        qgemm_serial(kern, M, N, k4, A, lda, packed, C, ldc);
+        return;
+    }
+    std::size_t tiles = (M + kern.mr - 1) / kern.mr;
+    std::size_t grain = std::max<std::size_t>(1, (std::size_t)(PARALLEL_MIN_WORK * tiles / work));
+    parallel_for(0, tiles, grain, [&](std::size_t t0, std::size_t t1)
+    {
+        std::size_t i0 = t0 * kern.mr;
+        std::size_t i1 = std::min(M, t1 * kern.mr);
+        qgemm_serial(kern, i1 - i0, N, k4, A + i0 * lda, lda, packed, C + i0 * ldc, ldc);
+    });
+}
+
+const char *qgemm_backend()
+{
+    return kernels().name;
+}
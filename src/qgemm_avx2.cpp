@@ -0,0 +1,65 @@
+#include "../include/gemm_kernels.h"
+#include "../include/qgemm.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#include <algorithm>
+#include <cstring>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+namespace
+{
+constexpr std::size_t MR = 4;
+constexpr std::size_t NB = 1;
+
+// 4 rows x 16 channels: 8 ymm accumulators. vpmaddubsw multiplies u8 x s8
+// and adds neighbouring pairs into int16 (safe, activations have 7 bits),
+// vpmaddwd against ones widens and adds the pairs into int32.
+AVX2_TARGET void micro_kernel(std::size_t k4, const std::uint8_t *A, std::size_t lda,
+                              const std::int8_t *w, std::size_t,
+                              std::size_t m, std::size_t, std::int32_t *C, std::size_t ldc)
+{
+    __m256i acc[MR][2];
+    for (std::size_t r = 0; r < MR; r++)
+    {
+        acc[r][0] = _mm256_setzero_si256();
+        acc[r][1] = _mm256_setzero_si256();
+    }
+    // rows past m repeat the last one; their sums are never stored
+    const std::uint8_t *rows[MR];
+    for (std::size_t r = 0; r < MR; r++)
+        rows[r] = A + std::min(r, m - 1) * lda;
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (std::size_t g = 0; g < k4; g += 4)
+    {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(w + g * QGEMM_BLOCK));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(w + g * QGEMM_BLOCK + 32));
+        for (std::size_t r = 0; r < MR; r++)
+        {
+            std::int32_t quad;
+            std::memcpy(&quad, rows[r] + g, sizeof(quad));
+            __m256i a = _mm256_set1_epi32(quad);
+            acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(_mm256_maddubs_epi16(a, b0), ones));
+            acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(_mm256_maddubs_epi16(a, b1), ones));
+        }
+    }
+
+    for (std::size_t r = 0; r < m; r++)
+    {
+        _mm256_storeu_si256((__m256i *)(C + r * ldc), acc[r][0]);
+        _mm256_storeu_si256((__m256i *)(C + r * ldc + 8), acc[r][1]);
+    }
+}
+
+const QGemmKernels kernels{"avx2", MR, NB, micro_kernel};
+} // namespace
+
+const QGemmKernels *qgemm_kernels_avx2() { return &kernels; }
+
+#else
+
+const QGemmKernels *qgemm_kernels_avx2() { return nullptr; }
+
+#endif
@@ -0,0 +1,65 @@
+#include "../include/gemm_kernels.h"
+#include "../include/qgemm.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#include <algorithm>
+#include <cstring>
+
+#define VNNI_TARGET __attribute__((target("avx512f,avx512bw,avx512vnni")))
+
+namespace
+{
+constexpr std::size_t MR = 8;
+constexpr std::size_t NB = 2;
+
+// 8 rows x 32 channels: 16 zmm accumulators. Per k group, two 64-byte weight
+// loads and one broadcast of 4 activation bytes per row feed vpdpbusd, which
+// multiplies u8 x s8 and adds each lane's 4 products straight into int32.
+VNNI_TARGET void micro_kernel(std::size_t k4, const std::uint8_t *A, std::size_t lda,
+                              const std::int8_t *w, std::size_t block_stride,
+                              std::size_t m, std::size_t nb, std::int32_t *C, std::size_t ldc)
+{
+    __m512i acc[MR][NB];
+    for (std::size_t r = 0; r < MR; r++)
+    {
+        acc[r][0] = _mm512_setzero_si512();
+        acc[r][1] = _mm512_setzero_si512();
+    }
+    // rows past m repeat the last one; their sums are never stored
+    const std::uint8_t *rows[MR];
+    for (std::size_t r = 0; r < MR; r++)
+        rows[r] = A + std::min(r, m - 1) * lda;
+
+    const std::int8_t *w1 = nb > 1 ? w + block_stride : w;
+    for (std::size_t g = 0; g < k4; g += 4)
+    {
+        __m512i b0 = _mm512_loadu_si512(w + g * QGEMM_BLOCK);
+        __m512i b1 = _mm512_loadu_si512(w1 + g * QGEMM_BLOCK);
+        for (std::size_t r = 0; r < MR; r++)
+        {
+            std::int32_t quad;
+            std::memcpy(&quad, rows[r] + g, sizeof(quad));
+            __m512i a = _mm512_set1_epi32(quad);
+            acc[r][0] = _mm512_dpbusd_epi32(acc[r][0], a, b0);
+            acc[r][1] = _mm512_dpbusd_epi32(acc[r][1], a, b1);
+        }
+    }
+
+    for (std::size_t r = 0; r < m; r++)
+    {
+        for (std::size_t b = 0; b < nb; b++)
+            _mm512_storeu_si512(C + r * ldc + b * QGEMM_BLOCK, acc[r][b]);
+    }
+}
+
+const QGemmKernels kernels{"avx512vnni", MR, NB, micro_kernel};
+} // namespace
+
+const QGemmKernels *qgemm_kernels_avx512vnni() { return &kernels; }
+
+#else
+
+const QGemmKernels *qgemm_kernels_avx512vnni() { return nullptr; }
+
+#endif
@@ -0,0 +1,466 @@
+#include "../include/storage.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+namespace
+{
+std::size_t round_up(std::size_t bytes, std::size_t multiple)
+{
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+// Smallest power-of-two class holding `bytes`; class 0 is STORAGE_ALIGNMENT bytes
+std::size_t size_class(std::size_t bytes)
+{
+    std::size_t cls = 0;
+    std::size_t capacity = STORAGE_ALIGNMENT;
+    while (capacity < bytes)
+    {
+        capacity <<= 1;
+        cls++;
+    }
+    return cls;
+}
+
+std::size_t class_bytes(std::size_t cls)
+{
+    return STORAGE_ALIGNMENT << cls;
+}
+
+HeapAllocator default_heap;
+std::atomic<Allocator *> current{&default_heap};
+thread_local Allocator *thread_current = nullptr;
+} // namespace
+
+// ---- HeapAllocator ----
+
+void *HeapAllocator::allocate(std::size_t bytes)
+{
+    return ::operator new(bytes, std::align_val_t(STORAGE_ALIGNMENT));
+}
+
+void HeapAllocator::deallocate(void *ptr, std::size_t)
+{
+    ::operator delete(ptr, std::align_val_t(STORAGE_ALIGNMENT));
+}
+
+// ---- PoolAllocator ----
+
+PoolAllocator::~PoolAllocator()
+{
+    release();
+}
+
+void *PoolAllocator::allocate(std::size_t bytes)
+{
+    std::size_t cls = size_class(bytes);
+    if (cls < N_CLASSES)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_free[cls].empty())
+        {
+            void *ptr = _free[cls].back();
+            _free[cls].pop_back();
+            _cached_bytes -= class_bytes(cls);
+            return ptr;
+        }
+    }
+    return default_heap.allocate(cls < N_CLASSES ? class_bytes(cls) : bytes);
+}
+
+void PoolAllocator::deallocate(void *ptr, std::size_t bytes)
+{
+    std::size_t cls = size_class(bytes);
+    if (cls >= N_CLASSES)
+    {
+        default_heap.deallocate(ptr, bytes);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free[cls].push_back(ptr);
+    _cached_bytes += class_bytes(cls);
+}
+
+void PoolAllocator::release()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (std::size_t cls = 0; cls < N_CLASSES; cls++)
+    {
+        for (void *ptr : _free[cls])
+        {
+            default_heap.deallocate(ptr, class_bytes(cls));
+        }
+        _free[cls].clear();
+    }
+    _cached_bytes = 0;
+}
+
+std::size_t PoolAllocator::cached_bytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cached_bytes;
+}
+
+// ---- ArenaAllocator ----
+
+ArenaAllocator::ArenaAllocator(std::size_t chunk_bytes)
+    : _chunk_bytes(round_up(std::max<std::size_t>(chunk_bytes, STORAGE_ALIGNMENT), STORAGE_ALIGNMENT))
+{
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+    for (const Chunk &chunk : _chunks)
+    {
+        default_heap.deallocate(chunk.base, chunk.size);
+    }
+}
+
+void ArenaAllocator::add_chunk(std::size_t bytes)
+{
+    bytes = std::max(bytes, _chunk_bytes);
+    _chunks.push_back({static_cast<char *>(default_heap.allocate(bytes)), bytes});
+    _current = _chunks.size() - 1;
+    _offset = 0;
+}
+
+void *ArenaAllocator::allocate(std::size_t bytes)
+{
+    bytes = round_up(bytes, STORAGE_ALIGNMENT);
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (_current < _chunks.size() && _chunks[_current].size - _offset < bytes)
+    {
+        _current++;
+        _offset = 0;
+    }
+    if (_current == _chunks.size())
+    {
+        add_chunk(bytes);
+    }
+    void *ptr = _chunks[_current].base + _offset;
+    _offset += bytes;
+    _live++;
+    return ptr;
+}
+
+void ArenaAllocator::deallocate(void *, std::size_t)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _live--;
+    if (_live == 0 && _reset_pending)
+    {
+        rewind();
+    }
+}
+
+void ArenaAllocator::reset()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_live == 0)
+    {
+        rewind();
+    }
+    else
+    {
+        _reset_pending = true;
+    }
+}
+
+void ArenaAllocator::rewind()
+{
+    // merge the chunks of a cycle that overflowed so the next one fits in one
+    if (_chunks.size() > 1)
+    {
+        std::size_t total = 0;
+        for (const Chunk &chunk : _chunks)
+        {
+            total += chunk.size;
+            default_heap.deallocate(chunk.base, chunk.size);
+        }
+        _chunks.clear();
+        add_chunk(total);
+    }
+    _current = 0;
+    _offset = 0;
+    _reset_pending = false;
+}
+
+std::size_t ArenaAllocator::live_blocks() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _live;
+}
+
+std::size_t ArenaAllocator::capacity() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::size_t total = 0;
+    for (const Chunk &chunk : _chunks)
+    {
+        total += chunk.size;
+    }
+    return total;
+}
+
+// ---- Current allocator ----
+
+Allocator &current_allocator()
+{
+    if (thread_current)
+    {
+        return *thread_current;
+    }
+    return *current.load(std::memory_order_acquire);
+}
+
+Allocator &heap_allocator()
+{
+    return default_heap;
+}
+
+AllocatorGuard::AllocatorGuard(Allocator &allocator)
+    : _previous(current.exchange(&allocator, std::memory_order_acq_rel))
+{
+}
+
+AllocatorGuard::~AllocatorGuard()
+{
+    current.store(_previous, std::memory_order_release);
+}
+
+ThreadAllocatorGuard::ThreadAllocatorGuard(Allocator &allocator) : _previous(thread_current)
+{
+    thread_current = &allocator;
+}
+
+ThreadAllocatorGuard::~ThreadAllocatorGuard()
+{
+    thread_current = _previous;
+}
+
+// ---- Storage ----
+
+Storage Storage::borrow(float *data, std::size_t size, std::shared_ptr<void> owner, DType dtype)
+{
+    Storage storage;
+    storage._data = data;
+    storage._size = size;
+    storage._dtype = dtype;
+    storage._capacity = size * dtype_size(dtype);
+    storage._owner = std::move(owner);
+    return storage;
+}
+
+Storage::Storage(std::size_t size, float value)
+{
+    allocate(size);
+    fill(value);
+}
+
+Storage::Storage(std::size_t size, DType dtype)
+    : _dtype(dtype)
+{
+    allocate(size);
+    if (size > 0)
+    {
+        std::memset(_data, 0, bytes());
+    }
+}
+
+Storage::Storage(const std::vector<float> &values)
+    : Storage(values.data(), values.data() + values.size())
+{
+}
+
+Storage::Storage(std::initializer_list<float> values)
+    : Storage(values.begin(), values.end())
+{
+}
+
+Storage::Storage(const float *first, const float *last)
+{
+    allocate(last - first);
+    if (_size > 0)
+    {
+        std::memcpy(_data, first, _size * sizeof(float));
+    }
+}
+
+Storage::Storage(const Storage &other)
+    : _dtype(other._dtype)
+{
+    allocate(other._size);
+    if (_size > 0)
+    {
+        std::memcpy(_data, other._data, bytes());
+    }
+}
+
+Storage::Storage(Storage &&other) noexcept
+    : _data(other._data), _size(other._size), _capacity(other._capacity), _allocator(other._allocator),
+      _dtype(other._dtype), _owner(std::move(other._owner))
+{
+    other._data = nullptr;
+    other._size = 0;
+    other._capacity = 0;
+}
+
+Storage &Storage::operator=(const Storage &other)
+{
+    if (this == &other)
+    {
+        return *this;
+    }
+    _dtype = other._dtype;
+    if (other.bytes() > _capacity)
+    {
+        release();
+        allocate(other._size);
+    }
+    _size = other._size;
+    if (_size > 0)
+    {
+        std::memcpy(_data, other._data, bytes());
+    }
+    return *this;
+}
+
+Storage &Storage::operator=(Storage &&other) noexcept
+{
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_capacity, other._capacity);
+    std::swap(_allocator, other._allocator);
+    std::swap(_dtype, other._dtype);
+    std::swap(_owner, other._owner);
+    return *this;
+}
+
+std::shared_ptr<void> Storage::share()
+{
+    if (_data && !_owner)
+    {
+        Allocator *allocator = _allocator;
+        std::size_t capacity = _capacity;
+        _owner = std::shared_ptr<void>(_data, [allocator, capacity](void *ptr) { allocator->deallocate(ptr, capacity); });
+    }
+    return _owner;
+}
+
+Storage::~Storage()
+{
+    release();
+}
+
+void Storage::allocate(std::size_t size)
+{
+    if (!_allocator)
+    {
+        _allocator = &current_allocator();
+    }
+    std::size_t n_bytes = size * dtype_size(_dtype);
+    if (size > 0)
+    {
+        _data = static_cast<float *>(_allocator->allocate(n_bytes));
+    }
+    _size = size;
+    _capacity = n_bytes;
+}
+
+void Storage::release()
+{
+    if (_data && !_owner)
+    {
+        _allocator->deallocate(_data, _capacity);
+    }
+    _owner.reset();
+    _data = nullptr;
+    _size = 0;
+    _capacity = 0;
+}
+
+void Storage::resize(std::size_t size)
+{
+    std::size_t element = dtype_size(_dtype);
+    if (size * element > _capacity)
+    {
+        Storage grown;
+        grown._allocator = _allocator;
+        grown._dtype = _dtype;
+        grown.allocate(size);
+        if (_size > 0)
+        {
+            std::memcpy(grown._data, _data, _size * element);
+        }
+        std::swap(_data, grown._data);
+        std::swap(_capacity, grown._capacity);
+        std::swap(_allocator, grown._allocator);
+        std::swap(_owner, grown._owner);
+    }
+    if (size > _size)
+    {
+        // all-zero bits are 0.0 in every dtype
+        std::memset((char *)_data + _size * element, 0, (size - _size) * element);
+    }
+    _size = size;
+}
+
+void Storage::fill(float value)
+{
+    if (_dtype == DType::Float32)
+    {
+        std::fill(begin(), end(), value);
+        return;
+    }
+    std::uint16_t h = _dtype == DType::BFloat16 ? float_to_bf16(value) : float_to_fp16(value);
+    std::fill(half_data(), half_data() + _size, h);
+}
+
+std::vector<float> Storage::to_vector() const
+{
+    if (_dtype == DType::Float32)
+    {
+        return std::vector<float>(begin(), end());
+    }
+    std::vector<float> values(_size);
+    half_to_float(half_data(), values.data(), _size, _dtype);
+    return values;
+}
+
+Storage Storage::to(DType dtype) const
+{
+    if (dtype == _dtype)
+    {
+        return *this;
+    }
+    Storage converted(_size, dtype);
+    if (_dtype == DType::Float32)
+    {
+        converted.assign_from(data());
+    }
+    else if (dtype == DType::Float32)
+    {
+        half_to_float(half_data(), converted.data(), _size, _dtype);
+    }
+    else
+    {
+        // between the two 16-bit formats, through float
+        std::vector<float> values = to_vector();
+        converted.assign_from(values.data());
+    }
+    return converted;
+}
+
+void Storage::assign_from(const float *values)
+{
+    if (_dtype == DType::Float32)
+    {
+        std::copy(values, values + _size, _data);
+    }
+    else
+    {
+        float_to_half(values, half_data(), _size, _dtype);
+    }
+}
@@ -1,36 +1,42 @@
 #include "../include/tensor.h"
+#include "../include/gemm.h"
+#include "../include/grad_mode.h"
+#include "../include/graph_capture.h"
+#include "../include/thread_pool.h"
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cstring>
 #include <numeric>
 #include <algorithm>
 #include <string>
 #include <stdexcept>
+#include <unordered_set>
 
 // Scalar Constructor (0D)
-Tensor::Tensor(float data, bool requires_grad, std::function<void(const std::vector<float> &)> gradfn, std::vector<std::shared_ptr<Tensor>> parents)
-    : _data{data}, _shape{}, _stride{}, _requires_grad(requires_grad), _gradfn(gradfn),
+Tensor::Tensor(float data, bool requires_grad, GradFn gradfn, std::vector<std::shared_ptr<Tensor>> parents)
+    : _storage(std::make_shared<Storage>(Storage{data})), _shape{}, _stride{}, _requires_grad(requires_grad), _gradfn(gradfn),
       _parents(parents)
 {
-    if (_requires_grad)
+    if (_requires_grad && !_gradfn)
     {
         zero_grad();
     }
 }
 
 // 1D Vector Constructor
-Tensor::Tensor(std::vector<float> data, bool requires_grad, std::function<void(const std::vector<float> &)> gradfn, std::vector<std::shared_ptr<Tensor>> parents)
-    : _data(data), _shape{data.size()}, _stride{1}, _requires_grad(requires_grad), _gradfn(gradfn),
+Tensor::Tensor(Storage data, bool requires_grad, GradFn gradfn, std::vector<std::shared_ptr<Tensor>> parents)
+    : _storage(std::make_shared<Storage>(std::move(data))), _shape{_storage->size()}, _stride{1}, _requires_grad(requires_grad), _gradfn(gradfn),
       _parents(parents)
 {
-    if (_requires_grad)
+    if (_requires_grad && !_gradfn)
     {
         zero_grad();
     }
 }
 
 // 2D Matrix Constructor
-Tensor::Tensor(std::vector<std::vector<float>> data, bool requires_grad, std::function<void(const std::vector<float> &)> gradfn, std::vector<std::shared_ptr<Tensor>> parents)
+Tensor::Tensor(std::vector<std::vector<float>> data, bool requires_grad, GradFn gradfn, std::vector<std::shared_ptr<Tensor>> parents)
     : _shape{data.size(), data[0].size()}, _stride{data[0].size(), 1},
       _requires_grad(requires_grad), _gradfn(gradfn), _parents(parents)
 {
@@ -44,21 +50,19 @@ Tensor::Tensor(std::vector<std::vector<float>> data, bool requires_grad, std::fu
         }
     }
     // store in row major format like pytorch and numpy
+    _storage = std::make_shared<Storage>(data.size() * n_expected_columns);
     for (std::size_t i = 0; i < data.size(); i++)
     {
-        for (std::size_t j = 0; j < data[i].size(); j++)
-        {
-            _data.push_back(data[i][j]);
-        }
+        std::copy(data[i].begin(), data[i].end(), _storage->begin() + i * n_expected_columns);
     }
-    if (_requires_grad)
+    if (_requires_grad && !_gradfn)
     {
         zero_grad();
     }
 }
 // Constructor for Flat Data + Explicit Shape
-Tensor::Tensor(std::vector<float> data, std::vector<std::size_t> shape, bool requires_grad, std::function<void(const std::vector<float> &)> gradfn, std::vector<std::shared_ptr<Tensor>> parents)
-    : _data(data), _shape(shape), _requires_grad(requires_grad), _gradfn(gradfn), _parents(parents)
+Tensor::Tensor(Storage data, std::vector<std::size_t> shape, bool requires_grad, GradFn gradfn, std::vector<std::shared_ptr<Tensor>> parents)
+    : _storage(std::make_shared<Storage>(std::move(data))), _shape(shape), _requires_grad(requires_grad), _gradfn(gradfn), _parents(parents)
 {
     // Calculate strides based on shape
     if (!_shape.empty()) {
@@ -69,14 +73,37 @@ Tensor::Tensor(std::vector<float> data, std::vector<std::size_t> shape, bool req
             s *= _shape[i];
         }
         // Basic validation
-        if (s != _data.size()) {
+        if (s != _storage->size()) {
              throw std::invalid_argument("Tensor shape does not match data size");
         }
-    } else {
-        _stride = {1};
     }
     
-    if (_requires_grad) zero_grad();
+    if (_requires_grad && !_gradfn) zero_grad();
+}
+
+Tensor::~Tensor()
+{
+    // Unlink the graph iteratively: left to the default destructor, a long chain
+    // of parents (held by _parents and by the gradfn/forwardfn captures) is freed
+    // recursively and can overflow the stack.
+    std::vector<std::shared_ptr<Tensor>> pending = std::move(_parents);
+    _gradfn = nullptr;
+    _forwardfn = nullptr;
+    while (!pending.empty())
+    {
+        std::shared_ptr<Tensor> node = std::move(pending.back());
+        pending.pop_back();
+        if (node.use_count() == 1)
+        {
+            for (auto &parent : node->_parents)
+            {
+                pending.push_back(std::move(parent));
+            }
+            node->_parents.clear();
+            node->_gradfn = nullptr;
+            node->_forwardfn = nullptr;
+        }
+    }
 }
 
 // Accessors and Indexing
@@ -84,9 +111,9 @@ Tensor::Tensor(std::vector<float> data, std::vector<std::size_t> shape, bool req
 const float &Tensor::item() const
 {
     // works only with scalars and 1d tensors of size 1
-    if (_data.size() == 1)
+    if (numel() == 1)
     {
-        return _data[0];
+        return (*_storage)[_offset];
     }
     else
     {
@@ -96,9 +123,9 @@ const float &Tensor::item() const
 
 float &Tensor::item()
 {
-    if (_data.size() == 1)
+    if (numel() == 1)
     {
-        return _data[0];
+        return (*_storage)[_offset];
     }
     else
     {
@@ -118,7 +145,7 @@ const float &Tensor::operator()(std::size_t i) const
         {
             throw std::invalid_argument("Index " + std::to_string(i) + " is out of bounds for array of size " + std::to_string(_shape[0]));
         }
-        return _data[i];
+        return (*_storage)[_offset + i * _stride[0]];
     }
     throw std::invalid_argument("This is not a 1D tensor. Use appropriate indices.");
 }
@@ -135,7 +162,7 @@ float &Tensor::operator()(std::size_t i)
         {
             throw std::invalid_argument("Index " + std::to_string(i) + " is out of bounds for array of size " + std::to_string(_shape[0]));
         }
-        return _data[i];
+        return (*_storage)[_offset + i * _stride[0]];
     }
     throw std::invalid_argument("This is not a 1D tensor. Use appropriate indices.");
 }
@@ -152,7 +179,7 @@ const float &Tensor::operator()(std::size_t i, std::size_t j) const
         {
             throw std::invalid_argument("Column index " + std::to_string(j) + " is out of bounds for tensor with " + std::to_string(_shape[1]) + " columns");
         }
-        return _data[i * _stride[0] + j * _stride[1]];
+        return (*_storage)[_offset + i * _stride[0] + j * _stride[1]];
     }
     throw std::invalid_argument("Can only double index into 2D tensors");
 }
@@ -169,7 +196,7 @@ float &Tensor::operator()(std::size_t i, std::size_t j)
         {
             throw std::invalid_argument("Column index " + std::to_string(j) + " is out of bounds for tensor with " + std::to_string(_shape[1]) + " columns");
         }
-        return _data[i * _stride[0] + j * _stride[1]];
+        return (*_storage)[_offset + i * _stride[0] + j * _stride[1]];
     }
     throw std::invalid_argument("Can only double index into 2D tensors");
 }
@@ -180,267 +207,440 @@ const std::vector<std::size_t> &Tensor::stride() const { return _stride; }
 
 std::size_t Tensor::numel() const 
 { 
-    return _data.size(); 
+    std::size_t n = 1;
+    for (std::size_t d : _shape)
+    {
+        n *= d;
+    }
+    return n;
 }
 
-std::vector<float> &Tensor::data() 
+Storage &Tensor::data() 
 { 
-    return _data; 
+    if (!_contiguous)
+    {
+        throw std::runtime_error("data() needs a contiguous tensor; call contiguous() first");
+    }
+    return *_storage; 
 }
 
-std::size_t Tensor::argmax() const
+const Storage &Tensor::data() const
 {
-    return std::distance(_data.begin(), std::max_element(_data.begin(), _data.end()));
+    if (!_contiguous)
+    {
+        throw std::runtime_error("data() needs a contiguous tensor; call contiguous() first");
+    }
+    return *_storage;
 }
 
-// Math Operators
+DType Tensor::dtype() const { return _storage->dtype(); }
 
-std::shared_ptr<Tensor> Tensor::operator+(std::shared_ptr<Tensor> other)
+void Tensor::set_dtype(DType dtype)
 {
-    // scalar + scalar
-    if (_shape.size() == 0 && other->shape().size() == 0)
+    if (dtype != data().dtype())
+        *_storage = _storage->to(dtype);
+}
+
+void Tensor::rebind(Storage data, Storage grad)
+{
+    Storage &current = this->data();
+    if (_is_view || data.size() != numel() || data.dtype() != current.dtype() || grad.size() != numel())
     {
-        float result = item() + other->item();
-        if (_requires_grad || other->requires_grad())
-        {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn = [self, other](const std::vector<float> &grad_output)
-            {
-               
-                self->add_to_grad(grad_output);
-                other->add_to_grad(grad_output);
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
-        }
-        return std::make_shared<Tensor>(result);
+        throw std::invalid_argument("rebind: the buffers do not match the tensor");
     }
-    // scalar + 1D
-    if (_shape.size() == 0 && other->shape().size() == 1)
+    std::memcpy(data.raw(), current.raw(), current.bytes());
+    if (_grad.size() == numel() && !_grad_stale)
     {
-        std::vector<float> result;
-        for (std::size_t i = 0; i < other->shape()[0]; i++)
-        {
-            result.push_back(item() + ((*other)(i)));
-        }
-        if (_requires_grad || other->requires_grad())
-        {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn =
-                [self, other](const std::vector<float> &grad_output)
-            {
-                // broadcast in forward == sum in backward
-                float grad_self = 0.0f;
-                for (std::size_t i = 0; i < grad_output.size(); i++)
-                {
-                    grad_self += grad_output[i];
-                }
-                self->add_to_grad({grad_self});
-                other->add_to_grad(grad_output);
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
-        }
-        return std::make_shared<Tensor>(result);
+        std::memcpy(grad.data(), _grad.data(), numel() * sizeof(float));
     }
-    // scalar + 2D
-    if (_shape.size() == 0 && other->shape().size() == 2)
+    else
     {
-        std::vector<std::vector<float>> result;
-        for (std::size_t i = 0; i < other->shape()[0]; i++)
-        {
-            std::vector<float> result_i;
-            for (std::size_t j = 0; j < other->shape()[1]; j++)
-            {
-                result_i.push_back(item() + (*other)(i, j));
-            }
-            result.push_back(result_i);
-        }
-        if (_requires_grad || other->requires_grad())
-        {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn =
-                [self, other](const std::vector<float> &grad_output)
-            {
-                // broadcast forward == sum in backward
-                float grad_self = 0.0f;
-                for (std::size_t i = 0; i < grad_output.size(); i++)
-                {
-                    grad_self += grad_output[i];
-                }
-                self->add_to_grad({grad_self});
-                other->add_to_grad(grad_output);
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
-        }
-        return std::make_shared<Tensor>(result);
+        grad.fill(0.0f);
     }
-    // 1D + scalar
-    if (_shape.size() == 1 && other->shape().size() == 0)
+    // views share *_storage, so they follow the move
+    current = std::move(data);
+    _grad = std::move(grad);
+    _grad_stale = false;
+}
+
+std::size_t Tensor::argmax() const
+{
+    const Storage &values = data();
+    return std::distance(values.begin(), std::max_element(values.begin(), values.end()));
+}
+
+std::shared_ptr<Tensor> Tensor::stack(const std::vector<std::shared_ptr<Tensor>> &tensors)
+{
+    if (tensors.empty())
+    {
+        throw std::invalid_argument("Cannot stack an empty list of tensors.");
+    }
+    const std::vector<std::size_t> &item_shape = tensors[0]->shape();
+    std::size_t item_numel = tensors[0]->numel();
+    bool requires_grad = GradMode::is_enabled();
+    bool any_requires_grad = false;
+    for (const auto &t : tensors)
     {
-        std::vector<float> result;
-        for (std::size_t i = 0; i < shape()[0]; i++)
+        if (t->shape() != item_shape)
         {
-            result.push_back(operator()(i) + other->item());
+            throw std::invalid_argument("All tensors must have the same shape to be stacked.");
         }
-        if (_requires_grad || other->requires_grad())
-        {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn =
-                [self, other](const std::vector<float> &grad_output)
-            {
-                self->add_to_grad(grad_output);
-                
-                float grad_other = 0.0f;
-                for (std::size_t i = 0; i < grad_output.size(); i++)
-                {
-                    grad_other += grad_output[i];
-                }
-                other->add_to_grad({grad_other});
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
-        }
-        return std::make_shared<Tensor>(result);
+        any_requires_grad = any_requires_grad || t->requires_grad();
     }
-    
-    if (_shape.size() == 2 && other->shape().size() == 0)
+    requires_grad = requires_grad && any_requires_grad;
+
+    Storage result(tensors.size() * item_numel);
+    for (std::size_t n = 0; n < tensors.size(); n++)
     {
-        std::vector<std::vector<float>> result;
-        for (std::size_t i = 0; i < shape()[0]; i++)
+        const Storage &item = tensors[n]->contiguous()->data();
+        std::copy(item.begin(), item.end(), result.begin() + n * item_numel);
+    }
+
+    std::vector<std::size_t> shape{tensors.size()};
+    shape.insert(shape.end(), item_shape.begin(), item_shape.end());
+
+    if (requires_grad)
+    {
+        GradFn gradfn =
+            [tensors, item_numel](const Storage &grad_output)
         {
-            std::vector<float> result_i;
-            for (std::size_t j = 0; j < shape()[1]; j++)
+            // split the batch gradient back into per-item slices
+            for (std::size_t n = 0; n < tensors.size(); n++)
             {
-                result_i.push_back(operator()(i, j) + other->item());
+                Storage grad_item(grad_output.begin() + n * item_numel,
+                                  grad_output.begin() + (n + 1) * item_numel);
+                tensors[n]->add_to_grad(std::move(grad_item));
             }
-            result.push_back(result_i);
-        }
-        if (_requires_grad || other->requires_grad())
+        };
+        return std::make_shared<Tensor>(std::move(result), shape, true, gradfn, tensors);
+    }
+    return std::make_shared<Tensor>(std::move(result), shape);
+}
+
+// Views
+
+namespace
+{
+std::vector<std::size_t> row_major_strides(const std::vector<std::size_t> &shape)
+{
+    std::vector<std::size_t> stride(shape.size());
+    std::size_t s = 1;
+    for (std::size_t d = shape.size(); d-- > 0;)
+    {
+        stride[d] = s;
+        s *= shape[d];
+    }
+    return stride;
+}
+
+// Strides of size-1 dimensions never move, so they do not matter
+bool is_row_major(const std::vector<std::size_t> &shape, const std::vector<std::size_t> &stride)
+{
+    std::size_t expected = 1;
+    for (std::size_t d = shape.size(); d-- > 0;)
+    {
+        if (shape[d] != 1 && stride[d] != expected)
         {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn = [self, other](const std::vector<float> &grad_output)
-            {
-                
-                self->add_to_grad(grad_output);
-               
-                float grad_other = 0.0f;
-                for (std::size_t i = 0; i < grad_output.size(); i++)
-                {
-                    grad_other += grad_output[i];
-                }
-                other->add_to_grad({grad_other});
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
+            return false;
         }
-        return std::make_shared<Tensor>(result);
+        expected *= shape[d];
     }
-    // 1D + 1D
-    if (_shape.size() == 1 && other->shape().size() == 1)
+    return true;
+}
+
+std::string shape_string(const std::vector<std::size_t> &shape)
+{
+    std::string text = "[";
+    for (std::size_t d = 0; d < shape.size(); d++)
     {
-        if (_shape[0] != other->shape()[0])
+        text += (d ? ", " : "") + std::to_string(shape[d]);
+    }
+    return text + "]";
+}
+
+// Calls fn(i, position) for the elements of a strided layout in row-major
+// order: i counts from 0, position = offset + sum(index[d] * stride[d])
+template <typename Fn>
+void for_each_strided(const std::vector<std::size_t> &shape, const std::vector<std::size_t> &stride,
+                      std::size_t offset, Fn fn)
+{
+    std::size_t rank = shape.size();
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+    {
+        n *= d;
+    }
+    if (rank == 0 || n == 0)
+    {
+        if (n == 1)
         {
-            throw std::invalid_argument("First dimensions are not equal.");
+            fn(0, offset);
         }
-        std::vector<float> result;
-        for (std::size_t i = 0; i < shape()[0]; i++)
+        return;
+    }
+    std::size_t inner = shape[rank - 1];
+    std::size_t inner_stride = stride[rank - 1];
+    std::vector<std::size_t> index(rank, 0);
+    std::size_t position = offset;
+    for (std::size_t i = 0; i < n; i += inner)
+    {
+        for (std::size_t k = 0; k < inner; k++)
         {
-            result.push_back(operator()(i) + (*other)(i));
+            fn(i + k, position + k * inner_stride);
         }
-        if (_requires_grad || other->requires_grad())
+        // step the outer dimensions like an odometer
+        for (std::size_t d = rank - 1; d-- > 0;)
         {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn =
-                [self, other](const std::vector<float> &grad_output)
+            position += stride[d];
+            if (++index[d] < shape[d])
             {
-                // propagate child gradients
-                self->add_to_grad(grad_output);
-                other->add_to_grad(grad_output);
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
+                break;
+            }
+            position -= index[d] * stride[d];
+            index[d] = 0;
         }
-        return std::make_shared<Tensor>(result);
     }
-    // 2D + 2D
-    else if (_shape.size() == 2 && other->shape().size() == 2)
+}
+
+// Gradient for the source of a view whose element i sits at
+// offset + sum(index * stride) in the source's row-major layout
+GradFn scatter_gradfn(std::shared_ptr<Tensor> source, std::vector<std::size_t> shape,
+                      std::vector<std::size_t> stride, std::size_t offset)
+{
+    return [source, shape, stride, offset](const Storage &grad_output)
     {
-        if (_shape[0] != other->shape()[0])
+        Storage grad_source(source->numel());
+        for_each_strided(shape, stride, offset, [&](std::size_t i, std::size_t position)
         {
-             throw std::invalid_argument("First dimensions are not equal.");
-        }
-        if (shape()[1] != other->shape()[1])
+            grad_source[position] += grad_output[i];
+        });
+        source->add_to_grad(std::move(grad_source));
+    };
+}
+
+// For views that keep the row-major order of their source
+GradFn pass_through_gradfn(std::shared_ptr<Tensor> source)
+{
+    return [source](const Storage &grad_output) { source->add_to_grad(grad_output); };
+}
+} // namespace
+
+std::shared_ptr<Tensor> Tensor::make_view(std::vector<std::size_t> shape, std::vector<std::size_t> stride,
+                                          std::size_t offset, GradFn gradfn)
+{
+    std::shared_ptr<Tensor> view(new Tensor());
+    view->_shape = std::move(shape);
+    view->_stride = std::move(stride);
+    view->_is_view = true;
+    view->_contiguous = is_row_major(view->_shape, view->_stride);
+    std::size_t n = view->numel();
+    if (view->_contiguous && (offset != 0 || n != _storage->size()))
+    {
+        // a window into the buffer: borrow the range, keeping the buffer (not
+        // just this tensor's Storage, which may be given another) alive
+        char *first = static_cast<char *>(_storage->raw()) + offset * dtype_size(_storage->dtype());
+        view->_storage = std::make_shared<Storage>(
+            Storage::borrow(reinterpret_cast<float *>(first), n, _storage->share(), _storage->dtype()));
+    }
+    else
+    {
+        view->_storage = _storage;
+        view->_offset = offset;
+    }
+
+    if (GradMode::is_enabled() && _requires_grad)
+    {
+        view->_requires_grad = true;
+        view->_gradfn = std::move(gradfn);
+        view->_parents = {shared_from_this()};
+        if (CaptureMode::is_active())
         {
-            throw std::invalid_argument("Second dimensions are not equal.");
+            // nothing to recompute: replay rewrites the shared buffer in place
+            view->_forwardfn = [](Storage &) {};
         }
-        std::vector<std::vector<float>> result;
-        for (std::size_t i = 0; i < shape()[0]; i++)
+    }
+    return view;
+}
+
+std::shared_ptr<Tensor> Tensor::view(std::vector<std::size_t> shape)
+{
+    if (!_contiguous)
+    {
+        throw std::invalid_argument("view() needs a contiguous tensor; use reshape() to copy");
+    }
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+    {
+        n *= d;
+    }
+    if (n != numel())
+    {
+        throw std::invalid_argument("Cannot view a tensor of shape " + shape_string(_shape) + " as " +
+                                    shape_string(shape));
+    }
+    std::vector<std::size_t> stride = row_major_strides(shape);
+    return make_view(std::move(shape), std::move(stride), _offset, pass_through_gradfn(shared_from_this()));
+}
+
+std::shared_ptr<Tensor> Tensor::reshape(std::vector<std::size_t> shape)
+{
+    return contiguous()->view(std::move(shape));
+}
+
+std::shared_ptr<Tensor> Tensor::transpose(std::size_t dim0, std::size_t dim1)
+{
+    if (dim0 >= _shape.size() || dim1 >= _shape.size())
+    {
+        throw std::invalid_argument("transpose: dimension out of range for a " + std::to_string(_shape.size()) +
+                                    "D tensor");
+    }
+    std::vector<std::size_t> shape = _shape;
+    std::vector<std::size_t> stride = _stride;
+    std::swap(shape[dim0], shape[dim1]);
+    std::swap(stride[dim0], stride[dim1]);
+
+    std::vector<std::size_t> source_stride = row_major_strides(_shape);
+    std::swap(source_stride[dim0], source_stride[dim1]);
+    GradFn gradfn = scatter_gradfn(shared_from_this(), shape, source_stride, 0);
+    return make_view(std::move(shape), std::move(stride), _offset, std::move(gradfn));
+}
+
+std::shared_ptr<Tensor> Tensor::slice(std::size_t dim, std::size_t start, std::size_t end, std::size_t step)
+{
+    if (dim >= _shape.size())
+    {
+        throw std::invalid_argument("slice: dimension out of range for a " + std::to_string(_shape.size()) +
+                                    "D tensor");
+    }
+    if (step == 0 || start > end || end > _shape[dim])
+    {
+        throw std::invalid_argument("slice: bad range [" + std::to_string(start) + ", " + std::to_string(end) +
+                                    ") step " + std::to_string(step) + " for a dimension of size " +
+                                    std::to_string(_shape[dim]));
+    }
+    std::vector<std::size_t> shape = _shape;
+    std::vector<std::size_t> stride = _stride;
+    shape[dim] = (end - start + step - 1) / step;
+    stride[dim] *= step;
+
+    std::vector<std::size_t> source_stride = row_major_strides(_shape);
+    std::size_t source_offset = start * source_stride[dim];
+    source_stride[dim] *= step;
+    GradFn gradfn = scatter_gradfn(shared_from_this(), shape, source_stride, source_offset);
+    return make_view(std::move(shape), std::move(stride), _offset + start * _stride[dim], std::move(gradfn));
+}
+
+std::shared_ptr<Tensor> Tensor::squeeze(std::size_t dim)
+{
+    if (dim >= _shape.size() || _shape[dim] != 1)
+    {
+        throw std::invalid_argument("squeeze: dimension " + std::to_string(dim) + " of shape " +
+                                    shape_string(_shape) + " does not have size 1");
+    }
+    std::vector<std::size_t> shape = _shape;
+    std::vector<std::size_t> stride = _stride;
+    shape.erase(shape.begin() + dim);
+    stride.erase(stride.begin() + dim);
+    return make_view(std::move(shape), std::move(stride), _offset, pass_through_gradfn(shared_from_this()));
+}
+
+std::shared_ptr<Tensor> Tensor::unsqueeze(std::size_t dim)
+{
+    if (dim > _shape.size())
+    {
+        throw std::invalid_argument("unsqueeze: dimension out of range for a " + std::to_string(_shape.size()) +
+                                    "D tensor");
+    }
+    std::vector<std::size_t> shape = _shape;
+    std::vector<std::size_t> stride = _stride;
+    std::size_t inserted = dim < _shape.size() ? _stride[dim] * _shape[dim] : 1;
+    shape.insert(shape.begin() + dim, 1);
+    stride.insert(stride.begin() + dim, inserted);
+    return make_view(std::move(shape), std::move(stride), _offset, pass_through_gradfn(shared_from_this()));
+}
+
+std::shared_ptr<Tensor> Tensor::contiguous()
+{
+    std::shared_ptr<Tensor> self = shared_from_this();
+    if (_contiguous)
+    {
+        return self;
+    }
+    auto gather = [self](Storage &out)
+    {
+        const Storage &source = *self->_storage;
+        if (source.dtype() == DType::Float32)
         {
-            std::vector<float> result_i;
-            for (std::size_t j = 0; j < shape()[1]; j++)
-            {
-                result_i.push_back(operator()(i, j) + (*other)(i, j));
-            }
-            result.push_back(result_i);
+            for_each_strided(self->_shape, self->_stride, self->_offset,
+                             [&](std::size_t i, std::size_t position) { out[i] = source[position]; });
+            return;
         }
-        if (_requires_grad || other->requires_grad())
+        const std::uint16_t *values = source.half_data();
+        std::uint16_t *copy = out.half_data();
+        for_each_strided(self->_shape, self->_stride, self->_offset,
+                         [&](std::size_t i, std::size_t position) { copy[i] = values[position]; });
+    };
+    Storage out(numel(), _storage->dtype());
+    gather(out);
+
+    if (GradMode::is_enabled() && _requires_grad)
+    {
+        std::vector<std::shared_ptr<Tensor>> parents{self};
+        auto result = std::make_shared<Tensor>(std::move(out), _shape, true, pass_through_gradfn(self), parents);
+        if (CaptureMode::is_active())
         {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn =
-                [self, other](const std::vector<float> &grad_output)
-            {
-                // propagate child gradient
-                self->add_to_grad(grad_output);
-                other->add_to_grad(grad_output);
-            };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
+            result->set_forwardfn(gather);
         }
-        return std::make_shared<Tensor>(result);
-    }
-    else 
-    {
-        throw std::invalid_argument("Addition not implemented for these shapes.");
+        return result;
     }
+    return std::make_shared<Tensor>(std::move(out), _shape);
 }
 
+bool Tensor::is_contiguous() const { return _contiguous; }
+
+bool Tensor::shares_storage() const { return _is_view || _storage.use_count() > 1; }
+
+// Math Operators
+
 std::shared_ptr<Tensor> Tensor::operator*(std::shared_ptr<Tensor> other)
 {
     if (_shape.size() == 0 || other->shape().size() == 0)
     {
         throw std::invalid_argument("Both arguments needs to be at least 1D for matmul.");
     }
+    if (_shape.size() > 2 || other->shape().size() > 2)
+    {
+        throw std::invalid_argument("Matmul is only implemented for 1D and 2D tensors.");
+    }
     if (_shape[_shape.size() - 1] != other->shape()[0])
     {
         throw std::invalid_argument(
             "Last dimension of first tensor doesn't have same size as first dimension of second.");
     }
+    // the GEMM kernels take row-major operands; transposed views are copied
+    std::shared_ptr<Tensor> self = contiguous();
+    other = other->contiguous();
+    bool requires_grad = GradMode::is_enabled() && (self->requires_grad() || other->requires_grad());
+    std::vector<std::shared_ptr<Tensor>> parents{self, other};
+
     // 1D x 1D -> float
     if (_shape.size() == 1 && other->shape().size() == 1)
     {
         float result = 0.0f;
-        for (std::size_t i = 0; i < _shape[0]; i++)
-        {
-            result += operator()(i) * (*other)(i);
-        }
-        if (_requires_grad || other->requires_grad())
+        sgemv(false, 1, _shape[0], 1.0f, self->data().data(), _shape[0], other->data().data(), 0.0f, &result);
+        if (requires_grad)
         {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn = [self, other](const std::vector<float> &grad_output)
+            GradFn gradfn = [self, other](const Storage &grad_output)
             {
-                std::vector<float> grad_self;
-                std::vector<float> grad_other;
+                Storage grad_self(self->numel());
+                Storage grad_other(other->numel());
                 for (std::size_t i = 0; i < self->numel(); i++)
                 {
-                    
-                    grad_self.push_back((*other)(i)*grad_output[0]);
-                    grad_other.push_back((*self)(i)*grad_output[0]);
+                    grad_self[i] = other->data()[i] * grad_output[0];
+                    grad_other[i] = self->data()[i] * grad_output[0];
                 }
-                self->add_to_grad(grad_self);
-                other->add_to_grad(grad_other);
+                self->add_to_grad(std::move(grad_self));
+                other->add_to_grad(std::move(grad_other));
             };
             return std::make_shared<Tensor>(result, true, gradfn, parents);
         }
@@ -449,171 +649,75 @@ std::shared_ptr<Tensor> Tensor::operator*(std::shared_ptr<Tensor> other)
     // 2D x 1D -> 1D
     else if (_shape.size() == 2 && other->shape().size() == 1)
     {
-        std::vector<float> result;
-        for (std::size_t i = 0; i < _shape[0]; i++)
-        {
-            float result_i = 0.0f;
-            for (std::size_t j = 0; j < _shape[1]; j++)
-            {
-                result_i += operator()(i, j) * (*other)(j);
-            }
-            result.push_back(result_i);
-        }
-        if (_requires_grad || other->requires_grad())
+        std::size_t M = _shape[0];
+        std::size_t K = _shape[1];
+        Storage result(M);
+        sgemv(false, M, K, 1.0f, self->data().data(), K, other->data().data(), 0.0f, result.data());
+        if (requires_grad)
         {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn = [self, other](const std::vector<float> &grad_output)
+            GradFn gradfn = [self, other, M, K](const Storage &grad_output)
             {
-                std::vector<float> grad_self;
-               
-                for (std::size_t i = 0; i < self->shape()[0]; i++)
-                {
-                    for (std::size_t j = 0; j < self->shape()[1]; j++)
-                    {
-                        
-                        grad_self.push_back((*other)(j)*grad_output[i]);
-                    }
-                }
-                std::vector<float> grad_other;
-                for (std::size_t i = 0; i < other->shape()[0]; i++)
-                {
-                   
-                    float grad_other_i = 0.0f;
-                    for (std::size_t j = 0; j < self->shape()[0]; j++)
-                    {
-                       
-                        grad_other_i += (*self)(j, i) * grad_output[j];
-                    }
-                    grad_other.push_back(grad_other_i);
-                }
-                self->add_to_grad(grad_self);
-                other->add_to_grad(grad_other);
+                // d(self) = grad_output (outer) other, d(other) = self^T * grad_output
+                Storage grad_self(M * K, 0.0f);
+                sger(M, K, 1.0f, grad_output.data(), other->data().data(), grad_self.data(), K);
+                Storage grad_other(K);
+                sgemv(true, M, K, 1.0f, self->data().data(), K, grad_output.data(), 0.0f, grad_other.data());
+                self->add_to_grad(std::move(grad_self));
+                other->add_to_grad(std::move(grad_other));
             };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
+            return std::make_shared<Tensor>(std::move(result), std::vector<std::size_t>{M}, true, gradfn, parents);
         }
-        return std::make_shared<Tensor>(result);
+        return std::make_shared<Tensor>(std::move(result), std::vector<std::size_t>{M});
     }
     // 1D x 2D -> 1D
     else if (_shape.size() == 1 && other->shape().size() == 2)
     {
-        std::vector<float> result;
-        for (std::size_t i = 0; i < other->shape()[1]; i++)
+        std::size_t K = other->shape()[0];
+        std::size_t N = other->shape()[1];
+        Storage result(N);
+        sgemv(true, K, N, 1.0f, other->data().data(), N, self->data().data(), 0.0f, result.data());
+        if (requires_grad)
         {
-            float result_i = 0.0f;
-            for (std::size_t j = 0; j < other->shape()[0]; j++)
+            GradFn gradfn = [self, other, K, N](const Storage &grad_output)
             {
-                result_i += operator()(j) * (*other)(j, i);
-            }
-            result.push_back(result_i);
-        }
-        if (_requires_grad || other->requires_grad())
-        {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn = [self, other](const std::vector<float> &grad_output)
-            {
-                std::vector<float> grad_self;
-             
-                for (std::size_t i = 0; i < self->shape()[0]; i++)
-                {
-                   
-                    float grad_self_i = 0.0f;
-                    for (std::size_t j = 0; j < other->shape()[1]; j++)
-                    {
-                       
-                        grad_self_i += (*other)(i, j) * grad_output[j];
-                    }
-                    grad_self.push_back(grad_self_i);
-                }
-                std::vector<float> grad_other;
-               
-                for (std::size_t i = 0; i < other->shape()[0]; i++)
-                {
-                    for (std::size_t j = 0; j < other->shape()[1]; j++)
-                    {
-                        
-                        grad_other.push_back((*self)(i)*grad_output[j]);
-                    }
-                }
-                self->add_to_grad(grad_self);
-                other->add_to_grad(grad_other);
+                // d(self) = other * grad_output, d(other) = self (outer) grad_output
+                Storage grad_self(K);
+                sgemv(false, K, N, 1.0f, other->data().data(), N, grad_output.data(), 0.0f, grad_self.data());
+                Storage grad_other(K * N, 0.0f);
+                sger(K, N, 1.0f, self->data().data(), grad_output.data(), grad_other.data(), N);
+                self->add_to_grad(std::move(grad_self));
+                other->add_to_grad(std::move(grad_other));
             };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
+            return std::make_shared<Tensor>(std::move(result), std::vector<std::size_t>{N}, true, gradfn, parents);
         }
-        return std::make_shared<Tensor>(result);
+        return std::make_shared<Tensor>(std::move(result), std::vector<std::size_t>{N});
     }
     // 2D x 2D
     else
     {
-        if (other->shape().size() < 2)
-        {
-            throw std::invalid_argument( "Expected second tensor to have at least 2 dimensions for this operation");
-        }
-        std::vector<std::vector<float>> result;
-        for (std::size_t i = 0; i < shape()[0]; i++)
+        std::size_t M = _shape[0];
+        std::size_t K = _shape[1];
+        std::size_t N = other->shape()[1];
+        Storage result(M * N);
+        sgemm(false, false, M, N, K, 1.0f, self->data().data(), K, other->data().data(), N, 0.0f, result.data(), N);
+        if (requires_grad)
         {
-            std::vector<float> result_i;
-            for (std::size_t j = 0; j < other->shape()[1]; j++)
+            GradFn gradfn =
+                [self, other, M, K, N](const Storage &grad_output)
             {
-                float result_i_j = 0.0f;
-                for (std::size_t k = 0; k < shape()[1]; k++)
-                {
-                    result_i_j += operator()(i, k) * (*other)(k, j);
-                }
-                result_i.push_back(result_i_j);
-            }
-            result.push_back(result_i);
-        }
-        if (_requires_grad || other->requires_grad())
-        {
-            std::shared_ptr<Tensor> self = shared_from_this();
-            std::vector<std::shared_ptr<Tensor>> parents{self, other};
-            std::function<void(const std::vector<float> &)> gradfn =
-                [self, other](const std::vector<float> &grad_output)
-            {
-                std::vector<float> grad_self;
-                
-                for (std::size_t i = 0; i < self->shape()[0]; i++)
-                {
-                    
-                    for (std::size_t j = 0; j < self->shape()[1]; j++)
-                    {
-                        float grad_self_i_j = 0.0f;
-                        
-                        for (std::size_t k = 0; k < other->shape()[1]; k++)
-                        {
-                            
-                            grad_self_i_j +=
-                                (*other)(j, k) * grad_output[i * other->shape()[1] + k];
-                        }
-                        grad_self.push_back(grad_self_i_j);
-                    }
-                }
-                std::vector<float> grad_other;
-               
-                for (std::size_t i = 0; i < other->shape()[0]; i++)
-                {
-                    
-                    for (std::size_t j = 0; j < other->shape()[1]; j++)
-                    {
-                        float grad_other_i_j = 0.0f;
-                        
-                        for (std::size_t k = 0; k < self->shape()[0]; k++)
-                        {
-                            
-                            grad_other_i_j +=
-                                (*self)(k, i) * grad_output[k * other->shape()[1] + j];
-                        }
-                        grad_other.push_back(grad_other_i_j);
-                    }
-                }
-                self->add_to_grad(grad_self);
-                other->add_to_grad(grad_other);
+                // d(self) = grad_output * other^T, d(other) = self^T * grad_output
+                Storage grad_self(M * K);
+                sgemm(false, true, M, K, N, 1.0f, grad_output.data(), N, other->data().data(), N,
+                      0.0f, grad_self.data(), K);
+                Storage grad_other(K * N);
+                sgemm(true, false, K, N, M, 1.0f, self->data().data(), K, grad_output.data(), N,
+                      0.0f, grad_other.data(), N);
+                self->add_to_grad(std::move(grad_self));
+                other->add_to_grad(std::move(grad_other));
             };
-            return std::make_shared<Tensor>(result, true, gradfn, parents);
+            return std::make_shared<Tensor>(std::move(result), std::vector<std::size_t>{M, N}, true, gradfn, parents);
         }
-        return std::make_shared<Tensor>(result);
+        return std::make_shared<Tensor>(std::move(result), std::vector<std::size_t>{M, N});
     }
 }
 
@@ -630,29 +734,58 @@ void Tensor::backward()
     {
         throw std::runtime_error("Grad can only be calculated for scalar outputs.");
     }
-    _reset_graph_visit();
-    _grad = {1.0f};
-    _backward();
+
+    run_backward(topological_order(this, true));
 }
 
-void Tensor::_backward()
+std::vector<Tensor *> Tensor::topological_order(Tensor *root, bool grad_only)
 {
-    if (!_requires_grad)
-    {
-        return;
-    }
-    if (_visited)
-    {
-        return;
-    }
-    _visited = true;
-    if (_gradfn)
-    {
-        _gradfn(_grad);
+    // Post-order DFS with an explicit stack, so deep graphs cannot overflow
+    // the call stack
+    std::vector<Tensor *> order;
+    std::unordered_set<Tensor *> visited{root};
+    std::vector<std::pair<Tensor *, std::size_t>> stack{{root, 0}};
+    while (!stack.empty())
+    {
+        Tensor *node = stack.back().first;
+        std::size_t next = stack.back().second++;
+        if (next < node->_parents.size())
+        {
+            Tensor *parent = node->_parents[next].get();
+            if ((parent->_requires_grad || !grad_only) && visited.insert(parent).second)
+            {
+                stack.push_back({parent, 0});
+            }
+        }
+        else
+        {
+            order.push_back(node);
+            stack.pop_back();
+        }
     }
-    for (std::size_t i = 0; i < _parents.size(); i++)
+    return order;
+}
+
+void Tensor::run_backward(const std::vector<Tensor *> &order)
+{
+    // Reversed, the post-order runs every node after all of its consumers have
+    // added into its gradient, so a shared subgraph propagates its full
+    // gradient exactly once
+    order.back()->_grad = {1.0f};
+    order.back()->_grad_stale = false;
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
     {
-        _parents[i]->_backward();
+        Tensor *node = *it;
+        // leaves keep their gradient; a node nothing flowed into contributes nothing
+        if (!node->_gradfn || !node->_requires_grad || node->_grad.empty() || node->_grad_stale)
+        {
+            continue;
+        }
+        node->_gradfn(node->_grad);
+        if (!node->_retains_grad)
+        {
+            node->_grad = Storage();
+        }
     }
 }
 
@@ -661,45 +794,102 @@ const bool &Tensor::requires_grad() const
     return _requires_grad; 
 };
 
-const std::vector<float> &Tensor::grad() const 
+const Storage &Tensor::grad() const 
 { 
-    return _grad; 
+    static const Storage none;
+    return _grad_stale ? none : _grad; 
 }
 
-void Tensor::add_to_grad(const std::vector<float> &grad_update)
+void Tensor::retain_grad()
+{
+    _retains_grad = true;
+}
+
+void Tensor::set_forwardfn(ForwardFn forwardfn)
+{
+    _forwardfn = std::move(forwardfn);
+}
+
+void Tensor::add_to_grad(Storage &&grad_update)
+{
+    if (_requires_grad && _grad.empty() && grad_update.size() == numel())
+    {
+        _grad = std::move(grad_update);
+        _grad_stale = false;
+        return;
+    }
+    add_to_grad(static_cast<const Storage &>(grad_update));
+}
+
+void Tensor::add_to_grad(const Storage &grad_update)
 {
     if (!_requires_grad)
     {
         return;
     }
+    if (_grad.empty() && numel() != 0)
+    {
+        _grad = grad_update;
+        if (_grad.size() != numel())
+        {
+            throw std::runtime_error("Gradient shape mismatch during accumulation.");
+        }
+        return;
+    }
     if (_grad.size() != grad_update.size())
     {
         throw std::runtime_error("Gradient shape mismatch during accumulation.");
     }
-    for (std::size_t i = 0; i < _grad.size(); i++)
+    if (_grad_stale)
     {
-        _grad[i] += grad_update[i];
+        // lazily zeroed: overwrite in place, which keeps an arena slice
+        std::memcpy(_grad.data(), grad_update.data(), _grad.size() * sizeof(float));
+        _grad_stale = false;
+        return;
     }
+    parallel_for(0, _grad.size(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            _grad[i] += grad_update[i];
+        }
+    });
 }
 
-void Tensor::zero_grad() { _grad = std::vector<float>(_data.size(), 0.0f); }
+void Tensor::scale_grad(float factor)
+{
+    if (_grad_stale)
+    {
+        return; // zeros either way
+    }
+    parallel_for(0, _grad.size(), ELEMENTWISE_GRAIN, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            _grad[i] *= factor;
+        }
+    });
+}
 
-void Tensor::_reset_graph_visit()
+void Tensor::zero_grad(bool lazy)
 {
-    
-    if (!_visited)
+    // reuse the buffer once it exists; parameters keep theirs for the whole run
+    if (_grad.size() == numel())
     {
-        return;
+        if (lazy)
+        {
+            _grad_stale = true;
+            return;
+        }
+        _grad.fill(0.0f);
     }
-    _visited = false;
-    for (std::size_t i = 0; i < _parents.size(); i++)
+    else
     {
-        _parents[i]->_reset_graph_visit();
+        _grad = Storage(numel());
     }
+    _grad_stale = false;
 }
 
-
-
 std::ostream &operator<<(std::ostream &os, const Tensor &obj)
 {
     std::string string_repr = "[";
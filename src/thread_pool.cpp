@@ -0,0 +1,240 @@
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+namespace
+{
+// Set on pool workers and on callers while they execute chunks; nested
+// parallel_for calls on such threads run inline.
+thread_local bool in_parallel_region = false;
+
+struct RegionGuard
+{
+    bool previous;
+    RegionGuard() : previous(in_parallel_region) { in_parallel_region = true; }
+    ~RegionGuard() { in_parallel_region = previous; }
+};
+} // namespace
+
+struct ThreadPool::Job
+{
+    const std::function<void(std::size_t, std::size_t)> *fn;
+    std::atomic<std::size_t> remaining{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+ThreadPool::ThreadPool(std::size_t num_threads)
+{
+    num_threads = std::max<std::size_t>(num_threads, 1);
+    for (std::size_t i = 0; i < num_threads; i++)
+    {
+        _queues.push_back(std::make_unique<Queue>());
+    }
+    // queue 0 belongs to the calling thread, the others to background workers
+    for (std::size_t i = 1; i < num_threads; i++)
+    {
+        _workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+std::size_t ThreadPool::size() const
+{
+    return _queues.size();
+}
+
+bool ThreadPool::pop(std::size_t queue, Task &task)
+{
+    Queue &q = *_queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty())
+    {
+        return false;
+    }
+    task = q.tasks.front();
+    q.tasks.pop_front();
+    _pending--;
+    return true;
+}
+
+bool ThreadPool::steal(std::size_t thief, Task &task)
+{
+    for (std::size_t i = 1; i < _queues.size(); i++)
+    {
+        Queue &q = *_queues[(thief + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+        {
+            continue;
+        }
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        _pending--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(const Task &task)
+{
+    Job &job = *task.job;
+    try
+    {
+        RegionGuard region;
+        (*job.fn)(task.begin, task.end);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(job.error_mutex);
+        if (!job.error)
+        {
+            job.error = std::current_exception();
+        }
+    }
+    job.remaining--;
+}
+
+void ThreadPool::worker_loop(std::size_t index)
+{
+    in_parallel_region = true;
+    while (true)
+    {
+        Task task;
+        if (pop(index, task) || steal(index, task))
+        {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _wake.wait(lock, [this] { return _stop || _pending > 0; });
+        if (_stop && _pending == 0)
+        {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+                              const std::function<void(std::size_t, std::size_t)> &fn)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+    grain = std::max<std::size_t>(grain, 1);
+    std::size_t range = end - begin;
+
+    // a few chunks per thread lets stealing even out uneven chunk costs
+    std::size_t max_chunks = size() * 4;
+    std::size_t n_chunks = std::min((range + grain - 1) / grain, max_chunks);
+
+    if (n_chunks <= 1 || size() == 1 || in_parallel_region)
+    {
+        fn(begin, end);
+        return;
+    }
+
+    Job job;
+    job.fn = &fn;
+    job.remaining = n_chunks;
+
+    // count the chunks before publishing them so a worker never takes one
+    // that is not yet accounted for
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _pending += n_chunks;
+    }
+
+    // deal chunks round-robin, starting at a rotating queue so concurrent
+    // callers do not all pile onto the same worker
+    std::size_t first = _next_queue++;
+    std::size_t chunk = range / n_chunks;
+    std::size_t extra = range % n_chunks;
+    std::size_t start = begin;
+    for (std::size_t c = 0; c < n_chunks; c++)
+    {
+        std::size_t stop = start + chunk + (c < extra ? 1 : 0);
+        Queue &q = *_queues[(first + c) % _queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(Task{&job, start, stop});
+        start = stop;
+    }
+    _wake.notify_all();
+
+    // help out until every chunk of this job has finished
+    while (job.remaining > 0)
+    {
+        Task task;
+        if (pop(0, task) || steal(0, task))
+        {
+            run(task);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    if (job.error)
+    {
+        std::rethrow_exception(job.error);
+    }
+}
+
+namespace
+{
+std::size_t default_num_threads()
+{
+    if (const char *env = std::getenv("DL_NUM_THREADS"))
+    {
+        long n = std::strtol(env, nullptr, 10);
+        if (n > 0)
+        {
+            return (std::size_t)n;
+        }
+    }
+    return std::max<unsigned>(std::thread::hardware_concurrency(), 1u);
+}
+
+std::unique_ptr<ThreadPool> &global_pool()
+{
+    static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>(default_num_threads());
+    return pool;
+}
+} // namespace
+
+ThreadPool &thread_pool()
+{
+    return *global_pool();
+}
+
+void set_num_threads(std::size_t num_threads)
+{
+    global_pool() = std::make_unique<ThreadPool>(std::max<std::size_t>(num_threads, 1));
+}
+
+std::size_t get_num_threads()
+{
+    return thread_pool().size();
+}
+
+void parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+                  const std::function<void(std::size_t, std::size_t)> &fn)
+{
+    thread_pool().parallel_for(begin, end, grain, fn);
+}
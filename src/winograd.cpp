@@ -0,0 +1,368 @@
+#include "../include/winograd.h"
+#include "../include/gemm.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+// Filter transform G [alpha x 3] of F(m x m, 3 x 3), alpha = m + 2. The
+// input (B^T) and output (A^T) transforms are written out in Apply below.
+template <std::size_t M>
+struct FilterTransform;
+
+// Interpolation points 0, 1, -1, infinity
+template <>
+struct FilterTransform<2>
+{
+    static constexpr float G[4][3] = {
+        {1, 0, 0},
+        {0.5f, 0.5f, 0.5f},
+        {0.5f, -0.5f, 0.5f},
+        {0, 0, 1}};
+};
+
+// Interpolation points 0, 1, -1, 2, -2, infinity
+template <>
+struct FilterTransform<4>
+{
+    static constexpr float G[6][3] = {
+        {1.0f / 4, 0, 0},
+        {-1.0f / 6, -1.0f / 6, -1.0f / 6},
+        {-1.0f / 6, 1.0f / 6, -1.0f / 6},
+        {1.0f / 24, 1.0f / 12, 1.0f / 6},
+        {1.0f / 24, -1.0f / 12, 1.0f / 6},
+        {0, 0, 1}};
+};
+
+struct Tiling
+{
+    std::size_t rows;  // tiles down
+    std::size_t cols;  // tiles across
+    std::size_t count; // rows * cols
+};
+
+// Where winograd_tile picks each tile size
+constexpr std::size_t F4_MIN_CHANNELS = 24;
+constexpr std::size_t F2_MIN_CHANNELS = 64;
+constexpr std::size_t MIN_TILES = 49;
+
+Tiling tiling(const ConvGeometry &g, std::size_t m)
+{
+    std::size_t rows = (g.out_height + m - 1) / m;
+    std::size_t cols = (g.out_width + m - 1) / m;
+    return {rows, cols, rows * cols};
+}
+
+// u = G g G^T for one 3x3 filter g, written with the given stride between
+// transform-domain positions
+template <std::size_t M>
+void transform_filter(const float g[3][3], float *u, std::size_t stride)
+{
+    using T = FilterTransform<M>;
+    constexpr std::size_t A = M + 2;
+    float tmp[A][3];
+    for (std::size_t i = 0; i < A; i++)
+        for (std::size_t j = 0; j < 3; j++)
+            tmp[i][j] = T::G[i][0] * g[0][j] + T::G[i][1] * g[1][j] + T::G[i][2] * g[2][j];
+    for (std::size_t i = 0; i < A; i++)
+        for (std::size_t j = 0; j < A; j++)
+            u[(i * A + j) * stride] = tmp[i][0] * T::G[j][0] + tmp[i][1] * T::G[j][1] + tmp[i][2] * T::G[j][2];
+}
+
+template <std::size_t M>
+void filter_transform(const float *weight, std::size_t c_out, std::size_t c_in, bool flip, float *U)
+{
+    // U[xi][rows][cols]: [c_out][c_in] as given, [c_in][c_out] flipped
+    std::size_t plane = c_out * c_in;
+    for (std::size_t co = 0; co < c_out; co++)
+    {
+        for (std::size_t ci = 0; ci < c_in; ci++)
+        {
+            const float *w = weight + (co * c_in + ci) * 9;
+            float g[3][3];
+            for (std::size_t kh = 0; kh < 3; kh++)
+                for (std::size_t kw = 0; kw < 3; kw++)
+                    g[kh][kw] = flip ? w[(2 - kh) * 3 + (2 - kw)] : w[kh * 3 + kw];
+            std::size_t index = flip ? ci * c_out + co : co * c_in + ci;
+            transform_filter<M>(g, U + index, plane);
+        }
+    }
+}
+
+// Tiles transformed together: the transforms below are written over lanes
+// of LANES tiles so the compiler turns each formula into vector arithmetic
+constexpr std::size_t LANES = 8;
+
+// 1-D transforms along one axis of a tile, for every lane: input applies B^T
+// to alpha values, output A^T to alpha values giving m. in and out hold rows
+// of LANES floats, is and os floats apart.
+template <std::size_t M>
+struct Apply;
+
+template <>
+struct Apply<2>
+{
+    static void input(const float *__restrict in, std::size_t is, float *__restrict out, std::size_t os)
+    {
+        for (std::size_t l = 0; l < LANES; l++)
+        {
+            float d0 = in[l], d1 = in[is + l], d2 = in[2 * is + l], d3 = in[3 * is + l];
+            out[l] = d0 - d2;
+            out[os + l] = d1 + d2;
+            out[2 * os + l] = d2 - d1;
+            out[3 * os + l] = d1 - d3;
+        }
+    }
+
+    static void output(const float *__restrict in, std::size_t is, float *__restrict out, std::size_t os)
+    {
+        for (std::size_t l = 0; l < LANES; l++)
+        {
+            float m0 = in[l], m1 = in[is + l], m2 = in[2 * is + l], m3 = in[3 * is + l];
+            out[l] = m0 + m1 + m2;
+            out[os + l] = m1 - m2 - m3;
+        }
+    }
+};
+
+template <>
+struct Apply<4>
+{
+    static void input(const float *__restrict in, std::size_t is, float *__restrict out, std::size_t os)
+    {
+        for (std::size_t l = 0; l < LANES; l++)
+        {
+            float d0 = in[l], d1 = in[is + l], d2 = in[2 * is + l];
+            float d3 = in[3 * is + l], d4 = in[4 * is + l], d5 = in[5 * is + l];
+            float a = d4 - 4.0f * d2; // rows 1 and 2 share d4 - 4 d2 and d3 - 4 d1
+            float b = d3 - 4.0f * d1;
+            float c = d4 - d2; // rows 3 and 4 share d4 - d2 and 2 (d3 - d1)
+            float e = 2.0f * (d3 - d1);
+            out[l] = 4.0f * d0 - 5.0f * d2 + d4;
+            out[os + l] = a + b;
+            out[2 * os + l] = a - b;
+            out[3 * os + l] = c + e;
+            out[4 * os + l] = c - e;
+            out[5 * os + l] = 4.0f * d1 - 5.0f * d3 + d5;
+        }
+    }
+
+    static void output(const float *__restrict in, std::size_t is, float *__restrict out, std::size_t os)
+    {
+        for (std::size_t l = 0; l < LANES; l++)
+        {
+            float m0 = in[l], m1 = in[is + l], m2 = in[2 * is + l];
+            float m3 = in[3 * is + l], m4 = in[4 * is + l], m5 = in[5 * is + l];
+            float sum12 = m1 + m2, diff12 = m1 - m2;
+            float sum34 = m3 + m4, diff34 = m3 - m4;
+            out[l] = m0 + sum12 + sum34;
+            out[os + l] = diff12 + 2.0f * diff34;
+            out[2 * os + l] = sum12 + 4.0f * sum34;
+            out[3 * os + l] = diff12 + 8.0f * diff34 + m5;
+        }
+    }
+};
+
+// V[xi][c][tile] = B^T d B for every input tile d
+template <std::size_t M>
+void input_transform(const float *image, const ConvGeometry &g, const Tiling &tiles, float *V)
+{
+    constexpr std::size_t A = M + 2;
+    std::size_t plane = g.channels * tiles.count;
+    long H = (long)g.height;
+    long W = (long)g.width;
+    // d, then B^T d, then B^T d B; each [A][A][LANES]
+    float d[A * A * LANES], t[A * A * LANES], v[A * A * LANES];
+
+    for (std::size_t c = 0; c < g.channels; c++)
+    {
+        const float *src = image + c * g.height * g.width;
+        for (std::size_t ty = 0; ty < tiles.rows; ty++)
+        {
+            long y0 = (long)(ty * M) - (long)g.padding;
+            for (std::size_t tx0 = 0; tx0 < tiles.cols; tx0 += LANES)
+            {
+                std::size_t lanes = std::min(LANES, tiles.cols - tx0);
+                for (std::size_t i = 0; i < A; i++)
+                {
+                    long y = y0 + (long)i;
+                    for (std::size_t j = 0; j < A; j++)
+                    {
+                        float *dst = d + (i * A + j) * LANES;
+                        long x = (long)(tx0 * M + j) - (long)g.padding;
+                        for (std::size_t l = 0; l < LANES; l++, x += (long)M)
+                        {
+                            // outside the image (and past the last tile) reads zeros
+                            bool inside = l < lanes && y >= 0 && y < H && x >= 0 && x < W;
+                            dst[l] = inside ? src[y * W + x] : 0.0f;
+                        }
+                    }
+                }
+                // B^T d: down each column of the tile, then d B along each row
+                for (std::size_t j = 0; j < A; j++)
+                    Apply<M>::input(d + j * LANES, A * LANES, t + j * LANES, A * LANES);
+                for (std::size_t i = 0; i < A; i++)
+                    Apply<M>::input(t + i * A * LANES, LANES, v + i * A * LANES, LANES);
+
+                float *dst = V + c * tiles.count + ty * tiles.cols + tx0;
+                for (std::size_t xi = 0; xi < A * A; xi++)
+                    std::copy(v + xi * LANES, v + xi * LANES + lanes, dst + xi * plane);
+            }
+        }
+    }
+}
+
+// out = A^T m A + bias for every tile, clipped to the output
+template <std::size_t M>
+void output_transform(const float *Mb, const ConvGeometry &g, std::size_t c_out, const Tiling &tiles,
+                      const float *bias, float *out)
+{
+    constexpr std::size_t A = M + 2;
+    std::size_t plane = c_out * tiles.count;
+    std::size_t H = g.out_height;
+    std::size_t W = g.out_width;
+    // m [A][A][LANES], A^T m [M][A][LANES], A^T m A [M][M][LANES]
+    float m[A * A * LANES], t[M * A * LANES], y[M * M * LANES];
+
+    for (std::size_t co = 0; co < c_out; co++)
+    {
+        float b = bias ? bias[co] : 0.0f;
+        float *dst = out + co * H * W;
+        for (std::size_t ty = 0; ty < tiles.rows; ty++)
+        {
+            std::size_t rows = std::min(M, H - ty * M);
+            for (std::size_t tx0 = 0; tx0 < tiles.cols; tx0 += LANES)
+            {
+                std::size_t lanes = std::min(LANES, tiles.cols - tx0);
+                const float *src = Mb + co * tiles.count + ty * tiles.cols + tx0;
+                for (std::size_t xi = 0; xi < A * A; xi++)
+                {
+                    std::copy(src + xi * plane, src + xi * plane + lanes, m + xi * LANES);
+                    std::fill(m + xi * LANES + lanes, m + (xi + 1) * LANES, 0.0f);
+                }
+                for (std::size_t j = 0; j < A; j++)
+                    Apply<M>::output(m + j * LANES, A * LANES, t + j * LANES, A * LANES);
+                for (std::size_t i = 0; i < M; i++)
+                    Apply<M>::output(t + i * A * LANES, LANES, y + i * M * LANES, LANES);
+
+                for (std::size_t l = 0; l < lanes; l++)
+                {
+                    std::size_t x0 = (tx0 + l) * M;
+                    std::size_t cols = std::min(M, W - x0);
+                    float *o = dst + ty * M * W + x0;
+                    for (std::size_t i = 0; i < rows; i++)
+                        for (std::size_t j = 0; j < cols; j++)
+                            o[i * W + j] = y[(i * M + j) * LANES + l] + b;
+                }
+            }
+        }
+    }
+}
+
+template <std::size_t M>
+void conv(const float *image, const ConvGeometry &g, const float *U, std::size_t c_out, const float *bias,
+          float *out, float *scratch)
+{
+    constexpr std::size_t A = M + 2;
+    Tiling tiles = tiling(g, M);
+    std::size_t c_in = g.channels;
+    float *V = scratch;
+    float *Mb = scratch + A * A * c_in * tiles.count;
+
+    input_transform<M>(image, g, tiles, V);
+    // the elementwise products summed over input channels, one GEMM per position
+    for (std::size_t xi = 0; xi < A * A; xi++)
+    {
+        sgemm(false, false, c_out, tiles.count, c_in,
+              1.0f, U + xi * c_out * c_in, c_in, V + xi * c_in * tiles.count, tiles.count,
+              0.0f, Mb + xi * c_out * tiles.count, tiles.count);
+    }
+    output_transform<M>(Mb, g, c_out, tiles, bias, out);
+}
+
+std::size_t alpha_of(std::size_t m)
+{
+    if (m != 2 && m != 4)
+        throw std::invalid_argument("Winograd: output tile must be 2 or 4, got " + std::to_string(m));
+    return m + 2;
+}
+} // namespace
+
+std::size_t winograd_tile(const ConvGeometry &g, std::size_t c_out)
+{
+    if (g.kernel_size != 3 || g.stride != 1 || g.padding > 2)
+        return 0;
+    // The transforms cost a fixed few dozen flops per input and output value
+    // and the per-position GEMMs are only (m + 2)^2 narrow ones, so Winograd
+    // needs channels on both sides and enough tiles to fill the GEMMs.
+    // Thresholds measured against the im2col GEMM with AVX-512.
+    std::size_t channels = std::min(g.channels, c_out);
+    if (channels >= F4_MIN_CHANNELS && tiling(g, 4).count >= MIN_TILES)
+        return 4;
+    if (channels >= F2_MIN_CHANNELS && tiling(g, 2).count >= MIN_TILES)
+        return 2;
+    return 0;
+}
+
+std::size_t winograd_filter_size(std::size_t c_out, std::size_t c_in, std::size_t m)
+{
+    std::size_t a = alpha_of(m);
+    return a * a * c_out * c_in;
+}
+
+void winograd_filter_transform(const float *weight, std::size_t c_out, std::size_t c_in, std::size_t m,
+                               bool flip, float *U)
+{
+    if (alpha_of(m) == 4)
+        filter_transform<2>(weight, c_out, c_in, flip, U);
+    else
+        filter_transform<4>(weight, c_out, c_in, flip, U);
+}
+
+std::size_t winograd_scratch_size(const ConvGeometry &g, std::size_t c_out, std::size_t m)
+{
+    std::size_t a = alpha_of(m);
+    return a * a * (g.channels + c_out) * tiling(g, m).count;
+}
+
+void winograd_conv(const float *image, const ConvGeometry &g, const float *U, std::size_t c_out,
+                   std::size_t m, const float *bias, float *out, float *scratch)
+{
+    if (alpha_of(m) == 4)
+        conv<2>(image, g, U, c_out, bias, out, scratch);
+    else
+        conv<4>(image, g, U, c_out, bias, out, scratch);
+}
+
+std::shared_ptr<const std::vector<float>> WinogradFilters::get(const Storage &weight, std::size_t c_out,
+                                                               std::size_t c_in, std::size_t m, bool flip)
+{
+    if (weight.size() != c_out * c_in * 9)
+        throw std::invalid_argument("WinogradFilters: weight does not hold " + std::to_string(c_out) + " x " +
+                                    std::to_string(c_in) + " 3x3 filters");
+    std::lock_guard<std::mutex> lock(_mutex);
+    Entry &entry = _entries[flip ? 1 : 0];
+    const unsigned char *bytes = static_cast<const unsigned char *>(weight.raw());
+    if (entry.U && entry.m == m && entry.dtype == weight.dtype() && entry.source.size() == weight.bytes() &&
+        std::memcmp(entry.source.data(), bytes, weight.bytes()) == 0)
+        return entry.U;
+
+    const float *values = weight.data();
+    if (weight.dtype() != DType::Float32)
+    {
+        entry.widened.resize(weight.size());
+        half_to_float(weight.half_data(), entry.widened.data(), weight.size(), weight.dtype());
+        values = entry.widened.data();
+    }
+    std::size_t size = winograd_filter_size(c_out, c_in, m);
+    if (!entry.U || entry.U.use_count() != 1 || entry.U->size() != size)
+        entry.U = std::make_shared<std::vector<float>>(size);
+    winograd_filter_transform(values, c_out, c_in, m, flip, entry.U->data());
+
+    entry.source.assign(bytes, bytes + weight.bytes());
+    entry.dtype = weight.dtype();
+    entry.m = m;
+    return entry.U;
+}
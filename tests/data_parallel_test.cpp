@@ -0,0 +1,97 @@
+// DataParallel must give the loss and gradients of the master model run on
+// the whole batch, for plain, class-weighted and label-smoothed cross-entropy.
+//
+// g++ tests/data_parallel_test.cpp src/*.cpp modules/*.cpp -Iinclude -o data_parallel_test -O2 -std=c++17 -pthread
+#include "../include/data_parallel.h"
+#include "../include/linear.h"
+#include "../include/loss.h"
+#include "../include/relu.h"
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+struct Net : Module
+{
+    std::shared_ptr<Linear> fc1 = std::make_shared<Linear>(6, 8);
+    std::shared_ptr<Relu> relu = std::make_shared<Relu>();
+    std::shared_ptr<Linear> fc2 = std::make_shared<Linear>(8, 4);
+
+    Net()
+    {
+        register_module("fc1", fc1);
+        register_module("relu", relu);
+        register_module("fc2", fc2);
+    }
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override
+    {
+        return fc2->forward(relu->forward(fc1->forward(x)));
+    }
+};
+
+// Runs the batch through the reference model and through DataParallel and
+// compares the losses and the master gradients
+bool check(const char *name, CrossEntropyLoss &criterion, bool capture)
+{
+    std::mt19937 rng(7);
+    std::normal_distribution<float> normal;
+    const std::size_t batch = 10;
+    std::vector<float> values(batch * 6);
+    for (float &v : values)
+        v = normal(rng);
+    auto inputs = std::make_shared<Tensor>(Storage(values), std::vector<std::size_t>{batch, 6});
+    std::vector<std::size_t> targets{0, 1, 2, 3, 2, 2, 0, 1, 3, 2};
+
+    Net reference;
+    auto loss = criterion(reference.forward(inputs), targets);
+    loss->backward();
+
+    DataParallel model([] { return std::make_shared<Net>(); }, 3);
+    auto weights = reference.state_dict();
+    model.module()->load_state_dict(weights);
+    model.module()->zero_grad();
+    model.set_capture(capture);
+    ParallelStep step{};
+    // a captured step records on the first batch and replays on the next
+    for (int run = 0; run < (capture ? 2 : 1); run++)
+    {
+        model.module()->zero_grad();
+        step = model.forward_backward(inputs, targets, criterion);
+    }
+
+    float diff = std::fabs(step.loss - loss->item());
+    const auto &expected = reference.parameters();
+    const auto &actual = model.module()->parameters();
+    for (std::size_t p = 0; p < expected.size(); p++)
+    {
+        const Storage &a = expected[p].second->grad();
+        const Storage &b = actual[p].second->grad();
+        for (std::size_t i = 0; i < a.size(); i++)
+            diff = std::max(diff, std::fabs(a[i] - b[i]));
+    }
+    bool ok = diff < 1e-5f;
+    std::printf("%s %s%s: loss %.6f vs %.6f, max difference %g\n", ok ? "ok  " : "FAIL", name,
+                capture ? " (captured)" : "", step.loss, loss->item(), diff);
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    CrossEntropyLoss plain;
+    CrossEntropyLoss weighted({0.2f, 1.0f, 3.0f, 0.5f});
+    CrossEntropyLoss smoothed({0.2f, 1.0f, 3.0f, 0.5f}, 0.1f);
+
+    bool ok = true;
+    for (bool capture : {false, true})
+    {
+        ok &= check("cross-entropy", plain, capture);
+        ok &= check("class-weighted cross-entropy", weighted, capture);
+        ok &= check("weighted, label-smoothed cross-entropy", smoothed, capture);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+// Stepping the iterator over batches without reading them must neither stall
+// the workers nor leave the skipped batches queued. A watchdog fails the test
+// if a batch never arrives.
+//
+// g++ tests/dataloader_test.cpp src/*.cpp modules/*.cpp -Iinclude -o dataloader_test -O2 -std=c++17 -pthread
+#include "../include/dataloader.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Sample i is the one-element tensor {i} with label i
+class Counting : public Dataset
+{
+public:
+    std::pair<int, std::shared_ptr<Tensor>> get_item(int index) override
+    {
+        return {index, std::make_shared<Tensor>(Storage(std::vector<float>{(float)index}), std::vector<std::size_t>{1})};
+    }
+    int get_length() override { return 12; }
+};
+
+bool check(const char *name, bool ok)
+{
+    std::printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    return ok;
+}
+
+bool holds(const Batch &batch, std::size_t first)
+{
+    bool ok = batch.size() == 2;
+    for (std::size_t i = 0; ok && i < batch.size(); i++)
+        ok = batch.labels[i] == first + i && batch.data->data()[i] == (float)(first + i);
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    std::atomic<bool> done{false};
+    std::thread watchdog([&done] {
+        for (int i = 0; i < 200 && !done; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (!done)
+        {
+            std::printf("FAIL timed out waiting for a batch\n");
+            std::fflush(stdout);
+            std::_Exit(1);
+        }
+    });
+
+    bool ok = true;
+    Counting dataset;
+    for (int workers : {1, 3})
+    {
+        DataLoader loader(&dataset, 2, false, workers, 2);
+
+        // skip two batches, more than the prefetch window ahead of the last read
+        auto it = loader.begin();
+        ++it;
+        ++it;
+        ok &= check("batch read after two skips is batch 2", holds(*it, 4));
+        ++it;
+        ++it;
+        ++it;
+        ok &= check("batch read after three more skips is batch 5", holds(*it, 10));
+
+        // the next epoch starts from the first batch again
+        std::size_t n = 0;
+        bool in_order = true;
+        for (Batch &batch : loader)
+            in_order &= holds(batch, 2 * n++);
+        ok &= check("following epoch reads every batch in order", in_order && n == 6);
+    }
+
+    done = true;
+    watchdog.join();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+// A usage split of FERDataset serves exactly that split's rows: one the file
+// has no rows of is empty, it never falls back to the whole file.
+//
+// g++ tests/fer_dataset_test.cpp src/*.cpp modules/*.cpp -Iinclude -o fer_dataset_test -O2 -std=c++17 -pthread
+#include "../include/fer_loader.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+// fer2013.csv layout: emotion,pixels,Usage
+void write_csv(const std::string &path)
+{
+    std::ofstream csv(path);
+    csv << "emotion,pixels,Usage\n";
+    const char *usages[] = {"Training", "Training", "PublicTest", "Training", "PublicTest"};
+    for (int row = 0; row < 5; row++)
+    {
+        csv << row << ",";
+        for (int p = 0; p < 48 * 48; p++)
+            csv << (p ? " " : "") << (row * 40 + p) % 256;
+        csv << "," << usages[row] << "\n";
+    }
+}
+
+bool expect(const char *name, bool ok)
+{
+    std::printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    write_csv("fer_dataset_test.csv");
+    FERLoader::convert("fer_dataset_test.csv", "fer_dataset_test.bin");
+
+    bool ok = true;
+    {
+        FERDataset all("fer_dataset_test.bin");
+        FERDataset training("fer_dataset_test.bin", FERUsage::Training);
+        FERDataset public_test("fer_dataset_test.bin", FERUsage::PublicTest);
+        FERDataset private_test("fer_dataset_test.bin", FERUsage::PrivateTest);
+
+        ok &= expect("whole file has 5 images", all.get_length() == 5);
+        ok &= expect("Training split has rows 0, 1, 3",
+                     training.get_length() == 3 && training.label(0) == 0 && training.label(1) == 1 &&
+                         training.label(2) == 3);
+        ok &= expect("PublicTest split has rows 2, 4",
+                     public_test.get_length() == 2 && public_test.label(0) == 2 && public_test.label(1) == 4);
+        ok &= expect("PrivateTest split is empty", private_test.get_length() == 0);
+
+        bool threw = false;
+        try
+        {
+            private_test.get_item(0);
+        }
+        catch (const std::out_of_range &)
+        {
+            threw = true;
+        }
+        ok &= expect("indexing the empty split throws", threw);
+    }
+
+    std::remove("fer_dataset_test.csv");
+    std::remove("fer_dataset_test.bin");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+// The fp32 master of a 16-bit parameter must follow weights loaded after the
+// optimizer was built, and a parameter whose dtype changed must be refused.
+//
+// g++ tests/optimizer_test.cpp src/*.cpp modules/*.cpp -Iinclude -o optimizer_test -O2 -std=c++17 -pthread
+#include "../include/adam.h"
+#include "../include/checkpoint.h"
+#include "../include/linear.h"
+#include "../include/sgd.h"
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+std::vector<float> values_of(const Tensor &t)
+{
+    std::vector<float> values(t.numel());
+    half_to_float(t.data().half_data(), values.data(), values.size(), t.data().dtype());
+    return values;
+}
+
+// One step with a gradient of g everywhere
+void step_with(Optimizer &optimizer, Module &module, float g)
+{
+    for (const auto &p : module.parameters())
+    {
+        p.second->zero_grad();
+        p.second->add_to_grad(Storage(p.second->numel(), g));
+    }
+    optimizer.step();
+}
+
+float max_difference(const std::vector<float> &a, const std::vector<float> &b)
+{
+    float diff = 0.0f;
+    for (std::size_t i = 0; i < a.size(); i++)
+        diff = std::max(diff, std::fabs(a[i] - b[i]));
+    return diff;
+}
+
+// build, to(bf16), optimizer, then load weights: the step must start from them
+bool check_resume(const char *name, bool adam)
+{
+    Linear model(64, 32);
+    model.to(DType::BFloat16);
+    std::unique_ptr<Optimizer> optimizer;
+    if (adam)
+        optimizer = std::make_unique<Adam>(model.parameters(), 0.001f);
+    else
+        optimizer = std::make_unique<SGD>(model.parameters(), 0.01f);
+    step_with(*optimizer, model, 0.1f);
+
+    Linear saved(64, 32);
+    saved.to(DType::BFloat16);
+    auto weights = saved.state_dict();
+    Storage shifted = weights["weight"]->data().to(DType::Float32);
+    for (float &v : shifted)
+        v += 0.5f;
+    weights["weight"]->data().assign_from(shifted.data());
+    std::vector<float> loaded = values_of(*weights["weight"]);
+
+    model.load_state_dict(weights);
+    step_with(*optimizer, model, 0.1f);
+    float after_load = max_difference(values_of(*model.parameters()[0].second), loaded);
+
+    save_checkpoint("optimizer_test.ckpt", saved);
+    load_checkpoint(model, "optimizer_test.ckpt");
+    std::remove("optimizer_test.ckpt");
+    step_with(*optimizer, model, 0.0f);
+    float after_checkpoint = max_difference(values_of(*model.parameters()[0].second), loaded);
+
+    // one small step away from the loaded weights, not back at the old ones
+    bool ok = after_load < 0.02f && after_checkpoint < 0.02f;
+    std::printf("%s %s resume: %g after load_state_dict, %g after load_checkpoint\n", ok ? "ok  " : "FAIL", name,
+                after_load, after_checkpoint);
+    return ok;
+}
+
+bool check_dtype_change()
+{
+    Linear model(8, 4);
+    SGD optimizer(model.parameters(), 0.1f);
+    model.to(DType::BFloat16);
+    try
+    {
+        step_with(optimizer, model, 1.0f);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::printf("ok   to() after the optimizer: %s\n", e.what());
+        return true;
+    }
+    std::printf("FAIL to() after the optimizer: step() did not throw\n");
+    return false;
+}
+} // namespace
+
+int main()
+{
+    bool ok = check_resume("SGD", false);
+    ok &= check_resume("Adam", true);
+    ok &= check_dtype_change();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+// A contiguous window of a tensor (slice, squeeze of a slice) must keep the
+// buffer it reads alive when its source is given new storage. Build with
+// -fsanitize=address to have a use after free reported instead of read.
+//
+// g++ tests/tensor_view_test.cpp src/*.cpp modules/*.cpp -Iinclude -o tensor_view_test -O2 -std=c++17 -pthread
+#include "../include/tensor.h"
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace
+{
+std::shared_ptr<Tensor> iota(std::vector<std::size_t> shape)
+{
+    std::size_t n = 1;
+    for (std::size_t d : shape)
+        n *= d;
+    Storage values(n);
+    for (std::size_t i = 0; i < n; i++)
+        values[i] = (float)i;
+    return std::make_shared<Tensor>(std::move(values), shape);
+}
+
+// The window's elements start at `first` of the original values
+bool holds(const char *name, const std::shared_ptr<Tensor> &view, float first)
+{
+    bool ok = true;
+    for (std::size_t i = 0; i < view->numel(); i++)
+        ok &= view->data()[i] == first + (float)i;
+    std::printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    bool ok = true;
+
+    // source given a new buffer by move assignment
+    auto t = iota({2, 3, 4});
+    auto slice = t->slice(0, 1, 2);
+    t->data() = Storage(48, 1.0f);
+    ok &= holds("slice after the source is reassigned", slice, 12.0f);
+
+    // a window of a window, then the source destroyed
+    auto u = iota({4, 3, 2});
+    auto row = u->slice(0, 2, 3)->squeeze(0);
+    u.reset();
+    ok &= holds("squeezed slice after the source is freed", row, 12.0f);
+
+    // source buffer grown by copy assignment
+    auto w = iota({3, 4});
+    auto last = w->slice(0, 2, 3);
+    w->data() = Storage(100, 2.0f);
+    ok &= holds("slice after the source grows", last, 8.0f);
+
+    return ok ? 0 : 1;
+}